@@ -17,7 +17,7 @@
 #include <linux/spinlock.h>
 #include <linux/mutex.h>
 #include <linux/wait.h>
-#include <linux/dma-mapping.h>
+#include <linux/math64.h>
 #include <sound/core.h>
 #include <sound/pcm.h>
 #include <sound/pcm_params.h>
@@ -41,17 +41,17 @@ static char *id[SNDRV_CARDS] = SNDRV_DEFAULT_STR;
 static bool enable[SNDRV_CARDS] = SNDRV_DEFAULT_ENABLE_PNP;
 
 module_param_array(index, int, NULL, 0444);
-MODULE_PARM_DESC(index, "Index value for Canon R5 audio driver.");
+MODULE_PARM_DESC(index, "Index value for each Canon R5 audio card, by device id.");
 module_param_array(id, charp, NULL, 0444);
-MODULE_PARM_DESC(id, "ID string for Canon R5 audio driver.");
+MODULE_PARM_DESC(id, "ID string for each Canon R5 audio card, by device id.");
 module_param_array(enable, bool, NULL, 0444);
-MODULE_PARM_DESC(enable, "Enable Canon R5 audio driver.");
+MODULE_PARM_DESC(enable, "Enable the audio card of each Canon R5, by device id.");
 
 /* PCM hardware definition */
 const struct snd_pcm_hardware canon_r5_audio_pcm_hardware = {
 	.info = SNDRV_PCM_INFO_MMAP |
 		SNDRV_PCM_INFO_MMAP_VALID |
-		SNDRV_PCM_INFO_BATCH |
+		SNDRV_PCM_INFO_HAS_LINK_ABSOLUTE_ATIME |
 		SNDRV_PCM_INFO_INTERLEAVED |
 		SNDRV_PCM_INFO_BLOCK_TRANSFER,
 	.formats = CANON_R5_AUDIO_FORMATS,
@@ -139,67 +139,261 @@ int canon_r5_audio_validate_quality(const struct canon_r5_audio_quality *quality
 }
 
 /* Memory management */
-void *canon_r5_audio_alloc_buffer(struct canon_r5_audio_device *audio, size_t size)
+static const struct {
+	size_t size;
+	unsigned int nr_objs;
+} canon_r5_audio_pool_layout[CANON_R5_AUDIO_POOL_CLASSES] = {
+	{  1024, 64 },
+	{  4096, 32 },
+	{ 16384,  8 },
+};
+
+static void canon_r5_audio_pool_push(struct canon_r5_audio_pool_class *class, void *obj)
 {
-	struct canon_r5_audio *priv = container_of(audio, struct canon_r5_audio, device);
+	*(void **)obj = class->depot;
+	class->depot = obj;
+}
+
+static void *canon_r5_audio_pool_pop(struct canon_r5_audio_pool_class *class)
+{
+	void *obj = class->depot;
+	
+	if (obj)
+		class->depot = *(void **)obj;
+	return obj;
+}
+
+/* Move up to half a magazine between the depot and a CPU. The local lock is held */
+static void canon_r5_audio_pool_refill(struct canon_r5_audio_pool_class *class,
+				       struct canon_r5_audio_magazine *mag)
+{
+	void *obj;
+	
+	raw_spin_lock(&class->lock);
+	while (mag->count < CANON_R5_AUDIO_MAGAZINE_SIZE / 2) {
+		obj = canon_r5_audio_pool_pop(class);
+		if (!obj)
+			break;
+		mag->objs[mag->count++] = obj;
+	}
+	raw_spin_unlock(&class->lock);
+}
+
+static void canon_r5_audio_pool_drain(struct canon_r5_audio_pool_class *class,
+				      struct canon_r5_audio_magazine *mag,
+				      unsigned int keep)
+{
+	raw_spin_lock(&class->lock);
+	while (mag->count > keep)
+		canon_r5_audio_pool_push(class, mag->objs[--mag->count]);
+	raw_spin_unlock(&class->lock);
+}
+
+static void *canon_r5_audio_pool_get(struct canon_r5_audio_pool_class *class)
+{
+	struct canon_r5_audio_magazine *mag;
+	unsigned long flags;
+	void *obj = NULL;
+	
+	local_lock_irqsave(&class->magazines->lock, flags);
+	mag = this_cpu_ptr(class->magazines);
+	if (!mag->count)
+		canon_r5_audio_pool_refill(class, mag);
+	if (mag->count)
+		obj = mag->objs[--mag->count];
+	local_unlock_irqrestore(&class->magazines->lock, flags);
+	
+	return obj;
+}
+
+static void canon_r5_audio_pool_put(struct canon_r5_audio_pool_class *class, void *obj)
+{
+	struct canon_r5_audio_magazine *mag;
 	unsigned long flags;
-	void *buffer = NULL;
-	int bit;
 	
-	spin_lock_irqsave(&priv->memory.lock, flags);
+	local_lock_irqsave(&class->magazines->lock, flags);
+	mag = this_cpu_ptr(class->magazines);
+	if (mag->count == CANON_R5_AUDIO_MAGAZINE_SIZE)
+		canon_r5_audio_pool_drain(class, mag, CANON_R5_AUDIO_MAGAZINE_SIZE / 2);
+	mag->objs[mag->count++] = obj;
+	local_unlock_irqrestore(&class->magazines->lock, flags);
+}
+
+static void canon_r5_audio_pool_account(struct canon_r5_audio_pool_class *class)
+{
+	int used = atomic_inc_return(&class->in_use);
+	int peak = atomic_read(&class->high_watermark);
 	
-	bit = find_first_zero_bit(priv->memory.bitmap, priv->memory.buffer_size / PAGE_SIZE);
-	if (bit < priv->memory.buffer_size / PAGE_SIZE) {
-		set_bit(bit, priv->memory.bitmap);
-		buffer = priv->memory.buffer_pool + (bit * PAGE_SIZE);
+	while (used > peak) {
+		if (atomic_try_cmpxchg(&class->high_watermark, &peak, used))
+			break;
 	}
+}
+
+int canon_r5_audio_pool_init(struct canon_r5_audio *priv)
+{
+	struct canon_r5_audio_pool_class *class;
+	size_t offset = 0;
+	unsigned int i, n;
+	int cpu;
+	
+	priv->memory.buffer_size = 0;
+	for (i = 0; i < CANON_R5_AUDIO_POOL_CLASSES; i++)
+		priv->memory.buffer_size += canon_r5_audio_pool_layout[i].size *
+					    canon_r5_audio_pool_layout[i].nr_objs;
 	
-	spin_unlock_irqrestore(&priv->memory.lock, flags);
+	priv->memory.buffer_pool = vmalloc(priv->memory.buffer_size);
+	if (!priv->memory.buffer_pool)
+		return -ENOMEM;
 	
-	return buffer;
+	for (i = 0; i < CANON_R5_AUDIO_POOL_CLASSES; i++) {
+		class = &priv->memory.classes[i];
+		class->size = canon_r5_audio_pool_layout[i].size;
+		class->nr_objs = canon_r5_audio_pool_layout[i].nr_objs;
+		class->base = priv->memory.buffer_pool + offset;
+		offset += class->size * class->nr_objs;
+		
+		class->magazines = alloc_percpu(struct canon_r5_audio_magazine);
+		if (!class->magazines)
+			goto error;
+		for_each_possible_cpu(cpu)
+			local_lock_init(&per_cpu_ptr(class->magazines, cpu)->lock);
+		
+		raw_spin_lock_init(&class->lock);
+		class->depot = NULL;
+		for (n = class->nr_objs; n--; )
+			canon_r5_audio_pool_push(class, class->base + n * class->size);
+		
+		atomic_set(&class->in_use, 0);
+		atomic_set(&class->high_watermark, 0);
+		atomic_set(&class->failures, 0);
+	}
+	
+	return 0;
+	
+error:
+	while (i--)
+		free_percpu(priv->memory.classes[i].magazines);
+	vfree(priv->memory.buffer_pool);
+	priv->memory.buffer_pool = NULL;
+	return -ENOMEM;
+}
+
+void canon_r5_audio_pool_destroy(struct canon_r5_audio *priv)
+{
+	unsigned int i;
+	
+	if (!priv->memory.buffer_pool)
+		return;
+	
+	for (i = 0; i < CANON_R5_AUDIO_POOL_CLASSES; i++)
+		free_percpu(priv->memory.classes[i].magazines);
+	
+	vfree(priv->memory.buffer_pool);
+	priv->memory.buffer_pool = NULL;
+}
+
+/* Smallest class that fits, falling back to larger ones when it runs dry */
+void *canon_r5_audio_alloc_buffer(struct canon_r5_audio_device *audio, size_t size)
+{
+	struct canon_r5_audio *priv = container_of(audio, struct canon_r5_audio, device);
+	struct canon_r5_audio_pool_class *class;
+	unsigned int i;
+	void *buffer;
+	
+	for (i = 0; i < CANON_R5_AUDIO_POOL_CLASSES; i++) {
+		class = &priv->memory.classes[i];
+		if (size > class->size)
+			continue;
+		
+		buffer = canon_r5_audio_pool_get(class);
+		if (buffer) {
+			canon_r5_audio_pool_account(class);
+			return buffer;
+		}
+		atomic_inc(&class->failures);
+	}
+	
+	return NULL;
 }
 
 void canon_r5_audio_free_buffer(struct canon_r5_audio_device *audio, void *buffer)
 {
 	struct canon_r5_audio *priv = container_of(audio, struct canon_r5_audio, device);
-	unsigned long flags;
-	int bit;
+	struct canon_r5_audio_pool_class *class;
+	unsigned int i;
 	
 	if (!buffer)
 		return;
-		
-	spin_lock_irqsave(&priv->memory.lock, flags);
 	
-	bit = ((char *)buffer - (char *)priv->memory.buffer_pool) / PAGE_SIZE;
-	if (bit >= 0 && bit < priv->memory.buffer_size / PAGE_SIZE)
-		clear_bit(bit, priv->memory.bitmap);
+	for (i = 0; i < CANON_R5_AUDIO_POOL_CLASSES; i++) {
+		class = &priv->memory.classes[i];
+		if (buffer < class->base ||
+		    buffer >= class->base + class->size * class->nr_objs)
+			continue;
+		
+		if (WARN_ON_ONCE((buffer - class->base) % class->size))
+			return;
 		
-	spin_unlock_irqrestore(&priv->memory.lock, flags);
+		canon_r5_audio_pool_put(class, buffer);
+		atomic_dec(&class->in_use);
+		return;
+	}
+	
+	WARN_ON_ONCE(1);
 }
 
 /* PTP audio command stubs */
-int canon_r5_ptp_audio_start_recording(struct canon_r5_device *dev)
+/* The answer names the sound object being recorded and where its samples start */
+int canon_r5_ptp_audio_start_recording(struct canon_r5_device *dev, u32 *object_handle,
+				       u32 *data_offset)
 {
-	/* Stub implementation using existing PTP command framework */
-	return canon_r5_ptp_command(dev, 0x9170, NULL, 0, NULL, 0, NULL);
+	struct canon_r5_ptp_transaction trans;
+	int ret;
+	
+	canon_r5_ptp_transaction_init(&trans, CANON_PTP_OP_AUDIO_START, NULL, 0);
+	
+	ret = canon_r5_ptp_transact(dev, &trans);
+	if (ret)
+		return ret;
+	
+	if (trans.response_code != PTP_RC_OK)
+		return -EIO;
+	
+	if (object_handle) {
+		if (trans.response_param_count < 1)
+			return -EPROTO;
+		*object_handle = trans.response_params[0];
+	}
+	
+	if (data_offset)
+		*data_offset = trans.response_param_count > 1 ? trans.response_params[1] : 0;
+	
+	return 0;
 }
 
 int canon_r5_ptp_audio_stop_recording(struct canon_r5_device *dev)
 {
-	/* Stub implementation using existing PTP command framework */
-	return canon_r5_ptp_command(dev, 0x9171, NULL, 0, NULL, 0, NULL);
+	u16 response_code;
+	
+	return canon_r5_ptp_command(dev, CANON_PTP_OP_AUDIO_STOP, NULL, 0, NULL, 0, &response_code);
 }
 
 int canon_r5_ptp_audio_set_input(struct canon_r5_device *dev, enum canon_r5_audio_input input)
 {
 	u32 params = (u32)input;
-	return canon_r5_ptp_command(dev, 0x9172, &params, 1, NULL, 0, NULL);
+	u16 response_code;
+	
+	return canon_r5_ptp_command(dev, CANON_PTP_OP_AUDIO_SET_INPUT, &params, 1,
+				    NULL, 0, &response_code);
 }
 
 int canon_r5_ptp_audio_set_gain(struct canon_r5_device *dev, u8 gain)
 {
 	u32 params = (u32)gain;
-	return canon_r5_ptp_command(dev, 0x9173, &params, 1, NULL, 0, NULL);
+	u16 response_code;
+	
+	return canon_r5_ptp_command(dev, CANON_PTP_OP_AUDIO_SET_GAIN, &params, 1, NULL, 0, &response_code);
 }
 
 int canon_r5_ptp_audio_get_levels(struct canon_r5_device *dev, u32 *left, u32 *right)
@@ -208,7 +402,8 @@ int canon_r5_ptp_audio_get_levels(struct canon_r5_device *dev, u32 *left, u32 *r
 	u16 response_code = 0;
 	int ret;
 	
-	ret = canon_r5_ptp_command(dev, 0x9174, NULL, 0, levels, sizeof(levels), &response_code);
+	ret = canon_r5_ptp_command(dev, CANON_PTP_OP_AUDIO_LEVELS, NULL, 0,
+				   levels, sizeof(levels), &response_code);
 	if (ret)
 		return ret;
 		
@@ -220,37 +415,229 @@ int canon_r5_ptp_audio_get_levels(struct canon_r5_device *dev, u32 *left, u32 *r
 	return 0;
 }
 
-/* Work functions */
-void canon_r5_audio_capture_work(struct work_struct *work)
+/* One GET_PARTIAL_OBJECT in flight, landing straight in the ring */
+struct canon_r5_audio_xfer {
+	struct canon_r5_ptp_transaction trans;
+	struct canon_r5_audio_pcm *pcm;
+};
+
+static void canon_r5_audio_xfer_complete(struct canon_r5_device *dev,
+					 struct canon_r5_ptp_transaction *trans);
+
+/* Request the rest of the current period at hw_pos. Needs buffer_lock */
+static int canon_r5_audio_submit_locked(struct canon_r5_audio_pcm *pcm)
 {
-	struct canon_r5_audio_pcm *pcm = container_of(work, struct canon_r5_audio_pcm, capture_work);
-	struct canon_r5_audio_device *audio = pcm->audio;
+	struct canon_r5_audio_xfer *xfer = pcm->xfer;
 	struct snd_pcm_runtime *runtime = pcm->substream->runtime;
+	size_t period_bytes = frames_to_bytes(runtime, runtime->period_size);
+	/* The buffer is a whole number of periods, so a chunk never wraps */
+	size_t len = period_bytes - pcm->hw_pos % period_bytes;
+	u64 offset = pcm->object_offset;
+	u32 params[4];
+	int ret;
+	
+	params[0] = pcm->object_handle;
+	if (offset + len > U32_MAX) {
+		params[1] = lower_32_bits(offset);
+		params[2] = upper_32_bits(offset);
+		params[3] = len;
+		canon_r5_ptp_transaction_init(&xfer->trans, CANON_PTP_OP_GET_PARTIAL_OBJECT_64,
+					      params, 4);
+	} else {
+		params[1] = offset;
+		params[2] = len;
+		canon_r5_ptp_transaction_init(&xfer->trans, CANON_PTP_OP_GET_PARTIAL_OBJECT,
+					      params, 3);
+	}
+	
+	/* A partial object read, but monitoring must not queue behind card downloads */
+	xfer->trans.traffic_class = CANON_R5_PTP_CLASS_REALTIME;
+	xfer->trans.data_in = runtime->dma_area + pcm->hw_pos;
+	xfer->trans.data_in_len = len;
+	xfer->trans.complete = canon_r5_audio_xfer_complete;
+	xfer->trans.context = xfer;
+	
+	ret = canon_r5_ptp_submit(pcm->audio->canon_dev, &xfer->trans);
+	pcm->xfer_busy = !ret;
+	return ret;
+}
+
+/* Sample bytes received so far by a transaction */
+static size_t canon_r5_audio_xfer_bytes(const struct canon_r5_audio_xfer *xfer)
+{
+	return min(READ_ONCE(xfer->trans.data_in_actual), xfer->trans.data_in_len);
+}
+
+/*
+ * Data arrival drives the stream: advance the hardware pointer, report
+ * finished periods and immediately ask for the next chunk. A read that
+ * brings nothing is retried after a back-off, and too many of them in a
+ * row stop the stream. May be called in atomic context.
+ */
+static void canon_r5_audio_xfer_complete(struct canon_r5_device *dev,
+					 struct canon_r5_ptp_transaction *trans)
+{
+	struct canon_r5_audio_xfer *xfer = trans->context;
+	struct canon_r5_audio_pcm *pcm = xfer->pcm;
+	struct canon_r5_audio_device *audio = pcm->audio;
+	struct snd_pcm_substream *substream = pcm->substream;
+	struct snd_pcm_runtime *runtime = substream->runtime;
+	size_t period_bytes = frames_to_bytes(runtime, runtime->period_size);
+	size_t buffer_bytes = frames_to_bytes(runtime, runtime->buffer_size);
+	bool ok = !trans->status && trans->response_code == PTP_RC_OK;
+	bool elapsed = false, retry = false, starved = false;
+	ktime_t arrival = ktime_get();
 	unsigned long flags;
+	size_t bytes = 0;
+	int ret = 0;
 	
-	canon_r5_audio_dbg(audio, "Processing audio capture work");
+	if (ok) {
+		/* A trailing partial frame is read again with the next chunk */
+		bytes = canon_r5_audio_xfer_bytes(xfer);
+		bytes -= bytes % frames_to_bytes(runtime, 1);
+	}
 	
 	spin_lock_irqsave(&pcm->buffer_lock, flags);
 	
-	/* Simulate audio data capture by advancing buffer position */
+	if (bytes) {
+		pcm->hw_pos += bytes;
+		if (pcm->hw_pos >= buffer_bytes)
+			pcm->hw_pos = 0;
+		elapsed = !(pcm->hw_pos % period_bytes);
+		pcm->hw_frames += bytes_to_frames(runtime, bytes);
+		pcm->hw_time = arrival;
+		pcm->object_offset += bytes;
+		pcm->retries = 0;
+		
+		audio->stats.last_capture = arrival;
+	} else {
+		starved = ++pcm->retries > CANON_R5_AUDIO_MAX_RETRIES;
+	}
+	
+	pcm->xfer_busy = false;
+	pcm->xfer_completing = true;
 	if (pcm->capture_active) {
-		size_t period_bytes = frames_to_bytes(runtime, runtime->period_size);
-		int pos = atomic_read(&pcm->buffer_pos);
+		if (bytes)
+			ret = canon_r5_audio_submit_locked(pcm);
+		else
+			retry = !starved;	/* Error or nothing recorded yet */
+	}
+	
+	spin_unlock_irqrestore(&pcm->buffer_lock, flags);
+	
+	if (bytes) {
+		canon_r5_counter_add(&audio->counters, CANON_R5_AUDIO_FRAMES_CAPTURED,
+				     bytes_to_frames(runtime, bytes));
+		canon_r5_counter_add(&audio->counters, CANON_R5_AUDIO_TOTAL_BYTES, bytes);
+	}
+	
+	if (!ok)
+		dev_warn_ratelimited(dev->dev, "[AUDIO] Audio transfer failed: %d (0x%04x)\n",
+				     trans->status, trans->response_code);
+	
+	if (elapsed)
+		snd_pcm_period_elapsed(substream);
+	
+	if (ret) {
+		canon_r5_counter_inc(&audio->counters, CANON_R5_AUDIO_BUFFER_OVERRUNS);
+		snd_pcm_stop_xrun(substream);
+	} else if (starved) {
+		dev_warn_ratelimited(dev->dev, "[AUDIO] No samples after %u reads, stopping\n",
+				     CANON_R5_AUDIO_MAX_RETRIES);
+		canon_r5_counter_inc(&audio->counters, CANON_R5_AUDIO_BUFFER_UNDERRUNS);
+		snd_pcm_stop_xrun(substream);
+	}
+	
+	/* Last touch: once xfer_completing drops, stream_sync may free the ring */
+	spin_lock_irqsave(&pcm->buffer_lock, flags);
+	if (retry && pcm->capture_active)
+		canon_r5_queue_delayed_work(audio->canon_dev, audio->audio_wq, &pcm->capture_work,
+					    usecs_to_jiffies(CANON_R5_AUDIO_RETRY_US));
+	pcm->xfer_completing = false;
+	wake_up(&pcm->xfer_wait);
+	spin_unlock_irqrestore(&pcm->buffer_lock, flags);
+}
+
+/* Neither the engine nor a completion still holds the ring */
+static bool canon_r5_audio_xfer_idle(struct canon_r5_audio_pcm *pcm)
+{
+	unsigned long flags;
+	bool idle;
+	
+	spin_lock_irqsave(&pcm->buffer_lock, flags);
+	idle = !pcm->xfer_busy && !pcm->xfer_completing;
+	spin_unlock_irqrestore(&pcm->buffer_lock, flags);
+	
+	return idle;
+}
+
+/* Stop the stream and wait until the engine has let go of the ring */
+static void canon_r5_audio_stream_sync(struct canon_r5_audio_pcm *pcm)
+{
+	unsigned long flags;
+	int ret;
+	
+	if (!pcm->xfer)
+		return;
+	
+	spin_lock_irqsave(&pcm->buffer_lock, flags);
+	pcm->capture_active = false;
+	spin_unlock_irqrestore(&pcm->buffer_lock, flags);
+	
+	ret = canon_r5_ptp_cancel(pcm->audio->canon_dev, &pcm->xfer->trans, -ECANCELED);
+	if (ret != -EINPROGRESS) {
+		spin_lock_irqsave(&pcm->buffer_lock, flags);
+		pcm->xfer_busy = false;
+		spin_unlock_irqrestore(&pcm->buffer_lock, flags);
+	}
+	
+	/* A completion may still be running, even one that resubmitted; it will not again */
+	wait_event(pcm->xfer_wait, canon_r5_audio_xfer_idle(pcm));
+}
+
+/* Work functions */
+void canon_r5_audio_capture_work(struct work_struct *work)
+{
+	struct canon_r5_audio_pcm *pcm = container_of(to_delayed_work(work),
+						      struct canon_r5_audio_pcm, capture_work);
+	struct canon_r5_audio_device *audio = pcm->audio;
+	unsigned long flags;
+	u32 handle, offset;
+	int ret = 0;
+	
+	if (!READ_ONCE(pcm->capture_active)) {
+		if (pcm->recording) {
+			canon_r5_ptp_audio_stop_recording(audio->canon_dev);
+			pcm->recording = false;
+		}
+		return;
+	}
+	
+	if (!pcm->recording) {
+		ret = canon_r5_ptp_audio_start_recording(audio->canon_dev, &handle, &offset);
+		if (ret) {
+			canon_r5_audio_err(audio, "Failed to start audio recording: %d", ret);
+			snd_pcm_stop_xrun(pcm->substream);
+			return;
+		}
+		pcm->recording = true;
 		
-		pos += period_bytes;
-		if (pos >= frames_to_bytes(runtime, runtime->buffer_size))
-			pos = 0;
-			
-		atomic_set(&pcm->buffer_pos, pos);
-		audio->stats.frames_captured += runtime->period_size;
-		audio->stats.total_bytes += period_bytes;
-		audio->stats.last_capture = ktime_get();
+		spin_lock_irqsave(&pcm->buffer_lock, flags);
+		pcm->object_handle = handle;
+		pcm->object_offset = offset;
+		pcm->retries = 0;
+		spin_unlock_irqrestore(&pcm->buffer_lock, flags);
 	}
 	
+	spin_lock_irqsave(&pcm->buffer_lock, flags);
+	if (pcm->capture_active && !pcm->xfer_busy)
+		ret = canon_r5_audio_submit_locked(pcm);
 	spin_unlock_irqrestore(&pcm->buffer_lock, flags);
 	
-	if (pcm->capture_active)
-		snd_pcm_period_elapsed(pcm->substream);
+	if (ret) {
+		canon_r5_audio_err(audio, "Failed to request audio data: %d", ret);
+		snd_pcm_stop_xrun(pcm->substream);
+	}
 }
 
 void canon_r5_audio_level_work(struct work_struct *work)
@@ -278,6 +665,15 @@ static int canon_r5_audio_pcm_open(struct snd_pcm_substream *substream)
 	
 	mutex_lock(&audio->lock);
 	
+	/* The stream's transfer context comes from the smallest size class */
+	pcm->xfer = canon_r5_audio_alloc_buffer(audio, sizeof(*pcm->xfer));
+	if (!pcm->xfer) {
+		ret = -ENOMEM;
+		goto error;
+	}
+	memset(pcm->xfer, 0, sizeof(*pcm->xfer));
+	pcm->xfer->pcm = pcm;
+	
 	pcm->substream = substream;
 	runtime->hw = canon_r5_audio_pcm_hardware;
 	
@@ -285,19 +681,30 @@ static int canon_r5_audio_pcm_open(struct snd_pcm_substream *substream)
 	INIT_LIST_HEAD(&pcm->buffer_list);
 	INIT_LIST_HEAD(&pcm->free_buffers);
 	spin_lock_init(&pcm->buffer_lock);
-	atomic_set(&pcm->buffer_pos, 0);
+	init_waitqueue_head(&pcm->xfer_wait);
+	pcm->capture_active = false;
+	pcm->xfer_busy = false;
+	pcm->xfer_completing = false;
+	pcm->recording = false;
+	pcm->hw_pos = 0;
+	pcm->hw_frames = 0;
 	
-	INIT_WORK(&pcm->capture_work, canon_r5_audio_capture_work);
+	INIT_DELAYED_WORK(&pcm->capture_work, canon_r5_audio_capture_work);
 	
+	/* Whole periods per buffer keep every chunk inside one period */
 	ret = snd_pcm_hw_constraint_integer(runtime, SNDRV_PCM_HW_PARAM_PERIODS);
 	if (ret < 0) {
 		canon_r5_audio_err(audio, "Failed to set period constraint: %d", ret);
-		goto error;
+		goto error_free;
 	}
 	
 	mutex_unlock(&audio->lock);
 	return 0;
 	
+error_free:
+	canon_r5_audio_free_buffer(audio, pcm->xfer);
+	pcm->xfer = NULL;
+	pcm->substream = NULL;
 error:
 	mutex_unlock(&audio->lock);
 	return ret;
@@ -312,8 +719,15 @@ static int canon_r5_audio_pcm_close(struct snd_pcm_substream *substream)
 	
 	mutex_lock(&audio->lock);
 	
-	pcm->capture_active = false;
-	cancel_work_sync(&pcm->capture_work);
+	canon_r5_audio_stream_sync(pcm);
+	cancel_delayed_work_sync(&pcm->capture_work);
+	if (pcm->recording) {
+		canon_r5_ptp_audio_stop_recording(audio->canon_dev);
+		pcm->recording = false;
+	}
+	
+	canon_r5_audio_free_buffer(audio, pcm->xfer);
+	pcm->xfer = NULL;
 	pcm->substream = NULL;
 	
 	mutex_unlock(&audio->lock);
@@ -324,39 +738,13 @@ static int canon_r5_audio_pcm_hw_params(struct snd_pcm_substream *substream,
 					struct snd_pcm_hw_params *params)
 {
 	struct canon_r5_audio_device *audio = snd_pcm_substream_chip(substream);
-	struct canon_r5_audio_pcm *pcm = &audio->capture_pcm;
-	size_t buffer_bytes = params_buffer_bytes(params);
-	int ret;
 	
-	canon_r5_audio_dbg(audio, "Setting HW params: rate=%d, channels=%d, format=%d, buffer_bytes=%zu",
+	/* The runtime buffer is managed by the PCM core (vmalloc) */
+	canon_r5_audio_dbg(audio, "Setting HW params: rate=%d, channels=%d, format=%d, buffer_bytes=%u",
 			   params_rate(params), params_channels(params),
-			   params_format(params), buffer_bytes);
-	
-	mutex_lock(&audio->lock);
-	
-	/* Allocate DMA coherent buffer */
-	pcm->dma_area = dma_alloc_coherent(audio->canon_dev->dev, buffer_bytes,
-					   &pcm->dma_addr, GFP_KERNEL);
-	if (!pcm->dma_area) {
-		canon_r5_audio_err(audio, "Failed to allocate DMA buffer");
-		ret = -ENOMEM;
-		goto error;
-	}
-	
-	pcm->dma_bytes = buffer_bytes;
-	
-	/* Set up runtime buffer */
-	snd_pcm_set_runtime_buffer(substream, &substream->dma_buffer);
-	substream->dma_buffer.area = pcm->dma_area;
-	substream->dma_buffer.addr = pcm->dma_addr;
-	substream->dma_buffer.bytes = buffer_bytes;
+			   params_format(params), params_buffer_bytes(params));
 	
-	mutex_unlock(&audio->lock);
 	return 0;
-	
-error:
-	mutex_unlock(&audio->lock);
-	return ret;
 }
 
 static int canon_r5_audio_pcm_hw_free(struct snd_pcm_substream *substream)
@@ -366,18 +754,11 @@ static int canon_r5_audio_pcm_hw_free(struct snd_pcm_substream *substream)
 	
 	canon_r5_audio_dbg(audio, "Freeing HW params");
 	
+	/* The buffer goes away after this; nothing may still be writing into it */
 	mutex_lock(&audio->lock);
-	
-	if (pcm->dma_area) {
-		dma_free_coherent(audio->canon_dev->dev, pcm->dma_bytes,
-				  pcm->dma_area, pcm->dma_addr);
-		pcm->dma_area = NULL;
-		pcm->dma_bytes = 0;
-	}
-	
-	snd_pcm_set_runtime_buffer(substream, NULL);
-	
+	canon_r5_audio_stream_sync(pcm);
 	mutex_unlock(&audio->lock);
+	
 	return 0;
 }
 
@@ -385,60 +766,111 @@ static int canon_r5_audio_pcm_prepare(struct snd_pcm_substream *substream)
 {
 	struct canon_r5_audio_device *audio = snd_pcm_substream_chip(substream);
 	struct canon_r5_audio_pcm *pcm = &audio->capture_pcm;
+	struct snd_pcm_runtime *runtime = substream->runtime;
 	
 	canon_r5_audio_dbg(audio, "Preparing PCM capture");
 	
 	mutex_lock(&audio->lock);
 	
-	atomic_set(&pcm->buffer_pos, 0);
-	memset(pcm->dma_area, 0, pcm->dma_bytes);
+	/* A stream stopped by xrun may still own a transfer */
+	canon_r5_audio_stream_sync(pcm);
+	pcm->hw_pos = 0;
+	pcm->hw_frames = 0;
+	pcm->retries = 0;
+	memset(runtime->dma_area, 0, runtime->dma_bytes);
 	
 	mutex_unlock(&audio->lock);
 	return 0;
 }
 
+/* Atomic context: only flip the state, capture_work talks to the camera */
 static int canon_r5_audio_pcm_trigger(struct snd_pcm_substream *substream, int cmd)
 {
 	struct canon_r5_audio_device *audio = snd_pcm_substream_chip(substream);
 	struct canon_r5_audio_pcm *pcm = &audio->capture_pcm;
-	int ret = 0;
+	unsigned long flags;
 	
 	canon_r5_audio_dbg(audio, "PCM trigger command: %d", cmd);
 	
-	mutex_lock(&audio->lock);
-	
 	switch (cmd) {
 	case SNDRV_PCM_TRIGGER_START:
+		spin_lock_irqsave(&pcm->buffer_lock, flags);
 		pcm->capture_active = true;
-		ret = canon_r5_ptp_audio_start_recording(audio->canon_dev);
-		if (!ret)
-			queue_work(audio->audio_wq, &pcm->capture_work);
+		spin_unlock_irqrestore(&pcm->buffer_lock, flags);
 		break;
 		
 	case SNDRV_PCM_TRIGGER_STOP:
+		spin_lock_irqsave(&pcm->buffer_lock, flags);
 		pcm->capture_active = false;
-		cancel_work_sync(&pcm->capture_work);
-		ret = canon_r5_ptp_audio_stop_recording(audio->canon_dev);
+		spin_unlock_irqrestore(&pcm->buffer_lock, flags);
 		break;
 		
 	default:
-		ret = -EINVAL;
-		break;
+		return -EINVAL;
 	}
 	
-	mutex_unlock(&audio->lock);
-	return ret;
+	canon_r5_mod_delayed_work(audio->canon_dev, audio->audio_wq, &pcm->capture_work, 0);
+	return 0;
 }
 
+/*
+ * Bytes already landed by the in-flight transfer count too, so the
+ * pointer moves within a period rather than in period-sized steps.
+ */
 static snd_pcm_uframes_t canon_r5_audio_pcm_pointer(struct snd_pcm_substream *substream)
 {
 	struct canon_r5_audio_device *audio = snd_pcm_substream_chip(substream);
 	struct canon_r5_audio_pcm *pcm = &audio->capture_pcm;
 	struct snd_pcm_runtime *runtime = substream->runtime;
-	int pos;
+	unsigned long flags;
+	size_t pos;
 	
-	pos = atomic_read(&pcm->buffer_pos);
-	return bytes_to_frames(runtime, pos);
+	spin_lock_irqsave(&pcm->buffer_lock, flags);
+	pos = pcm->hw_pos;
+	if (pcm->xfer_busy)
+		pos += canon_r5_audio_xfer_bytes(pcm->xfer);
+	spin_unlock_irqrestore(&pcm->buffer_lock, flags);
+	
+	return bytes_to_frames(runtime, pos) % runtime->buffer_size;
+}
+
+/*
+ * Link-absolute audio timestamps: audio_ts counts the frames delivered
+ * since prepare and system_ts is when the newest of them arrived, on
+ * CLOCK_MONOTONIC like the vb2 buffers of the live view stream.
+ */
+static int canon_r5_audio_pcm_get_time_info(struct snd_pcm_substream *substream,
+					    struct timespec64 *system_ts,
+					    struct timespec64 *audio_ts,
+					    struct snd_pcm_audio_tstamp_config *config,
+					    struct snd_pcm_audio_tstamp_report *report)
+{
+	struct canon_r5_audio_device *audio = snd_pcm_substream_chip(substream);
+	struct canon_r5_audio_pcm *pcm = &audio->capture_pcm;
+	struct snd_pcm_runtime *runtime = substream->runtime;
+	unsigned long flags;
+	ktime_t host;
+	u64 frames;
+	
+	spin_lock_irqsave(&pcm->buffer_lock, flags);
+	frames = pcm->hw_frames;
+	host = pcm->hw_time;
+	spin_unlock_irqrestore(&pcm->buffer_lock, flags);
+	
+	if (config->type_requested != SNDRV_PCM_AUDIO_TSTAMP_TYPE_LINK_ABSOLUTE ||
+	    runtime->tstamp_type != SNDRV_PCM_TSTAMP_TYPE_MONOTONIC || !frames) {
+		/* Let the core derive audio_ts from the pointer */
+		snd_pcm_gettime(runtime, system_ts);
+		report->actual_type = SNDRV_PCM_AUDIO_TSTAMP_TYPE_DEFAULT;
+		return 0;
+	}
+	
+	*system_ts = ktime_to_timespec64(host);
+	*audio_ts = ns_to_timespec64(div_u64(frames * NSEC_PER_SEC, runtime->rate));
+	report->actual_type = SNDRV_PCM_AUDIO_TSTAMP_TYPE_LINK_ABSOLUTE;
+	report->accuracy_report = 0;
+	
+	return 0;
 }
 
 const struct snd_pcm_ops canon_r5_audio_pcm_ops = {
@@ -449,6 +881,7 @@ const struct snd_pcm_ops canon_r5_audio_pcm_ops = {
 	.prepare = canon_r5_audio_pcm_prepare,
 	.trigger = canon_r5_audio_pcm_trigger,
 	.pointer = canon_r5_audio_pcm_pointer,
+	.get_time_info = canon_r5_audio_pcm_get_time_info,
 };
 
 /* Control callbacks */
@@ -530,7 +963,10 @@ static void canon_r5_audio_proc_read(struct snd_info_entry *entry,
 				     struct snd_info_buffer *buffer)
 {
 	struct canon_r5_audio_device *audio = entry->private_data;
+	struct canon_r5_audio *priv = container_of(audio, struct canon_r5_audio, device);
+	struct canon_r5_audio_pool_class *class;
 	struct canon_r5_audio_stats stats;
+	unsigned int i;
 	
 	canon_r5_audio_get_stats(audio, &stats);
 	
@@ -551,6 +987,13 @@ static void canon_r5_audio_proc_read(struct snd_info_entry *entry,
 	snd_iprintf(buffer, "  Bit depth: %u\n", audio->quality.bit_depth);
 	snd_iprintf(buffer, "  Input source: %s\n", canon_r5_audio_input_name(audio->quality.input_source));
 	snd_iprintf(buffer, "  Recording mode: %s\n", canon_r5_audio_mode_name(audio->quality.recording_mode));
+	snd_iprintf(buffer, "\nBuffer Pool:\n");
+	for (i = 0; i < CANON_R5_AUDIO_POOL_CLASSES; i++) {
+		class = &priv->memory.classes[i];
+		snd_iprintf(buffer, "  %zu bytes: %d/%u in use, high watermark %d, failures %d\n",
+			    class->size, atomic_read(&class->in_use), class->nr_objs,
+			    atomic_read(&class->high_watermark), atomic_read(&class->failures));
+	}
 }
 
 int canon_r5_audio_create_proc(struct canon_r5_audio_device *audio)
@@ -625,10 +1068,10 @@ int canon_r5_audio_start_capture(struct canon_r5_audio_device *audio)
 		goto unlock;
 	}
 	
-	ret = canon_r5_ptp_audio_start_recording(audio->canon_dev);
+	ret = canon_r5_ptp_audio_start_recording(audio->canon_dev, NULL, NULL);
 	if (!ret) {
 		audio->capture_enabled = true;
-		queue_work(audio->audio_wq, &audio->level_work);
+		canon_r5_queue_work(audio->canon_dev, audio->audio_wq, &audio->level_work);
 	}
 	
 unlock:
@@ -659,15 +1102,23 @@ unlock:
 	return ret;
 }
 
+/* Lock-free: counters are summed per CPU and the rest are single stores */
 int canon_r5_audio_get_stats(struct canon_r5_audio_device *audio,
 			    struct canon_r5_audio_stats *stats)
 {
+	u64 counters[CANON_R5_AUDIO_COUNTERS] = {};
+	
 	if (!audio || !stats)
 		return -EINVAL;
-		
-	mutex_lock(&audio->lock);
+	
 	*stats = audio->stats;
-	mutex_unlock(&audio->lock);
+	
+	canon_r5_counters_read(&audio->counters, counters);
+	stats->frames_captured = counters[CANON_R5_AUDIO_FRAMES_CAPTURED];
+	stats->frames_dropped = counters[CANON_R5_AUDIO_FRAMES_DROPPED];
+	stats->total_bytes = counters[CANON_R5_AUDIO_TOTAL_BYTES];
+	stats->buffer_overruns = counters[CANON_R5_AUDIO_BUFFER_OVERRUNS];
+	stats->buffer_underruns = counters[CANON_R5_AUDIO_BUFFER_UNDERRUNS];
 	
 	return 0;
 }
@@ -676,12 +1127,19 @@ void canon_r5_audio_reset_stats(struct canon_r5_audio_device *audio)
 {
 	if (!audio)
 		return;
-		
-	mutex_lock(&audio->lock);
+	
 	memset(&audio->stats, 0, sizeof(audio->stats));
-	mutex_unlock(&audio->lock);
+	canon_r5_counters_reset(&audio->counters);
 }
 
+static const char * const canon_r5_audio_counter_names[CANON_R5_AUDIO_COUNTERS] = {
+	[CANON_R5_AUDIO_FRAMES_CAPTURED]	= "frames_captured",
+	[CANON_R5_AUDIO_FRAMES_DROPPED]		= "frames_dropped",
+	[CANON_R5_AUDIO_TOTAL_BYTES]		= "total_bytes",
+	[CANON_R5_AUDIO_BUFFER_OVERRUNS]	= "buffer_overruns",
+	[CANON_R5_AUDIO_BUFFER_UNDERRUNS]	= "buffer_underruns",
+};
+
 /* Driver initialization */
 int canon_r5_audio_init(struct canon_r5_device *dev)
 {
@@ -689,6 +1147,8 @@ int canon_r5_audio_init(struct canon_r5_device *dev)
 	struct canon_r5_audio_device *audio;
 	struct snd_card *card;
 	struct snd_pcm *pcm;
+	int idx = SNDRV_DEFAULT_IDX1;
+	char *xid = SNDRV_DEFAULT_STR1;
 	int ret;
 	
 	if (!dev) {
@@ -696,9 +1156,16 @@ int canon_r5_audio_init(struct canon_r5_device *dev)
 		return -EINVAL;
 	}
 	
+	/* Card options follow the body's device id, so a rig can name each camera */
+	if (dev->id >= 0 && dev->id < SNDRV_CARDS) {
+		if (!enable[dev->id])
+			return -ENOENT;
+		idx = index[dev->id];
+		xid = id[dev->id];
+	}
+	
 	/* Create ALSA card */
-	ret = snd_card_new(dev->dev, SNDRV_DEFAULT_IDX1, SNDRV_DEFAULT_STR1,
-			   THIS_MODULE, sizeof(*priv), &card);
+	ret = snd_card_new(dev->dev, idx, xid, THIS_MODULE, sizeof(*priv), &card);
 	if (ret) {
 		dev_err(dev->dev, "Failed to create ALSA card: %d\n", ret);
 		return ret;
@@ -730,26 +1197,21 @@ int canon_r5_audio_init(struct canon_r5_device *dev)
 	INIT_WORK(&audio->level_work, canon_r5_audio_level_work);
 	
 	/* Initialize memory management */
-	priv->memory.buffer_size = 256 * 1024; /* 256KB buffer pool */
-	priv->memory.buffer_pool = vmalloc(priv->memory.buffer_size);
-	if (!priv->memory.buffer_pool) {
-		ret = -ENOMEM;
+	ret = canon_r5_audio_pool_init(priv);
+	if (ret)
 		goto error_card;
-	}
 	
-	priv->memory.bitmap = bitmap_zalloc(priv->memory.buffer_size / PAGE_SIZE, GFP_KERNEL);
-	if (!priv->memory.bitmap) {
-		ret = -ENOMEM;
+	ret = canon_r5_counters_register(dev, &audio->counters, "audio",
+					 canon_r5_audio_counter_names, CANON_R5_AUDIO_COUNTERS);
+	if (ret)
 		goto error_buffer;
-	}
-	
-	spin_lock_init(&priv->memory.lock);
 	
 	/* Create workqueue */
-	audio->audio_wq = alloc_workqueue("canon_r5_audio", WQ_MEM_RECLAIM, 0);
+	audio->audio_wq = canon_r5_workqueue_get(dev, CANON_R5_WORK_STREAM, "canon_r5_audio",
+						 WQ_MEM_RECLAIM, 0);
 	if (!audio->audio_wq) {
 		ret = -ENOMEM;
-		goto error_bitmap;
+		goto error_counters;
 	}
 	
 	/* Create PCM device */
@@ -764,6 +1226,7 @@ int canon_r5_audio_init(struct canon_r5_device *dev)
 	strcpy(pcm->name, "Canon R5 Audio Capture");
 	
 	snd_pcm_set_ops(pcm, SNDRV_PCM_STREAM_CAPTURE, &canon_r5_audio_pcm_ops);
+	snd_pcm_set_managed_buffer_all(pcm, SNDRV_DMA_TYPE_VMALLOC, NULL, 0, 0);
 	
 	/* Create ALSA controls */
 	ret = canon_r5_audio_create_controls(audio);
@@ -810,11 +1273,11 @@ error_proc:
 	canon_r5_audio_free_proc(audio);
 	canon_r5_audio_free_controls(audio);
 error_wq:
-	destroy_workqueue(audio->audio_wq);
-error_bitmap:
-	bitmap_free(priv->memory.bitmap);
+	canon_r5_workqueue_put(dev, audio->audio_wq);
+error_counters:
+	canon_r5_counters_unregister(&audio->counters);
 error_buffer:
-	vfree(priv->memory.buffer_pool);
+	canon_r5_audio_pool_destroy(priv);
 error_card:
 	snd_card_free(card);
 	return ret;
@@ -836,6 +1299,16 @@ void canon_r5_audio_cleanup(struct canon_r5_device *dev)
 	
 	dev_info(dev->dev, "Cleaning up Canon R5 audio driver\n");
 	
+	/* No new opens or triggers; a stream still open must let go of the ring */
+	snd_card_disconnect(audio->card);
+	
+	mutex_lock(&audio->lock);
+	if (audio->capture_pcm.xfer) {
+		canon_r5_audio_stream_sync(&audio->capture_pcm);
+		cancel_delayed_work_sync(&audio->capture_pcm.capture_work);
+	}
+	mutex_unlock(&audio->lock);
+	
 	/* Stop capture if active */
 	canon_r5_audio_stop_capture(audio);
 	
@@ -844,31 +1317,41 @@ void canon_r5_audio_cleanup(struct canon_r5_device *dev)
 	canon_r5_audio_free_controls(audio);
 	
 	if (audio->audio_wq) {
-		flush_workqueue(audio->audio_wq);
-		destroy_workqueue(audio->audio_wq);
+		cancel_work_sync(&audio->level_work);
+		canon_r5_workqueue_put(dev, audio->audio_wq);
 	}
 	
-	if (priv->memory.bitmap)
-		bitmap_free(priv->memory.bitmap);
-		
-	if (priv->memory.buffer_pool)
-		vfree(priv->memory.buffer_pool);
+	canon_r5_audio_pool_destroy(priv);
+	canon_r5_counters_unregister(&audio->counters);
 	
-	snd_card_disconnect(audio->card);
 	snd_card_free(audio->card);
 	
 	canon_r5_unregister_audio_driver(dev);
 }
 
 /* Module functions */
+static const struct canon_r5_bringup_ops canon_r5_audio_bringup_ops = {
+	.run = canon_r5_audio_init,
+	.teardown = canon_r5_audio_cleanup,
+};
+
 static int __init canon_r5_audio_module_init(void)
 {
+	int ret;
+	
+	ret = canon_r5_bringup_register(CANON_R5_BRINGUP_AUDIO, &canon_r5_audio_bringup_ops);
+	if (ret) {
+		pr_err("Failed to register audio bring-up step: %d\n", ret);
+		return ret;
+	}
+	
 	pr_info("Canon R5 Audio Driver v%s loaded\n", "1.0.0");
 	return 0;
 }
 
 static void __exit canon_r5_audio_module_exit(void)
 {
+	canon_r5_bringup_unregister(CANON_R5_BRINGUP_AUDIO);
 	pr_info("Canon R5 Audio Driver unloaded\n");
 }
 
@@ -883,4 +1366,8 @@ EXPORT_SYMBOL_GPL(canon_r5_audio_get_quality);
 EXPORT_SYMBOL_GPL(canon_r5_audio_start_capture);
 EXPORT_SYMBOL_GPL(canon_r5_audio_stop_capture);
 EXPORT_SYMBOL_GPL(canon_r5_audio_get_stats);
-EXPORT_SYMBOL_GPL(canon_r5_audio_reset_stats);
\ No newline at end of file
+EXPORT_SYMBOL_GPL(canon_r5_audio_reset_stats);
+EXPORT_SYMBOL_GPL(canon_r5_audio_pool_init);
+EXPORT_SYMBOL_GPL(canon_r5_audio_pool_destroy);
+EXPORT_SYMBOL_GPL(canon_r5_audio_alloc_buffer);
+EXPORT_SYMBOL_GPL(canon_r5_audio_free_buffer);
\ No newline at end of file
@@ -0,0 +1,343 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Canon R5 Linux Driver Suite
+ * Deferred device bring-up
+ *
+ * Copyright (C) 2025 Canon R5 Driver Project
+ */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/spinlock.h>
+#include <linux/workqueue.h>
+#include <linux/ktime.h>
+
+#include "../../include/core/canon-r5.h"
+#include "../../include/core/canon-r5-ptp.h"
+
+/*
+ * Probe only sets up the transport and hands the device to this module.
+ * Each step runs as its own work item as soon as the steps it depends on
+ * have finished, so everything that only needs an open session (property
+ * prefetch, card scan, V4L2 and ALSA registration) proceeds in parallel.
+ * Feature modules plug in their step when they load; a step whose module
+ * is not loaded simply does not hold up the device.
+ */
+
+static const struct {
+	const char	*name;
+	unsigned long	requires;
+} canon_r5_bringup_table[CANON_R5_BRINGUP_COUNT] = {
+	[CANON_R5_BRINGUP_SESSION]	= { "session",		0 },
+	[CANON_R5_BRINGUP_DEVICE_INFO]	= { "device info",	BIT(CANON_R5_BRINGUP_SESSION) },
+	[CANON_R5_BRINGUP_PROPERTIES]	= { "properties",	BIT(CANON_R5_BRINGUP_SESSION) },
+	[CANON_R5_BRINGUP_STORAGE]	= { "storage",		BIT(CANON_R5_BRINGUP_SESSION) },
+	[CANON_R5_BRINGUP_VIDEO]	= { "video",		BIT(CANON_R5_BRINGUP_SESSION) },
+	[CANON_R5_BRINGUP_STILL]	= { "still",		BIT(CANON_R5_BRINGUP_SESSION) },
+	[CANON_R5_BRINGUP_AUDIO]	= { "audio",		BIT(CANON_R5_BRINGUP_SESSION) },
+};
+
+static struct workqueue_struct *canon_r5_bringup_wq;
+
+/* Serializes step registration against teardown */
+static DEFINE_MUTEX(canon_r5_bringup_lock);
+
+/* Built-in steps */
+static int canon_r5_bringup_session(struct canon_r5_device *dev)
+{
+	return canon_r5_ptp_open_session(dev);
+}
+
+static void canon_r5_bringup_session_teardown(struct canon_r5_device *dev)
+{
+	canon_r5_ptp_close_session(dev);
+}
+
+static int canon_r5_bringup_device_info(struct canon_r5_device *dev)
+{
+	struct ptp_device_info info;
+	
+	return canon_r5_ptp_get_device_info(dev, &info);
+}
+
+/* Opening the session started the prefetch; this step ends when it has */
+static int canon_r5_bringup_properties(struct canon_r5_device *dev)
+{
+	flush_work(&dev->props.refresh_work);
+	return 0;
+}
+
+static const struct canon_r5_bringup_ops canon_r5_bringup_session_ops = {
+	.run = canon_r5_bringup_session,
+	.teardown = canon_r5_bringup_session_teardown,
+};
+
+static const struct canon_r5_bringup_ops canon_r5_bringup_device_info_ops = {
+	.run = canon_r5_bringup_device_info,
+};
+
+static const struct canon_r5_bringup_ops canon_r5_bringup_properties_ops = {
+	.run = canon_r5_bringup_properties,
+};
+
+static const struct canon_r5_bringup_ops *canon_r5_bringup_ops[CANON_R5_BRINGUP_COUNT] = {
+	[CANON_R5_BRINGUP_SESSION]	= &canon_r5_bringup_session_ops,
+	[CANON_R5_BRINGUP_DEVICE_INFO]	= &canon_r5_bringup_device_info_ops,
+	[CANON_R5_BRINGUP_PROPERTIES]	= &canon_r5_bringup_properties_ops,
+};
+
+/* Queue every step whose prerequisites are done */
+static void canon_r5_bringup_kick(struct canon_r5_device *dev)
+{
+	struct canon_r5_bringup *b = &dev->bringup;
+	unsigned long flags, requires;
+	int step;
+	
+	spin_lock_irqsave(&b->lock, flags);
+	
+	for (step = 0; b->active && step < CANON_R5_BRINGUP_COUNT; step++) {
+		requires = canon_r5_bringup_table[step].requires;
+		if ((b->queued & BIT(step)) || (b->done & requires) != requires)
+			continue;
+		if (!READ_ONCE(canon_r5_bringup_ops[step]))
+			continue;
+	
+		b->queued |= BIT(step);
+		queue_work(canon_r5_bringup_wq, &b->steps[step].work);
+	}
+	
+	spin_unlock_irqrestore(&b->lock, flags);
+}
+
+/* Every step that can run has finished */
+static bool canon_r5_bringup_settled_locked(struct canon_r5_bringup *b)
+{
+	int step;
+	
+	for (step = 0; step < CANON_R5_BRINGUP_COUNT; step++) {
+		if (!READ_ONCE(canon_r5_bringup_ops[step]))
+			continue;
+		if ((b->queued & ~(b->done | b->failed)) & BIT(step))
+			return false;
+		if (!(b->queued & BIT(step)) && !(b->failed & canon_r5_bringup_table[step].requires))
+			return false;
+	}
+	
+	return true;
+}
+
+static void canon_r5_bringup_work(struct work_struct *work)
+{
+	struct canon_r5_bringup_step_work *w = container_of(work, struct canon_r5_bringup_step_work,
+							    work);
+	struct canon_r5_device *dev = w->dev;
+	struct canon_r5_bringup *b = &dev->bringup;
+	const struct canon_r5_bringup_ops *ops;
+	unsigned long flags, failed = 0;
+	bool settled = false;
+	ktime_t start;
+	int ret;
+	
+	ops = READ_ONCE(canon_r5_bringup_ops[w->step]);
+	if (!ops) {
+		spin_lock_irqsave(&b->lock, flags);
+		b->queued &= ~BIT(w->step);
+		spin_unlock_irqrestore(&b->lock, flags);
+		return;
+	}
+	
+	start = ktime_get();
+	ret = ops->run(dev);
+	w->duration_us = ktime_us_delta(ktime_get(), start);
+	
+	spin_lock_irqsave(&b->lock, flags);
+	if (ret)
+		b->failed |= BIT(w->step);
+	else
+		b->done |= BIT(w->step);
+	spin_unlock_irqrestore(&b->lock, flags);
+	
+	if (ret)
+		canon_r5_warn(dev, "Bring-up step '%s' failed: %d",
+			      canon_r5_bringup_table[w->step].name, ret);
+	else
+		canon_r5_dbg(dev, "Bring-up step '%s' done in %u us",
+			     canon_r5_bringup_table[w->step].name, w->duration_us);
+	
+	canon_r5_bringup_kick(dev);
+	
+	spin_lock_irqsave(&b->lock, flags);
+	if (b->active && !b->settled && canon_r5_bringup_settled_locked(b)) {
+		settled = b->settled = true;
+		failed = b->failed;
+	}
+	spin_unlock_irqrestore(&b->lock, flags);
+	
+	if (!settled)
+		return;
+	
+	if (failed) {
+		canon_r5_warn(dev, "Bring-up incomplete after %lld ms (failed steps 0x%lx)",
+			      ktime_ms_delta(ktime_get(), b->start), failed);
+		return;
+	}
+	
+	canon_r5_set_state(dev, CANON_R5_STATE_READY);
+	canon_r5_info(dev, "Device ready %lld ms after probe",
+		      ktime_ms_delta(ktime_get(), b->start));
+}
+
+void canon_r5_bringup_init(struct canon_r5_device *dev)
+{
+	struct canon_r5_bringup *b = &dev->bringup;
+	int step;
+	
+	spin_lock_init(&b->lock);
+	b->active = false;
+	b->settled = false;
+	b->queued = 0;
+	b->done = 0;
+	b->failed = 0;
+	
+	for (step = 0; step < CANON_R5_BRINGUP_COUNT; step++) {
+		INIT_WORK(&b->steps[step].work, canon_r5_bringup_work);
+		b->steps[step].dev = dev;
+		b->steps[step].step = step;
+		b->steps[step].duration_us = 0;
+	}
+}
+EXPORT_SYMBOL_GPL(canon_r5_bringup_init);
+
+/* Start bringing the device up in the background; returns immediately */
+void canon_r5_bringup_start(struct canon_r5_device *dev)
+{
+	struct canon_r5_bringup *b = &dev->bringup;
+	unsigned long flags;
+	
+	spin_lock_irqsave(&b->lock, flags);
+	b->active = true;
+	b->settled = false;
+	b->queued = 0;
+	b->done = 0;
+	b->failed = 0;
+	b->start = ktime_get();
+	spin_unlock_irqrestore(&b->lock, flags);
+	
+	canon_r5_bringup_kick(dev);
+}
+EXPORT_SYMBOL_GPL(canon_r5_bringup_start);
+
+/* Wait for running steps, then undo finished ones in reverse order */
+void canon_r5_bringup_stop(struct canon_r5_device *dev)
+{
+	struct canon_r5_bringup *b = &dev->bringup;
+	const struct canon_r5_bringup_ops *ops;
+	unsigned long flags, done;
+	int step;
+	
+	spin_lock_irqsave(&b->lock, flags);
+	b->active = false;
+	spin_unlock_irqrestore(&b->lock, flags);
+	
+	for (step = 0; step < CANON_R5_BRINGUP_COUNT; step++)
+		cancel_work_sync(&b->steps[step].work);
+	
+	mutex_lock(&canon_r5_bringup_lock);
+	
+	spin_lock_irqsave(&b->lock, flags);
+	done = b->done;
+	b->done = 0;
+	b->queued = 0;
+	spin_unlock_irqrestore(&b->lock, flags);
+	
+	for (step = CANON_R5_BRINGUP_COUNT - 1; step >= 0; step--) {
+		ops = canon_r5_bringup_ops[step];
+		if ((done & BIT(step)) && ops && ops->teardown)
+			ops->teardown(dev);
+	}
+	
+	mutex_unlock(&canon_r5_bringup_lock);
+}
+EXPORT_SYMBOL_GPL(canon_r5_bringup_stop);
+
+static void canon_r5_bringup_attach(struct canon_r5_device *dev, void *data)
+{
+	canon_r5_bringup_kick(dev);
+}
+
+struct canon_r5_bringup_detach {
+	enum canon_r5_bringup_step step;
+	const struct canon_r5_bringup_ops *ops;
+};
+
+static void canon_r5_bringup_detach(struct canon_r5_device *dev, void *data)
+{
+	struct canon_r5_bringup_detach *detach = data;
+	struct canon_r5_bringup *b = &dev->bringup;
+	unsigned long flags;
+	bool done;
+	
+	cancel_work_sync(&b->steps[detach->step].work);
+	
+	spin_lock_irqsave(&b->lock, flags);
+	done = b->done & BIT(detach->step);
+	b->done &= ~BIT(detach->step);
+	b->queued &= ~BIT(detach->step);
+	spin_unlock_irqrestore(&b->lock, flags);
+	
+	if (done && detach->ops->teardown)
+		detach->ops->teardown(dev);
+}
+
+/* Called by feature modules on load; devices already present pick the step up */
+int canon_r5_bringup_register(enum canon_r5_bringup_step step,
+			      const struct canon_r5_bringup_ops *ops)
+{
+	if (step >= CANON_R5_BRINGUP_COUNT || !ops || !ops->run)
+		return -EINVAL;
+	
+	mutex_lock(&canon_r5_bringup_lock);
+	if (canon_r5_bringup_ops[step]) {
+		mutex_unlock(&canon_r5_bringup_lock);
+		return -EBUSY;
+	}
+	WRITE_ONCE(canon_r5_bringup_ops[step], ops);
+	mutex_unlock(&canon_r5_bringup_lock);
+	
+	canon_r5_for_each_device(canon_r5_bringup_attach, NULL);
+	return 0;
+}
+EXPORT_SYMBOL_GPL(canon_r5_bringup_register);
+
+/* Called on module unload: tears the step down on every device */
+void canon_r5_bringup_unregister(enum canon_r5_bringup_step step)
+{
+	struct canon_r5_bringup_detach detach = { .step = step };
+	
+	if (step >= CANON_R5_BRINGUP_COUNT)
+		return;
+	
+	mutex_lock(&canon_r5_bringup_lock);
+	detach.ops = canon_r5_bringup_ops[step];
+	WRITE_ONCE(canon_r5_bringup_ops[step], NULL);
+	if (detach.ops)
+		canon_r5_for_each_device(canon_r5_bringup_detach, &detach);
+	mutex_unlock(&canon_r5_bringup_lock);
+}
+EXPORT_SYMBOL_GPL(canon_r5_bringup_unregister);
+
+int canon_r5_bringup_module_init(void)
+{
+	/* Unbound and unlimited so independent steps really overlap */
+	canon_r5_bringup_wq = alloc_workqueue("canon-r5-bringup", WQ_UNBOUND, 0);
+	if (!canon_r5_bringup_wq)
+		return -ENOMEM;
+	
+	return 0;
+}
+
+void canon_r5_bringup_module_exit(void)
+{
+	destroy_workqueue(canon_r5_bringup_wq);
+}
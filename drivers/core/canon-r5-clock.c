@@ -0,0 +1,181 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Canon R5 Linux Driver Suite
+ * Camera clock recovery
+ *
+ * Copyright (C) 2025 Canon R5 Driver Project
+ */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/spinlock.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+
+#include "../../include/core/canon-r5.h"
+
+/*
+ * Live view and audio data carry the camera's capture time in
+ * microseconds. Each observation pairs such a time with the host arrival
+ * time; transport delay only ever adds to the latter, so the observation
+ * with the smallest offset in a window is the best estimate of the true
+ * mapping. Successive window minima give the rate error between the two
+ * clocks, which is low-pass filtered and applied between anchors.
+ */
+
+/* Ignore rate estimates over a span shorter than this */
+#define CANON_R5_CLOCK_MIN_SPAN_NS	(100 * NSEC_PER_MSEC)
+
+/* A prediction error beyond this means the camera clock was reset */
+#define CANON_R5_CLOCK_MAX_STEP_NS	(100 * NSEC_PER_MSEC)
+
+/* Crystal tolerance is well under this; anything larger is noise */
+#define CANON_R5_CLOCK_MAX_PPB		1000000
+
+static void canon_r5_clock_reset_locked(struct canon_r5_clock *clock)
+{
+	clock->valid = false;
+	clock->dev_base_us = 0;
+	clock->host_base_ns = 0;
+	clock->drift_ppb = 0;
+	clock->dev_last_us = 0;
+	clock->nr_obs = 0;
+}
+
+void canon_r5_clock_init(struct canon_r5_device *dev)
+{
+	spin_lock_init(&dev->clock.lock);
+	canon_r5_clock_reset_locked(&dev->clock);
+	dev->clock.resets = 0;
+}
+EXPORT_SYMBOL_GPL(canon_r5_clock_init);
+
+/* Drop the estimate, e.g. when a new session may have restarted the camera clock */
+void canon_r5_clock_reset(struct canon_r5_device *dev)
+{
+	unsigned long flags;
+	
+	spin_lock_irqsave(&dev->clock.lock, flags);
+	canon_r5_clock_reset_locked(&dev->clock);
+	spin_unlock_irqrestore(&dev->clock.lock, flags);
+}
+EXPORT_SYMBOL_GPL(canon_r5_clock_reset);
+
+static s64 canon_r5_clock_map_locked(const struct canon_r5_clock *clock, u64 dev_us)
+{
+	s64 delta = (s64)(dev_us - clock->dev_base_us) * NSEC_PER_USEC;
+	
+	return clock->host_base_ns + delta + div_s64(delta * clock->drift_ppb, NSEC_PER_SEC);
+}
+
+/* Fold the finished window into the estimate */
+static void canon_r5_clock_update_locked(struct canon_r5_clock *clock)
+{
+	s64 span, measured, predicted;
+	
+	if (!clock->valid) {
+		clock->dev_base_us = clock->win_dev_us;
+		clock->host_base_ns = clock->win_host_ns;
+		clock->drift_ppb = 0;
+		clock->valid = true;
+		return;
+	}
+	
+	span = (s64)(clock->win_dev_us - clock->dev_base_us) * NSEC_PER_USEC;
+	if (span < CANON_R5_CLOCK_MIN_SPAN_NS)
+		return;
+	
+	measured = div64_s64((clock->win_host_ns - clock->host_base_ns - span) * NSEC_PER_SEC,
+			     span);
+	clock->drift_ppb += (measured - clock->drift_ppb) / 8;
+	clock->drift_ppb = clamp_t(s64, clock->drift_ppb,
+				   -CANON_R5_CLOCK_MAX_PPB, CANON_R5_CLOCK_MAX_PPB);
+	
+	/* Re-anchor, pulling the phase only part of the way to avoid steps */
+	predicted = canon_r5_clock_map_locked(clock, clock->win_dev_us);
+	clock->host_base_ns = predicted + (clock->win_host_ns - predicted) / 4;
+	clock->dev_base_us = clock->win_dev_us;
+}
+
+/*
+ * Record that data captured at camera time @dev_us arrived at @arrival and
+ * return its capture time on CLOCK_MONOTONIC. Until the first window has
+ * completed the arrival time is returned unchanged. May be called in
+ * atomic context.
+ */
+ktime_t canon_r5_clock_stamp(struct canon_r5_device *dev, u64 dev_us, ktime_t arrival)
+{
+	struct canon_r5_clock *clock = &dev->clock;
+	s64 host = ktime_to_ns(arrival);
+	s64 offset = host - (s64)dev_us * NSEC_PER_USEC;
+	unsigned long flags;
+	s64 err, result = host;
+	
+	spin_lock_irqsave(&clock->lock, flags);
+	
+	if (clock->valid) {
+		err = host - canon_r5_clock_map_locked(clock, dev_us);
+		if (err < -CANON_R5_CLOCK_MAX_STEP_NS || err > CANON_R5_CLOCK_MAX_STEP_NS) {
+			canon_r5_clock_reset_locked(clock);
+			clock->resets++;
+		}
+	}
+	
+	if (!clock->nr_obs || offset < clock->win_offset_ns) {
+		clock->win_dev_us = dev_us;
+		clock->win_host_ns = host;
+		clock->win_offset_ns = offset;
+	}
+	if (++clock->nr_obs >= CANON_R5_CLOCK_WINDOW) {
+		canon_r5_clock_update_locked(clock);
+		clock->nr_obs = 0;
+	}
+	
+	if (dev_us > clock->dev_last_us)
+		clock->dev_last_us = dev_us;
+	
+	/* Nothing is captured after it arrives */
+	if (clock->valid)
+		result = min(canon_r5_clock_map_locked(clock, dev_us), host);
+	
+	spin_unlock_irqrestore(&clock->lock, flags);
+	
+	return ns_to_ktime(result);
+}
+EXPORT_SYMBOL_GPL(canon_r5_clock_stamp);
+
+/* Convert a camera time without recording an observation */
+int canon_r5_clock_to_host(struct canon_r5_device *dev, u64 dev_us, ktime_t *host)
+{
+	struct canon_r5_clock *clock = &dev->clock;
+	unsigned long flags;
+	int ret = -EAGAIN;
+	
+	spin_lock_irqsave(&clock->lock, flags);
+	if (clock->valid) {
+		*host = ns_to_ktime(canon_r5_clock_map_locked(clock, dev_us));
+		ret = 0;
+	}
+	spin_unlock_irqrestore(&clock->lock, flags);
+	
+	return ret;
+}
+EXPORT_SYMBOL_GPL(canon_r5_clock_to_host);
+
+/* Widen a 32-bit camera stamp around the newest time seen on any stream */
+u64 canon_r5_clock_extend(struct canon_r5_device *dev, u32 stamp)
+{
+	struct canon_r5_clock *clock = &dev->clock;
+	unsigned long flags;
+	u64 last;
+	
+	spin_lock_irqsave(&clock->lock, flags);
+	last = clock->dev_last_us;
+	spin_unlock_irqrestore(&clock->lock, flags);
+	
+	if (!last)
+		return stamp;
+	
+	return last + (s32)(stamp - (u32)last);
+}
+EXPORT_SYMBOL_GPL(canon_r5_clock_extend);
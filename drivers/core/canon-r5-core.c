@@ -35,11 +35,33 @@ static void canon_r5_device_release(struct kref *kref)
 	
 	canon_r5_dbg(dev, "Releasing device");
 	
-	if (dev->ptp.event_wq)
-		destroy_workqueue(dev->ptp.event_wq);
+	if (dev->ptp.event_wq) {
+		cancel_work_sync(&dev->ptp.event_work);
+		canon_r5_workqueue_put(dev, dev->ptp.event_wq);
+	}
+	
+	if (dev->props.wq) {
+		cancel_work_sync(&dev->props.refresh_work);
+		cancel_delayed_work_sync(&dev->props.write_work);
+		canon_r5_workqueue_put(dev, dev->props.wq);
+	}
 	
+	canon_r5_stats_free(dev);
 	idr_destroy(&dev->transaction_idr);
 	
+	/* device_cleanup() unlinked it; a device that never got there is unlinked here */
+	if (dev->dev) {
+		if (device_is_registered(dev->dev))
+			device_del(dev->dev);
+		put_device(dev->dev);
+	}
+	canon_r5_workers_free(dev);
+	if (dev->id >= 0) {
+		mutex_lock(&canon_r5_device_lock);
+		idr_remove(&canon_r5_device_idr, dev->id);
+		mutex_unlock(&canon_r5_device_lock);
+	}
+	
 	kfree(dev->serial_number);
 	kfree(dev->firmware_version);
 	kfree(dev);
@@ -61,7 +83,7 @@ EXPORT_SYMBOL_GPL(canon_r5_device_put);
 struct canon_r5_device *canon_r5_device_alloc(struct device *parent)
 {
 	struct canon_r5_device *dev;
-	int id;
+	int id, i;
 	
 	dev = kzalloc(sizeof(*dev), GFP_KERNEL);
 	if (!dev)
@@ -73,11 +95,18 @@ struct canon_r5_device *canon_r5_device_alloc(struct device *parent)
 	spin_lock_init(&dev->transaction_lock);
 	
 	idr_init(&dev->transaction_idr);
+	for (i = 0; i < CANON_R5_PTP_CLASSES; i++)
+		INIT_LIST_HEAD(&dev->ptp.tx_queue[i]);
+	init_waitqueue_head(&dev->ptp.rx_wait);
+	canon_r5_props_init(dev);
+	canon_r5_clock_init(dev);
+	canon_r5_bringup_init(dev);
 	
 	dev->state = CANON_R5_STATE_DISCONNECTED;
 	dev->ptp.session_id = 0;
 	dev->ptp.transaction_id = 1;
 	dev->ptp.session_open = false;
+	dev->id = -1;
 	
 	mutex_lock(&canon_r5_device_lock);
 	id = idr_alloc(&canon_r5_device_idr, dev, 0, 0, GFP_KERNEL);
@@ -87,17 +116,24 @@ struct canon_r5_device *canon_r5_device_alloc(struct device *parent)
 		canon_r5_device_put(dev);
 		return NULL;
 	}
+	dev->id = id;
 	
-	dev->dev = device_create(canon_r5_class, parent, MKDEV(0, 0), dev,
-				"canon-r5-%d", id);
+	dev->dev = device_create_with_groups(canon_r5_class, parent, MKDEV(0, 0), dev,
+					     canon_r5_props_groups, "canon-r5-%d", id);
 	if (IS_ERR(dev->dev)) {
-		mutex_lock(&canon_r5_device_lock);
-		idr_remove(&canon_r5_device_idr, id);
-		mutex_unlock(&canon_r5_device_lock);
+		dev->dev = NULL;
+		canon_r5_device_put(dev);
+		return NULL;
+	}
+	dev->sysfs_kobj = &dev->dev->kobj;
+	
+	if (canon_r5_workers_init(dev)) {
 		canon_r5_device_put(dev);
 		return NULL;
 	}
 	
+	canon_r5_stats_init(dev);
+	
 	canon_r5_info(dev, "Canon R5 device allocated (id=%d)", id);
 	
 	return dev;
@@ -114,8 +150,8 @@ int canon_r5_device_initialize(struct canon_r5_device *dev)
 	canon_r5_info(dev, "Initializing Canon R5 device");
 	
 	/* Create event workqueue */
-	dev->ptp.event_wq = alloc_workqueue("canon-r5-events",
-					   WQ_MEM_RECLAIM | WQ_UNBOUND, 1);
+	dev->ptp.event_wq = canon_r5_workqueue_get(dev, CANON_R5_WORK_IO, "canon-r5-events",
+						   WQ_MEM_RECLAIM | WQ_UNBOUND, 1);
 	if (!dev->ptp.event_wq) {
 		canon_r5_err(dev, "Failed to create event workqueue");
 		return -ENOMEM;
@@ -123,6 +159,15 @@ int canon_r5_device_initialize(struct canon_r5_device *dev)
 	
 	INIT_WORK(&dev->ptp.event_work, canon_r5_ptp_event_handler);
 	
+	/* Property refresh and write flushes, kept off the shared system queue */
+	dev->props.wq = canon_r5_workqueue_get(dev, CANON_R5_WORK_IO, "canon-r5-props",
+					       WQ_MEM_RECLAIM | WQ_UNBOUND, 1);
+	if (!dev->props.wq) {
+		canon_r5_err(dev, "Failed to create property workqueue");
+		ret = -ENOMEM;
+		goto error_props;
+	}
+	
 	/* Initialize PTP layer */
 	ret = canon_r5_ptp_init(dev);
 	if (ret) {
@@ -136,7 +181,10 @@ int canon_r5_device_initialize(struct canon_r5_device *dev)
 	return 0;
 	
 error_ptp:
-	destroy_workqueue(dev->ptp.event_wq);
+	canon_r5_workqueue_put(dev, dev->props.wq);
+	dev->props.wq = NULL;
+error_props:
+	canon_r5_workqueue_put(dev, dev->ptp.event_wq);
 	dev->ptp.event_wq = NULL;
 	return ret;
 }
@@ -149,6 +197,9 @@ void canon_r5_device_cleanup(struct canon_r5_device *dev)
 	
 	canon_r5_info(dev, "Cleaning up Canon R5 device");
 	
+	/* Finish or undo whatever bring-up got to */
+	canon_r5_bringup_stop(dev);
+	
 	/* Unregister all driver modules */
 	canon_r5_unregister_video_driver(dev);
 	canon_r5_unregister_still_driver(dev);
@@ -170,9 +221,43 @@ void canon_r5_device_cleanup(struct canon_r5_device *dev)
 	}
 	
 	canon_r5_set_state(dev, CANON_R5_STATE_DISCONNECTED);
+	
+	/*
+	 * Hand the name to the next body that is plugged in. The last
+	 * reference may be dropped anywhere, so only the put is left for
+	 * the release.
+	 */
+	if (dev->dev && device_is_registered(dev->dev))
+		device_del(dev->dev);
 }
 EXPORT_SYMBOL_GPL(canon_r5_device_cleanup);
 
+/* Call fn on every live device; fn may sleep and drop references */
+void canon_r5_for_each_device(void (*fn)(struct canon_r5_device *dev, void *data), void *data)
+{
+	struct canon_r5_device *dev;
+	int id = 0;
+	
+	for (;;) {
+		mutex_lock(&canon_r5_device_lock);
+		dev = idr_get_next(&canon_r5_device_idr, &id);
+		/* Skip a device whose last reference is being dropped */
+		while (dev && !kref_get_unless_zero(&dev->kref)) {
+			id++;
+			dev = idr_get_next(&canon_r5_device_idr, &id);
+		}
+		mutex_unlock(&canon_r5_device_lock);
+		
+		if (!dev)
+			break;
+		
+		fn(dev, data);
+		canon_r5_device_put(dev);
+		id++;
+	}
+}
+EXPORT_SYMBOL_GPL(canon_r5_for_each_device);
+
 /* Transport layer management */
 int canon_r5_register_transport(struct canon_r5_device *dev, struct canon_r5_transport_ops *ops)
 {
@@ -253,7 +338,7 @@ void canon_r5_notify_event(struct canon_r5_device *dev, int event_type, void *da
 	
 	/* Trigger event processing workqueue */
 	if (dev->ptp.event_wq)
-		queue_work(dev->ptp.event_wq, &dev->ptp.event_work);
+		canon_r5_queue_work(dev, dev->ptp.event_wq, &dev->ptp.event_work);
 }
 EXPORT_SYMBOL_GPL(canon_r5_notify_event);
 
@@ -505,6 +590,23 @@ int canon_r5_core_init(void)
 	
 	canon_r5_class->class_groups = canon_r5_class_groups;
 	
+	ret = canon_r5_bringup_module_init();
+	if (ret) {
+		pr_err("Failed to create bring-up workqueue: %d\n", ret);
+		class_destroy(canon_r5_class);
+		return ret;
+	}
+	
+	ret = canon_r5_workers_module_init();
+	if (ret) {
+		pr_err("Failed to create shared workqueues: %d\n", ret);
+		canon_r5_bringup_module_exit();
+		class_destroy(canon_r5_class);
+		return ret;
+	}
+	
+	canon_r5_stats_module_init();
+	
 	pr_info("Canon R5 Driver Suite - Core Module Loaded\n");
 	return 0;
 }
@@ -514,6 +616,9 @@ void canon_r5_core_exit(void)
 {
 	pr_info("Canon R5 Driver Suite - Core Module Unloading\n");
 	
+	canon_r5_stats_module_exit();
+	canon_r5_workers_module_exit();
+	canon_r5_bringup_module_exit();
 	class_destroy(canon_r5_class);
 	
 	pr_info("Canon R5 Driver Suite - Core Module Unloaded\n");
@@ -0,0 +1,560 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Canon R5 Linux Driver Suite
+ * Device property cache
+ *
+ * Copyright (C) 2025 Canon R5 Driver Project
+ */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/workqueue.h>
+#include <linux/device.h>
+#include <linux/sysfs.h>
+#include <linux/mutex.h>
+
+#include "../../include/core/canon-r5.h"
+#include "../../include/core/canon-r5-ptp.h"
+
+/* GET/SET_PROPERTY transactions kept in flight while filling or flushing */
+#define CANON_R5_PROPS_PREFETCH_DEPTH	8
+
+static unsigned int prop_write_window_us = 2000;
+module_param(prop_write_window_us, uint, 0644);
+MODULE_PARM_DESC(prop_write_window_us, "Window for combining property writes outside begin/commit (us, default 2000)");
+
+struct canon_r5_props_fetch {
+	struct canon_r5_ptp_transaction trans;
+	u16			code;
+	u32			generation;
+	u8			value[CANON_R5_PROP_VALUE_MAX];
+	size_t			len;
+};
+
+static void canon_r5_props_write_work(struct work_struct *work);
+
+/* Map a property code to its cache slot, or -1 if it is not tracked */
+static int canon_r5_props_slot(u16 code)
+{
+	if (code >= PTP_DPC_BATTERY_LEVEL &&
+	    code < PTP_DPC_BATTERY_LEVEL + CANON_R5_PROPS_PTP_COUNT)
+		return code - PTP_DPC_BATTERY_LEVEL;
+	
+	if (code >= CANON_PTP_DPC_BEEP &&
+	    code < CANON_PTP_DPC_BEEP + CANON_R5_PROPS_CANON_COUNT)
+		return CANON_R5_PROPS_PTP_COUNT + code - CANON_PTP_DPC_BEEP;
+	
+	return -1;
+}
+
+static u16 canon_r5_props_code(int slot)
+{
+	if (slot < CANON_R5_PROPS_PTP_COUNT)
+		return PTP_DPC_BATTERY_LEVEL + slot;
+	
+	return CANON_PTP_DPC_BEEP + slot - CANON_R5_PROPS_PTP_COUNT;
+}
+
+void canon_r5_props_init(struct canon_r5_device *dev)
+{
+	spin_lock_init(&dev->props.lock);
+	INIT_WORK(&dev->props.refresh_work, canon_r5_props_refresh_work);
+	INIT_DELAYED_WORK(&dev->props.write_work, canon_r5_props_write_work);
+	mutex_init(&dev->props.write_lock);
+	memset(dev->props.entries, 0, sizeof(dev->props.entries));
+	dev->props.nr_writes = 0;
+	dev->props.write_holds = 0;
+	dev->props.write_error = 0;
+	dev->props.enabled = false;
+}
+EXPORT_SYMBOL_GPL(canon_r5_props_init);
+
+/* Forget every value, e.g. when the session opens or closes */
+void canon_r5_props_invalidate(struct canon_r5_device *dev)
+{
+	unsigned long flags;
+	int i;
+	
+	spin_lock_irqsave(&dev->props.lock, flags);
+	for (i = 0; i < CANON_R5_PROPS_COUNT; i++) {
+		dev->props.entries[i].state = CANON_R5_PROP_UNKNOWN;
+		dev->props.entries[i].generation++;
+	}
+	spin_unlock_irqrestore(&dev->props.lock, flags);
+}
+EXPORT_SYMBOL_GPL(canon_r5_props_invalidate);
+
+/*
+ * Copy a cached value into the caller's buffer, zero-extended.
+ * Returns -ENOENT on a miss and -EOPNOTSUPP for uncached properties.
+ */
+int canon_r5_props_lookup(struct canon_r5_device *dev, u16 code,
+			  void *value, size_t value_size)
+{
+	struct canon_r5_prop *prop;
+	unsigned long flags;
+	int slot, ret;
+	
+	slot = canon_r5_props_slot(code);
+	if (slot < 0)
+		return -EOPNOTSUPP;
+	
+	prop = &dev->props.entries[slot];
+	
+	spin_lock_irqsave(&dev->props.lock, flags);
+	switch (prop->state) {
+	case CANON_R5_PROP_VALID:
+		memset(value, 0, value_size);
+		memcpy(value, prop->value, min_t(size_t, prop->len, value_size));
+		ret = 0;
+		break;
+	case CANON_R5_PROP_UNCACHED:
+		ret = -EOPNOTSUPP;
+		break;
+	default:
+		ret = -ENOENT;
+		break;
+	}
+	spin_unlock_irqrestore(&dev->props.lock, flags);
+	
+	return ret;
+}
+EXPORT_SYMBOL_GPL(canon_r5_props_lookup);
+
+/* Store a value read at @generation unless a change event has overtaken it */
+static void canon_r5_props_store_gen(struct canon_r5_device *dev, int slot, u32 generation,
+				     const void *value, size_t len)
+{
+	struct canon_r5_prop *prop = &dev->props.entries[slot];
+	unsigned long flags;
+	
+	spin_lock_irqsave(&dev->props.lock, flags);
+	if (prop->generation == generation) {
+		if (!value || len > CANON_R5_PROP_VALUE_MAX) {
+			/* Unsupported or too wide: always ask the camera */
+			prop->state = CANON_R5_PROP_UNCACHED;
+		} else {
+			memcpy(prop->value, value, len);
+			prop->len = len;
+			prop->state = CANON_R5_PROP_VALID;
+		}
+	}
+	spin_unlock_irqrestore(&dev->props.lock, flags);
+}
+
+/* Record a value the driver itself just wrote or read */
+void canon_r5_props_store(struct canon_r5_device *dev, u16 code,
+			  const void *value, size_t len)
+{
+	int slot = canon_r5_props_slot(code);
+	
+	if (slot < 0)
+		return;
+	
+	canon_r5_props_store_gen(dev, slot, READ_ONCE(dev->props.entries[slot].generation),
+				 value, len);
+}
+EXPORT_SYMBOL_GPL(canon_r5_props_store);
+
+/* DEVICE_PROP_CHANGED: mark the value stale and refetch it in the background */
+void canon_r5_props_changed(struct canon_r5_device *dev, u16 code)
+{
+	struct canon_r5_prop *prop;
+	unsigned long flags;
+	int slot;
+	
+	slot = canon_r5_props_slot(code);
+	if (slot < 0)
+		return;
+	
+	prop = &dev->props.entries[slot];
+	
+	spin_lock_irqsave(&dev->props.lock, flags);
+	prop->generation++;
+	if (prop->state != CANON_R5_PROP_UNCACHED)
+		prop->state = CANON_R5_PROP_STALE;
+	spin_unlock_irqrestore(&dev->props.lock, flags);
+	
+	if (READ_ONCE(dev->props.enabled))
+		canon_r5_queue_work(dev, dev->props.wq, &dev->props.refresh_work);
+}
+EXPORT_SYMBOL_GPL(canon_r5_props_changed);
+
+static void canon_r5_props_fetch_init(struct canon_r5_device *dev,
+				      struct canon_r5_props_fetch *fetch, int slot)
+{
+	u32 param;
+	
+	fetch->code = canon_r5_props_code(slot);
+	fetch->generation = READ_ONCE(dev->props.entries[slot].generation);
+	param = fetch->code;
+	
+	canon_r5_ptp_transaction_init(&fetch->trans, CANON_PTP_OP_GET_PROPERTY, &param, 1);
+	fetch->trans.data_in = fetch->value;
+	fetch->trans.data_in_len = sizeof(fetch->value);
+}
+
+/* Apply one completed fetch to the cache */
+static int canon_r5_props_fetch_done(struct canon_r5_device *dev,
+				     struct canon_r5_props_fetch *fetch, int status)
+{
+	int slot = canon_r5_props_slot(fetch->code);
+	
+	if (status)
+		return status;
+	
+	switch (fetch->trans.response_code) {
+	case PTP_RC_OK:
+		break;
+	case PTP_RC_DEVICE_PROP_NOT_SUPPORTED:
+	case PTP_RC_OPERATION_NOT_SUPPORTED:
+		/* Ask once per session, not on every poll */
+		canon_r5_props_store_gen(dev, slot, fetch->generation, NULL, 0);
+		return -EOPNOTSUPP;
+	default:
+		return -EIO;
+	}
+	
+	canon_r5_props_store_gen(dev, slot, fetch->generation, fetch->value,
+				 max(fetch->trans.data_in_length, fetch->trans.data_in_actual));
+	return 0;
+}
+
+/*
+ * Refetch every property that is unknown or stale, keeping up to
+ * CANON_R5_PROPS_PREFETCH_DEPTH transactions in flight so the whole
+ * table costs a handful of bus turnarounds rather than one per code.
+ */
+int canon_r5_props_prefetch(struct canon_r5_device *dev)
+{
+	struct canon_r5_props_fetch *fetch;
+	unsigned int count, i;
+	int slot = 0, ret = 0, err;
+	u8 state;
+	
+	fetch = kcalloc(CANON_R5_PROPS_PREFETCH_DEPTH, sizeof(*fetch), GFP_KERNEL);
+	if (!fetch)
+		return -ENOMEM;
+	
+	while (slot < CANON_R5_PROPS_COUNT && !ret) {
+		/* Submit a window of outstanding lookups */
+		for (count = 0; slot < CANON_R5_PROPS_COUNT &&
+		     count < CANON_R5_PROPS_PREFETCH_DEPTH; slot++) {
+			state = READ_ONCE(dev->props.entries[slot].state);
+			if (state == CANON_R5_PROP_VALID || state == CANON_R5_PROP_UNCACHED)
+				continue;
+	
+			canon_r5_props_fetch_init(dev, &fetch[count], slot);
+			ret = canon_r5_ptp_submit(dev, &fetch[count].trans);
+			if (ret)
+				break;
+			count++;
+		}
+	
+		/* Collect them in order, even after a failed submit */
+		for (i = 0; i < count; i++) {
+			err = canon_r5_ptp_wait(dev, &fetch[i].trans, CANON_R5_PTP_TIMEOUT_MS);
+			err = canon_r5_props_fetch_done(dev, &fetch[i], err);
+			if (err && err != -EOPNOTSUPP && !ret)
+				ret = err;
+		}
+	}
+	
+	kfree(fetch);
+	return ret;
+}
+EXPORT_SYMBOL_GPL(canon_r5_props_prefetch);
+
+void canon_r5_props_refresh_work(struct work_struct *work)
+{
+	struct canon_r5_device *dev = container_of(work, struct canon_r5_device, props.refresh_work);
+	int ret;
+	
+	if (!READ_ONCE(dev->props.enabled))
+		return;
+	
+	ret = canon_r5_props_prefetch(dev);
+	if (ret)
+		canon_r5_dbg(dev, "Property refresh failed: %d", ret);
+}
+EXPORT_SYMBOL_GPL(canon_r5_props_refresh_work);
+
+/* Read a property from the cache, fetching it from the camera on a miss */
+int canon_r5_props_get(struct canon_r5_device *dev, u16 code, void *value, size_t value_size)
+{
+	struct canon_r5_props_fetch *fetch;
+	int slot, ret;
+	
+	ret = canon_r5_props_lookup(dev, code, value, value_size);
+	if (ret != -ENOENT)
+		return ret;
+	
+	slot = canon_r5_props_slot(code);
+	
+	fetch = kzalloc(sizeof(*fetch), GFP_KERNEL);
+	if (!fetch)
+		return -ENOMEM;
+	
+	canon_r5_props_fetch_init(dev, fetch, slot);
+	ret = canon_r5_ptp_transact(dev, &fetch->trans);
+	ret = canon_r5_props_fetch_done(dev, fetch, ret);
+	if (!ret) {
+		memset(value, 0, value_size);
+		memcpy(value, fetch->value,
+		       min3(value_size, fetch->trans.data_in_actual, sizeof(fetch->value)));
+	}
+	
+	kfree(fetch);
+	return ret;
+}
+EXPORT_SYMBOL_GPL(canon_r5_props_get);
+
+/*
+ * Session is open: start following change events and fill the cache in
+ * bulk from refresh_work, so the caller need not wait for the prefetch.
+ * Reads that miss in the meantime go to the camera as before.
+ */
+void canon_r5_props_start(struct canon_r5_device *dev)
+{
+	canon_r5_props_invalidate(dev);
+	WRITE_ONCE(dev->props.enabled, true);
+	canon_r5_queue_work(dev, dev->props.wq, &dev->props.refresh_work);
+}
+EXPORT_SYMBOL_GPL(canon_r5_props_start);
+
+static void canon_r5_props_drop_writes(struct canon_r5_device *dev)
+{
+	unsigned long flags;
+	unsigned int i;
+	
+	spin_lock_irqsave(&dev->props.lock, flags);
+	for (i = 0; i < dev->props.nr_writes; i++)
+		dev->props.entries[dev->props.write_order[i]].write_pending = false;
+	dev->props.nr_writes = 0;
+	spin_unlock_irqrestore(&dev->props.lock, flags);
+}
+
+void canon_r5_props_stop(struct canon_r5_device *dev)
+{
+	WRITE_ONCE(dev->props.enabled, false);
+	cancel_work_sync(&dev->props.refresh_work);
+	cancel_delayed_work_sync(&dev->props.write_work);
+	canon_r5_props_drop_writes(dev);
+	canon_r5_props_invalidate(dev);
+}
+EXPORT_SYMBOL_GPL(canon_r5_props_stop);
+
+/*
+ * Queue a SET_PROPERTY. A later write to the same code replaces the queued
+ * value but keeps its place. Outside a begin/commit bracket the queue is
+ * flushed prop_write_window_us after the first write; untracked or wide
+ * properties are written immediately.
+ */
+int canon_r5_props_write(struct canon_r5_device *dev, u16 code,
+			 const void *value, size_t len)
+{
+	struct canon_r5_prop *prop;
+	unsigned long flags;
+	bool arm;
+	int slot;
+	
+	if (!dev || !value)
+		return -EINVAL;
+	
+	slot = canon_r5_props_slot(code);
+	if (slot < 0 || len > CANON_R5_PROP_VALUE_MAX)
+		return canon_r5_ptp_set_property(dev, code, (void *)value, len);
+	
+	prop = &dev->props.entries[slot];
+	
+	spin_lock_irqsave(&dev->props.lock, flags);
+	if (!prop->write_pending) {
+		prop->write_pending = true;
+		dev->props.write_order[dev->props.nr_writes++] = slot;
+	}
+	memcpy(prop->write_value, value, len);
+	prop->write_len = len;
+	arm = !dev->props.write_holds;
+	spin_unlock_irqrestore(&dev->props.lock, flags);
+	
+	/* Without a queue the writes wait for the next commit */
+	if (arm && dev->props.wq)
+		canon_r5_queue_delayed_work(dev, dev->props.wq, &dev->props.write_work,
+					    usecs_to_jiffies(prop_write_window_us));
+	return 0;
+}
+EXPORT_SYMBOL_GPL(canon_r5_props_write);
+
+/* Hold queued writes until the matching commit */
+void canon_r5_props_write_begin(struct canon_r5_device *dev)
+{
+	unsigned long flags;
+	
+	spin_lock_irqsave(&dev->props.lock, flags);
+	dev->props.write_holds++;
+	spin_unlock_irqrestore(&dev->props.lock, flags);
+}
+EXPORT_SYMBOL_GPL(canon_r5_props_write_begin);
+
+/* Close a bracket; the outermost commit sends everything queued and waits */
+int canon_r5_props_write_commit(struct canon_r5_device *dev)
+{
+	unsigned long flags;
+	bool last;
+	
+	spin_lock_irqsave(&dev->props.lock, flags);
+	if (WARN_ON(!dev->props.write_holds)) {
+		spin_unlock_irqrestore(&dev->props.lock, flags);
+		return -EINVAL;
+	}
+	last = !--dev->props.write_holds;
+	spin_unlock_irqrestore(&dev->props.lock, flags);
+	
+	return last ? canon_r5_props_flush_writes(dev) : 0;
+}
+EXPORT_SYMBOL_GPL(canon_r5_props_write_commit);
+
+/* Take up to @max queued writes off the head of the queue */
+static unsigned int canon_r5_props_pop_writes(struct canon_r5_device *dev,
+					      struct canon_r5_props_fetch *batch,
+					      unsigned int max)
+{
+	struct canon_r5_props *props = &dev->props;
+	struct canon_r5_prop *prop;
+	unsigned long flags;
+	unsigned int count, i;
+	u32 param;
+	
+	spin_lock_irqsave(&props->lock, flags);
+	count = min(props->nr_writes, max);
+	for (i = 0; i < count; i++) {
+		prop = &props->entries[props->write_order[i]];
+		batch[i].code = canon_r5_props_code(props->write_order[i]);
+		batch[i].len = prop->write_len;
+		memcpy(batch[i].value, prop->write_value, prop->write_len);
+		prop->write_pending = false;
+	}
+	props->nr_writes -= count;
+	memmove(props->write_order, props->write_order + count, props->nr_writes);
+	spin_unlock_irqrestore(&props->lock, flags);
+	
+	for (i = 0; i < count; i++) {
+		param = batch[i].code;
+		canon_r5_ptp_transaction_init(&batch[i].trans, CANON_PTP_OP_SET_PROPERTY, &param, 1);
+		batch[i].trans.data_out = batch[i].value;
+		batch[i].trans.data_out_len = batch[i].len;
+	}
+	
+	return count;
+}
+
+/*
+ * Send every queued write back to back, CANON_R5_PROPS_PREFETCH_DEPTH at a
+ * time, then wait for the responses. Returns the first failure, including
+ * one left over from an earlier windowed flush.
+ */
+int canon_r5_props_flush_writes(struct canon_r5_device *dev)
+{
+	struct canon_r5_props_fetch *batch;
+	unsigned int count, submitted, i;
+	int ret, err;
+	
+	batch = kcalloc(CANON_R5_PROPS_PREFETCH_DEPTH, sizeof(*batch), GFP_KERNEL);
+	if (!batch)
+		return -ENOMEM;
+	
+	mutex_lock(&dev->props.write_lock);
+	ret = xchg(&dev->props.write_error, 0);
+	
+	while ((count = canon_r5_props_pop_writes(dev, batch, CANON_R5_PROPS_PREFETCH_DEPTH))) {
+		for (submitted = 0; submitted < count; submitted++) {
+			err = canon_r5_ptp_submit(dev, &batch[submitted].trans);
+			if (err) {
+				if (!ret)
+					ret = err;
+				break;
+			}
+		}
+		
+		for (i = 0; i < submitted; i++) {
+			err = canon_r5_ptp_wait(dev, &batch[i].trans, CANON_R5_PTP_TIMEOUT_MS);
+			if (!err && batch[i].trans.response_code != PTP_RC_OK)
+				err = -EIO;
+			if (err) {
+				canon_r5_warn(dev, "Failed to set property 0x%04x: %d",
+					      batch[i].code, err);
+				if (!ret)
+					ret = err;
+				continue;
+			}
+			canon_r5_props_store(dev, batch[i].code, batch[i].value, batch[i].len);
+		}
+	}
+	
+	mutex_unlock(&dev->props.write_lock);
+	kfree(batch);
+	return ret;
+}
+EXPORT_SYMBOL_GPL(canon_r5_props_flush_writes);
+
+static void canon_r5_props_write_work(struct work_struct *work)
+{
+	struct canon_r5_device *dev = container_of(to_delayed_work(work), struct canon_r5_device,
+						   props.write_work);
+	int ret;
+	
+	/* A bracket opened since the first write; its commit flushes */
+	if (READ_ONCE(dev->props.write_holds))
+		return;
+	
+	ret = canon_r5_props_flush_writes(dev);
+	if (ret)
+		cmpxchg(&dev->props.write_error, 0, ret);
+}
+
+/* Sysfs: frequently polled values, served from the cache */
+static ssize_t canon_r5_props_show(struct device *device, char *buf, u16 code)
+{
+	struct canon_r5_device *dev = dev_get_drvdata(device);
+	u32 value;
+	int ret;
+	
+	ret = canon_r5_props_get(dev, code, &value, sizeof(value));
+	if (ret)
+		return ret;
+	
+	return sysfs_emit(buf, "%u\n", value);
+}
+
+#define CANON_R5_PROP_ATTR(_name, _code)					\
+static ssize_t _name##_show(struct device *device,				\
+			    struct device_attribute *attr, char *buf)		\
+{										\
+	return canon_r5_props_show(device, buf, _code);				\
+}										\
+static DEVICE_ATTR_RO(_name)
+
+CANON_R5_PROP_ATTR(battery_level, PTP_DPC_BATTERY_LEVEL);
+CANON_R5_PROP_ATTR(iso, PTP_DPC_EXPOSURE_INDEX);
+CANON_R5_PROP_ATTR(f_number, PTP_DPC_F_NUMBER);
+CANON_R5_PROP_ATTR(exposure_time, PTP_DPC_EXPOSURE_TIME);
+
+static struct attribute *canon_r5_props_attrs[] = {
+	&dev_attr_battery_level.attr,
+	&dev_attr_iso.attr,
+	&dev_attr_f_number.attr,
+	&dev_attr_exposure_time.attr,
+	NULL,
+};
+
+static const struct attribute_group canon_r5_props_group = {
+	.name = "properties",
+	.attrs = canon_r5_props_attrs,
+};
+
+const struct attribute_group *canon_r5_props_groups[] = {
+	&canon_r5_props_group,
+	NULL,
+};
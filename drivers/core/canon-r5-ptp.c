@@ -9,12 +9,19 @@
 #include <linux/kernel.h>
 #include <linux/module.h>
 #include <linux/slab.h>
+#include <linux/mm.h>
 #include <linux/mutex.h>
 #include <linux/workqueue.h>
+#include <linux/completion.h>
+#include <linux/idr.h>
+#include <linux/wait.h>
+#include <linux/jiffies.h>
+#include <linux/math64.h>
 #include <linux/byteorder/little_endian.h>
 
 #include "../../include/core/canon-r5.h"
 #include "../../include/core/canon-r5-ptp.h"
+#include "../../include/core/canon-r5-trace.h"
 
 MODULE_AUTHOR("Canon R5 Driver Project");
 MODULE_DESCRIPTION("Canon R5 Camera Driver Suite - PTP Protocol");
@@ -53,107 +60,1023 @@ static void build_ptp_container(struct ptp_container *container, u16 type, u16 c
 	}
 }
 
-/* Send PTP command and receive response */
-int canon_r5_ptp_command(struct canon_r5_device *dev, u16 code, 
-			 u32 *params, int param_count,
-			 void *data, int data_len,
-			 u16 *response_code)
+/* Transaction engine */
+
+#define CANON_R5_PTP_MAX_TRANS_ID	0x7FFFFFFF
+#define CANON_R5_PTP_RX_ALIGN		1024
+
+/* Back-to-back receive errors after which the pipe is treated as gone */
+#define CANON_R5_PTP_RX_MAX_ERRORS	3
+
+/*
+ * Stands in the idr for a cancelled in-flight transaction whose data and
+ * response the camera has yet to send; its window slot stays claimed until
+ * they drain or CANON_R5_PTP_TIMEOUT_MS passes without them.
+ */
+static unsigned long canon_r5_ptp_drain_marker;
+#define CANON_R5_PTP_DRAINING	((struct canon_r5_ptp_transaction *)&canon_r5_ptp_drain_marker)
+
+/* PTP allows one transaction per session; pipelining is an explicit opt-in */
+static unsigned int max_inflight = 1;
+module_param(max_inflight, uint, 0644);
+MODULE_PARM_DESC(max_inflight, "Maximum PTP transactions in flight (default: 1 = strictly sequential, >1 pipelines commands on cameras that accept it)");
+
+static unsigned int realtime_share = 50;
+module_param(realtime_share, uint, 0644);
+MODULE_PARM_DESC(realtime_share, "Percent of the link reserved for live view and audio while bulk transfers run (1-99, default: 50)");
+
+static unsigned int canon_r5_ptp_window(void)
 {
-	struct ptp_container cmd, resp;
-	size_t resp_len;
-	u32 trans_id;
-	int ret;
+	return clamp_t(unsigned int, READ_ONCE(max_inflight), 1, CANON_R5_PTP_MAX_INFLIGHT);
+}
+
+/* Default traffic class of an opcode; callers may override it before submitting */
+static u8 canon_r5_ptp_classify(u16 code)
+{
+	switch (code) {
+	case CANON_PTP_OP_GET_LIVEVIEW:
+		return CANON_R5_PTP_CLASS_REALTIME;
+	case PTP_OP_GET_NUM_OBJECTS:
+	case PTP_OP_GET_OBJECT_HANDLES:
+	case PTP_OP_GET_OBJECT_INFO:
+	case PTP_OP_GET_OBJECT:
+	case CANON_PTP_OP_GET_FOLDER_INFO:
+	case CANON_PTP_OP_GET_PARTIAL_OBJECT:
+	case PTP_OP_SEND_OBJECT:
+		return CANON_R5_PTP_CLASS_BULK;
+	/* Shared with the 64-bit object ops, whose callers ask for bulk themselves */
+	case CANON_PTP_OP_AUDIO_START:
+	case CANON_PTP_OP_AUDIO_STOP:
+	case CANON_PTP_OP_AUDIO_SET_INPUT:
+	case CANON_PTP_OP_AUDIO_SET_GAIN:
+	case CANON_PTP_OP_AUDIO_LEVELS:
+		return CANON_R5_PTP_CLASS_CONTROL;
+	default:
+		return CANON_R5_PTP_CLASS_CONTROL;
+	}
+}
+
+/*
+ * Real-time and bulk share the link by bytes moved: each class advances
+ * its virtual time by bytes / share as its transactions retire, and the
+ * one further behind goes next. Needs transaction_lock.
+ */
+static void canon_r5_ptp_charge_locked(struct canon_r5_device *dev,
+				       const struct canon_r5_ptp_transaction *trans)
+{
+	unsigned int share = clamp_t(unsigned int, READ_ONCE(realtime_share), 1, 99);
+	u64 bytes = 2 * PTP_CONTAINER_HEADER_SIZE + trans->data_in_actual + trans->data_out_len;
 	
-	if (!dev || !response_code)
+	if (trans->traffic_class == CANON_R5_PTP_CLASS_BULK)
+		share = 100 - share;
+	
+	dev->ptp.class_vtime[trans->traffic_class] += div_u64(bytes * 100, share);
+}
+
+/* Next transaction to send, or NULL if none may go yet. Needs transaction_lock */
+static struct canon_r5_ptp_transaction *canon_r5_ptp_next_locked(struct canon_r5_device *dev)
+{
+	struct list_head *queue = dev->ptp.tx_queue;
+	unsigned int window = canon_r5_ptp_window();
+	bool bulk;
+	
+	if (dev->ptp.inflight >= window)
+		return NULL;
+	
+	if (!list_empty(&queue[CANON_R5_PTP_CLASS_CONTROL]))
+		return list_first_entry(&queue[CANON_R5_PTP_CLASS_CONTROL],
+					struct canon_r5_ptp_transaction, list);
+	
+	/*
+	 * Bulk leaves a window slot free, so a shutter press or live view
+	 * frame waits for at most one partial-object chunk.
+	 */
+	bulk = !list_empty(&queue[CANON_R5_PTP_CLASS_BULK]) &&
+	       dev->ptp.bulk_inflight < max(window - 1, 1U);
+	
+	if (!list_empty(&queue[CANON_R5_PTP_CLASS_REALTIME]) &&
+	    (!bulk || dev->ptp.class_vtime[CANON_R5_PTP_CLASS_REALTIME] <=
+		      dev->ptp.class_vtime[CANON_R5_PTP_CLASS_BULK]))
+		return list_first_entry(&queue[CANON_R5_PTP_CLASS_REALTIME],
+					struct canon_r5_ptp_transaction, list);
+	
+	if (bulk)
+		return list_first_entry(&queue[CANON_R5_PTP_CLASS_BULK],
+					struct canon_r5_ptp_transaction, list);
+	
+	return NULL;
+}
+
+static void canon_r5_ptp_kick_tx(struct canon_r5_device *dev)
+{
+	struct workqueue_struct *wq = READ_ONCE(dev->ptp.xfer_wq);
+	
+	if (wq)
+		canon_r5_queue_work(dev, wq, &dev->ptp.tx_work);
+}
+
+static void canon_r5_ptp_start_rx(struct canon_r5_device *dev)
+{
+	struct workqueue_struct *wq = READ_ONCE(dev->ptp.xfer_wq);
+	
+	/* The asynchronous stream is always listening */
+	if (dev->ptp.rx_async)
+		return;
+	
+	if (wq)
+		canon_r5_queue_work(dev, wq, &dev->ptp.rx_work);
+}
+
+void canon_r5_ptp_transaction_init(struct canon_r5_ptp_transaction *trans, u16 code,
+				   const u32 *params, int param_count)
+{
+	int i;
+	
+	memset(trans, 0, sizeof(*trans));
+	INIT_LIST_HEAD(&trans->list);
+	init_completion(&trans->done);
+	
+	trans->code = code;
+	trans->traffic_class = canon_r5_ptp_classify(code);
+	trans->param_count = clamp(param_count, 0, PTP_MAX_PARAMS);
+	for (i = 0; params && i < trans->param_count; i++)
+		trans->params[i] = params[i];
+}
+EXPORT_SYMBOL_GPL(canon_r5_ptp_transaction_init);
+
+/* Retire a transaction; returns true if the caller must deliver it. Needs transaction_lock */
+static bool canon_r5_ptp_finish_locked(struct canon_r5_device *dev,
+				       struct canon_r5_ptp_transaction *trans, int status)
+{
+	bool sent = trans->state == CANON_R5_PTP_TRANS_INFLIGHT;
+	u64 us;
+	
+	switch (trans->state) {
+	case CANON_R5_PTP_TRANS_QUEUED:
+		list_del_init(&trans->list);
+		break;
+	case CANON_R5_PTP_TRANS_INFLIGHT:
+		idr_remove(&dev->transaction_idr, trans->trans_id);
+		dev->ptp.inflight--;
+		if (trans->traffic_class == CANON_R5_PTP_CLASS_BULK)
+			dev->ptp.bulk_inflight--;
+		if (trans->traffic_class != CANON_R5_PTP_CLASS_CONTROL)
+			canon_r5_ptp_charge_locked(dev, trans);
+		if (dev->ptp.rx_trans == trans)
+			dev->ptp.rx_trans = NULL;
+		break;
+	default:
+		return false;
+	}
+	
+	trans->state = CANON_R5_PTP_TRANS_DONE;
+	trans->status = status;
+	
+	us = ktime_us_delta(ktime_get(), trans->submitted);
+	trace_canon_r5_ptp_response(dev->dev, trans->code, trans->trans_id, trans->response_code,
+				    status, trans->data_in_actual, us);
+	canon_r5_stats_record(dev, trans, us, sent);
+	
+	/* Someone is still touching the buffers, let them deliver on unpin */
+	if (trans->pins) {
+		trans->notify_pending = true;
+		return false;
+	}
+	
+	return true;
+}
+
+/* Hand a finished transaction back to its owner; called without transaction_lock */
+static void canon_r5_ptp_deliver(struct canon_r5_device *dev,
+				 struct canon_r5_ptp_transaction *trans)
+{
+	if (trans->complete)
+		trans->complete(dev, trans);
+	else
+		complete(&trans->done);
+}
+
+static void canon_r5_ptp_unpin(struct canon_r5_device *dev,
+			       struct canon_r5_ptp_transaction *trans)
+{
+	unsigned long flags;
+	bool deliver = false;
+	
+	spin_lock_irqsave(&dev->transaction_lock, flags);
+	if (!--trans->pins && trans->notify_pending) {
+		trans->notify_pending = false;
+		deliver = true;
+	}
+	spin_unlock_irqrestore(&dev->transaction_lock, flags);
+	
+	wake_up(&dev->ptp.rx_wait);
+	
+	if (deliver)
+		canon_r5_ptp_deliver(dev, trans);
+}
+
+static bool canon_r5_ptp_unpinned(struct canon_r5_device *dev,
+				  struct canon_r5_ptp_transaction *trans)
+{
+	unsigned long flags;
+	bool unpinned;
+	
+	spin_lock_irqsave(&dev->transaction_lock, flags);
+	unpinned = !trans->pins;
+	spin_unlock_irqrestore(&dev->transaction_lock, flags);
+	
+	return unpinned;
+}
+
+/*
+ * Finish an in-flight transaction early and park its id until the camera's
+ * response drains, so the next command does not go out ahead of it.
+ * Returns true if the caller must deliver it. Needs transaction_lock.
+ */
+static bool canon_r5_ptp_abandon_locked(struct canon_r5_device *dev,
+					struct canon_r5_ptp_transaction *trans, int error)
+{
+	bool deliver;
+	int id;
+	
+	deliver = canon_r5_ptp_finish_locked(dev, trans, error);
+	
+	id = idr_alloc(&dev->transaction_idr, CANON_R5_PTP_DRAINING, trans->trans_id,
+		       trans->trans_id + 1, GFP_ATOMIC);
+	if (id >= 0) {
+		dev->ptp.inflight++;
+		dev->ptp.drain_deadline = ktime_add_ms(ktime_get(), CANON_R5_PTP_TIMEOUT_MS);
+	} else
+		canon_r5_warn(dev, "PTP transaction %u abandoned undrained: %d",
+			      trans->trans_id, id);
+	
+	return deliver;
+}
+
+static void canon_r5_ptp_deliver_list(struct canon_r5_device *dev, struct list_head *done)
+{
+	struct canon_r5_ptp_transaction *trans, *tmp;
+	
+	list_for_each_entry_safe(trans, tmp, done, list) {
+		list_del_init(&trans->list);
+		canon_r5_ptp_deliver(dev, trans);
+	}
+}
+
+/*
+ * Part of a container was lost: fail only the transaction whose data phase
+ * it belonged to and resynchronise the parser on the next container. The
+ * other transactions in flight are still answered by the camera.
+ */
+static void canon_r5_ptp_resync(struct canon_r5_device *dev, int error)
+{
+	struct canon_r5_ptp_transaction *trans;
+	unsigned long flags;
+	LIST_HEAD(done);
+	
+	spin_lock_irqsave(&dev->transaction_lock, flags);
+	
+	trans = dev->ptp.rx_remaining ? dev->ptp.rx_trans : NULL;
+	if (trans && canon_r5_ptp_abandon_locked(dev, trans, error))
+		list_add_tail(&trans->list, &done);
+	
+	dev->ptp.rx_trans = NULL;
+	dev->ptp.rx_offset = 0;
+	dev->ptp.rx_remaining = 0;
+	
+	spin_unlock_irqrestore(&dev->transaction_lock, flags);
+	
+	if (trans)
+		canon_r5_warn(dev, "PTP transaction %u lost its data phase: %d",
+			      trans->trans_id, error);
+	
+	canon_r5_ptp_deliver_list(dev, &done);
+	canon_r5_ptp_kick_tx(dev);
+}
+
+/*
+ * Time out, by trans_id, callback transactions the camera has not answered
+ * within CANON_R5_PTP_TIMEOUT_MS. Waited-for ones time out in
+ * canon_r5_ptp_wait() against the caller's own timeout. Abandoned ids whose
+ * response never came give their window slot back once the newest of them
+ * is past its deadline; a late answer is then dropped as unknown.
+ */
+static void canon_r5_ptp_expire(struct canon_r5_device *dev)
+{
+	struct canon_r5_ptp_transaction *trans;
+	ktime_t now = ktime_get();
+	unsigned long flags;
+	unsigned int drained = 0;
+	bool undrain;
+	LIST_HEAD(done);
+	int id;
+	
+	spin_lock_irqsave(&dev->transaction_lock, flags);
+	
+	undrain = ktime_after(now, dev->ptp.drain_deadline);
+	
+	idr_for_each_entry(&dev->transaction_idr, trans, id) {
+		if (trans == CANON_R5_PTP_DRAINING) {
+			if (undrain) {
+				idr_remove(&dev->transaction_idr, id);
+				dev->ptp.inflight--;
+				drained++;
+			}
+			continue;
+		}
+		if (!trans->complete || trans->pins ||
+		    ktime_ms_delta(now, trans->submitted) < CANON_R5_PTP_TIMEOUT_MS)
+			continue;
+		
+		canon_r5_warn(dev, "PTP command 0x%04x timed out (trans_id: %u)",
+			      trans->code, trans->trans_id);
+		if (canon_r5_ptp_abandon_locked(dev, trans, -ETIMEDOUT))
+			list_add_tail(&trans->list, &done);
+	}
+	
+	spin_unlock_irqrestore(&dev->transaction_lock, flags);
+	
+	if (drained) {
+		canon_r5_warn(dev, "Gave up draining %u abandoned PTP transaction(s)", drained);
+		canon_r5_ptp_kick_tx(dev);
+	}
+	
+	canon_r5_ptp_deliver_list(dev, &done);
+}
+
+/* Fail in-flight (and optionally queued) transactions, e.g. after a transport error */
+static void canon_r5_ptp_fail_all(struct canon_r5_device *dev, int error, bool queued)
+{
+	struct canon_r5_ptp_transaction *trans, *tmp;
+	unsigned long flags;
+	LIST_HEAD(done);
+	int id, i;
+	
+	spin_lock_irqsave(&dev->transaction_lock, flags);
+	
+	idr_for_each_entry(&dev->transaction_idr, trans, id) {
+		if (trans == CANON_R5_PTP_DRAINING) {
+			idr_remove(&dev->transaction_idr, id);
+			dev->ptp.inflight--;
+			continue;
+		}
+		if (canon_r5_ptp_finish_locked(dev, trans, error))
+			list_add_tail(&trans->list, &done);
+	}
+	
+	for (i = 0; queued && i < CANON_R5_PTP_CLASSES; i++) {
+		list_for_each_entry_safe(trans, tmp, &dev->ptp.tx_queue[i], list) {
+			if (canon_r5_ptp_finish_locked(dev, trans, error))
+				list_add_tail(&trans->list, &done);
+		}
+	}
+	
+	/* Resynchronise the container parser */
+	dev->ptp.rx_trans = NULL;
+	dev->ptp.rx_offset = 0;
+	dev->ptp.rx_remaining = 0;
+	
+	spin_unlock_irqrestore(&dev->transaction_lock, flags);
+	
+	canon_r5_ptp_deliver_list(dev, &done);
+}
+
+/* Queue a transaction for transmission; may be called from atomic context */
+int canon_r5_ptp_submit(struct canon_r5_device *dev, struct canon_r5_ptp_transaction *trans)
+{
+	struct workqueue_struct *wq;
+	struct list_head *queue;
+	unsigned long flags;
+	
+	if (!dev || !trans)
 		return -EINVAL;
 	
-	mutex_lock(&dev->ptp.lock);
+	if (trans->data_out_len > U32_MAX - PTP_CONTAINER_HEADER_SIZE ||
+	    trans->traffic_class >= CANON_R5_PTP_CLASSES)
+		return -EINVAL;
 	
-	if (!dev->ptp.session_open && code != PTP_OP_OPEN_SESSION) {
-		canon_r5_warn(dev, "PTP session not open for command 0x%04x", code);
-		mutex_unlock(&dev->ptp.lock);
+	wq = READ_ONCE(dev->ptp.xfer_wq);
+	if (!wq || !dev->transport_ops)
+		return -ENODEV;
+	
+	if (!READ_ONCE(dev->ptp.session_open) && trans->code != PTP_OP_OPEN_SESSION) {
+		canon_r5_warn(dev, "PTP session not open for command 0x%04x", trans->code);
 		return -ENOTCONN;
 	}
 	
-	/* Get next transaction ID */
-	trans_id = dev->ptp.transaction_id++;
+	spin_lock_irqsave(&dev->transaction_lock, flags);
+	
+	if (trans->state == CANON_R5_PTP_TRANS_QUEUED ||
+	    trans->state == CANON_R5_PTP_TRANS_INFLIGHT) {
+		spin_unlock_irqrestore(&dev->transaction_lock, flags);
+		return -EBUSY;
+	}
+	
+	reinit_completion(&trans->done);
+	trans->pins = 0;
+	trans->notify_pending = false;
+	trans->status = 0;
+	trans->response_code = 0;
+	trans->response_param_count = 0;
+	trans->data_in_length = 0;
+	trans->data_in_actual = 0;
+	trans->submitted = ktime_get();
+	trans->state = CANON_R5_PTP_TRANS_QUEUED;
+	
+	/* A class that sat idle gets no credit for it */
+	queue = &dev->ptp.tx_queue[trans->traffic_class];
+	if (list_empty(queue))
+		dev->ptp.class_vtime[trans->traffic_class] =
+			max(dev->ptp.class_vtime[trans->traffic_class], dev->ptp.vtime);
+	list_add_tail(&trans->list, queue);
+	
+	spin_unlock_irqrestore(&dev->transaction_lock, flags);
+	
+	canon_r5_queue_work(dev, wq, &dev->ptp.tx_work);
+	
+	return 0;
+}
+EXPORT_SYMBOL_GPL(canon_r5_ptp_submit);
+
+/* Withdraw a transaction that has not been waited for yet */
+int canon_r5_ptp_cancel(struct canon_r5_device *dev, struct canon_r5_ptp_transaction *trans,
+			int error)
+{
+	enum canon_r5_ptp_trans_state state;
+	unsigned long flags;
+	
+	if (!dev || !trans)
+		return -EINVAL;
+	
+	spin_lock_irqsave(&dev->transaction_lock, flags);
+	state = trans->state;
+	if (state == CANON_R5_PTP_TRANS_QUEUED)
+		canon_r5_ptp_finish_locked(dev, trans, error);
+	else if (state == CANON_R5_PTP_TRANS_INFLIGHT)
+		/* The camera still answers it */
+		canon_r5_ptp_abandon_locked(dev, trans, error);
+	if (state == CANON_R5_PTP_TRANS_QUEUED || state == CANON_R5_PTP_TRANS_INFLIGHT)
+		trans->notify_pending = false;
+	spin_unlock_irqrestore(&dev->transaction_lock, flags);
+	
+	switch (state) {
+	case CANON_R5_PTP_TRANS_QUEUED:
+	case CANON_R5_PTP_TRANS_INFLIGHT:
+		/* Wait for the sender/receiver to let go of our buffers */
+		wait_event(dev->ptp.rx_wait, canon_r5_ptp_unpinned(dev, trans));
+		canon_r5_ptp_kick_tx(dev);
+		return error;
+	case CANON_R5_PTP_TRANS_DONE:
+		/* Completion raced with us; the callback owner has to synchronise itself */
+		if (trans->complete)
+			return -EINPROGRESS;
+		wait_for_completion(&trans->done);
+		return trans->status;
+	default:
+		return 0;
+	}
+}
+EXPORT_SYMBOL_GPL(canon_r5_ptp_cancel);
+
+int canon_r5_ptp_wait(struct canon_r5_device *dev, struct canon_r5_ptp_transaction *trans,
+		      unsigned int timeout_ms)
+{
+	if (!dev || !trans)
+		return -EINVAL;
+	
+	if (!wait_for_completion_timeout(&trans->done, msecs_to_jiffies(timeout_ms))) {
+		canon_r5_warn(dev, "PTP command 0x%04x timed out (trans_id: %u)",
+			      trans->code, trans->trans_id);
+		return canon_r5_ptp_cancel(dev, trans, -ETIMEDOUT);
+	}
+	
+	return trans->status;
+}
+EXPORT_SYMBOL_GPL(canon_r5_ptp_wait);
+
+/* Submit a transaction and wait for its response */
+int canon_r5_ptp_transact(struct canon_r5_device *dev, struct canon_r5_ptp_transaction *trans)
+{
+	int ret;
+	
+	ret = canon_r5_ptp_submit(dev, trans);
+	if (ret)
+		return ret;
 	
-	/* Build command container */
-	build_ptp_container(&cmd, PTP_CONTAINER_COMMAND, code, trans_id, params, param_count);
+	return canon_r5_ptp_wait(dev, trans, CANON_R5_PTP_TIMEOUT_MS);
+}
+EXPORT_SYMBOL_GPL(canon_r5_ptp_transact);
+
+/* Copy part of the data-out phase, from the caller's buffer or its fill callback */
+static int canon_r5_ptp_data_out_copy(struct canon_r5_ptp_transaction *trans,
+				      u64 offset, void *buf, size_t len)
+{
+	if (trans->data_out_fill)
+		return trans->data_out_fill(trans, offset, buf, len);
+	
+	memcpy(buf, (const u8 *)trans->data_out + offset, len);
+	return 0;
+}
+
+/* Send the command container and optional data phase of one transaction */
+static int canon_r5_ptp_send_request(struct canon_r5_device *dev,
+				     struct canon_r5_ptp_transaction *trans)
+{
+	struct ptp_container cmd;
+	struct ptp_container *hdr = dev->ptp.tx_buffer;
+	const u8 *data = trans->data_out;
+	size_t remaining = trans->data_out_len;
+	size_t chunk, sent;
+	int ret;
+	
+	build_ptp_container(&cmd, PTP_CONTAINER_COMMAND, trans->code, trans->trans_id,
+			    trans->params, trans->param_count);
+	
+	trace_canon_r5_ptp_submit(dev->dev, trans->code, trans->trans_id, trans->param_count,
+				  trans->data_out_len);
 	
-	/* Send command */
 	ret = canon_r5_transport_send(dev, &cmd, le32_to_cpu(cmd.length));
-	if (ret) {
-		canon_r5_err(dev, "Failed to send PTP command 0x%04x: %d", code, ret);
-		mutex_unlock(&dev->ptp.lock);
+	if (ret)
 		return ret;
+	
+	canon_r5_dbg(dev, "Sent PTP command 0x%04x (trans_id: %u)", trans->code, trans->trans_id);
+	
+	if ((!data && !trans->data_out_fill) || !remaining)
+		return 0;
+	
+	trace_canon_r5_ptp_data(dev->dev, trans->code, trans->trans_id, true, remaining);
+	
+	/* The data container header shares the first transfer with the payload */
+	build_ptp_container(hdr, PTP_CONTAINER_DATA, trans->code, trans->trans_id, NULL, 0);
+	hdr->length = cpu_to_le32(PTP_CONTAINER_HEADER_SIZE + remaining);
+	
+	chunk = min_t(size_t, remaining, CANON_R5_PTP_TX_CHUNK_SIZE - PTP_CONTAINER_HEADER_SIZE);
+	ret = canon_r5_ptp_data_out_copy(trans, 0,
+					 (u8 *)dev->ptp.tx_buffer + PTP_CONTAINER_HEADER_SIZE, chunk);
+	if (ret)
+		return ret;
+	
+	ret = canon_r5_transport_send(dev, dev->ptp.tx_buffer, PTP_CONTAINER_HEADER_SIZE + chunk);
+	if (ret)
+		return ret;
+	
+	sent = chunk;
+	remaining -= chunk;
+	
+	/* The transport splits and pipelines the rest of a flat payload itself */
+	if (remaining && !trans->data_out_fill) {
+		ret = canon_r5_transport_send(dev, data + sent, remaining);
+		if (ret)
+			return ret;
+		remaining = 0;
 	}
 	
-	canon_r5_dbg(dev, "Sent PTP command 0x%04x (trans_id: %u)", code, trans_id);
+	/* A filled payload streams through tx_buffer, so memory stays bounded */
+	while (remaining) {
+		chunk = min_t(size_t, remaining, CANON_R5_PTP_TX_CHUNK_SIZE);
+		ret = trans->data_out_fill(trans, sent, dev->ptp.tx_buffer, chunk);
+		if (ret)
+			return ret;
+		
+		ret = canon_r5_transport_send(dev, dev->ptp.tx_buffer, chunk);
+		if (ret)
+			return ret;
+		
+		sent += chunk;
+		remaining -= chunk;
+	}
+	
+	canon_r5_dbg(dev, "Sent PTP data phase (%zu bytes)", trans->data_out_len);
 	
-	/* Send data phase if provided */
-	if (data && data_len > 0) {
-		struct ptp_container data_container;
+	return 0;
+}
+
+/* Dispatch queued transactions by class while the in-flight window has room */
+static void canon_r5_ptp_tx_work(struct work_struct *work)
+{
+	struct canon_r5_device *dev = container_of(work, struct canon_r5_device, ptp.tx_work);
+	struct canon_r5_ptp_transaction *trans;
+	unsigned long flags;
+	bool deliver;
+	int id, ret;
+	
+	/* With an asynchronous receiver nothing else notices a silent camera */
+	canon_r5_ptp_expire(dev);
+	
+	for (;;) {
+		idr_preload(GFP_KERNEL);
+		spin_lock_irqsave(&dev->transaction_lock, flags);
+		
+		trans = canon_r5_ptp_next_locked(dev);
+		if (!trans) {
+			spin_unlock_irqrestore(&dev->transaction_lock, flags);
+			idr_preload_end();
+			break;
+		}
 		
-		build_ptp_container(&data_container, PTP_CONTAINER_DATA, code, trans_id, NULL, 0);
-		data_container.length = cpu_to_le32(sizeof(data_container) + data_len);
+		trans->trans_id = dev->ptp.transaction_id;
 		
-		ret = canon_r5_transport_send(dev, &data_container, sizeof(data_container));
-		if (ret) {
-			canon_r5_err(dev, "Failed to send PTP data header: %d", ret);
-			mutex_unlock(&dev->ptp.lock);
-			return ret;
+		id = idr_alloc(&dev->transaction_idr, trans, trans->trans_id,
+			       trans->trans_id + 1, GFP_NOWAIT);
+		if (id < 0) {
+			deliver = canon_r5_ptp_finish_locked(dev, trans, id);
+			spin_unlock_irqrestore(&dev->transaction_lock, flags);
+			idr_preload_end();
+			canon_r5_err(dev, "Failed to track PTP transaction: %d", id);
+			if (deliver)
+				canon_r5_ptp_deliver(dev, trans);
+			continue;
 		}
 		
-		ret = canon_r5_transport_send(dev, data, data_len);
+		if (++dev->ptp.transaction_id > CANON_R5_PTP_MAX_TRANS_ID)
+			dev->ptp.transaction_id = 1;
+		
+		list_del_init(&trans->list);
+		trans->state = CANON_R5_PTP_TRANS_INFLIGHT;
+		trans->pins++;
+		dev->ptp.inflight++;
+		if (trans->traffic_class == CANON_R5_PTP_CLASS_BULK)
+			dev->ptp.bulk_inflight++;
+		if (trans->traffic_class != CANON_R5_PTP_CLASS_CONTROL)
+			dev->ptp.vtime = dev->ptp.class_vtime[trans->traffic_class];
+		
+		spin_unlock_irqrestore(&dev->transaction_lock, flags);
+		idr_preload_end();
+		
+		ret = canon_r5_ptp_send_request(dev, trans);
 		if (ret) {
-			canon_r5_err(dev, "Failed to send PTP data: %d", ret);
-			mutex_unlock(&dev->ptp.lock);
-			return ret;
+			canon_r5_err(dev, "Failed to send PTP command 0x%04x: %d", trans->code, ret);
+			spin_lock_irqsave(&dev->transaction_lock, flags);
+			canon_r5_ptp_finish_locked(dev, trans, ret);
+			spin_unlock_irqrestore(&dev->transaction_lock, flags);
+		} else {
+			canon_r5_ptp_start_rx(dev);
 		}
 		
-		canon_r5_dbg(dev, "Sent PTP data phase (%d bytes)", data_len);
+		/* Delivers the failure, if any, now that the buffers are released */
+		canon_r5_ptp_unpin(dev, trans);
 	}
+}
+
+/* Map a payload offset onto the transaction's destination memory */
+static u8 *canon_r5_ptp_rx_dest(const struct canon_r5_ptp_transaction *trans, size_t offset,
+				size_t *avail)
+{
+	unsigned int i;
 	
-	/* Receive response */
-	ret = canon_r5_transport_receive(dev, &resp, sizeof(resp), &resp_len);
-	if (ret) {
-		canon_r5_err(dev, "Failed to receive PTP response: %d", ret);
-		mutex_unlock(&dev->ptp.lock);
-		return ret;
+	if (!trans->data_in_nvec) {
+		if (!trans->data_in || offset >= trans->data_in_len)
+			return NULL;
+		*avail = trans->data_in_len - offset;
+		return (u8 *)trans->data_in + offset;
 	}
 	
-	/* Validate response */
-	if (resp_len < sizeof(resp) - sizeof(resp.params)) {
-		canon_r5_err(dev, "PTP response too short: %zu bytes", resp_len);
-		mutex_unlock(&dev->ptp.lock);
-		return -EPROTO;
+	for (i = 0; i < trans->data_in_nvec; i++) {
+		if (offset < trans->data_in_vec[i].iov_len) {
+			*avail = trans->data_in_vec[i].iov_len - offset;
+			return (u8 *)trans->data_in_vec[i].iov_base + offset;
+		}
+		offset -= trans->data_in_vec[i].iov_len;
 	}
 	
-	if (le16_to_cpu(resp.type) != PTP_CONTAINER_RESPONSE) {
-		canon_r5_err(dev, "Invalid PTP response type: 0x%04x", le16_to_cpu(resp.type));
-		mutex_unlock(&dev->ptp.lock);
-		return -EPROTO;
+	return NULL;
+}
+
+/* Store received payload bytes at the given offset of the transaction */
+static void canon_r5_ptp_rx_copy(struct canon_r5_ptp_transaction *trans, size_t offset,
+				 const u8 *buf, size_t len)
+{
+	size_t copy, avail;
+	u8 *dst;
+	
+	while (len) {
+		dst = canon_r5_ptp_rx_dest(trans, offset, &avail);
+		if (!dst)
+			break;
+		
+		copy = min(len, avail);
+		memcpy(dst, buf, copy);
+		buf += copy;
+		len -= copy;
+		offset += copy;
+		trans->data_in_actual = offset;
+	}
+}
+
+static size_t canon_r5_ptp_rx_data(struct canon_r5_device *dev, const u8 *buf, size_t len)
+{
+	struct canon_r5_ptp_transaction *trans;
+	unsigned long flags;
+	size_t offset;
+	
+	len = min(len, dev->ptp.rx_remaining);
+	
+	spin_lock_irqsave(&dev->transaction_lock, flags);
+	trans = dev->ptp.rx_trans;
+	if (trans)
+		trans->pins++;
+	offset = dev->ptp.rx_offset;
+	dev->ptp.rx_offset += len;
+	dev->ptp.rx_remaining -= len;
+	spin_unlock_irqrestore(&dev->transaction_lock, flags);
+	
+	if (trans) {
+		canon_r5_ptp_rx_copy(trans, offset, buf, len);
+		canon_r5_ptp_unpin(dev, trans);
 	}
 	
-	if (le32_to_cpu(resp.trans_id) != trans_id) {
-		canon_r5_err(dev, "PTP transaction ID mismatch: expected %u, got %u",
-			    trans_id, le32_to_cpu(resp.trans_id));
-		mutex_unlock(&dev->ptp.lock);
-		return -EPROTO;
+	return len;
+}
+
+static void canon_r5_ptp_rx_response(struct canon_r5_device *dev,
+				     const struct ptp_container *resp, size_t len)
+{
+	struct canon_r5_ptp_transaction *trans;
+	u32 trans_id = le32_to_cpu(resp->trans_id);
+	u16 code = le16_to_cpu(resp->code);
+	unsigned long flags;
+	bool deliver = false;
+	int i, count;
+	
+	count = min_t(int, (len - PTP_CONTAINER_HEADER_SIZE) / sizeof(u32), PTP_MAX_PARAMS);
+	
+	spin_lock_irqsave(&dev->transaction_lock, flags);
+	trans = idr_find(&dev->transaction_idr, trans_id);
+	if (trans == CANON_R5_PTP_DRAINING) {
+		idr_remove(&dev->transaction_idr, trans_id);
+		dev->ptp.inflight--;
+		spin_unlock_irqrestore(&dev->transaction_lock, flags);
+		
+		canon_r5_dbg(dev, "Drained PTP response 0x%04x for cancelled transaction %u",
+			     code, trans_id);
+		canon_r5_ptp_kick_tx(dev);
+		return;
+	}
+	if (trans) {
+		trans->response_code = code;
+		trans->response_param_count = count;
+		for (i = 0; i < count; i++)
+			trans->response_params[i] = le32_to_cpu(resp->params[i]);
+		deliver = canon_r5_ptp_finish_locked(dev, trans, 0);
+	}
+	spin_unlock_irqrestore(&dev->transaction_lock, flags);
+	
+	if (!trans) {
+		canon_r5_dbg(dev, "Dropping PTP response 0x%04x for unknown transaction %u",
+			     code, trans_id);
+		return;
 	}
 	
-	*response_code = le16_to_cpu(resp.code);
+	canon_r5_dbg(dev, "Received PTP response 0x%04x (trans_id: %u)", code, trans_id);
 	
-	canon_r5_dbg(dev, "Received PTP response 0x%04x for command 0x%04x", 
-		    *response_code, code);
+	if (deliver)
+		canon_r5_ptp_deliver(dev, trans);
 	
-	mutex_unlock(&dev->ptp.lock);
+	/* A window slot was released */
+	canon_r5_ptp_kick_tx(dev);
+}
+
+static size_t canon_r5_ptp_rx_container(struct canon_r5_device *dev, const u8 *buf, size_t len)
+{
+	const struct ptp_container *container = (const struct ptp_container *)buf;
+	struct canon_r5_ptp_transaction *trans;
+	unsigned long flags;
+	u32 length, trans_id;
+	u16 type;
+	
+	if (len < PTP_CONTAINER_HEADER_SIZE) {
+		canon_r5_warn(dev, "Short PTP container (%zu bytes)", len);
+		return 0;
+	}
+	
+	length = le32_to_cpu(container->length);
+	type = le16_to_cpu(container->type);
+	trans_id = le32_to_cpu(container->trans_id);
+	
+	if (length < PTP_CONTAINER_HEADER_SIZE) {
+		canon_r5_warn(dev, "Invalid PTP container length %u", length);
+		return 0;
+	}
+	
+	switch (type) {
+	case PTP_CONTAINER_DATA:
+		spin_lock_irqsave(&dev->transaction_lock, flags);
+		trans = idr_find(&dev->transaction_idr, trans_id);
+		if (trans == CANON_R5_PTP_DRAINING)
+			trans = NULL;
+		if (trans)
+			trans->data_in_length = length - PTP_CONTAINER_HEADER_SIZE;
+		dev->ptp.rx_trans = trans;
+		dev->ptp.rx_offset = 0;
+		dev->ptp.rx_remaining = length - PTP_CONTAINER_HEADER_SIZE;
+		spin_unlock_irqrestore(&dev->transaction_lock, flags);
+		
+		trace_canon_r5_ptp_data(dev->dev, le16_to_cpu(container->code), trans_id, false,
+					length - PTP_CONTAINER_HEADER_SIZE);
+		
+		if (!trans)
+			canon_r5_dbg(dev, "Discarding PTP data for unknown transaction %u", trans_id);
+		return PTP_CONTAINER_HEADER_SIZE;
+	case PTP_CONTAINER_RESPONSE:
+		len = min_t(size_t, length, len);
+		canon_r5_ptp_rx_response(dev, container, len);
+		return len;
+	default:
+		canon_r5_dbg(dev, "Ignoring PTP container type 0x%04x on bulk pipe", type);
+		return min_t(size_t, length, len);
+	}
+}
+
+/* Feed one bulk IN transfer through the container parser */
+static void canon_r5_ptp_rx_process(struct canon_r5_device *dev, const u8 *buf, size_t len)
+{
+	size_t used;
+	
+	while (len) {
+		if (dev->ptp.rx_remaining)
+			used = canon_r5_ptp_rx_data(dev, buf, len);
+		else
+			used = canon_r5_ptp_rx_container(dev, buf, len);
+		
+		if (!used)
+			break;
+		
+		buf += used;
+		len -= used;
+	}
+}
+
+/* Receive the rest of a data phase into the caller's buffer, skipping the parser */
+static int canon_r5_ptp_rx_direct(struct canon_r5_device *dev)
+{
+	struct canon_r5_ptp_transaction *trans;
+	size_t offset, avail, len = 0, actual = 0;
+	unsigned long flags;
+	u8 *dst = NULL;
+	int ret;
+	
+	spin_lock_irqsave(&dev->transaction_lock, flags);
+	trans = dev->ptp.rx_trans;
+	offset = dev->ptp.rx_offset;
+	if (trans)
+		dst = canon_r5_ptp_rx_dest(trans, offset, &avail);
+	if (dst) {
+		len = min(dev->ptp.rx_remaining, avail);
+		/* Partial reads must end on a packet boundary */
+		if (len < dev->ptp.rx_remaining)
+			len = round_down(len, CANON_R5_PTP_RX_ALIGN);
+	}
+	if (len)
+		trans->pins++;
+	spin_unlock_irqrestore(&dev->transaction_lock, flags);
+	
+	if (!len)
+		return 0;
+	
+	ret = canon_r5_transport_receive(dev, dst, len, &actual);
+	if (!ret) {
+		actual = min(actual, len);
+		trans->data_in_actual = offset + actual;
+		
+		spin_lock_irqsave(&dev->transaction_lock, flags);
+		dev->ptp.rx_offset += actual;
+		dev->ptp.rx_remaining -= actual;
+		if (actual < len) {
+			/* Short packet: the device ended the container early */
+			dev->ptp.rx_remaining = 0;
+		}
+		spin_unlock_irqrestore(&dev->transaction_lock, flags);
+		
+		if (actual < len)
+			canon_r5_warn(dev, "PTP data phase truncated (%zu of %zu bytes)",
+				      actual, len);
+	}
+	
+	canon_r5_ptp_unpin(dev, trans);
+	
+	return ret ? ret : 1;
+}
+
+/* Synchronous receiver: drains bulk IN while transactions are outstanding */
+static void canon_r5_ptp_rx_work(struct work_struct *work)
+{
+	struct canon_r5_device *dev = container_of(work, struct canon_r5_device, ptp.rx_work);
+	unsigned int errors = 0;
+	size_t actual;
+	int ret;
+	
+	while (READ_ONCE(dev->ptp.inflight) || dev->ptp.rx_remaining) {
+		ret = dev->ptp.rx_remaining ? canon_r5_ptp_rx_direct(dev) : 0;
+		if (!ret) {
+			actual = 0;
+			ret = canon_r5_transport_receive(dev, dev->ptp.rx_buffer,
+							 CANON_R5_PTP_RX_BUFFER_SIZE, &actual);
+			if (!ret)
+				canon_r5_ptp_rx_process(dev, dev->ptp.rx_buffer, actual);
+		}
+		
+		/* An idle pipe loses nothing; slow commands time out on their own */
+		if (ret == -ETIMEDOUT && !dev->ptp.rx_remaining) {
+			canon_r5_ptp_expire(dev);
+			continue;
+		}
+		
+		if (ret < 0) {
+			canon_r5_err(dev, "Failed to receive PTP response: %d", ret);
+			if (ret == -ENODEV || ret == -ESHUTDOWN ||
+			    ++errors >= CANON_R5_PTP_RX_MAX_ERRORS) {
+				canon_r5_ptp_fail_all(dev, ret, false);
+				break;
+			}
+			canon_r5_ptp_resync(dev, ret);
+			continue;
+		}
+		
+		errors = 0;
+	}
+}
+
+/* Asynchronous receiver: called in order for every completed bulk IN transfer */
+static void canon_r5_ptp_rx_complete(struct canon_r5_device *dev, const void *data,
+				     size_t len, int status)
+{
+	if (status == -ENODEV || status == -ESHUTDOWN) {
+		canon_r5_ptp_fail_all(dev, status, false);
+		return;
+	}
+	
+	if (status) {
+		/* Part of a container is lost, resynchronise on the next one */
+		canon_r5_ptp_resync(dev, status);
+		return;
+	}
+	
+	canon_r5_ptp_expire(dev);
+	canon_r5_ptp_rx_process(dev, data, len);
+}
+
+/* Run one transaction synchronously with optional data-out or data-in phase */
+static int canon_r5_ptp_run(struct canon_r5_device *dev, u16 code,
+			    u32 *params, int param_count,
+			    const void *data_out, size_t data_out_len,
+			    void *data_in, size_t data_in_len, size_t *actual_len,
+			    u16 *response_code)
+{
+	struct canon_r5_ptp_transaction trans;
+	int ret;
+	
+	if (!dev || !response_code)
+		return -EINVAL;
+	
+	if (param_count < 0 || param_count > PTP_MAX_PARAMS || (param_count && !params))
+		return -EINVAL;
+	
+	canon_r5_ptp_transaction_init(&trans, code, params, param_count);
+	trans.data_out = data_out;
+	trans.data_out_len = data_out ? data_out_len : 0;
+	trans.data_in = data_in;
+	trans.data_in_len = data_in ? data_in_len : 0;
+	
+	ret = canon_r5_ptp_transact(dev, &trans);
+	if (ret)
+		return ret;
+	
+	if (actual_len)
+		*actual_len = trans.data_in_actual;
+	
+	*response_code = trans.response_code;
+	
+	canon_r5_dbg(dev, "Received PTP response 0x%04x for command 0x%04x",
+		    *response_code, code);
 	
 	return (*response_code == PTP_RC_OK) ? 0 : -EIO;
 }
+
+/* Send PTP command and receive response */
+int canon_r5_ptp_command(struct canon_r5_device *dev, u16 code, 
+			 u32 *params, int param_count,
+			 void *data, int data_len,
+			 u16 *response_code)
+{
+	if (data_len < 0)
+		return -EINVAL;
+	
+	return canon_r5_ptp_run(dev, code, params, param_count, data, data_len,
+				NULL, 0, NULL, response_code);
+}
 EXPORT_SYMBOL_GPL(canon_r5_ptp_command);
 
+/* Send PTP command and receive its data-in phase into the caller's buffer */
+int canon_r5_ptp_command_in(struct canon_r5_device *dev, u16 code,
+			    u32 *params, int param_count,
+			    void *buffer, size_t buffer_len, size_t *actual_len,
+			    u16 *response_code)
+{
+	return canon_r5_ptp_run(dev, code, params, param_count, NULL, 0,
+				buffer, buffer_len, actual_len, response_code);
+}
+EXPORT_SYMBOL_GPL(canon_r5_ptp_command_in);
+
 /* Open PTP session */
 int canon_r5_ptp_open_session(struct canon_r5_device *dev)
 {
@@ -185,6 +1108,12 @@ int canon_r5_ptp_open_session(struct canon_r5_device *dev)
 	
 	canon_r5_info(dev, "PTP session opened successfully (ID: %u)", session_id);
 	
+	/* The camera may have restarted its clock with the session */
+	canon_r5_clock_reset(dev);
+	
+	/* Later property reads are served from memory once the prefetch lands */
+	canon_r5_props_start(dev);
+	
 	return 0;
 }
 EXPORT_SYMBOL_GPL(canon_r5_ptp_open_session);
@@ -206,6 +1135,7 @@ int canon_r5_ptp_close_session(struct canon_r5_device *dev)
 	mutex_unlock(&dev->ptp.lock);
 	
 	canon_r5_info(dev, "Closing PTP session");
+	canon_r5_props_stop(dev);
 	
 	ret = canon_r5_ptp_command(dev, PTP_OP_CLOSE_SESSION, NULL, 0,
 				  NULL, 0, &response_code);
@@ -359,30 +1289,133 @@ int canon_r5_ptp_liveview_stop(struct canon_r5_device *dev)
 }
 EXPORT_SYMBOL_GPL(canon_r5_ptp_liveview_stop);
 
-/* Get live view frame */
-int canon_r5_ptp_get_liveview_frame(struct canon_r5_device *dev,
-				   void **frame_data, size_t *frame_size)
+/* Route a GET_LIVEVIEW data phase: frame header first, payload into @buffer */
+void canon_r5_ptp_liveview_prepare(struct canon_r5_ptp_transaction *trans,
+				   struct kvec vec[2],
+				   struct canon_liveview_header *header,
+				   void *buffer, size_t buffer_len)
 {
-	u16 response_code;
+	canon_r5_ptp_transaction_init(trans, CANON_PTP_OP_GET_LIVEVIEW, NULL, 0);
+	
+	vec[0].iov_base = header;
+	vec[0].iov_len = sizeof(*header);
+	vec[1].iov_base = buffer;
+	vec[1].iov_len = buffer_len;
+	
+	trans->data_in_vec = vec;
+	trans->data_in_nvec = 2;
+}
+EXPORT_SYMBOL_GPL(canon_r5_ptp_liveview_prepare);
+
+/* Validate a received frame in place and return the payload size */
+int canon_r5_ptp_liveview_parse(struct canon_r5_device *dev,
+				const struct canon_r5_ptp_transaction *trans,
+				const struct canon_liveview_header *header,
+				void *buffer, size_t *frame_size)
+{
+	size_t received, offset, payload, length;
+	
+	if (!dev || !trans || !header || !buffer || !frame_size)
+		return -EINVAL;
+	
+	*frame_size = 0;
+	
+	if (trans->data_in_actual < sizeof(*header))
+		return -ENODATA;
+	
+	if (trans->data_in_length > trans->data_in_actual) {
+		canon_r5_dbg(dev, "Live view frame exceeds buffer (%zu > %zu bytes)",
+			     trans->data_in_length, trans->data_in_actual);
+		return -EMSGSIZE;
+	}
+	
+	received = trans->data_in_actual - sizeof(*header);
+	offset = le32_to_cpu(header->data_offset);
+	length = le32_to_cpu(header->length);
+	
+	/* data_offset counts from the start of the frame header */
+	if (offset < sizeof(*header))
+		offset = sizeof(*header);
+	offset -= sizeof(*header);
+	
+	if (offset > received) {
+		canon_r5_warn(dev, "Invalid live view data offset %zu", offset);
+		return -EPROTO;
+	}
+	
+	payload = received - offset;
+	if (length && length < payload)
+		payload = length;
+	
+	/* Padded headers are rare; shift the payload down rather than copy the frame */
+	if (offset && payload)
+		memmove(buffer, (u8 *)buffer + offset, payload);
+	
+	*frame_size = payload;
+	
+	return 0;
+}
+EXPORT_SYMBOL_GPL(canon_r5_ptp_liveview_parse);
+
+/* Get live view frame straight into a caller supplied buffer */
+int canon_r5_ptp_get_liveview_frame_into(struct canon_r5_device *dev,
+					 void *buffer, size_t buffer_len,
+					 struct canon_liveview_header *header,
+					 size_t *frame_size)
+{
+	struct canon_r5_ptp_transaction trans;
+	struct kvec vec[2];
 	int ret;
 	
-	if (!dev || !frame_data || !frame_size)
+	if (!dev || !buffer || !buffer_len || !header || !frame_size)
 		return -EINVAL;
 	
 	canon_r5_dbg(dev, "Getting live view frame");
 	
-	ret = canon_r5_ptp_command(dev, CANON_PTP_OP_GET_LIVEVIEW, NULL, 0,
-				  NULL, 0, &response_code);
+	canon_r5_ptp_liveview_prepare(&trans, vec, header, buffer, buffer_len);
+	
+	ret = canon_r5_ptp_transact(dev, &trans);
 	if (ret) {
 		canon_r5_dbg(dev, "Failed to get live view frame: %d", ret);
 		return ret;
 	}
 	
-	/* TODO: Implement frame data retrieval and parsing */
-	/* For now, return no data */
+	if (trans.response_code != PTP_RC_OK) {
+		canon_r5_dbg(dev, "Live view frame not available: 0x%04x", trans.response_code);
+		return -EIO;
+	}
+	
+	return canon_r5_ptp_liveview_parse(dev, &trans, header, buffer, frame_size);
+}
+EXPORT_SYMBOL_GPL(canon_r5_ptp_get_liveview_frame_into);
+
+/* Get live view frame into a new buffer, released by the caller with kvfree() */
+int canon_r5_ptp_get_liveview_frame(struct canon_r5_device *dev,
+				   void **frame_data, size_t *frame_size)
+{
+	struct canon_liveview_header header;
+	void *buffer;
+	int ret;
+	
+	if (!dev || !frame_data || !frame_size)
+		return -EINVAL;
+	
 	*frame_data = NULL;
 	*frame_size = 0;
 	
+	buffer = kvmalloc(CANON_R5_LIVEVIEW_MAX_FRAME_SIZE, GFP_KERNEL);
+	if (!buffer)
+		return -ENOMEM;
+	
+	ret = canon_r5_ptp_get_liveview_frame_into(dev, buffer, CANON_R5_LIVEVIEW_MAX_FRAME_SIZE,
+						   &header, frame_size);
+	if (ret || !*frame_size) {
+		kvfree(buffer);
+		return ret;
+	}
+	
+	*frame_data = buffer;
+	
 	return 0;
 }
 EXPORT_SYMBOL_GPL(canon_r5_ptp_get_liveview_frame);
@@ -468,7 +1501,7 @@ int canon_r5_ptp_stop_movie(struct canon_r5_device *dev)
 }
 EXPORT_SYMBOL_GPL(canon_r5_ptp_stop_movie);
 
-/* Get device property */
+/* Get device property, from the property cache when possible */
 int canon_r5_ptp_get_property(struct canon_r5_device *dev, u16 property,
 			     void *value, size_t value_size)
 {
@@ -479,18 +1512,22 @@ int canon_r5_ptp_get_property(struct canon_r5_device *dev, u16 property,
 	if (!dev || !value)
 		return -EINVAL;
 	
-	canon_r5_dbg(dev, "Getting device property 0x%04x", property);
+	ret = canon_r5_props_get(dev, property, value, value_size);
+	if (ret != -EOPNOTSUPP)
+		return ret;
 	
-	ret = canon_r5_ptp_command(dev, CANON_PTP_OP_GET_PROPERTY, params, 1,
-				  NULL, 0, &response_code);
+	canon_r5_dbg(dev, "Getting uncached device property 0x%04x", property);
+	
+	/* Anything the camera does not fill reads back as zero */
+	memset(value, 0, value_size);
+	
+	ret = canon_r5_ptp_command_in(dev, CANON_PTP_OP_GET_PROPERTY, params, 1,
+				     value, value_size, NULL, &response_code);
 	if (ret) {
 		canon_r5_dbg(dev, "Failed to get property 0x%04x: %d", property, ret);
 		return ret;
 	}
 	
-	/* TODO: Parse property data from response */
-	memset(value, 0, value_size);
-	
 	return 0;
 }
 EXPORT_SYMBOL_GPL(canon_r5_ptp_get_property);
@@ -515,54 +1552,246 @@ int canon_r5_ptp_set_property(struct canon_r5_device *dev, u16 property,
 		return ret;
 	}
 	
+	if (response_code != PTP_RC_OK) {
+		canon_r5_warn(dev, "Set property 0x%04x failed: 0x%04x", property, response_code);
+		return -EIO;
+	}
+	
+	canon_r5_props_store(dev, property, value, value_size);
 	return 0;
 }
 EXPORT_SYMBOL_GPL(canon_r5_ptp_set_property);
 
-/* Check for PTP events */
+/* Number of decoded events waiting for dispatch */
 int canon_r5_ptp_check_event(struct canon_r5_device *dev)
 {
-	/* TODO: Implement event checking from interrupt endpoint data */
-	return 0;
+	if (!dev)
+		return -EINVAL;
+	
+	return smp_load_acquire(&dev->ptp.event_head) - READ_ONCE(dev->ptp.event_tail);
 }
 EXPORT_SYMBOL_GPL(canon_r5_ptp_check_event);
 
-/* PTP event handler work function */
-void canon_r5_ptp_event_handler(struct work_struct *work)
+/*
+ * Decode an interrupt-endpoint container and push it onto the event ring.
+ * Called from URB completion, the ring's only producer.
+ */
+void canon_r5_ptp_event_received(struct canon_r5_device *dev, const void *data, size_t len)
 {
-	struct canon_r5_device *dev = container_of(work, struct canon_r5_device, ptp.event_work);
+	const struct ptp_container *container = data;
+	struct canon_r5_ptp *ptp;
+	struct canon_r5_event *event;
+	unsigned int head, tail, i;
+	size_t length;
 	
-	if (!dev)
+	if (!dev || !data || len < PTP_CONTAINER_HEADER_SIZE)
+		return;
+	
+	if (le16_to_cpu(container->type) != PTP_CONTAINER_EVENT) {
+		canon_r5_dbg(dev, "Ignoring interrupt container type 0x%04x",
+			     le16_to_cpu(container->type));
+		return;
+	}
+	
+	length = min_t(size_t, le32_to_cpu(container->length), len);
+	if (length < PTP_CONTAINER_HEADER_SIZE)
 		return;
 	
-	canon_r5_dbg(dev, "Processing PTP events");
+	ptp = &dev->ptp;
+	head = ptp->event_head;
+	tail = smp_load_acquire(&ptp->event_tail);
+	
+	if (head - tail >= CANON_R5_EVENT_RING_SIZE) {
+		atomic_inc(&ptp->events_dropped);
+	} else {
+		event = &ptp->events[head & (CANON_R5_EVENT_RING_SIZE - 1)];
+		event->code = le16_to_cpu(container->code);
+		event->nr_params = min_t(size_t, (length - PTP_CONTAINER_HEADER_SIZE) / sizeof(u32),
+					 ARRAY_SIZE(event->params));
+		for (i = 0; i < event->nr_params; i++)
+			event->params[i] = le32_to_cpu(container->params[i]);
+		
+		/* Publish the slot before the new head */
+		smp_store_release(&ptp->event_head, head + 1);
+	}
+	
+	if (ptp->event_wq)
+		canon_r5_queue_work(dev, ptp->event_wq, &ptp->event_work);
+}
+EXPORT_SYMBOL_GPL(canon_r5_ptp_event_received);
+
+/* Storage IDs are 0x0001xxxx for the CFexpress slot and 0x0002xxxx for SD */
+static int canon_r5_ptp_event_slot(u32 storage_id)
+{
+	return (int)(storage_id >> 16) - 1;
+}
+
+/* A property change is dropped when a later one in the batch reports the same property */
+static bool canon_r5_ptp_event_superseded(const struct canon_r5_event *batch,
+					  unsigned int count, unsigned int index)
+{
+	unsigned int i;
+	
+	if (batch[index].code != PTP_EC_DEVICE_PROP_CHANGED || !batch[index].nr_params)
+		return false;
 	
-	/* Check for events */
-	canon_r5_ptp_check_event(dev);
+	for (i = index + 1; i < count; i++) {
+		if (batch[i].code == PTP_EC_DEVICE_PROP_CHANGED && batch[i].nr_params &&
+		    batch[i].params[0] == batch[index].params[0])
+			return true;
+	}
 	
-	/* TODO: Process specific event types and call appropriate handlers */
+	return false;
+}
+
+static void canon_r5_ptp_dispatch_event(struct canon_r5_device *dev,
+					const struct canon_r5_event *event)
+{
+	struct canon_r5_event_handler *handler = &dev->event_handler;
+	void (*object_changed)(struct canon_r5_device *, u16, u32);
+	void (*capture_complete)(struct canon_r5_device *, u32);
+	void (*property_changed)(struct canon_r5_device *, u32);
+	void (*card_event)(struct canon_r5_device *, int);
+	u32 param = event->params[0];
+	
+	switch (event->code) {
+	case PTP_EC_OBJECT_ADDED:
+	case PTP_EC_OBJECT_REMOVED:
+	case PTP_EC_OBJECT_INFO_CHANGED:
+	case CANON_PTP_EC_OBJECT_CREATED:
+	case CANON_PTP_EC_OBJECT_REMOVED:
+	case PTP_EC_UNREPORTED_STATUS:
+		if (!event->nr_params && event->code != PTP_EC_UNREPORTED_STATUS)
+			break;
+		object_changed = READ_ONCE(handler->object_changed);
+		if (object_changed)
+			object_changed(dev, event->code, event->nr_params ? param : 0);
+		break;
+	case PTP_EC_REQUEST_OBJECT_TRANSFER:
+	case CANON_PTP_EC_REQUEST_OBJECT_TRANSFER:
+		capture_complete = READ_ONCE(handler->still_capture_complete);
+		if (capture_complete && event->nr_params)
+			capture_complete(dev, param);
+		break;
+	case PTP_EC_STORE_ADDED:
+	case PTP_EC_STORE_REMOVED:
+		card_event = event->code == PTP_EC_STORE_ADDED ?
+			     READ_ONCE(handler->card_inserted) : READ_ONCE(handler->card_removed);
+		if (card_event && event->nr_params)
+			card_event(dev, canon_r5_ptp_event_slot(param));
+		break;
+	case PTP_EC_DEVICE_PROP_CHANGED:
+		if (event->nr_params)
+			canon_r5_props_changed(dev, param);
+		property_changed = READ_ONCE(handler->property_changed);
+		if (property_changed && event->nr_params)
+			property_changed(dev, param);
+		break;
+	default:
+		canon_r5_dbg(dev, "Unhandled event 0x%04x", event->code);
+		break;
+	}
+}
+
+/*
+ * Drain the event ring in batches. Each batch is copied out and the slots
+ * released before any handler runs, so a slow handler never stalls the
+ * interrupt endpoint.
+ */
+void canon_r5_ptp_event_handler(struct work_struct *work)
+{
+	struct canon_r5_device *dev = container_of(work, struct canon_r5_device, ptp.event_work);
+	struct canon_r5_ptp *ptp = &dev->ptp;
+	struct canon_r5_event batch[CANON_R5_EVENT_BATCH];
+	struct canon_r5_event lost = { .code = PTP_EC_UNREPORTED_STATUS };
+	unsigned int head, tail, count, i;
+	int dropped;
+	
+	/* Lost object events leave subscribers stale; tell them to re-query */
+	dropped = atomic_xchg(&ptp->events_dropped, 0);
+	if (dropped) {
+		canon_r5_warn(dev, "Event ring overflow, %d events lost", dropped);
+		canon_r5_ptp_dispatch_event(dev, &lost);
+	}
+	
+	tail = ptp->event_tail;
+	for (;;) {
+		head = smp_load_acquire(&ptp->event_head);
+		count = min_t(unsigned int, head - tail, CANON_R5_EVENT_BATCH);
+		if (!count)
+			break;
+		
+		for (i = 0; i < count; i++)
+			batch[i] = ptp->events[(tail + i) & (CANON_R5_EVENT_RING_SIZE - 1)];
+		tail += count;
+		smp_store_release(&ptp->event_tail, tail);
+		
+		for (i = 0; i < count; i++) {
+			if (canon_r5_ptp_event_superseded(batch, count, i))
+				continue;
+			canon_r5_ptp_dispatch_event(dev, &batch[i]);
+		}
+	}
 }
 EXPORT_SYMBOL_GPL(canon_r5_ptp_event_handler);
 
 /* Initialize PTP layer */
 int canon_r5_ptp_init(struct canon_r5_device *dev)
 {
+	int ret;
+	
 	if (!dev)
 		return -EINVAL;
 	
 	canon_r5_info(dev, "Initializing PTP layer");
 	
-	/* PTP layer is already initialized in core device allocation */
+	dev->ptp.tx_buffer = kmalloc(CANON_R5_PTP_TX_CHUNK_SIZE, GFP_KERNEL);
+	dev->ptp.rx_buffer = kmalloc(CANON_R5_PTP_RX_BUFFER_SIZE, GFP_KERNEL);
+	if (!dev->ptp.tx_buffer || !dev->ptp.rx_buffer) {
+		canon_r5_err(dev, "Failed to allocate PTP transfer buffers");
+		ret = -ENOMEM;
+		goto error_buffers;
+	}
+	
+	INIT_WORK(&dev->ptp.tx_work, canon_r5_ptp_tx_work);
+	INIT_WORK(&dev->ptp.rx_work, canon_r5_ptp_rx_work);
+	
+	/* Sender and receiver must be able to run concurrently */
+	dev->ptp.xfer_wq = canon_r5_workqueue_get(dev, CANON_R5_WORK_IO, "canon-r5-ptp",
+						  WQ_MEM_RECLAIM | WQ_UNBOUND, 2);
+	if (!dev->ptp.xfer_wq) {
+		canon_r5_err(dev, "Failed to create PTP transfer workqueue");
+		ret = -ENOMEM;
+		goto error_buffers;
+	}
+	
+	/* Prefer the transport's streaming receiver when it has one */
+	if (dev->transport_ops && dev->transport_ops->rx_start) {
+		ret = dev->transport_ops->rx_start(dev, canon_r5_ptp_rx_complete);
+		if (ret)
+			canon_r5_warn(dev, "Asynchronous receive unavailable (%d), polling instead", ret);
+		else
+			dev->ptp.rx_async = true;
+	}
 	
 	canon_r5_info(dev, "PTP layer initialized successfully");
 	
 	return 0;
+	
+error_buffers:
+	kfree(dev->ptp.rx_buffer);
+	dev->ptp.rx_buffer = NULL;
+	kfree(dev->ptp.tx_buffer);
+	dev->ptp.tx_buffer = NULL;
+	return ret;
 }
 EXPORT_SYMBOL_GPL(canon_r5_ptp_init);
 
 /* Cleanup PTP layer */
 void canon_r5_ptp_cleanup(struct canon_r5_device *dev)
 {
+	struct workqueue_struct *wq;
+	
 	if (!dev)
 		return;
 	
@@ -571,6 +1800,27 @@ void canon_r5_ptp_cleanup(struct canon_r5_device *dev)
 	/* Close PTP session if open */
 	canon_r5_ptp_close_session(dev);
 	
+	if (dev->ptp.rx_async) {
+		if (dev->transport_ops && dev->transport_ops->rx_stop)
+			dev->transport_ops->rx_stop(dev);
+		dev->ptp.rx_async = false;
+	}
+	
+	/* Stop accepting transactions and fail whatever is left */
+	wq = dev->ptp.xfer_wq;
+	if (wq) {
+		WRITE_ONCE(dev->ptp.xfer_wq, NULL);
+		canon_r5_ptp_fail_all(dev, -ESHUTDOWN, true);
+		cancel_work_sync(&dev->ptp.tx_work);
+		cancel_work_sync(&dev->ptp.rx_work);
+		canon_r5_workqueue_put(dev, wq);
+	}
+	
+	kfree(dev->ptp.rx_buffer);
+	dev->ptp.rx_buffer = NULL;
+	kfree(dev->ptp.tx_buffer);
+	dev->ptp.tx_buffer = NULL;
+	
 	canon_r5_info(dev, "PTP layer cleaned up");
 }
 EXPORT_SYMBOL_GPL(canon_r5_ptp_cleanup);
@@ -729,8 +1979,19 @@ EXPORT_SYMBOL_GPL(canon_r5_ptp_set_bracketing);
 
 int canon_r5_ptp_get_battery_info(struct canon_r5_device *dev, u32 *level, u32 *status)
 {
-	if (!dev || !level || !status) return -EINVAL;
-	*level = 85; *status = 1;
+	int ret;
+	
+	if (!dev || !level || !status)
+		return -EINVAL;
+	
+	ret = canon_r5_props_get(dev, PTP_DPC_BATTERY_LEVEL, level, sizeof(*level));
+	if (ret)
+		return ret;
+	
+	/* Older bodies do not report a status; treat that as "normal" */
+	if (canon_r5_props_get(dev, CANON_PTP_DPC_BATTERY_STATUS, status, sizeof(*status)))
+		*status = 1;
+	
 	return 0;
 }
 EXPORT_SYMBOL_GPL(canon_r5_ptp_get_battery_info);
@@ -742,4 +2003,198 @@ int canon_r5_ptp_get_captured_image(struct canon_r5_device *dev, u32 object_id,
 	*data = NULL; *size = 0;
 	return -ENODATA;
 }
-EXPORT_SYMBOL_GPL(canon_r5_ptp_get_captured_image);
\ No newline at end of file
+EXPORT_SYMBOL_GPL(canon_r5_ptp_get_captured_image);
+
+/* Download an object straight into a caller-provided buffer */
+int canon_r5_ptp_get_object_into(struct canon_r5_device *dev, u32 object_handle,
+				 void *buffer, size_t buffer_len, size_t *object_size)
+{
+	struct canon_r5_ptp_transaction trans;
+	int ret;
+	
+	if (!dev || !buffer || !buffer_len || !object_size)
+		return -EINVAL;
+	
+	*object_size = 0;
+	
+	canon_r5_ptp_transaction_init(&trans, PTP_OP_GET_OBJECT, &object_handle, 1);
+	trans.data_in = buffer;
+	trans.data_in_len = buffer_len;
+	
+	ret = canon_r5_ptp_transact(dev, &trans);
+	if (ret) {
+		canon_r5_dbg(dev, "Failed to get object 0x%08x: %d", object_handle, ret);
+		return ret;
+	}
+	
+	if (trans.response_code != PTP_RC_OK) {
+		canon_r5_dbg(dev, "Get object 0x%08x failed: 0x%04x",
+			     object_handle, trans.response_code);
+		return -EIO;
+	}
+	
+	if (trans.data_in_length > trans.data_in_actual) {
+		canon_r5_dbg(dev, "Object 0x%08x exceeds buffer (%zu > %zu bytes)",
+			     object_handle, trans.data_in_length, trans.data_in_actual);
+		return -EMSGSIZE;
+	}
+	
+	*object_size = trans.data_in_actual;
+	return 0;
+}
+EXPORT_SYMBOL_GPL(canon_r5_ptp_get_object_into);
+
+/* Streaming object reader */
+
+void canon_r5_ptp_reader_init(struct canon_r5_ptp_object_reader *reader,
+			      struct canon_r5_device *dev, u32 object_handle,
+			      u64 offset, u64 length, void *dest)
+{
+	memset(reader, 0, sizeof(*reader));
+	reader->dev = dev;
+	reader->object_handle = object_handle;
+	reader->start = offset;
+	reader->offset = offset;
+	reader->end = offset + length;
+	reader->dest = dest;
+	reader->chunk_size = CANON_R5_PTP_READER_CHUNK_SIZE;
+	reader->depth = CANON_R5_PTP_READER_DEPTH;
+}
+EXPORT_SYMBOL_GPL(canon_r5_ptp_reader_init);
+
+/* Request the next chunk of the object into ring slot @index */
+static int canon_r5_ptp_reader_issue(struct canon_r5_ptp_object_reader *reader,
+				     unsigned int index)
+{
+	struct canon_r5_ptp_reader_chunk *chunk = &reader->chunk[index];
+	size_t len = min_t(u64, reader->chunk_size, reader->end - reader->offset);
+	u32 params[4];
+	int ret;
+	
+	if (reader->offset + len > U32_MAX) {
+		params[0] = reader->object_handle;
+		params[1] = lower_32_bits(reader->offset);
+		params[2] = upper_32_bits(reader->offset);
+		params[3] = len;
+		canon_r5_ptp_transaction_init(&chunk->trans, CANON_PTP_OP_GET_PARTIAL_OBJECT_64,
+					      params, 4);
+		/* The opcode alone reads as an audio command */
+		chunk->trans.traffic_class = CANON_R5_PTP_CLASS_BULK;
+	} else {
+		params[0] = reader->object_handle;
+		params[1] = reader->offset;
+		params[2] = len;
+		canon_r5_ptp_transaction_init(&chunk->trans, CANON_PTP_OP_GET_PARTIAL_OBJECT,
+					      params, 3);
+	}
+	
+	if (reader->dest)
+		chunk->buffer = (u8 *)reader->dest + (reader->offset - reader->start);
+	else
+		chunk->buffer = (u8 *)reader->bounce + index * reader->chunk_size;
+	
+	chunk->trans.data_in = chunk->buffer;
+	chunk->trans.data_in_len = len;
+	chunk->offset = reader->offset;
+	chunk->len = len;
+	
+	ret = canon_r5_ptp_submit(reader->dev, &chunk->trans);
+	if (ret)
+		return ret;
+	
+	chunk->busy = true;
+	reader->offset += len;
+	return 0;
+}
+
+/* Run the transfer to completion; returns 0 once the range or the object is done */
+int canon_r5_ptp_reader_run(struct canon_r5_ptp_object_reader *reader)
+{
+	struct canon_r5_device *dev;
+	struct canon_r5_ptp_reader_chunk *chunk;
+	unsigned int i, head = 0;
+	size_t got;
+	int ret = 0;
+	
+	if (!reader || !reader->dev || !reader->chunk_size || reader->end < reader->start)
+		return -EINVAL;
+	
+	dev = reader->dev;
+	reader->depth = clamp_t(unsigned int, reader->depth, 1, CANON_R5_PTP_READER_MAX_DEPTH);
+	reader->consumed = 0;
+	reader->eof = false;
+	
+	if (!reader->dest) {
+		reader->bounce = kvmalloc_array(reader->depth, reader->chunk_size, GFP_KERNEL);
+		if (!reader->bounce)
+			return -ENOMEM;
+	}
+	
+	for (i = 0; i < reader->depth && reader->offset < reader->end; i++) {
+		ret = canon_r5_ptp_reader_issue(reader, i);
+		if (ret)
+			goto out_cancel;
+	}
+	
+	/* Chunks complete in the order they were issued, head is the oldest */
+	while (reader->chunk[head].busy) {
+		chunk = &reader->chunk[head];
+		
+		ret = canon_r5_ptp_wait(dev, &chunk->trans, CANON_R5_PTP_TIMEOUT_MS);
+		chunk->busy = false;
+		if (!ret && chunk->trans.response_code != PTP_RC_OK) {
+			canon_r5_dbg(dev, "Partial read of 0x%08x at %llu failed: 0x%04x",
+				     reader->object_handle, chunk->offset,
+				     chunk->trans.response_code);
+			ret = -EIO;
+		}
+		if (ret)
+			goto out_cancel;
+		
+		got = min(chunk->trans.data_in_actual, chunk->len);
+		if (got && reader->consume) {
+			ret = reader->consume(reader, chunk->offset, chunk->buffer, got);
+			if (ret)
+				goto out_cancel;
+		}
+		reader->consumed += got;
+		
+		if (got < chunk->len) {
+			reader->eof = true;
+			goto out_drain;
+		}
+		
+		if (reader->offset < reader->end) {
+			ret = canon_r5_ptp_reader_issue(reader, head);
+			if (ret)
+				goto out_cancel;
+		}
+		
+		head = (head + 1) % reader->depth;
+	}
+	goto out;
+
+out_drain:
+	/* Reads issued past the end of the object come back empty or refused */
+	for (i = 0; i < reader->depth; i++) {
+		if (!reader->chunk[i].busy)
+			continue;
+		canon_r5_ptp_wait(dev, &reader->chunk[i].trans, CANON_R5_PTP_TIMEOUT_MS);
+		reader->chunk[i].busy = false;
+	}
+	goto out;
+
+out_cancel:
+	for (i = 0; i < reader->depth; i++) {
+		if (!reader->chunk[i].busy)
+			continue;
+		canon_r5_ptp_cancel(dev, &reader->chunk[i].trans, -ECANCELED);
+		reader->chunk[i].busy = false;
+	}
+
+out:
+	kvfree(reader->bounce);
+	reader->bounce = NULL;
+	return ret;
+}
+EXPORT_SYMBOL_GPL(canon_r5_ptp_reader_run);
@@ -0,0 +1,488 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Canon R5 Linux Driver Suite
+ * PTP transaction statistics, driver counter sets and tracepoints
+ *
+ * Copyright (C) 2025 Canon R5 Driver Project
+ */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/percpu.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/ktime.h>
+#include <linux/bitops.h>
+#include <linux/slab.h>
+#include <linux/kobject.h>
+#include <linux/sysfs.h>
+#include <linux/u64_stats_sync.h>
+
+#include "../../include/core/canon-r5.h"
+#include "../../include/core/canon-r5-ptp.h"
+
+#define CREATE_TRACE_POINTS
+#include "../../include/core/canon-r5-trace.h"
+
+/* The USB transport lives in its own module */
+EXPORT_TRACEPOINT_SYMBOL_GPL(canon_r5_urb_complete);
+
+/*
+ * Per-device debugfs under canon-r5/<device>/:
+ *   ptp_latency	per-opcode counts, bytes, errors and log2 latency histogram
+ *   ptp_reset		write to clear the counters
+ *   stats		every registered counter set, one <set>.<counter> per line
+ * Feature drivers add their own counters to the same directory.
+ *
+ * Counter sets also appear in sysfs as canon-r5-N/stats/<set>/<counter>.
+ */
+
+static struct dentry *canon_r5_debugfs_root;
+
+/* Find or claim the slot for an opcode; the last slot takes the overflow */
+static unsigned int canon_r5_stats_slot(struct canon_r5_stats *stats, u16 code)
+{
+	unsigned int i;
+	
+	for (i = 0; i < CANON_R5_STATS_OPCODES - 1; i++) {
+		if (stats->codes[i] == code)
+			return i;
+		if (!stats->codes[i]) {
+			WRITE_ONCE(stats->codes[i], code);
+			return i;
+		}
+	}
+	
+	return CANON_R5_STATS_OPCODES - 1;
+}
+
+/* Bucket n holds latencies below 2^n microseconds */
+static unsigned int canon_r5_stats_bucket(u64 us)
+{
+	return min_t(unsigned int, fls64(us), CANON_R5_STATS_BUCKETS - 1);
+}
+
+/*
+ * Account a retired transaction that took @us since submission. Called
+ * with transaction_lock held and interrupts off, which also serialises
+ * slot claims, so the per-CPU counters need no further protection.
+ */
+void canon_r5_stats_record(struct canon_r5_device *dev,
+			   const struct canon_r5_ptp_transaction *trans, u64 us, bool sent)
+{
+	struct canon_r5_stats *stats = &dev->stats;
+	struct canon_r5_ptp_op_stats *op;
+	
+	if (!stats->ops)
+		return;
+	
+	op = this_cpu_ptr(stats->ops) + canon_r5_stats_slot(stats, trans->code);
+	op->count++;
+	if (trans->status || trans->response_code != PTP_RC_OK)
+		op->errors++;
+	op->bytes_in += trans->data_in_actual;
+	if (sent)
+		op->bytes_out += trans->data_out_len;
+	op->latency[canon_r5_stats_bucket(us)]++;
+}
+EXPORT_SYMBOL_GPL(canon_r5_stats_record);
+
+/* Sum one slot over all CPUs; returns the opcode, or 0 for an unused slot */
+u16 canon_r5_stats_read(struct canon_r5_device *dev, unsigned int slot,
+			struct canon_r5_ptp_op_stats *sum)
+{
+	const struct canon_r5_ptp_op_stats *op;
+	unsigned int i;
+	int cpu;
+	
+	memset(sum, 0, sizeof(*sum));
+	
+	if (!dev->stats.ops || slot >= CANON_R5_STATS_OPCODES)
+		return 0;
+	
+	for_each_possible_cpu(cpu) {
+		op = per_cpu_ptr(dev->stats.ops, cpu) + slot;
+		sum->count += op->count;
+		sum->errors += op->errors;
+		sum->bytes_in += op->bytes_in;
+		sum->bytes_out += op->bytes_out;
+		for (i = 0; i < CANON_R5_STATS_BUCKETS; i++)
+			sum->latency[i] += op->latency[i];
+	}
+	
+	if (slot == CANON_R5_STATS_OPCODES - 1)
+		return sum->count ? 0xffff : 0;
+	
+	return READ_ONCE(dev->stats.codes[slot]);
+}
+EXPORT_SYMBOL_GPL(canon_r5_stats_read);
+
+/* Upper bound in microseconds of the bucket holding the given percentile */
+u64 canon_r5_stats_percentile(const struct canon_r5_ptp_op_stats *sum, unsigned int pct)
+{
+	u64 seen = 0, target;
+	unsigned int i;
+	
+	if (!sum->count)
+		return 0;
+	
+	target = div_u64(sum->count * pct + 99, 100);
+	
+	for (i = 0; i < CANON_R5_STATS_BUCKETS; i++) {
+		seen += sum->latency[i];
+		if (seen >= target)
+			break;
+	}
+	
+	return 1ULL << min_t(unsigned int, i, CANON_R5_STATS_BUCKETS - 1);
+}
+EXPORT_SYMBOL_GPL(canon_r5_stats_percentile);
+
+/* Per-device debugfs directory, or NULL when debugfs is unavailable */
+struct dentry *canon_r5_stats_debugfs_dir(struct canon_r5_device *dev)
+{
+	return dev->stats.debugfs;
+}
+EXPORT_SYMBOL_GPL(canon_r5_stats_debugfs_dir);
+
+static int canon_r5_stats_latency_show(struct seq_file *m, void *v)
+{
+	struct canon_r5_device *dev = m->private;
+	struct canon_r5_ptp_op_stats sum;
+	unsigned int slot, i;
+	u16 code;
+	
+	seq_puts(m, "opcode  count      errors   bytes_in     bytes_out    p50_us    p90_us    p99_us\n");
+	
+	for (slot = 0; slot < CANON_R5_STATS_OPCODES; slot++) {
+		code = canon_r5_stats_read(dev, slot, &sum);
+		if (!code || !sum.count)
+			continue;
+	
+		if (code == 0xffff)
+			seq_puts(m, "other ");
+		else
+			seq_printf(m, "0x%04x", code);
+		seq_printf(m, "  %-10llu %-8llu %-12llu %-12llu %-9llu %-9llu %llu\n",
+			   sum.count, sum.errors, sum.bytes_in, sum.bytes_out,
+			   canon_r5_stats_percentile(&sum, 50),
+			   canon_r5_stats_percentile(&sum, 90),
+			   canon_r5_stats_percentile(&sum, 99));
+	
+		seq_puts(m, "       ");
+		for (i = 0; i < CANON_R5_STATS_BUCKETS; i++) {
+			if (sum.latency[i])
+				seq_printf(m, " <%lluus:%llu", 1ULL << i, sum.latency[i]);
+		}
+		seq_putc(m, '\n');
+	}
+	
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(canon_r5_stats_latency);
+
+/* Writing anything clears the counters; opcode slots stay claimed */
+static ssize_t canon_r5_stats_reset_write(struct file *file, const char __user *buf,
+					  size_t count, loff_t *ppos)
+{
+	struct canon_r5_device *dev = file->private_data;
+	unsigned long flags;
+	int cpu;
+	
+	if (!dev->stats.ops)
+		return count;
+	
+	spin_lock_irqsave(&dev->transaction_lock, flags);
+	for_each_possible_cpu(cpu)
+		memset(per_cpu_ptr(dev->stats.ops, cpu), 0,
+		       sizeof(struct canon_r5_ptp_op_stats) * CANON_R5_STATS_OPCODES);
+	spin_unlock_irqrestore(&dev->transaction_lock, flags);
+	
+	return count;
+}
+
+static const struct file_operations canon_r5_stats_reset_fops = {
+	.owner		= THIS_MODULE,
+	.open		= simple_open,
+	.write		= canon_r5_stats_reset_write,
+	.llseek		= noop_llseek,
+};
+
+/* Counter sets */
+
+struct canon_r5_counter_attr {
+	struct kobj_attribute	attr;
+	struct canon_r5_counter_set *set;
+	unsigned int		index;
+};
+
+/* Each CPU's counters are read as one consistent snapshot */
+static void canon_r5_counters_sum(struct canon_r5_counter_set *set, u64 *vals)
+{
+	const struct canon_r5_counters_pcpu *c;
+	u64 snap[CANON_R5_COUNTERS_MAX];
+	unsigned int start, i;
+	int cpu;
+	
+	memset(vals, 0, sizeof(*vals) * set->count);
+	
+	for_each_possible_cpu(cpu) {
+		c = per_cpu_ptr(set->pcpu, cpu);
+		do {
+			start = u64_stats_fetch_begin(&c->syncp);
+			for (i = 0; i < set->count; i++)
+				snap[i] = u64_stats_read(&c->val[i]);
+		} while (u64_stats_fetch_retry(&c->syncp, start));
+	
+		for (i = 0; i < set->count; i++)
+			vals[i] += snap[i];
+	}
+}
+
+/* Totals since the last reset */
+void canon_r5_counters_read(struct canon_r5_counter_set *set, u64 *vals)
+{
+	unsigned long flags;
+	unsigned int i;
+	
+	if (!set->pcpu) {
+		memset(vals, 0, sizeof(*vals) * set->count);
+		return;
+	}
+	
+	spin_lock_irqsave(&set->base_lock, flags);
+	canon_r5_counters_sum(set, vals);
+	for (i = 0; i < set->count; i++)
+		vals[i] -= set->base[i];
+	spin_unlock_irqrestore(&set->base_lock, flags);
+}
+EXPORT_SYMBOL_GPL(canon_r5_counters_read);
+
+u64 canon_r5_counter_read(struct canon_r5_counter_set *set, unsigned int idx)
+{
+	u64 vals[CANON_R5_COUNTERS_MAX];
+	
+	if (idx >= set->count)
+		return 0;
+	
+	canon_r5_counters_read(set, vals);
+	return vals[idx];
+}
+EXPORT_SYMBOL_GPL(canon_r5_counter_read);
+
+/* Updates racing with a reset land on one side of it or the other */
+void canon_r5_counters_reset(struct canon_r5_counter_set *set)
+{
+	unsigned long flags;
+	
+	if (!set->pcpu)
+		return;
+	
+	spin_lock_irqsave(&set->base_lock, flags);
+	canon_r5_counters_sum(set, set->base);
+	spin_unlock_irqrestore(&set->base_lock, flags);
+}
+EXPORT_SYMBOL_GPL(canon_r5_counters_reset);
+
+static ssize_t canon_r5_counter_show(struct kobject *kobj, struct kobj_attribute *attr,
+				     char *buf)
+{
+	struct canon_r5_counter_attr *ca = container_of(attr, struct canon_r5_counter_attr, attr);
+	
+	return sysfs_emit(buf, "%llu\n", canon_r5_counter_read(ca->set, ca->index));
+}
+
+/* One read-only file per counter under stats/<set>; best effort */
+static void canon_r5_counters_sysfs_add(struct canon_r5_counter_set *set)
+{
+	struct attribute_group group = {};
+	struct attribute **list;
+	unsigned int i;
+	int ret;
+	
+	if (!set->dev->stats.kobj)
+		return;
+	
+	set->attrs = kcalloc(set->count, sizeof(*set->attrs), GFP_KERNEL);
+	list = kcalloc(set->count + 1, sizeof(*list), GFP_KERNEL);
+	if (!set->attrs || !list)
+		goto fail;
+	
+	for (i = 0; i < set->count; i++) {
+		struct canon_r5_counter_attr *ca = &set->attrs[i];
+		
+		sysfs_attr_init(&ca->attr.attr);
+		ca->attr.attr.name = set->names[i];
+		ca->attr.attr.mode = 0444;
+		ca->attr.show = canon_r5_counter_show;
+		ca->set = set;
+		ca->index = i;
+		list[i] = &ca->attr.attr;
+	}
+	group.attrs = list;
+	
+	set->kobj = kobject_create_and_add(set->name, set->dev->stats.kobj);
+	if (!set->kobj)
+		goto fail;
+	
+	ret = sysfs_create_group(set->kobj, &group);
+	if (ret) {
+		kobject_put(set->kobj);
+		set->kobj = NULL;
+		goto fail;
+	}
+	
+	kfree(list);
+	return;
+	
+fail:
+	canon_r5_warn(set->dev, "No sysfs counters for %s", set->name);
+	kfree(list);
+	kfree(set->attrs);
+	set->attrs = NULL;
+}
+
+/*
+ * Allocate a set of @count counters named by @names, which must outlive
+ * the set. With a NULL @dev the counters work but are not published.
+ */
+int canon_r5_counters_register(struct canon_r5_device *dev, struct canon_r5_counter_set *set,
+			       const char *name, const char * const *names, unsigned int count)
+{
+	int cpu;
+	
+	if (!count || count > CANON_R5_COUNTERS_MAX)
+		return -EINVAL;
+	
+	strscpy(set->name, name, sizeof(set->name));
+	set->names = names;
+	set->count = count;
+	spin_lock_init(&set->base_lock);
+	INIT_LIST_HEAD(&set->list);
+	set->dev = NULL;
+	set->kobj = NULL;
+	set->attrs = NULL;
+	
+	set->pcpu = __alloc_percpu(sizeof(struct canon_r5_counters_pcpu) + count * sizeof(u64_stats_t),
+				   __alignof__(struct canon_r5_counters_pcpu));
+	set->base = kcalloc(count, sizeof(*set->base), GFP_KERNEL);
+	if (!set->pcpu || !set->base) {
+		free_percpu(set->pcpu);
+		set->pcpu = NULL;
+		kfree(set->base);
+		set->base = NULL;
+		return -ENOMEM;
+	}
+	
+	for_each_possible_cpu(cpu)
+		u64_stats_init(&per_cpu_ptr(set->pcpu, cpu)->syncp);
+	
+	if (!dev)
+		return 0;
+	
+	set->dev = dev;
+	mutex_lock(&dev->stats.sets_lock);
+	list_add_tail(&set->list, &dev->stats.sets);
+	mutex_unlock(&dev->stats.sets_lock);
+	
+	canon_r5_counters_sysfs_add(set);
+	
+	return 0;
+}
+EXPORT_SYMBOL_GPL(canon_r5_counters_register);
+
+/* The owner must have stopped updating the set */
+void canon_r5_counters_unregister(struct canon_r5_counter_set *set)
+{
+	if (set->dev) {
+		mutex_lock(&set->dev->stats.sets_lock);
+		list_del(&set->list);
+		mutex_unlock(&set->dev->stats.sets_lock);
+	
+		/* Removing the files waits for any show() still running */
+		kobject_put(set->kobj);
+		set->kobj = NULL;
+		kfree(set->attrs);
+		set->attrs = NULL;
+		set->dev = NULL;
+	}
+	
+	free_percpu(set->pcpu);
+	set->pcpu = NULL;
+	kfree(set->base);
+	set->base = NULL;
+}
+EXPORT_SYMBOL_GPL(canon_r5_counters_unregister);
+
+static int canon_r5_stats_counters_show(struct seq_file *m, void *v)
+{
+	struct canon_r5_device *dev = m->private;
+	struct canon_r5_counter_set *set;
+	u64 vals[CANON_R5_COUNTERS_MAX];
+	unsigned int i;
+	
+	mutex_lock(&dev->stats.sets_lock);
+	list_for_each_entry(set, &dev->stats.sets, list) {
+		canon_r5_counters_read(set, vals);
+		for (i = 0; i < set->count; i++)
+			seq_printf(m, "%s.%s: %llu\n", set->name, set->names[i], vals[i]);
+	}
+	mutex_unlock(&dev->stats.sets_lock);
+	
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(canon_r5_stats_counters);
+
+/* Statistics are best effort; a device without them still works */
+void canon_r5_stats_init(struct canon_r5_device *dev)
+{
+	struct canon_r5_stats *stats = &dev->stats;
+	
+	mutex_init(&stats->sets_lock);
+	INIT_LIST_HEAD(&stats->sets);
+	
+	if (dev->sysfs_kobj) {
+		stats->kobj = kobject_create_and_add("stats", dev->sysfs_kobj);
+		if (!stats->kobj)
+			canon_r5_warn(dev, "Counter sysfs directory unavailable");
+	}
+	
+	stats->ops = __alloc_percpu(sizeof(struct canon_r5_ptp_op_stats) * CANON_R5_STATS_OPCODES,
+				    __alignof__(struct canon_r5_ptp_op_stats));
+	if (!stats->ops)
+		canon_r5_warn(dev, "PTP statistics unavailable");
+	
+	if (!canon_r5_debugfs_root)
+		return;
+	
+	stats->debugfs = debugfs_create_dir(dev_name(dev->dev), canon_r5_debugfs_root);
+	debugfs_create_file("ptp_latency", 0444, stats->debugfs, dev,
+			    &canon_r5_stats_latency_fops);
+	debugfs_create_file("ptp_reset", 0200, stats->debugfs, dev,
+			    &canon_r5_stats_reset_fops);
+	debugfs_create_file("stats", 0444, stats->debugfs, dev,
+			    &canon_r5_stats_counters_fops);
+}
+
+void canon_r5_stats_free(struct canon_r5_device *dev)
+{
+	kobject_put(dev->stats.kobj);
+	dev->stats.kobj = NULL;
+	debugfs_remove_recursive(dev->stats.debugfs);
+	dev->stats.debugfs = NULL;
+	free_percpu(dev->stats.ops);
+	dev->stats.ops = NULL;
+}
+
+void canon_r5_stats_module_init(void)
+{
+	canon_r5_debugfs_root = debugfs_create_dir(CANON_R5_MODULE_NAME, NULL);
+	if (IS_ERR(canon_r5_debugfs_root))
+		canon_r5_debugfs_root = NULL;
+}
+
+void canon_r5_stats_module_exit(void)
+{
+	debugfs_remove_recursive(canon_r5_debugfs_root);
+	canon_r5_debugfs_root = NULL;
+}
@@ -12,10 +12,32 @@
 #include <linux/usb.h>
 #include <linux/slab.h>
 #include <linux/mutex.h>
+#include <linux/spinlock.h>
 #include <linux/completion.h>
+#include <linux/workqueue.h>
 
 #include "../../include/core/canon-r5.h"
 #include "../../include/core/canon-r5-ptp.h"
+#include "../../include/core/canon-r5-trace.h"
+
+/* Bulk transfer resources, allocated once at probe */
+#define CANON_R5_USB_MAX_RX_URBS	16
+#define CANON_R5_USB_TX_URBS		2
+#define CANON_R5_USB_MIN_URB_SIZE	(64 * 1024)
+#define CANON_R5_USB_SYNC_BUFFER_SIZE	(64 * 1024)
+#define CANON_R5_USB_TIMEOUT_MS		5000
+
+/* One persistent URB with its coherent transfer buffer */
+struct canon_r5_usb_xfer {
+	struct canon_r5_device	*dev;
+	struct urb		*urb;
+	void			*buffer;
+	dma_addr_t		dma;
+	size_t			size;
+	struct completion	done;
+	bool			busy;
+	struct list_head	list;		/* on rx_done once completed */
+};
 
 /* USB transport layer structure */
 struct canon_r5_usb {
@@ -26,7 +48,28 @@ struct canon_r5_usb {
 	struct usb_endpoint_descriptor *ep_bulk_out;
 	struct urb		*int_urb;
 	u8			*int_buffer;
+	struct work_struct	int_reset_work;
 	size_t			max_packet_size;
+	
+	/* Streaming bulk IN */
+	struct canon_r5_usb_xfer rx[CANON_R5_USB_MAX_RX_URBS];
+	unsigned int		rx_count;
+	struct usb_anchor	rx_anchor;
+	bool			rx_running;
+	struct workqueue_struct	*rx_wq;
+	struct work_struct	rx_work;
+	struct list_head	rx_done;	/* rx_lock */
+	spinlock_t		rx_lock;
+	void (*rx_complete)(struct canon_r5_device *dev, const void *data,
+			    size_t len, int status);
+	
+	/* Double-buffered bulk OUT */
+	struct canon_r5_usb_xfer tx[CANON_R5_USB_TX_URBS];
+	struct mutex		tx_lock;
+	
+	/* Bounce buffer for synchronous bulk IN */
+	void			*sync_buffer;
+	struct mutex		sync_lock;
 };
 
 MODULE_AUTHOR("Canon R5 Driver Project");
@@ -35,6 +78,14 @@ MODULE_LICENSE("GPL v2");
 MODULE_VERSION(CANON_R5_DRIVER_VERSION);
 MODULE_SOFTDEP("pre: canon-r5-core");
 
+static unsigned int rx_urbs = 4;
+module_param(rx_urbs, uint, 0444);
+MODULE_PARM_DESC(rx_urbs, "Number of bulk IN URBs kept in flight (1-16)");
+
+static unsigned int urb_size_kb = 512;
+module_param(urb_size_kb, uint, 0444);
+MODULE_PARM_DESC(urb_size_kb, "Size of each bulk URB buffer in KiB (64-4096)");
+
 /* Forward declarations for USB transport functions */
 
 /* USB device table - PIDs will be updated when actual device is analyzed */
@@ -45,17 +96,24 @@ static const struct usb_device_id canon_r5_usb_id_table[] = {
 };
 MODULE_DEVICE_TABLE(usb, canon_r5_usb_id_table);
 
-/* USB bulk transfer completion callback */
-/* Not currently used; keep as placeholder but annotate to avoid warnings */
-static void __maybe_unused canon_r5_usb_bulk_callback(struct urb *urb)
+/* USB bulk IN completion: leave the copy to rx_work, outside interrupt context */
+static void canon_r5_usb_bulk_callback(struct urb *urb)
 {
-	struct canon_r5_device *dev = urb->context;
+	struct canon_r5_usb_xfer *xfer = urb->context;
+	struct canon_r5_device *dev = xfer ? xfer->dev : NULL;
+	struct canon_r5_usb *usb;
+	unsigned long flags;
 	
 	if (!dev) {
 		pr_err("canon-r5-usb: NULL device in bulk callback\n");
 		return;
 	}
 	
+	trace_canon_r5_urb_complete(dev->dev, urb->ep->desc.bEndpointAddress, urb->status,
+				    urb->actual_length, urb->transfer_buffer_length);
+	
+	usb = dev->usb;
+	
 	switch (urb->status) {
 	case 0:
 		/* Success */
@@ -64,9 +122,12 @@ static void __maybe_unused canon_r5_usb_bulk_callback(struct urb *urb)
 		break;
 	case -ECONNRESET:
 	case -ENOENT:
-	case -ESHUTDOWN:
-		/* URB was cancelled */
+		/* Killed by rx_reset, or by rx_stop, which reports the teardown itself */
 		canon_r5_dbg(dev, "USB bulk transfer cancelled");
+		return;
+	case -ESHUTDOWN:
+		/* The device or its host controller is gone; the consumer fails what is in flight */
+		canon_r5_dbg(dev, "USB bulk transfer shut down");
 		break;
 	case -EPROTO:
 		canon_r5_warn(dev, "USB protocol error in bulk transfer");
@@ -78,13 +139,30 @@ static void __maybe_unused canon_r5_usb_bulk_callback(struct urb *urb)
 		canon_r5_warn(dev, "USB timeout in bulk transfer");
 		break;
 	case -EPIPE:
+		/* Clearing the halt sleeps, rx_work restarts the stream */
 		canon_r5_warn(dev, "USB endpoint stalled in bulk transfer");
-		usb_clear_halt(dev->usb->udev, urb->pipe);
 		break;
 	default:
 		canon_r5_err(dev, "USB bulk transfer failed with error %d", urb->status);
 		break;
 	}
+	
+	spin_lock_irqsave(&usb->rx_lock, flags);
+	list_add_tail(&xfer->list, &usb->rx_done);
+	spin_unlock_irqrestore(&usb->rx_lock, flags);
+	
+	if (READ_ONCE(usb->rx_running))
+		queue_work(usb->rx_wq, &usb->rx_work);
+}
+
+/* USB bulk OUT completion */
+static void canon_r5_usb_tx_callback(struct urb *urb)
+{
+	struct canon_r5_usb_xfer *xfer = urb->context;
+	
+	trace_canon_r5_urb_complete(xfer->dev->dev, urb->ep->desc.bEndpointAddress, urb->status,
+				    urb->actual_length, urb->transfer_buffer_length);
+	complete(&xfer->done);
 }
 
 /* USB interrupt transfer completion callback */
@@ -98,13 +176,13 @@ static void canon_r5_usb_int_callback(struct urb *urb)
 		return;
 	}
 	
+	trace_canon_r5_urb_complete(dev->dev, urb->ep->desc.bEndpointAddress, urb->status,
+				    urb->actual_length, urb->transfer_buffer_length);
+	
 	switch (urb->status) {
 	case 0:
-		/* Success - process the interrupt data */
-		canon_r5_dbg(dev, "USB interrupt received (%d bytes)", urb->actual_length);
-		
-		/* Trigger event processing */
-		canon_r5_notify_event(dev, 0, NULL);
+		/* Success - queue the event container for dispatch */
+		canon_r5_ptp_event_received(dev, urb->transfer_buffer, urb->actual_length);
 		break;
 	case -ECONNRESET:
 	case -ENOENT:
@@ -122,9 +200,10 @@ static void canon_r5_usb_int_callback(struct urb *urb)
 		canon_r5_warn(dev, "USB timeout in interrupt transfer");
 		break;
 	case -EPIPE:
+		/* usb_clear_halt() sleeps; the reset work resubmits */
 		canon_r5_warn(dev, "USB endpoint stalled in interrupt transfer");
-		usb_clear_halt(dev->usb->udev, urb->pipe);
-		break;
+		schedule_work(&dev->usb->int_reset_work);
+		return;
 	default:
 		canon_r5_err(dev, "USB interrupt transfer failed with error %d", urb->status);
 		break;
@@ -139,6 +218,24 @@ static void canon_r5_usb_int_callback(struct urb *urb)
 	}
 }
 
+/* Recover from an interrupt IN stall outside of URB completion context */
+static void canon_r5_usb_int_reset_work(struct work_struct *work)
+{
+	struct canon_r5_usb *usb = container_of(work, struct canon_r5_usb, int_reset_work);
+	struct canon_r5_device *dev = usb->int_urb->context;
+	int ret;
+	
+	ret = usb_clear_halt(usb->udev, usb->int_urb->pipe);
+	if (ret)
+		canon_r5_warn(dev, "Failed to clear interrupt IN halt: %d", ret);
+	
+	if (canon_r5_get_state(dev) != CANON_R5_STATE_DISCONNECTED) {
+		ret = usb_submit_urb(usb->int_urb, GFP_KERNEL);
+		if (ret)
+			canon_r5_err(dev, "Failed to resubmit interrupt URB: %d", ret);
+	}
+}
+
 /* Initialize USB endpoints and URBs */
 static int canon_r5_usb_init_endpoints(struct canon_r5_device *dev)
 {
@@ -200,6 +297,8 @@ static int canon_r5_usb_init_endpoints(struct canon_r5_device *dev)
 		return -ENOMEM;
 	}
 	
+	INIT_WORK(&dev->usb->int_reset_work, canon_r5_usb_int_reset_work);
+	
 	/* Initialize interrupt URB */
 	usb_fill_int_urb(dev->usb->int_urb, dev->usb->udev,
 			 usb_rcvintpipe(dev->usb->udev, dev->usb->ep_int_in->bEndpointAddress),
@@ -224,7 +323,9 @@ static int canon_r5_usb_init_endpoints(struct canon_r5_device *dev)
 static void canon_r5_usb_cleanup_endpoints(struct canon_r5_device *dev)
 {
 	if (dev->usb->int_urb) {
-		usb_kill_urb(dev->usb->int_urb);
+		/* Poison first so the reset work cannot resubmit */
+		usb_poison_urb(dev->usb->int_urb);
+		cancel_work_sync(&dev->usb->int_reset_work);
 		usb_free_urb(dev->usb->int_urb);
 		dev->usb->int_urb = NULL;
 	}
@@ -235,40 +336,355 @@ static void canon_r5_usb_cleanup_endpoints(struct canon_r5_device *dev)
 	}
 }
 
+/* Allocate one URB and its coherent buffer, halving the size on failure */
+static int canon_r5_usb_alloc_xfer(struct canon_r5_device *dev, struct canon_r5_usb_xfer *xfer,
+				   size_t size)
+{
+	xfer->dev = dev;
+	init_completion(&xfer->done);
+	
+	xfer->urb = usb_alloc_urb(0, GFP_KERNEL);
+	if (!xfer->urb)
+		return -ENOMEM;
+	
+	for (;;) {
+		xfer->buffer = usb_alloc_coherent(dev->usb->udev, size, GFP_KERNEL, &xfer->dma);
+		if (xfer->buffer) {
+			xfer->size = size;
+			return 0;
+		}
+		if (size <= CANON_R5_USB_MIN_URB_SIZE)
+			break;
+		size /= 2;
+	}
+	
+	usb_free_urb(xfer->urb);
+	xfer->urb = NULL;
+	return -ENOMEM;
+}
+
+static void canon_r5_usb_free_xfer(struct canon_r5_device *dev, struct canon_r5_usb_xfer *xfer)
+{
+	if (xfer->buffer)
+		usb_free_coherent(dev->usb->udev, xfer->size, xfer->buffer, xfer->dma);
+	usb_free_urb(xfer->urb);
+	xfer->buffer = NULL;
+	xfer->urb = NULL;
+}
+
+/* Release all bulk transfer resources */
+static void canon_r5_usb_free_transfers(struct canon_r5_device *dev)
+{
+	struct canon_r5_usb *usb = dev->usb;
+	unsigned int i;
+	
+	for (i = 0; i < usb->rx_count; i++)
+		canon_r5_usb_free_xfer(dev, &usb->rx[i]);
+	usb->rx_count = 0;
+	
+	for (i = 0; i < CANON_R5_USB_TX_URBS; i++)
+		canon_r5_usb_free_xfer(dev, &usb->tx[i]);
+	
+	kfree(usb->sync_buffer);
+	usb->sync_buffer = NULL;
+}
+
+/* Recover from a bulk IN stall: clear the halt and restart the ring. Runs in rx_work */
+static void canon_r5_usb_rx_reset(struct canon_r5_usb *usb, struct canon_r5_device *dev)
+{
+	unsigned long flags;
+	unsigned int i;
+	int ret;
+	
+	usb_kill_anchored_urbs(&usb->rx_anchor);
+	
+	/* Whatever completed behind the stall is lost with it */
+	spin_lock_irqsave(&usb->rx_lock, flags);
+	INIT_LIST_HEAD(&usb->rx_done);
+	spin_unlock_irqrestore(&usb->rx_lock, flags);
+	
+	ret = usb_clear_halt(usb->udev, usb_rcvbulkpipe(usb->udev,
+							usb->ep_bulk_in->bEndpointAddress));
+	if (ret)
+		canon_r5_warn(dev, "Failed to clear bulk IN halt: %d", ret);
+	
+	for (i = 0; i < usb->rx_count && READ_ONCE(usb->rx_running); i++) {
+		usb_anchor_urb(usb->rx[i].urb, &usb->rx_anchor);
+		ret = usb_submit_urb(usb->rx[i].urb, GFP_KERNEL);
+		if (ret) {
+			usb_unanchor_urb(usb->rx[i].urb);
+			canon_r5_err(dev, "Failed to restart bulk IN URB: %d", ret);
+			break;
+		}
+	}
+}
+
+/* Pass completed bulk IN transfers to the consumer in order and keep the URBs in flight */
+static void canon_r5_usb_rx_work(struct work_struct *work)
+{
+	struct canon_r5_usb *usb = container_of(work, struct canon_r5_usb, rx_work);
+	struct canon_r5_usb_xfer *xfer;
+	unsigned long flags;
+	struct urb *urb;
+	int ret;
+	
+	while (READ_ONCE(usb->rx_running)) {
+		spin_lock_irqsave(&usb->rx_lock, flags);
+		xfer = list_first_entry_or_null(&usb->rx_done, struct canon_r5_usb_xfer, list);
+		if (xfer)
+			list_del_init(&xfer->list);
+		spin_unlock_irqrestore(&usb->rx_lock, flags);
+		
+		if (!xfer)
+			break;
+		
+		urb = xfer->urb;
+		if (usb->rx_complete)
+			usb->rx_complete(xfer->dev, xfer->buffer, urb->actual_length, urb->status);
+		
+		if (urb->status == -EPIPE) {
+			canon_r5_usb_rx_reset(usb, xfer->dev);
+			continue;
+		}
+		
+		/* Resubmitting to a device that is gone only fails again */
+		if (urb->status == -ESHUTDOWN)
+			continue;
+		
+		usb_anchor_urb(urb, &usb->rx_anchor);
+		ret = usb_submit_urb(urb, GFP_KERNEL);
+		if (ret) {
+			usb_unanchor_urb(urb);
+			canon_r5_err(xfer->dev, "Failed to resubmit bulk IN URB: %d", ret);
+		}
+	}
+}
+
+/* Preallocate bulk URBs and DMA-able buffers so transfers never allocate */
+static int canon_r5_usb_alloc_transfers(struct canon_r5_device *dev)
+{
+	struct canon_r5_usb *usb = dev->usb;
+	unsigned int count = clamp_t(unsigned int, rx_urbs, 1, CANON_R5_USB_MAX_RX_URBS);
+	size_t size = clamp_t(size_t, (size_t)urb_size_kb * 1024, CANON_R5_USB_MIN_URB_SIZE,
+			      4096 * 1024);
+	unsigned int i;
+	int ret;
+	
+	init_usb_anchor(&usb->rx_anchor);
+	INIT_WORK(&usb->rx_work, canon_r5_usb_rx_work);
+	INIT_LIST_HEAD(&usb->rx_done);
+	spin_lock_init(&usb->rx_lock);
+	mutex_init(&usb->tx_lock);
+	mutex_init(&usb->sync_lock);
+	
+	usb->sync_buffer = kmalloc(CANON_R5_USB_SYNC_BUFFER_SIZE, GFP_KERNEL);
+	if (!usb->sync_buffer)
+		return -ENOMEM;
+	
+	for (i = 0; i < CANON_R5_USB_TX_URBS; i++) {
+		ret = canon_r5_usb_alloc_xfer(dev, &usb->tx[i], size);
+		if (ret)
+			goto error;
+		
+		usb_fill_bulk_urb(usb->tx[i].urb, usb->udev,
+				  usb_sndbulkpipe(usb->udev, usb->ep_bulk_out->bEndpointAddress),
+				  usb->tx[i].buffer, usb->tx[i].size,
+				  canon_r5_usb_tx_callback, &usb->tx[i]);
+		usb->tx[i].urb->transfer_dma = usb->tx[i].dma;
+		usb->tx[i].urb->transfer_flags |= URB_NO_TRANSFER_DMA_MAP;
+	}
+	
+	/* Run with fewer URBs rather than none if coherent memory is tight */
+	for (i = 0; i < count; i++) {
+		if (canon_r5_usb_alloc_xfer(dev, &usb->rx[i], size))
+			break;
+		
+		usb_fill_bulk_urb(usb->rx[i].urb, usb->udev,
+				  usb_rcvbulkpipe(usb->udev, usb->ep_bulk_in->bEndpointAddress),
+				  usb->rx[i].buffer, usb->rx[i].size,
+				  canon_r5_usb_bulk_callback, &usb->rx[i]);
+		usb->rx[i].urb->transfer_dma = usb->rx[i].dma;
+		usb->rx[i].urb->transfer_flags |= URB_NO_TRANSFER_DMA_MAP;
+		usb->rx_count++;
+	}
+	
+	if (!usb->rx_count) {
+		ret = -ENOMEM;
+		goto error;
+	}
+	
+	canon_r5_info(dev, "Bulk transport: %u IN URBs of %zu KiB, %u OUT URBs of %zu KiB",
+		     usb->rx_count, usb->rx[0].size / 1024,
+		     CANON_R5_USB_TX_URBS, usb->tx[0].size / 1024);
+	
+	return 0;
+	
+error:
+	canon_r5_usb_free_transfers(dev);
+	return ret;
+}
+
+/* Start streaming bulk IN: keep every URB of the ring in flight */
+static int canon_r5_usb_rx_start(struct canon_r5_device *dev,
+				 void (*complete)(struct canon_r5_device *dev, const void *data,
+						  size_t len, int status))
+{
+	struct canon_r5_usb *usb = dev->usb;
+	unsigned int i;
+	int ret = 0;
+	
+	if (!usb || !usb->rx_count)
+		return -ENODEV;
+	
+	if (usb->rx_running)
+		return -EBUSY;
+	
+	/* One ordered work item copies every transfer out of its URB */
+	usb->rx_wq = canon_r5_workqueue_get(dev, CANON_R5_WORK_IO, "canon-r5-usb-rx",
+					    WQ_MEM_RECLAIM | WQ_HIGHPRI, 1);
+	if (!usb->rx_wq)
+		return -ENOMEM;
+	
+	/* Synchronous receivers must be done with the pipe */
+	mutex_lock(&usb->sync_lock);
+	
+	usb->rx_complete = complete;
+	WRITE_ONCE(usb->rx_running, true);
+	
+	for (i = 0; i < usb->rx_count; i++) {
+		usb_anchor_urb(usb->rx[i].urb, &usb->rx_anchor);
+		ret = usb_submit_urb(usb->rx[i].urb, GFP_KERNEL);
+		if (ret) {
+			usb_unanchor_urb(usb->rx[i].urb);
+			canon_r5_err(dev, "Failed to submit bulk IN URB: %d", ret);
+			break;
+		}
+	}
+	
+	if (ret) {
+		WRITE_ONCE(usb->rx_running, false);
+		usb_kill_anchored_urbs(&usb->rx_anchor);
+		cancel_work_sync(&usb->rx_work);
+		INIT_LIST_HEAD(&usb->rx_done);
+		usb->rx_complete = NULL;
+	}
+	
+	mutex_unlock(&usb->sync_lock);
+	
+	if (ret) {
+		canon_r5_workqueue_put(dev, usb->rx_wq);
+		usb->rx_wq = NULL;
+	}
+	
+	return ret;
+}
+
+static void canon_r5_usb_rx_stop(struct canon_r5_device *dev)
+{
+	struct canon_r5_usb *usb = dev->usb;
+	
+	if (!usb || !usb->rx_running)
+		return;
+	
+	/* Kill first: nothing completing during the kill queues rx_work again */
+	WRITE_ONCE(usb->rx_running, false);
+	usb_kill_anchored_urbs(&usb->rx_anchor);
+	cancel_work_sync(&usb->rx_work);
+	/* rx_work may have resubmitted or restarted the ring while it ran */
+	usb_kill_anchored_urbs(&usb->rx_anchor);
+	INIT_LIST_HEAD(&usb->rx_done);
+	
+	/* No answer to what is still in flight comes through this ring now */
+	if (usb->rx_complete)
+		usb->rx_complete(dev, NULL, 0, -ESHUTDOWN);
+	usb->rx_complete = NULL;
+	
+	canon_r5_workqueue_put(dev, usb->rx_wq);
+	usb->rx_wq = NULL;
+}
+
+/* Wait for a bulk OUT URB and report its result */
+static int canon_r5_usb_tx_wait(struct canon_r5_device *dev, struct canon_r5_usb_xfer *xfer)
+{
+	struct urb *urb = xfer->urb;
+	
+	if (!wait_for_completion_timeout(&xfer->done,
+					 msecs_to_jiffies(CANON_R5_USB_TIMEOUT_MS))) {
+		usb_kill_urb(urb);
+		xfer->busy = false;
+		return -ETIMEDOUT;
+	}
+	
+	xfer->busy = false;
+	
+	if (urb->status)
+		return urb->status;
+	
+	return urb->actual_length == urb->transfer_buffer_length ? 0 : -EIO;
+}
+
 /* Send data via USB bulk out */
 int canon_r5_usb_bulk_send(struct canon_r5_device *dev, const void *data, size_t len)
 {
-	void *transfer_buffer;
-	int actual_len;
-	int ret;
+	struct canon_r5_usb *usb;
+	struct canon_r5_usb_xfer *xfer;
+	const u8 *src = data;
+	size_t total = len;
+	size_t chunk;
+	unsigned int i, next = 0;
+	int ret = 0, err;
 	
 	if (!dev || !data || !len)
 		return -EINVAL;
 	
-	if (!dev->usb->ep_bulk_out)
+	usb = dev->usb;
+	if (!usb || !usb->ep_bulk_out || !usb->tx[0].urb)
 		return -ENODEV;
 	
-	/* Allocate transfer buffer */
-	transfer_buffer = kmalloc(len, GFP_KERNEL);
-	if (!transfer_buffer)
-		return -ENOMEM;
+	mutex_lock(&usb->tx_lock);
 	
-	/* Copy data to transfer buffer */
-	memcpy(transfer_buffer, data, len);
+	/* Fill one buffer while the other is on the wire */
+	while (len) {
+		xfer = &usb->tx[next];
+		
+		if (xfer->busy) {
+			ret = canon_r5_usb_tx_wait(dev, xfer);
+			if (ret)
+				break;
+		}
+		
+		chunk = min(len, xfer->size);
+		memcpy(xfer->buffer, src, chunk);
+		xfer->urb->transfer_buffer_length = chunk;
+		reinit_completion(&xfer->done);
+		
+		ret = usb_submit_urb(xfer->urb, GFP_KERNEL);
+		if (ret)
+			break;
+		
+		xfer->busy = true;
+		src += chunk;
+		len -= chunk;
+		next = (next + 1) % CANON_R5_USB_TX_URBS;
+	}
 	
-	/* Use synchronous bulk transfer */
-	ret = usb_bulk_msg(dev->usb->udev,
-			   usb_sndbulkpipe(dev->usb->udev, dev->usb->ep_bulk_out->bEndpointAddress),
-			   transfer_buffer, len, &actual_len, 5000);
+	/* Drain whatever is still in flight */
+	for (i = 0; i < CANON_R5_USB_TX_URBS; i++) {
+		if (!usb->tx[i].busy)
+			continue;
+		err = canon_r5_usb_tx_wait(dev, &usb->tx[i]);
+		if (!ret)
+			ret = err;
+	}
+	
+	mutex_unlock(&usb->tx_lock);
 	
 	if (ret) {
 		canon_r5_err(dev, "Bulk send failed: %d", ret);
 	} else {
-		canon_r5_dbg(dev, "Bulk send completed successfully (%d bytes)", actual_len);
+		canon_r5_dbg(dev, "Bulk send completed successfully (%zu bytes)", total);
 	}
 	
-	kfree(transfer_buffer);
-	
 	return ret;
 }
 EXPORT_SYMBOL_GPL(canon_r5_usb_bulk_send);
@@ -276,40 +692,59 @@ EXPORT_SYMBOL_GPL(canon_r5_usb_bulk_send);
 /* Receive data via USB bulk in */
 int canon_r5_usb_bulk_receive(struct canon_r5_device *dev, void *data, size_t len, size_t *actual_len)
 {
-	void *transfer_buffer;
+	struct canon_r5_usb *usb;
+	size_t done = 0;
+	size_t chunk;
 	int received_len;
-	int ret;
+	int ret = 0;
 	
 	if (!dev || !data || !len)
 		return -EINVAL;
 	
-	if (!dev->usb->ep_bulk_in)
+	usb = dev->usb;
+	if (!usb || !usb->ep_bulk_in || !usb->sync_buffer)
 		return -ENODEV;
 	
-	/* Allocate transfer buffer */
-	transfer_buffer = kmalloc(len, GFP_KERNEL);
-	if (!transfer_buffer)
-		return -ENOMEM;
+	mutex_lock(&usb->sync_lock);
 	
-	/* Use synchronous bulk transfer */
-	ret = usb_bulk_msg(dev->usb->udev,
-			   usb_rcvbulkpipe(dev->usb->udev, dev->usb->ep_bulk_in->bEndpointAddress),
-			   transfer_buffer, len, &received_len, 5000);
+	/* The streaming ring owns the pipe while it runs */
+	if (usb->rx_running) {
+		mutex_unlock(&usb->sync_lock);
+		return -EBUSY;
+	}
 	
-	if (ret) {
-		canon_r5_err(dev, "Bulk receive failed: %d", ret);
-	} else {
-		/* Copy received data */
-		memcpy(data, transfer_buffer, received_len);
-		if (actual_len)
-			*actual_len = received_len;
+	/* Large reads go through the persistent bounce buffer in packet-aligned chunks */
+	while (done < len) {
+		chunk = min_t(size_t, len - done, CANON_R5_USB_SYNC_BUFFER_SIZE);
+		
+		ret = usb_bulk_msg(usb->udev,
+				   usb_rcvbulkpipe(usb->udev, usb->ep_bulk_in->bEndpointAddress),
+				   usb->sync_buffer, chunk, &received_len, CANON_R5_USB_TIMEOUT_MS);
+		if (ret)
+			break;
+		
+		memcpy((u8 *)data + done, usb->sync_buffer, received_len);
+		done += received_len;
 		
-		canon_r5_dbg(dev, "Bulk receive completed successfully (%d bytes)", received_len);
+		/* A short packet ends the transfer */
+		if ((size_t)received_len < chunk)
+			break;
 	}
 	
-	kfree(transfer_buffer);
+	mutex_unlock(&usb->sync_lock);
 	
-	return ret;
+	/* Report what arrived, but never a failed transfer as a complete one */
+	if (actual_len)
+		*actual_len = done;
+	
+	if (ret) {
+		canon_r5_err(dev, "Bulk receive failed after %zu bytes: %d", done, ret);
+		return ret;
+	}
+	
+	canon_r5_dbg(dev, "Bulk receive completed successfully (%zu bytes)", done);
+	
+	return 0;
 }
 EXPORT_SYMBOL_GPL(canon_r5_usb_bulk_receive);
 
@@ -317,6 +752,8 @@ EXPORT_SYMBOL_GPL(canon_r5_usb_bulk_receive);
 static struct canon_r5_transport_ops usb_transport_ops = {
 	.bulk_send = canon_r5_usb_bulk_send,
 	.bulk_receive = canon_r5_usb_bulk_receive,
+	.rx_start = canon_r5_usb_rx_start,
+	.rx_stop = canon_r5_usb_rx_stop,
 };
 
 /* USB device probe function */
@@ -351,6 +788,9 @@ static int canon_r5_usb_probe(struct usb_interface *intf, const struct usb_devic
 	dev->usb->udev = usb_get_dev(udev);
 	dev->usb->intf = usb_get_intf(intf);
 	
+	/* Buffer memory shared with other devices is allocated against the host controller */
+	dev->dma_dev = udev->bus->sysdev;
+	
 	/* Set device data */
 	usb_set_intfdata(intf, dev);
 	
@@ -361,11 +801,18 @@ static int canon_r5_usb_probe(struct usb_interface *intf, const struct usb_devic
 		goto error_endpoints;
 	}
 	
+	/* Preallocate bulk URBs and buffers */
+	ret = canon_r5_usb_alloc_transfers(dev);
+	if (ret) {
+		dev_err(&intf->dev, "Failed to allocate bulk transfers: %d\n", ret);
+		goto error_transfers;
+	}
+	
 	/* Register transport layer */
 	ret = canon_r5_register_transport(dev, &usb_transport_ops);
 	if (ret) {
 		dev_err(&intf->dev, "Failed to register transport: %d\n", ret);
-		goto error_endpoints;
+		goto error_register;
 	}
 	
 	/* Initialize device */
@@ -377,14 +824,19 @@ static int canon_r5_usb_probe(struct usb_interface *intf, const struct usb_devic
 	
 	canon_r5_set_state(dev, CANON_R5_STATE_CONNECTED);
 	
-	/* TODO: Initialize PTP session and detect device capabilities */
+	/* Session, device info and feature modules come up in the background */
+	canon_r5_bringup_start(dev);
 	
-	dev_info(&intf->dev, "Canon R5 device successfully probed and initialized\n");
+	dev_info(&intf->dev, "Canon R5 device successfully probed, bring-up started\n");
 	
 	return 0;
 	
 error_transport:
+	canon_r5_usb_rx_stop(dev);
 	canon_r5_unregister_transport(dev);
+error_register:
+	canon_r5_usb_free_transfers(dev);
+error_transfers:
 	canon_r5_usb_cleanup_endpoints(dev);
 error_endpoints:
 	usb_put_intf(dev->usb->intf);
@@ -404,6 +856,12 @@ static void canon_r5_usb_disconnect(struct usb_interface *intf)
 	
 	dev_info(&intf->dev, "Canon R5 device disconnecting\n");
 	
+	/* Tear the function drivers down while they can still reach the camera */
+	canon_r5_bringup_stop(dev);
+	
+	/* Stop bulk IN streaming before the PTP layer goes away */
+	canon_r5_usb_rx_stop(dev);
+	
 	/* Unregister transport */
 	canon_r5_unregister_transport(dev);
 	
@@ -412,6 +870,7 @@ static void canon_r5_usb_disconnect(struct usb_interface *intf)
 	
 	/* Cleanup USB resources */
 	canon_r5_usb_cleanup_endpoints(dev);
+	canon_r5_usb_free_transfers(dev);
 	
 	/* Release USB references */
 	usb_put_intf(dev->usb->intf);
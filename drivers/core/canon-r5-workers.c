@@ -0,0 +1,331 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Canon R5 Linux Driver Suite
+ * Worker pool for multi-camera rigs
+ *
+ * Copyright (C) 2025 Canon R5 Driver Project
+ */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/spinlock.h>
+#include <linux/workqueue.h>
+#include <linux/cpumask.h>
+#include <linux/string.h>
+#include <linux/slab.h>
+
+#include "../../include/core/canon-r5.h"
+
+/*
+ * Every module asks here for the queues it would otherwise allocate. One
+ * body keeps its dedicated queues, exactly as before. With shared_workers
+ * set, all bodies share one unbound queue per work class instead, so a rig
+ * of sixteen cameras runs on three queues and the kernel's unbound pools
+ * rather than on a hundred-odd rescuers and worker pools of its own.
+ *
+ * Sharing stays fair without any per-device accounting: a work item is
+ * never queued twice, so a body only ever has its own handful of items
+ * (sender and receiver, one frame worker per node, its downloaders) on a
+ * queue, and a busy body cannot push the others' items back further than
+ * that. Classes keep card upkeep from ever delaying a live view frame.
+ *
+ * Unpinned work is queued on the NUMA node of the camera's host controller.
+ * A body given a CPU set through worker_cpus (or its sysfs file) shares
+ * per-CPU queues and has its work spread round-robin over that set.
+ *
+ * The shared queues are never drained for a single body: modules cancel
+ * their own work items before they put a queue.
+ */
+
+static bool shared_workers;
+module_param(shared_workers, bool, 0444);
+MODULE_PARM_DESC(shared_workers, "Run every camera's work on one shared pool of queues (multi-camera rigs)");
+
+static char *worker_cpus;
+module_param(worker_cpus, charp, 0444);
+MODULE_PARM_DESC(worker_cpus, "CPU lists to pin cameras to, one per device id separated by ';' (e.g. \"0-3;4-7\")");
+
+static const struct {
+	const char	*name;
+	unsigned int	flags;
+} canon_r5_work_classes[CANON_R5_WORK_CLASSES] = {
+	[CANON_R5_WORK_IO]	= { "io",	WQ_MEM_RECLAIM | WQ_HIGHPRI },
+	[CANON_R5_WORK_STREAM]	= { "stream",	WQ_MEM_RECLAIM | WQ_HIGHPRI },
+	[CANON_R5_WORK_BULK]	= { "bulk",	WQ_MEM_RECLAIM },
+};
+
+static struct workqueue_struct *canon_r5_shared_wq[CANON_R5_WORK_CLASSES];
+static struct workqueue_struct *canon_r5_pinned_wq[CANON_R5_WORK_CLASSES];
+
+/* Serializes creation of the shared queues */
+static DEFINE_MUTEX(canon_r5_workers_lock);
+
+static bool canon_r5_workqueue_in(struct workqueue_struct *wq,
+				   struct workqueue_struct **pool)
+{
+	int i;
+	
+	for (i = 0; i < CANON_R5_WORK_CLASSES; i++)
+		if (wq == READ_ONCE(pool[i]))
+			return true;
+	
+	return false;
+}
+
+static bool canon_r5_workqueue_shared(struct workqueue_struct *wq)
+{
+	return canon_r5_workqueue_in(wq, canon_r5_shared_wq) ||
+	       canon_r5_workqueue_in(wq, canon_r5_pinned_wq);
+}
+
+static struct workqueue_struct *canon_r5_workqueue_pool(enum canon_r5_work_class cls,
+						       bool pinned)
+{
+	struct workqueue_struct **slot;
+	unsigned int flags = canon_r5_work_classes[cls].flags;
+	int max_active = 0;
+	
+	slot = pinned ? &canon_r5_pinned_wq[cls] : &canon_r5_shared_wq[cls];
+	
+	mutex_lock(&canon_r5_workers_lock);
+	if (!*slot) {
+		/* Bounded so a rig cannot fan out into hundreds of workers */
+		if (!pinned) {
+			flags |= WQ_UNBOUND;
+			max_active = min_t(int, 4 * num_possible_cpus(), WQ_UNBOUND_MAX_ACTIVE);
+		}
+		WRITE_ONCE(*slot, alloc_workqueue("canon-r5-%s%s", flags, max_active,
+						  canon_r5_work_classes[cls].name,
+						  pinned ? "-pinned" : ""));
+	}
+	mutex_unlock(&canon_r5_workers_lock);
+	
+	return *slot;
+}
+
+/*
+ * Queue for one of a device's work sources. @flags and @max_active describe
+ * the dedicated queue used outside multi-device mode; a @max_active of 1
+ * asks for an ordered one. Shared queues give no ordering between items.
+ */
+struct workqueue_struct *canon_r5_workqueue_get(struct canon_r5_device *dev,
+						enum canon_r5_work_class cls, const char *name,
+						unsigned int flags, int max_active)
+{
+	if (cls >= CANON_R5_WORK_CLASSES)
+		return NULL;
+	
+	if (READ_ONCE(dev->workers.pinned))
+		return canon_r5_workqueue_pool(cls, true);
+	
+	if (shared_workers)
+		return canon_r5_workqueue_pool(cls, false);
+	
+	if (max_active == 1)
+		return alloc_ordered_workqueue("%s", flags & ~WQ_UNBOUND, name);
+	
+	return alloc_workqueue("%s", flags, max_active, name);
+}
+EXPORT_SYMBOL_GPL(canon_r5_workqueue_get);
+
+/* The caller has cancelled its work items; a shared queue lives on */
+void canon_r5_workqueue_put(struct canon_r5_device *dev __attribute__((unused)),
+			    struct workqueue_struct *wq)
+{
+	if (wq && !canon_r5_workqueue_shared(wq))
+		destroy_workqueue(wq);
+}
+EXPORT_SYMBOL_GPL(canon_r5_workqueue_put);
+
+/* Next online CPU of the pinned set, or WORK_CPU_UNBOUND. Any context */
+static int canon_r5_work_cpu(struct canon_r5_device *dev)
+{
+	struct canon_r5_workers *workers = &dev->workers;
+	unsigned long flags;
+	int cpu, i, n;
+	
+	if (!READ_ONCE(workers->pinned))
+		return WORK_CPU_UNBOUND;
+	
+	spin_lock_irqsave(&workers->lock, flags);
+	cpu = workers->last_cpu;
+	n = cpumask_weight(workers->cpus);
+	for (i = 0; i < n; i++) {
+		cpu = cpumask_next(cpu, workers->cpus);
+		if (cpu >= nr_cpu_ids)
+			cpu = cpumask_first(workers->cpus);
+		if (cpu_online(cpu))
+			break;
+	}
+	if (i < n)
+		workers->last_cpu = cpu;
+	else
+		cpu = WORK_CPU_UNBOUND;
+	spin_unlock_irqrestore(&workers->lock, flags);
+	
+	return cpu;
+}
+
+bool canon_r5_queue_work(struct canon_r5_device *dev, struct workqueue_struct *wq,
+			 struct work_struct *work)
+{
+	int cpu = canon_r5_work_cpu(dev);
+	
+	if (cpu == WORK_CPU_UNBOUND && dev->workers.node != NUMA_NO_NODE &&
+	    canon_r5_workqueue_in(wq, canon_r5_shared_wq))
+		return queue_work_node(dev->workers.node, wq, work);
+	
+	return queue_work_on(cpu, wq, work);
+}
+EXPORT_SYMBOL_GPL(canon_r5_queue_work);
+
+bool canon_r5_queue_delayed_work(struct canon_r5_device *dev, struct workqueue_struct *wq,
+				 struct delayed_work *dwork, unsigned long delay)
+{
+	return queue_delayed_work_on(canon_r5_work_cpu(dev), wq, dwork, delay);
+}
+EXPORT_SYMBOL_GPL(canon_r5_queue_delayed_work);
+
+bool canon_r5_mod_delayed_work(struct canon_r5_device *dev, struct workqueue_struct *wq,
+			       struct delayed_work *dwork, unsigned long delay)
+{
+	return mod_delayed_work_on(canon_r5_work_cpu(dev), wq, dwork, delay);
+}
+EXPORT_SYMBOL_GPL(canon_r5_mod_delayed_work);
+
+static void canon_r5_workers_set(struct canon_r5_device *dev, const struct cpumask *cpus)
+{
+	struct canon_r5_workers *workers = &dev->workers;
+	unsigned long flags;
+	
+	spin_lock_irqsave(&workers->lock, flags);
+	cpumask_and(workers->cpus, cpus, cpu_possible_mask);
+	workers->last_cpu = -1;
+	WRITE_ONCE(workers->pinned, !cpumask_empty(workers->cpus));
+	spin_unlock_irqrestore(&workers->lock, flags);
+}
+
+/* Sysfs: the device's CPU set; queues taken from now on follow it */
+static ssize_t worker_cpus_show(struct device *device, struct device_attribute *attr, char *buf)
+{
+	struct canon_r5_device *dev = dev_get_drvdata(device);
+	unsigned long flags;
+	ssize_t len;
+	
+	spin_lock_irqsave(&dev->workers.lock, flags);
+	len = sysfs_emit(buf, "%*pbl\n", cpumask_pr_args(dev->workers.cpus));
+	spin_unlock_irqrestore(&dev->workers.lock, flags);
+	
+	return len;
+}
+
+static ssize_t worker_cpus_store(struct device *device, struct device_attribute *attr,
+				 const char *buf, size_t count)
+{
+	struct canon_r5_device *dev = dev_get_drvdata(device);
+	cpumask_var_t cpus;
+	int ret;
+	
+	if (!zalloc_cpumask_var(&cpus, GFP_KERNEL))
+		return -ENOMEM;
+	
+	ret = cpulist_parse(buf, cpus);
+	if (!ret && !cpumask_empty(cpus) && !cpumask_intersects(cpus, cpu_possible_mask))
+		ret = -EINVAL;
+	if (!ret)
+		canon_r5_workers_set(dev, cpus);
+	
+	free_cpumask_var(cpus);
+	return ret ? ret : count;
+}
+static DEVICE_ATTR_RW(worker_cpus);
+
+/* Entry @id of the worker_cpus parameter, if it has one */
+static int canon_r5_workers_param(int id, struct cpumask *cpus)
+{
+	char *list, *entry, *cursor;
+	int ret = 0, i = 0;
+	
+	if (!worker_cpus || id < 0)
+		return 0;
+	
+	list = kstrdup(worker_cpus, GFP_KERNEL);
+	if (!list)
+		return -ENOMEM;
+	
+	cursor = list;
+	while ((entry = strsep(&cursor, ";")) != NULL) {
+		if (i++ == id) {
+			ret = cpulist_parse(strim(entry), cpus);
+			break;
+		}
+	}
+	
+	kfree(list);
+	return ret;
+}
+
+int canon_r5_workers_init(struct canon_r5_device *dev)
+{
+	struct canon_r5_workers *workers = &dev->workers;
+	int ret;
+	
+	spin_lock_init(&workers->lock);
+	workers->last_cpu = -1;
+	workers->node = dev_to_node(dev->dev->parent ? dev->dev->parent : dev->dev);
+	
+	if (!zalloc_cpumask_var(&workers->cpus, GFP_KERNEL))
+		return -ENOMEM;
+	
+	ret = canon_r5_workers_param(dev->id, workers->cpus);
+	if (ret) {
+		canon_r5_warn(dev, "Ignoring worker_cpus entry %d: %d", dev->id, ret);
+		cpumask_clear(workers->cpus);
+	}
+	canon_r5_workers_set(dev, workers->cpus);
+	
+	if (workers->pinned)
+		canon_r5_info(dev, "Work pinned to CPUs %*pbl", cpumask_pr_args(workers->cpus));
+	
+	ret = device_create_file(dev->dev, &dev_attr_worker_cpus);
+	if (ret)
+		canon_r5_warn(dev, "Worker CPU sysfs file unavailable: %d", ret);
+	
+	return 0;
+}
+
+void canon_r5_workers_free(struct canon_r5_device *dev)
+{
+	free_cpumask_var(dev->workers.cpus);
+}
+
+int canon_r5_workers_module_init(void)
+{
+	if (!shared_workers)
+		return 0;
+	
+	/* Created up front so the first body does not pay for it */
+	if (!canon_r5_workqueue_pool(CANON_R5_WORK_IO, false) ||
+	    !canon_r5_workqueue_pool(CANON_R5_WORK_STREAM, false) ||
+	    !canon_r5_workqueue_pool(CANON_R5_WORK_BULK, false)) {
+		canon_r5_workers_module_exit();
+		return -ENOMEM;
+	}
+	
+	return 0;
+}
+
+void canon_r5_workers_module_exit(void)
+{
+	int i;
+	
+	for (i = 0; i < CANON_R5_WORK_CLASSES; i++) {
+		if (canon_r5_shared_wq[i])
+			destroy_workqueue(canon_r5_shared_wq[i]);
+		if (canon_r5_pinned_wq[i])
+			destroy_workqueue(canon_r5_pinned_wq[i]);
+		canon_r5_shared_wq[i] = NULL;
+		canon_r5_pinned_wq[i] = NULL;
+	}
+}
@@ -14,10 +14,20 @@
 #include <linux/completion.h>
 #include <linux/workqueue.h>
 #include <linux/timer.h>
-#include <linux/kfifo.h>
 #include <linux/atomic.h>
 #include <linux/wait.h>
 #include <linux/dma-mapping.h>
+#include <linux/vmalloc.h>
+#include <linux/mempool.h>
+#include <linux/fs.h>
+#include <linux/mm.h>
+#include <linux/poll.h>
+#include <linux/uaccess.h>
+#include <linux/idr.h>
+#include <linux/miscdevice.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/version.h>
 
 #include "../../include/core/canon-r5.h"
 #include "../../include/core/canon-r5-ptp.h"
@@ -28,8 +38,27 @@ MODULE_DESCRIPTION("Canon R5 Camera Driver Suite - Still Image Capture");
 MODULE_LICENSE("GPL v2");
 MODULE_VERSION(CANON_R5_DRIVER_VERSION);
 
-/* Default image buffer size (50MB for high-res RAW) */
-#define CANON_R5_STILL_BUFFER_SIZE	(50 * 1024 * 1024)
+static unsigned int pool_buffers = 4;
+module_param(pool_buffers, uint, 0444);
+MODULE_PARM_DESC(pool_buffers, "Preallocated still image buffers (1-16, default 4)");
+
+static unsigned int max_in_camera = CANON_R5_STILL_MAX_IN_CAMERA;
+module_param(max_in_camera, uint, 0644);
+MODULE_PARM_DESC(max_in_camera, "Shots triggered ahead of their transfer request (1-64, default 8)");
+
+/* One download stage worker; several run at once on the unbound capture_wq */
+struct canon_r5_still_downloader {
+	struct work_struct work;
+	struct canon_r5_still *still_priv;
+	struct canon_r5_ptp_object_reader reader;
+};
+
+static DEFINE_IDA(canon_r5_still_ida);
+
+static inline struct canon_r5_still *to_still_priv(struct canon_r5_still_device *still)
+{
+	return container_of(still, struct canon_r5_still, device);
+}
 
 /* Helper function implementations */
 
@@ -193,35 +222,364 @@ int canon_r5_still_validate_capture_settings(const struct canon_r5_capture_setti
 
 /* Memory management */
 
-void *canon_r5_still_alloc_image_buffer(struct canon_r5_still_device *still, size_t size)
+size_t canon_r5_still_buffer_size(const struct canon_r5_image_quality *quality)
+{
+	if (quality->raw_plus_jpeg || quality->size == CANON_R5_STILL_SIZE_RAW ||
+	    quality->format == CANON_R5_STILL_RAW_CR3 ||
+	    quality->format == CANON_R5_STILL_RAW_CR2)
+		return CANON_R5_STILL_RAW_BUFFER_SIZE;
+
+	switch (quality->size) {
+	case CANON_R5_STILL_SIZE_MEDIUM:
+		return CANON_R5_STILL_MEDIUM_BUFFER_SIZE;
+	case CANON_R5_STILL_SIZE_SMALL:
+		return CANON_R5_STILL_SMALL_BUFFER_SIZE;
+	default:
+		return CANON_R5_STILL_LARGE_BUFFER_SIZE;
+	}
+}
+EXPORT_SYMBOL_GPL(canon_r5_still_buffer_size);
+
+static void still_pool_free(struct canon_r5_still *still_priv)
+{
+	unsigned int i;
+
+	for (i = 0; i < still_priv->memory.nr_buffers; i++)
+		vfree(still_priv->memory.slots[i].vaddr);
+
+	memset(still_priv->memory.slots, 0, sizeof(still_priv->memory.slots));
+	still_priv->memory.nr_buffers = 0;
+	still_priv->memory.nr_free = 0;
+	still_priv->memory.nr_ready = 0;
+	still_priv->memory.buffer_size = 0;
+}
+
+/*
+ * Buffers are page-backed (vmalloc_user) rather than kmalloc'd: a 64 MiB
+ * physically contiguous allocation is unlikely to succeed once memory is
+ * fragmented, and zeroed vmalloc_user pages can be mapped to userspace.
+ * Keeps however many buffers could be allocated, failing only if none could.
+ */
+static int still_pool_alloc(struct canon_r5_still *still_priv, size_t size)
+{
+	struct canon_r5_still_device *still = &still_priv->device;
+	unsigned int count = clamp_t(unsigned int, pool_buffers, 1,
+				     CANON_R5_STILL_POOL_MAX_BUFFERS);
+	unsigned int i;
+
+	size = PAGE_ALIGN(size);
+
+	for (i = 0; i < count; i++) {
+		still_priv->memory.slots[i].vaddr = vmalloc_user(size);
+		if (!still_priv->memory.slots[i].vaddr)
+			break;
+		still_priv->memory.slots[i].state = CANON_R5_STILL_SLOT_FREE;
+	}
+
+	if (i == 0) {
+		canon_r5_still_err(still, "Failed to allocate image buffer pool (%zu bytes)", size);
+		return -ENOMEM;
+	}
+
+	if (i < count)
+		canon_r5_still_warn(still, "Image buffer pool reduced to %u of %u buffers",
+				    i, count);
+
+	spin_lock(&still_priv->memory.lock);
+	still_priv->memory.nr_buffers = i;
+	still_priv->memory.nr_free = i;
+	still_priv->memory.nr_ready = 0;
+	still_priv->memory.buffer_size = size;
+	spin_unlock(&still_priv->memory.lock);
+
+	canon_r5_still_dbg(still, "Image buffer pool: %u x %zu bytes", i, size);
+	return 0;
+}
+
+/* Called with still->lock held; the pool must be idle and unmapped to be resized */
+static int still_pool_resize(struct canon_r5_still *still_priv, size_t size)
 {
-    struct canon_r5_still *driver_data;
-    void *buffer;
+	struct canon_r5_still_device *still = &still_priv->device;
+	bool idle;
+
+	if (PAGE_ALIGN(size) == still_priv->memory.buffer_size)
+		return 0;
+
+	spin_lock(&still_priv->memory.lock);
+	idle = still_priv->memory.nr_free == still_priv->memory.nr_buffers;
+	spin_unlock(&still_priv->memory.lock);
+
+	if (!idle || still_priv->users || still->capture_active ||
+	    atomic_read(&still->pending_captures)) {
+		/* Larger buffers still hold smaller images; only growing needs a reallocation */
+		if (size <= still_priv->memory.buffer_size)
+			return 0;
+		return -EBUSY;
+	}
+
+	still_pool_free(still_priv);
+	return still_pool_alloc(still_priv, size);
+}
+
+static unsigned int still_max_in_camera(void)
+{
+	return clamp_t(unsigned int, READ_ONCE(max_in_camera), 1, 64);
+}
+
+/* Remember the deepest a stage has been; racing updates only lose a sample */
+static void still_stage_note(struct canon_r5_still_device *still,
+			     enum canon_r5_still_stage stage, int depth)
+{
+	if (depth > 0 && (u32)depth > READ_ONCE(still->stats.stage_max[stage]))
+		WRITE_ONCE(still->stats.stage_max[stage], depth);
+}
+
+/*
+ * Room to trigger @count more shots: a slot for each on top of those the
+ * frames in flight will still claim, and space in the camera's buffer.
+ * Frames that are downloading already hold their slot.
+ */
+static bool still_pipeline_room(struct canon_r5_still *still_priv, unsigned int count)
+{
+	struct canon_r5_still_device *still = &still_priv->device;
+	int unclaimed = atomic_read(&still->pending_captures) -
+			atomic_read(&still_priv->pipeline.downloading);
+
+	return (int)READ_ONCE(still_priv->memory.nr_free) >= max(unclaimed, 0) + (int)count &&
+	       atomic_read(&still_priv->pipeline.in_camera) + count <= still_max_in_camera();
+}
+
+/*
+ * Wait until the pipeline can take @count more images on top of the
+ * captures already in flight. This is the backpressure for bursts: the
+ * camera keeps shots in its own buffer until they are downloaded, so
+ * triggering no more than we can receive never loses an image to -ENOMEM.
+ */
+static int still_pool_reserve(struct canon_r5_still_device *still, unsigned int count)
+{
+	struct canon_r5_still *still_priv = to_still_priv(still);
+	int ret;
+
+	if (!still_priv->memory.nr_buffers)
+		return -ENOMEM;
+
+	ret = wait_event_killable(still_priv->memory.wait,
+				  still_pipeline_room(still_priv, count) ||
+				  !READ_ONCE(still->initialized));
+	if (ret)
+		return ret;
+
+	return READ_ONCE(still->initialized) ? 0 : -ENODEV;
+}
+
+/* Claim a FREE slot for the next download, returns its index or -ENOSPC */
+static int still_slot_get(struct canon_r5_still *still_priv)
+{
+	unsigned int i;
+	int index = -ENOSPC;
+
+	spin_lock(&still_priv->memory.lock);
+	for (i = 0; i < still_priv->memory.nr_buffers; i++) {
+		struct canon_r5_still_slot *slot = &still_priv->memory.slots[i];
+
+		if (slot->state != CANON_R5_STILL_SLOT_FREE)
+			continue;
+		slot->state = CANON_R5_STILL_SLOT_FILLING;
+		slot->owner = NULL;
+		still_priv->memory.nr_free--;
+		index = i;
+		break;
+	}
+	spin_unlock(&still_priv->memory.lock);
+
+	return index;
+}
+
+/*
+ * Downloads finish out of order when several run at once. Publish DONE
+ * slots to readers strictly in trigger order, stepping over frames that
+ * failed so one lost image does not hold back the rest. Called with
+ * memory.lock held, returns true if a slot became READY.
+ */
+static bool still_handoff_locked(struct canon_r5_still *still_priv)
+{
+	struct canon_r5_still_slot *slot;
+	u32 start = still_priv->memory.sequence;
+	bool published = false;
+	unsigned int i;
+
+	for (;;) {
+		if (!(still_priv->pipeline.skip & 1)) {
+			for (i = 0; i < still_priv->memory.nr_buffers; i++) {
+				slot = &still_priv->memory.slots[i];
+				if (slot->state == CANON_R5_STILL_SLOT_DONE &&
+				    slot->sequence == still_priv->memory.sequence)
+					break;
+			}
+			if (i == still_priv->memory.nr_buffers)
+				break;
+			
+			slot->state = CANON_R5_STILL_SLOT_READY;
+			still_priv->memory.nr_ready++;
+			published = true;
+		}
+		still_priv->pipeline.skip >>= 1;
+		still_priv->memory.sequence++;
+	}
+
+	/* The skip window moved; downloaders held back by it may number a frame */
+	if (still_priv->memory.sequence != start)
+		wake_up(&still_priv->events.wait);
+
+	return published;
+}
+
+/* A downloaded slot holding frame @sequence is waiting for hand-off */
+static void still_slot_done(struct canon_r5_still *still_priv, unsigned int index,
+			    u32 sequence, size_t bytesused)
+{
+	struct canon_r5_still_device *still = &still_priv->device;
+	struct canon_r5_still_slot *slot = &still_priv->memory.slots[index];
+	unsigned int ready;
+	bool published;
+
+	spin_lock(&still_priv->memory.lock);
+	slot->bytesused = bytesused;
+	slot->sequence = sequence;
+	slot->state = CANON_R5_STILL_SLOT_DONE;
+	published = still_handoff_locked(still_priv);
+	ready = still_priv->memory.nr_ready;
 	
+	still->stats.last_capture = ktime_get();
+	spin_unlock(&still_priv->memory.lock);
+
+	canon_r5_counter_inc(&still->counters, CANON_R5_STILL_IMAGES_CAPTURED);
+	canon_r5_counter_add(&still->counters, CANON_R5_STILL_TOTAL_BYTES, bytesused);
+
+	still_stage_note(still, CANON_R5_STILL_STAGE_READY, ready);
+	if (published)
+		wake_up(&still->capture_wait);
+}
+
+/* Frame @sequence will never arrive; let the frames behind it through */
+static void still_slot_skip(struct canon_r5_still *still_priv, u32 sequence)
+{
+	u32 offset;
+	bool published;
+
+	spin_lock(&still_priv->memory.lock);
+	offset = sequence - still_priv->memory.sequence;
+	/* still_events_pop() never numbers a frame past the window */
+	if (!WARN_ON_ONCE(offset >= CANON_R5_STILL_SKIP_WINDOW))
+		still_priv->pipeline.skip |= BIT(offset);
+	published = still_handoff_locked(still_priv);
+	spin_unlock(&still_priv->memory.lock);
+
+	canon_r5_counter_inc(&still_priv->device.counters, CANON_R5_STILL_IMAGES_FAILED);
+
+	if (published)
+		wake_up(&still_priv->device.capture_wait);
+}
+
+/* Hand the oldest READY slot to @owner, returns its index or -EAGAIN */
+static int still_slot_dequeue(struct canon_r5_still *still_priv, const void *owner)
+{
+	struct canon_r5_still_slot *slot, *oldest = NULL;
+	unsigned int i;
+	int index = -EAGAIN;
+
+	spin_lock(&still_priv->memory.lock);
+	for (i = 0; i < still_priv->memory.nr_buffers; i++) {
+		slot = &still_priv->memory.slots[i];
+		if (slot->state != CANON_R5_STILL_SLOT_READY)
+			continue;
+		if (!oldest || (s32)(slot->sequence - oldest->sequence) < 0) {
+			oldest = slot;
+			index = i;
+		}
+	}
+	if (oldest) {
+		oldest->state = CANON_R5_STILL_SLOT_USER;
+		oldest->owner = owner;
+		still_priv->memory.nr_ready--;
+	}
+	spin_unlock(&still_priv->memory.lock);
+
+	return index;
+}
+
+/* Return a FILLING or USER slot held by @owner to the free pool */
+static int still_slot_put(struct canon_r5_still *still_priv, unsigned int index,
+			  const void *owner)
+{
+	struct canon_r5_still_slot *slot;
+	int ret = -EINVAL;
+
+	spin_lock(&still_priv->memory.lock);
+	if (index < still_priv->memory.nr_buffers) {
+		slot = &still_priv->memory.slots[index];
+		if ((slot->state == CANON_R5_STILL_SLOT_FILLING ||
+		     slot->state == CANON_R5_STILL_SLOT_USER) && slot->owner == owner) {
+			slot->state = CANON_R5_STILL_SLOT_FREE;
+			slot->owner = NULL;
+			still_priv->memory.nr_free++;
+			ret = 0;
+		}
+	}
+	spin_unlock(&still_priv->memory.lock);
+
+	if (!ret)
+		wake_up(&still_priv->memory.wait);
+	return ret;
+}
+
+void *canon_r5_still_alloc_image_buffer(struct canon_r5_still_device *still, size_t size)
+{
+	struct canon_r5_still *still_priv;
+	int index;
+
 	if (!still || !still->canon_dev)
 		return NULL;
-	
-	driver_data = still->canon_dev->still_priv;
-	if (!driver_data)
+
+	still_priv = to_still_priv(still);
+
+	if (size > still_priv->memory.buffer_size) {
+		canon_r5_still_err(still, "Image (%zu bytes) exceeds pool buffer size (%zu bytes)",
+				   size, still_priv->memory.buffer_size);
 		return NULL;
-	
-	/* For now, use simple kmalloc - could be optimized with buffer pools */
-	buffer = kmalloc(size, GFP_KERNEL);
-	if (!buffer) {
-		canon_r5_still_err(still, "Failed to allocate image buffer (%zu bytes)", size);
+	}
+
+	index = still_slot_get(still_priv);
+	if (index < 0) {
+		canon_r5_still_err(still, "Image buffer pool exhausted");
 		return NULL;
 	}
-	
-	canon_r5_still_dbg(still, "Allocated image buffer: %zu bytes", size);
-	return buffer;
+
+	canon_r5_still_dbg(still, "Allocated image buffer %d: %zu bytes", index, size);
+	return still_priv->memory.slots[index].vaddr;
 }
 
 void canon_r5_still_free_image_buffer(struct canon_r5_still_device *still, void *buffer)
 {
-	if (buffer) {
-		kfree(buffer);
-		canon_r5_still_dbg(still, "Freed image buffer");
+	struct canon_r5_still *still_priv;
+	unsigned int i;
+
+	if (!still || !buffer)
+		return;
+
+	still_priv = to_still_priv(still);
+
+	for (i = 0; i < still_priv->memory.nr_buffers; i++) {
+		if (still_priv->memory.slots[i].vaddr == buffer)
+			break;
+	}
+
+	if (still_slot_put(still_priv, i, NULL)) {
+		canon_r5_still_warn(still, "Freeing buffer not owned by the kernel");
+		return;
 	}
+
+	canon_r5_still_dbg(still, "Freed image buffer %u", i);
 }
 
 /* Image management */
@@ -230,10 +588,12 @@ static struct canon_r5_captured_image *alloc_captured_image(struct canon_r5_stil
 {
 	struct canon_r5_captured_image *image;
 	
-	image = kzalloc(sizeof(*image), GFP_KERNEL);
+	image = mempool_alloc(to_still_priv(still)->memory.image_pool, GFP_KERNEL);
 	if (!image)
 		return NULL;
 	
+	memset(image, 0, sizeof(*image));
+	image->still = still;
 	INIT_LIST_HEAD(&image->list);
 	init_completion(&image->ready);
 	atomic_set(&image->ref_count, 1);
@@ -241,106 +601,278 @@ static struct canon_r5_captured_image *alloc_captured_image(struct canon_r5_stil
 	return image;
 }
 
+static void free_captured_image(struct canon_r5_captured_image *image)
+{
+	struct canon_r5_still *still_priv = to_still_priv(image->still);
+
+	if (image->data)
+		still_slot_put(still_priv, image->slot, NULL);
+	mempool_free(image, still_priv->memory.image_pool);
+}
+
+/* Camera reported a new image ready for transfer */
+static void still_object_ready(struct canon_r5_device *dev, u32 object_handle)
+{
+	struct canon_r5_still *still_priv = dev->still_priv;
+	unsigned long flags;
+	unsigned int announced;
+	bool queued;
+	
+	if (!still_priv)
+		return;
+	
+	spin_lock_irqsave(&still_priv->events.lock, flags);
+	queued = kfifo_put(&still_priv->events.handles, object_handle);
+	announced = kfifo_len(&still_priv->events.handles);
+	spin_unlock_irqrestore(&still_priv->events.lock, flags);
+	
+	if (!queued)
+		canon_r5_still_warn(&still_priv->device, "Dropping object 0x%08x, event queue full",
+				    object_handle);
+	
+	/* The shot has left the camera's buffer and made room for another trigger */
+	atomic_dec_if_positive(&still_priv->pipeline.in_camera);
+	still_stage_note(&still_priv->device, CANON_R5_STILL_STAGE_ANNOUNCED, announced);
+	
+	wake_up(&still_priv->events.wait);
+	wake_up(&still_priv->memory.wait);
+}
+
+/*
+ * Forget handles left over from captures triggered on the camera body.
+ * Only called with nothing in flight, so frame numbering restarts at the
+ * next ring sequence.
+ */
+static void still_events_reset(struct canon_r5_still *still_priv)
+{
+	unsigned long flags;
+	u32 sequence;
+	
+	spin_lock(&still_priv->memory.lock);
+	sequence = still_priv->memory.sequence;
+	still_priv->pipeline.skip = 0;
+	spin_unlock(&still_priv->memory.lock);
+	
+	atomic_set(&still_priv->pipeline.in_camera, 0);
+	
+	spin_lock_irqsave(&still_priv->events.lock, flags);
+	kfifo_reset(&still_priv->events.handles);
+	still_priv->events.sequence = sequence;
+	spin_unlock_irqrestore(&still_priv->events.lock, flags);
+}
+
+/*
+ * Frames are numbered as their transfer request is claimed, in event order.
+ * A frame more than the skip window ahead of hand-off waits here, so its
+ * failure can always be recorded in pipeline.skip.
+ */
+static bool still_events_pop(struct canon_r5_still *still_priv, u32 *object_handle,
+			     u32 *sequence)
+{
+	unsigned long flags;
+	bool found = false;
+	
+	spin_lock_irqsave(&still_priv->events.lock, flags);
+	if (still_priv->events.sequence - READ_ONCE(still_priv->memory.sequence) <
+	    CANON_R5_STILL_SKIP_WINDOW)
+		found = kfifo_get(&still_priv->events.handles, object_handle);
+	if (found)
+		*sequence = still_priv->events.sequence++;
+	spin_unlock_irqrestore(&still_priv->events.lock, flags);
+	
+	return found;
+}
+
+/* Wait for the transfer-request event naming the next captured object */
+static int still_wait_object(struct canon_r5_still_device *still, u32 *object_handle,
+			     u32 *sequence)
+{
+	struct canon_r5_still *still_priv = to_still_priv(still);
+	long timeout;
+	
+	timeout = wait_event_timeout(still_priv->events.wait,
+				     still_events_pop(still_priv, object_handle, sequence) ||
+				     !READ_ONCE(still->initialized),
+				     msecs_to_jiffies(CANON_R5_STILL_EVENT_TIMEOUT_MS));
+	if (!READ_ONCE(still->initialized))
+		return -ENODEV;
+	if (!timeout)
+		return -ETIMEDOUT;
+	
+	return 0;
+}
+
+/* Account for @count shots about to be triggered, called with still->lock held */
+static void still_pipeline_trigger(struct canon_r5_still *still_priv, unsigned int count)
+{
+	struct canon_r5_still_device *still = &still_priv->device;
+	
+	atomic_add(count, &still->pending_captures);
+	still_stage_note(still, CANON_R5_STILL_STAGE_TRIGGERED,
+			 atomic_add_return(count, &still_priv->pipeline.in_camera));
+}
+
+/* The camera refused the trigger */
+static void still_pipeline_untrigger(struct canon_r5_still *still_priv, unsigned int count)
+{
+	atomic_sub(count, &still_priv->pipeline.in_camera);
+	atomic_sub(count, &still_priv->device.pending_captures);
+}
+
+/* Hand @count triggered shots to the download stage */
+static void still_pipeline_queue(struct canon_r5_still *still_priv, unsigned int count)
+{
+	struct canon_r5_still_device *still = &still_priv->device;
+	unsigned int i;
+	
+	atomic_add(count, &still_priv->pipeline.queued);
+	
+	/* Idle workers pick frames up at once, busy ones when they finish */
+	for (i = 0; i < CANON_R5_STILL_DOWNLOADERS; i++)
+		canon_r5_queue_work(still->canon_dev, still->capture_wq,
+				    &still_priv->downloaders[i]->work);
+}
+
 /* Work functions */
 
-void canon_r5_still_capture_work(struct work_struct *work)
+static int still_capture_one(struct canon_r5_still_downloader *downloader)
 {
-	struct canon_r5_still_device *still = container_of(work, 
-		struct canon_r5_still_device, capture_work);
-	struct canon_r5_captured_image *image;
-	u32 object_id;
-	void *data;
+	struct canon_r5_still *still_priv = downloader->still_priv;
+	struct canon_r5_still_device *still = &still_priv->device;
+	struct canon_r5_ptp_object_reader *reader = &downloader->reader;
+	struct canon_r5_still_slot *slot;
+	u32 object_id, sequence;
 	size_t size;
-	int ret;
+	int index, ret;
 	
-	canon_r5_still_dbg(still, "Processing capture work");
-	
-	/* Allocate new image structure */
-	image = alloc_captured_image(still);
-	if (!image) {
-		canon_r5_still_err(still, "Failed to allocate captured image");
-		goto error;
+	ret = still_wait_object(still, &object_id, &sequence);
+	if (ret) {
+		canon_r5_still_err(still, "No transfer request for captured image: %d", ret);
+		
+		/* The shot is lost; stop counting it against the camera's buffer */
+		atomic_dec_if_positive(&still_priv->pipeline.in_camera);
+		canon_r5_counter_inc(&still->counters, CANON_R5_STILL_IMAGES_FAILED);
+		return ret;
 	}
 	
-	/* Simulate getting object ID from PTP event - in real implementation
-	 * this would come from the camera's ObjectAdded event */
-	object_id = 0x12345678; /* Placeholder */
-	
-	/* Retrieve image data from camera */
-	ret = canon_r5_ptp_get_captured_image(still->canon_dev, object_id, &data, &size);
+	/* Capture paths reserved a slot before triggering the shutter */
+	index = still_slot_get(still_priv);
+	if (index < 0) {
+		canon_r5_still_err(still, "Image buffer pool exhausted");
+		ret = index;
+		goto error_skip;
+	}
+	slot = &still_priv->memory.slots[index];
+	still_stage_note(still, CANON_R5_STILL_STAGE_DOWNLOADING,
+			 atomic_inc_return(&still_priv->pipeline.downloading));
+	
+	/* Partial-object chunks land directly in the slot, several in flight */
+	canon_r5_ptp_reader_init(reader, still->canon_dev, object_id, 0,
+				 still_priv->memory.buffer_size, slot->vaddr);
+	ret = canon_r5_ptp_reader_run(reader);
+	atomic_dec(&still_priv->pipeline.downloading);
+	if (!ret && !reader->eof) {
+		/* Filled the slot without reaching the end of the object */
+		ret = -EMSGSIZE;
+	}
 	if (ret) {
 		canon_r5_still_err(still, "Failed to retrieve captured image: %d", ret);
-		goto error_free_image;
+		still_slot_put(still_priv, index, NULL);
+		goto error_skip;
 	}
+	size = reader->consumed;
 	
 	/* Fill in image metadata */
-	image->metadata.timestamp = ktime_get_real();
-	image->metadata.file_size = size;
-	image->metadata.capture_settings = still->settings;
-	
-	/* Copy image data to our buffer */
-	image->data = canon_r5_still_alloc_image_buffer(still, size);
-	if (!image->data) {
-		canon_r5_still_err(still, "Failed to allocate image data buffer");
-		goto error_free_image;
-	}
+	memset(&slot->metadata, 0, sizeof(slot->metadata));
+	slot->metadata.timestamp = ktime_get_real();
+	slot->metadata.file_size = size;
+	slot->metadata.capture_settings = still->settings;
 	
-	memcpy(image->data, data, size);
-	image->data_size = size;
+	still_slot_done(still_priv, index, sequence, size);
 	
-	/* Add to captured images list */
-	spin_lock(&still->image_list_lock);
-	list_add_tail(&image->list, &still->captured_images);
-	kfifo_put(&still->image_queue, image);
-	spin_unlock(&still->image_list_lock);
-	
-	/* Signal completion */
-	complete(&image->ready);
-	wake_up(&still->capture_wait);
+	canon_r5_still_info(still, "Captured image %u: %zu bytes", sequence, size);
+	return 0;
+
+error_skip:
+	still_slot_skip(still_priv, sequence);
+	return ret;
+}
+
+void canon_r5_still_capture_work(struct work_struct *work)
+{
+	struct canon_r5_still_downloader *downloader = container_of(work,
+		struct canon_r5_still_downloader, work);
+	struct canon_r5_still *still_priv = downloader->still_priv;
+	struct canon_r5_still_device *still = &still_priv->device;
 	
-	/* Update statistics */
-	still->stats.images_captured++;
-	still->stats.total_bytes += size;
-	still->stats.last_capture = ktime_get();
+	canon_r5_still_dbg(still, "Processing capture work");
 	
-	canon_r5_still_info(still, "Captured image: %zu bytes", size);
-	return;
-
-error_free_image:
-	kfree(image);
-error:
-	still->stats.images_failed++;
-	atomic_dec(&still->pending_captures);
+	while (atomic_dec_if_positive(&still_priv->pipeline.queued) >= 0) {
+		still_capture_one(downloader);
+		
+		if (atomic_dec_and_test(&still->pending_captures)) {
+			mutex_lock(&still->lock);
+			if (!still->continuous_active && !atomic_read(&still->pending_captures))
+				still->capture_active = false;
+			mutex_unlock(&still->lock);
+		}
+		
+		/* A new reservation may now fit */
+		wake_up(&still_priv->memory.wait);
+	}
 }
 
-void canon_r5_still_continuous_timer(struct timer_list *timer)
+/*
+ * Continuous shooting trigger stage. Runs in process context because the
+ * capture command sleeps, and holds a tick rather than blocking when the
+ * camera's buffer or the ring is full, so downloads keep draining.
+ */
+void canon_r5_still_trigger_work(struct work_struct *work)
 {
-	struct canon_r5_still_device *still = from_timer(still, timer, continuous_timer);
+	struct canon_r5_still_device *still = container_of(to_delayed_work(work),
+		struct canon_r5_still_device, trigger_work);
+	struct canon_r5_still *still_priv = to_still_priv(still);
+	unsigned long interval;
 	int ret;
 	
-	if (!still->continuous_active)
-		return;
+	mutex_lock(&still->lock);
+	
+	if (!still->continuous_active || !still->initialized)
+		goto out_unlock;
 	
-	/* Trigger next capture */
+	interval = max_t(unsigned long, HZ / max_t(u32, still->settings.continuous_fps, 1), 1);
+	
+	if (!still_pipeline_room(still_priv, 1)) {
+		canon_r5_counter_inc(&still->counters, CANON_R5_STILL_TRIGGER_STALLS);
+		canon_r5_queue_delayed_work(still->canon_dev, still->capture_wq,
+					    &still->trigger_work, interval);
+		goto out_unlock;
+	}
+	
+	still_pipeline_trigger(still_priv, 1);
 	ret = canon_r5_ptp_capture_single(still->canon_dev);
 	if (ret) {
+		still_pipeline_untrigger(still_priv, 1);
 		canon_r5_still_err(still, "Continuous capture failed: %d", ret);
 		still->continuous_active = false;
-		return;
+		if (!atomic_read(&still->pending_captures))
+			still->capture_active = false;
+		goto out_unlock;
 	}
-	
-	still->continuous_count++;
+	still_pipeline_queue(still_priv, 1);
 	
 	/* Schedule next capture if within burst limit */
-	if (still->continuous_count < still->settings.burst_count) {
-		unsigned long next_jiffies = jiffies + 
-			HZ / still->settings.continuous_fps;
-		mod_timer(&still->continuous_timer, next_jiffies);
+	if (++still->continuous_count < still->settings.burst_count) {
+		canon_r5_queue_delayed_work(still->canon_dev, still->capture_wq,
+					    &still->trigger_work, interval);
 	} else {
 		still->continuous_active = false;
 		canon_r5_still_info(still, "Continuous capture completed: %u images", 
 				    still->continuous_count);
 	}
+
+out_unlock:
+	mutex_unlock(&still->lock);
 }
 
 void canon_r5_still_af_work(struct work_struct *work)
@@ -363,12 +895,13 @@ void canon_r5_still_af_work(struct work_struct *work)
 		if (ret == 0) {
 			still->focus.focus_position = position;
 			still->focus.focus_achieved = achieved;
-			still->stats.af_success += achieved ? 1 : 0;
+			if (achieved)
+				canon_r5_counter_inc(&still->counters, CANON_R5_STILL_AF_SUCCESS);
 		}
 	}
 	
 	still->focus.af_active = false;
-	still->stats.af_operations++;
+	canon_r5_counter_inc(&still->counters, CANON_R5_STILL_AF_OPERATIONS);
 	
 	mutex_unlock(&still->focus.lock);
 	complete(&still->focus.af_complete);
@@ -397,6 +930,13 @@ int canon_r5_still_set_quality(struct canon_r5_still_device *still,
 	
 	mutex_lock(&still->lock);
 	
+	ret = still_pool_resize(to_still_priv(still), canon_r5_still_buffer_size(quality));
+	if (ret) {
+		canon_r5_still_warn(still, "Cannot resize image buffer pool: %d", ret);
+		mutex_unlock(&still->lock);
+		return ret;
+	}
+	
 	ret = canon_r5_ptp_set_image_quality(still->canon_dev, 
 					    quality->format, 
 					    quality->size, 
@@ -428,6 +968,40 @@ int canon_r5_still_get_quality(struct canon_r5_still_device *still,
 }
 EXPORT_SYMBOL_GPL(canon_r5_still_get_quality);
 
+/*
+ * Push the exposure part of the settings as one combined property write,
+ * in the standard PTP encodings (f-number * 100, seconds * 10000,
+ * bias in 1/1000 EV).
+ */
+static int still_push_exposure(struct canon_r5_still_device *still,
+			       const struct canon_r5_capture_settings *settings)
+{
+	struct canon_r5_device *dev = still->canon_dev;
+	u16 iso = min_t(u32, settings->iso, U16_MAX);
+	s16 bias = settings->exposure_compensation * 1000 / 3;
+	u32 exposure_time;
+	u16 f_number;
+	
+	if (!READ_ONCE(dev->ptp.session_open))
+		return 0;
+	
+	canon_r5_props_write_begin(dev);
+	canon_r5_props_write(dev, PTP_DPC_EXPOSURE_INDEX, &iso, sizeof(iso));
+	if (settings->aperture.denominator) {
+		f_number = settings->aperture.numerator * 100 / settings->aperture.denominator;
+		canon_r5_props_write(dev, PTP_DPC_F_NUMBER, &f_number, sizeof(f_number));
+	}
+	if (settings->shutter_speed.denominator) {
+		exposure_time = (u64)settings->shutter_speed.numerator * 10000 /
+				settings->shutter_speed.denominator;
+		canon_r5_props_write(dev, PTP_DPC_EXPOSURE_TIME, &exposure_time,
+				     sizeof(exposure_time));
+	}
+	canon_r5_props_write(dev, PTP_DPC_EXPOSURE_BIAS_COMPENSATION, &bias, sizeof(bias));
+	
+	return canon_r5_props_write_commit(dev);
+}
+
 int canon_r5_still_set_capture_settings(struct canon_r5_still_device *still,
 					const struct canon_r5_capture_settings *settings)
 {
@@ -441,17 +1015,27 @@ int canon_r5_still_set_capture_settings(struct canon_r5_still_device *still,
 		return ret;
 	
 	mutex_lock(&still->lock);
-	still->settings = *settings;
+	
+	ret = still_push_exposure(still, settings);
+	if (ret)
+		canon_r5_still_warn(still, "Exposure settings not applied: %d", ret);
 	
 	/* Set bracketing if enabled */
-	if (settings->mode == CANON_R5_CAPTURE_BRACKET) {
+	if (!ret && settings->mode == CANON_R5_CAPTURE_BRACKET) {
 		ret = canon_r5_ptp_set_bracketing(still->canon_dev, 
 						 settings->bracket_shots,
 						 settings->bracket_step);
 	}
 	
+	/* Only settings the camera accepted are kept */
+	if (!ret)
+		still->settings = *settings;
+	
 	mutex_unlock(&still->lock);
 	
+	if (ret)
+		return ret;
+	
 	canon_r5_still_info(still, "Set capture settings: %s mode, ISO %u", 
 			    canon_r5_capture_mode_name(settings->mode),
 			    settings->iso);
@@ -463,6 +1047,8 @@ EXPORT_SYMBOL_GPL(canon_r5_still_set_capture_settings);
 int canon_r5_still_get_capture_settings(struct canon_r5_still_device *still,
 					struct canon_r5_capture_settings *settings)
 {
+	u32 value;
+	
 	if (!still || !settings)
 		return -EINVAL;
 	
@@ -470,17 +1056,35 @@ int canon_r5_still_get_capture_settings(struct canon_r5_still_device *still,
 	*settings = still->settings;
 	mutex_unlock(&still->lock);
 	
+	/* Reflect dial changes made on the body; cache only, no round trip */
+	if (!canon_r5_props_lookup(still->canon_dev, PTP_DPC_EXPOSURE_INDEX, &value, sizeof(value)) &&
+	    value)
+		settings->iso = value;
+	if (!canon_r5_props_lookup(still->canon_dev, PTP_DPC_F_NUMBER, &value, sizeof(value)) &&
+	    value) {
+		settings->aperture.numerator = value;		/* f-number * 100 */
+		settings->aperture.denominator = 100;
+	}
+	if (!canon_r5_props_lookup(still->canon_dev, PTP_DPC_EXPOSURE_TIME, &value, sizeof(value)) &&
+	    value) {
+		settings->shutter_speed.numerator = value;	/* seconds * 10000 */
+		settings->shutter_speed.denominator = 10000;
+	}
+	
 	return 0;
 }
 EXPORT_SYMBOL_GPL(canon_r5_still_get_capture_settings);
 
 int canon_r5_still_capture_single(struct canon_r5_still_device *still)
 {
+	struct canon_r5_still *still_priv;
 	int ret;
 	
 	if (!still)
 		return -EINVAL;
 	
+	still_priv = to_still_priv(still);
+	
 	mutex_lock(&still->lock);
 	
 	if (still->capture_active) {
@@ -489,18 +1093,34 @@ int canon_r5_still_capture_single(struct canon_r5_still_device *still)
 	}
 	
 	still->capture_active = true;
-	atomic_inc(&still->pending_captures);
+	mutex_unlock(&still->lock);
+	
+	still_events_reset(still_priv);
+	
+	/* Wait for a free pool buffer without blocking other still operations */
+	ret = still_pool_reserve(still, 1);
+	
+	mutex_lock(&still->lock);
+	if (!ret && !still->initialized)
+		ret = -ENODEV;
+	if (ret) {
+		still->capture_active = false;
+		mutex_unlock(&still->lock);
+		return ret;
+	}
+	
+	still_pipeline_trigger(still_priv, 1);
 	
 	ret = canon_r5_ptp_capture_single(still->canon_dev);
 	if (ret) {
 		still->capture_active = false;
-		atomic_dec(&still->pending_captures);
+		still_pipeline_untrigger(still_priv, 1);
 		mutex_unlock(&still->lock);
 		return ret;
 	}
 	
 	/* Schedule work to process the capture */
-	queue_work(still->capture_wq, &still->capture_work);
+	still_pipeline_queue(still_priv, 1);
 	
 	mutex_unlock(&still->lock);
 	
@@ -511,7 +1131,9 @@ EXPORT_SYMBOL_GPL(canon_r5_still_capture_single);
 
 int canon_r5_still_capture_burst(struct canon_r5_still_device *still, u16 count)
 {
-	int ret;
+	struct canon_r5_still *still_priv;
+	unsigned int remaining, segment;
+	int ret = 0;
 	
 	if (!still)
 		return -EINVAL;
@@ -519,6 +1141,8 @@ int canon_r5_still_capture_burst(struct canon_r5_still_device *still, u16 count)
 	if (count == 0 || count > 999)
 		return -EINVAL;
 	
+	still_priv = to_still_priv(still);
+	
 	mutex_lock(&still->lock);
 	
 	if (still->capture_active) {
@@ -527,18 +1151,55 @@ int canon_r5_still_capture_burst(struct canon_r5_still_device *still, u16 count)
 	}
 	
 	still->capture_active = true;
-	atomic_add(count, &still->pending_captures);
+	mutex_unlock(&still->lock);
+	
+	still_events_reset(still_priv);
+	
+	/*
+	 * Trigger the burst in segments no larger than the pool or the camera's
+	 * buffer, waiting for room in between rather than failing mid-burst.
+	 * Earlier segments keep downloading while later ones are triggered.
+	 * capture_active keeps the pool from being resized underneath us.
+	 */
+	for (remaining = count; remaining; remaining -= segment) {
+		segment = min3(remaining, still_priv->memory.nr_buffers,
+			       still_max_in_camera());
+		
+		ret = still_pool_reserve(still, segment);
+		if (ret)
+			break;
+		
+		/* Cleanup clears initialized under the lock before tearing down the workqueue */
+		mutex_lock(&still->lock);
+		if (!still->initialized) {
+			mutex_unlock(&still->lock);
+			ret = -ENODEV;
+			break;
+		}
+		
+		still_pipeline_trigger(still_priv, segment);
+		
+		ret = canon_r5_ptp_capture_burst(still->canon_dev, segment);
+		if (ret) {
+			still_pipeline_untrigger(still_priv, segment);
+			mutex_unlock(&still->lock);
+			break;
+		}
+		
+		still_pipeline_queue(still_priv, segment);
+		mutex_unlock(&still->lock);
+	}
 	
-	ret = canon_r5_ptp_capture_burst(still->canon_dev, count);
 	if (ret) {
-		still->capture_active = false;
-		atomic_sub(count, &still->pending_captures);
+		mutex_lock(&still->lock);
+		if (!atomic_read(&still->pending_captures))
+			still->capture_active = false;
 		mutex_unlock(&still->lock);
+		canon_r5_still_err(still, "Burst stopped after %u of %u images: %d",
+				   count - remaining, count, ret);
 		return ret;
 	}
 	
-	mutex_unlock(&still->lock);
-	
 	canon_r5_still_info(still, "Burst capture initiated: %u images", count);
 	return 0;
 }
@@ -546,9 +1207,6 @@ EXPORT_SYMBOL_GPL(canon_r5_still_capture_burst);
 
 int canon_r5_still_start_continuous(struct canon_r5_still_device *still)
 {
-	int ret;
-	unsigned long first_capture;
-	
 	if (!still)
 		return -EINVAL;
 	
@@ -562,19 +1220,10 @@ int canon_r5_still_start_continuous(struct canon_r5_still_device *still)
 	still->continuous_active = true;
 	still->continuous_count = 0;
 	still->capture_active = true;
+	still_events_reset(to_still_priv(still));
 	
-	/* Start first capture immediately */
-	ret = canon_r5_ptp_capture_single(still->canon_dev);
-	if (ret) {
-		still->continuous_active = false;
-		still->capture_active = false;
-		mutex_unlock(&still->lock);
-		return ret;
-	}
-	
-	/* Schedule next captures */
-	first_capture = jiffies + HZ / still->settings.continuous_fps;
-	mod_timer(&still->continuous_timer, first_capture);
+	/* Start first capture immediately, the trigger work paces the rest */
+	canon_r5_queue_delayed_work(still->canon_dev, still->capture_wq, &still->trigger_work, 0);
 	
 	mutex_unlock(&still->lock);
 	
@@ -597,9 +1246,15 @@ int canon_r5_still_stop_continuous(struct canon_r5_still_device *still)
 	}
 	
 	still->continuous_active = false;
-	still->capture_active = false;
-	del_timer_sync(&still->continuous_timer);
+	mutex_unlock(&still->lock);
 	
+	/* The trigger work takes still->lock itself */
+	cancel_delayed_work_sync(&still->trigger_work);
+	
+	/* Shots already triggered finish downloading before the next capture */
+	mutex_lock(&still->lock);
+	if (!atomic_read(&still->pending_captures))
+		still->capture_active = false;
 	mutex_unlock(&still->lock);
 	
 	canon_r5_still_info(still, "Continuous capture stopped after %u images", 
@@ -610,18 +1265,33 @@ EXPORT_SYMBOL_GPL(canon_r5_still_stop_continuous);
 
 struct canon_r5_captured_image *canon_r5_still_get_next_image(struct canon_r5_still_device *still)
 {
-	struct canon_r5_captured_image *image = NULL;
+	struct canon_r5_still *still_priv;
+	struct canon_r5_captured_image *image;
+	struct canon_r5_still_slot *slot;
+	int index;
 	
 	if (!still)
 		return NULL;
 	
-	spin_lock(&still->image_list_lock);
+	still_priv = to_still_priv(still);
 	
-	if (kfifo_get(&still->image_queue, &image)) {
-		atomic_inc(&image->ref_count);
+	image = alloc_captured_image(still);
+	if (!image)
+		return NULL;
+	
+	index = still_slot_dequeue(still_priv, NULL);
+	if (index < 0) {
+		mempool_free(image, still_priv->memory.image_pool);
+		return NULL;
 	}
 	
-	spin_unlock(&still->image_list_lock);
+	/* The descriptor points into the slot; release_image() hands it back */
+	slot = &still_priv->memory.slots[index];
+	image->slot = index;
+	image->data = slot->vaddr;
+	image->data_size = slot->bytesused;
+	image->metadata = slot->metadata;
+	complete(&image->ready);
 	
 	return image;
 }
@@ -632,12 +1302,8 @@ void canon_r5_still_release_image(struct canon_r5_captured_image *image)
 	if (!image)
 		return;
 	
-	if (atomic_dec_and_test(&image->ref_count)) {
-		if (image->data) {
-			kfree(image->data);
-		}
-		kfree(image);
-	}
+	if (atomic_dec_and_test(&image->ref_count))
+		free_captured_image(image);
 }
 EXPORT_SYMBOL_GPL(canon_r5_still_release_image);
 
@@ -649,7 +1315,7 @@ int canon_r5_still_autofocus(struct canon_r5_still_device *still)
 		return -EINVAL;
 	
 	reinit_completion(&still->focus.af_complete);
-	queue_work(system_wq, &still->focus.af_work);
+	canon_r5_queue_work(still->canon_dev, still->capture_wq, &still->focus.af_work);
 	
 	return 0;
 }
@@ -696,30 +1362,292 @@ EXPORT_SYMBOL_GPL(canon_r5_still_get_focus_info);
 int canon_r5_still_get_stats(struct canon_r5_still_device *still,
 			     struct canon_r5_still_stats *stats)
 {
+	u64 counters[CANON_R5_STILL_COUNTERS] = {};
+	struct canon_r5_still *still_priv;
+	unsigned long flags;
+	
 	if (!still || !stats)
 		return -EINVAL;
 	
+	still_priv = to_still_priv(still);
 	*stats = still->stats;
+	
+	canon_r5_counters_read(&still->counters, counters);
+	stats->images_captured = counters[CANON_R5_STILL_IMAGES_CAPTURED];
+	stats->images_failed = counters[CANON_R5_STILL_IMAGES_FAILED];
+	stats->total_bytes = counters[CANON_R5_STILL_TOTAL_BYTES];
+	stats->af_operations = counters[CANON_R5_STILL_AF_OPERATIONS];
+	stats->af_success = counters[CANON_R5_STILL_AF_SUCCESS];
+	stats->trigger_stalls = counters[CANON_R5_STILL_TRIGGER_STALLS];
+	
+	stats->stage_depth[CANON_R5_STILL_STAGE_TRIGGERED] =
+		atomic_read(&still_priv->pipeline.in_camera);
+	spin_lock_irqsave(&still_priv->events.lock, flags);
+	stats->stage_depth[CANON_R5_STILL_STAGE_ANNOUNCED] =
+		kfifo_len(&still_priv->events.handles);
+	spin_unlock_irqrestore(&still_priv->events.lock, flags);
+	stats->stage_depth[CANON_R5_STILL_STAGE_DOWNLOADING] =
+		atomic_read(&still_priv->pipeline.downloading);
+	stats->stage_depth[CANON_R5_STILL_STAGE_READY] =
+		READ_ONCE(still_priv->memory.nr_ready);
 	return 0;
 }
 EXPORT_SYMBOL_GPL(canon_r5_still_get_stats);
 
+static const char * const still_counter_names[CANON_R5_STILL_COUNTERS] = {
+	[CANON_R5_STILL_IMAGES_CAPTURED]	= "images_captured",
+	[CANON_R5_STILL_IMAGES_FAILED]		= "images_failed",
+	[CANON_R5_STILL_TOTAL_BYTES]		= "total_bytes",
+	[CANON_R5_STILL_AF_OPERATIONS]		= "af_operations",
+	[CANON_R5_STILL_AF_SUCCESS]		= "af_success",
+	[CANON_R5_STILL_TRIGGER_STALLS]		= "trigger_stalls",
+};
+
+static const char * const still_stage_names[CANON_R5_STILL_STAGES] = {
+	[CANON_R5_STILL_STAGE_TRIGGERED]	= "triggered",
+	[CANON_R5_STILL_STAGE_ANNOUNCED]	= "announced",
+	[CANON_R5_STILL_STAGE_DOWNLOADING]	= "downloading",
+	[CANON_R5_STILL_STAGE_READY]		= "ready",
+};
+
+static int still_stats_show(struct seq_file *m, void *v)
+{
+	struct canon_r5_still_device *still = m->private;
+	struct canon_r5_still_stats stats;
+	int i;
+	
+	canon_r5_still_get_stats(still, &stats);
+	
+	seq_printf(m, "images_captured: %llu\n", stats.images_captured);
+	seq_printf(m, "images_failed: %llu\n", stats.images_failed);
+	seq_printf(m, "total_bytes: %llu\n", stats.total_bytes);
+	seq_printf(m, "af_operations: %llu\n", stats.af_operations);
+	seq_printf(m, "af_success: %llu\n", stats.af_success);
+	seq_printf(m, "average_focus_time_ms: %u\n", stats.average_focus_time_ms);
+	seq_printf(m, "average_capture_time_ms: %u\n", stats.average_capture_time_ms);
+	seq_printf(m, "last_capture_ns: %lld\n", ktime_to_ns(stats.last_capture));
+	seq_printf(m, "trigger_stalls: %llu\n", stats.trigger_stalls);
+	for (i = 0; i < CANON_R5_STILL_STAGES; i++) {
+		seq_printf(m, "%s_depth: %u\n", still_stage_names[i], stats.stage_depth[i]);
+		seq_printf(m, "%s_max: %u\n", still_stage_names[i], stats.stage_max[i]);
+	}
+	
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(still_stats);
+
 void canon_r5_still_reset_stats(struct canon_r5_still_device *still)
 {
 	if (!still)
 		return;
 	
 	memset(&still->stats, 0, sizeof(still->stats));
+	canon_r5_counters_reset(&still->counters);
 	canon_r5_still_info(still, "Statistics reset");
 }
 EXPORT_SYMBOL_GPL(canon_r5_still_reset_stats);
 
+/* Capture ring character device */
+
+static void still_downloaders_free(struct canon_r5_still *still_priv)
+{
+	unsigned int i;
+
+	for (i = 0; i < CANON_R5_STILL_DOWNLOADERS; i++) {
+		kfree(still_priv->downloaders[i]);
+		still_priv->downloaders[i] = NULL;
+	}
+}
+
+static void still_release(struct kref *ref)
+{
+	struct canon_r5_still *still_priv = container_of(ref, struct canon_r5_still, ref);
+	struct canon_r5_device *dev = still_priv->device.canon_dev;
+
+	still_downloaders_free(still_priv);
+	mempool_destroy(still_priv->memory.image_pool);
+	still_pool_free(still_priv);
+	kfree(still_priv);
+	canon_r5_device_put(dev);
+}
+
+static int canon_r5_still_open(struct inode *inode, struct file *file)
+{
+	struct canon_r5_still *still_priv = container_of(file->private_data,
+							 struct canon_r5_still, miscdev);
+	struct canon_r5_still_device *still = &still_priv->device;
+
+	mutex_lock(&still->lock);
+	if (!still->initialized) {
+		mutex_unlock(&still->lock);
+		return -ENODEV;
+	}
+	still_priv->users++;
+	kref_get(&still_priv->ref);
+	mutex_unlock(&still->lock);
+
+	file->private_data = still_priv;
+	return nonseekable_open(inode, file);
+}
+
+static int canon_r5_still_release(struct inode *inode, struct file *file)
+{
+	struct canon_r5_still *still_priv = file->private_data;
+	struct canon_r5_still_device *still = &still_priv->device;
+	unsigned int i;
+
+	/* Slots this file never queued back are returned on close */
+	for (i = 0; i < still_priv->memory.nr_buffers; i++)
+		still_slot_put(still_priv, i, file);
+
+	mutex_lock(&still->lock);
+	still_priv->users--;
+	mutex_unlock(&still->lock);
+
+	kref_put(&still_priv->ref, still_release);
+	return 0;
+}
+
+static int canon_r5_still_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct canon_r5_still *still_priv = file->private_data;
+	unsigned long slot_pages, index, offset;
+
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+
+	/* An open file keeps the pool from being resized */
+	slot_pages = still_priv->memory.buffer_size >> PAGE_SHIFT;
+	if (!slot_pages)
+		return -ENODEV;
+
+	index = vma->vm_pgoff / slot_pages;
+	offset = vma->vm_pgoff % slot_pages;
+
+	if (index >= still_priv->memory.nr_buffers ||
+	    vma_pages(vma) > slot_pages - offset)
+		return -EINVAL;
+
+	/* Nor may mprotect() make it writable later */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,3,0)
+	vm_flags_clear(vma, VM_MAYWRITE);
+#else
+	vma->vm_flags &= ~VM_MAYWRITE;
+#endif
+
+	return remap_vmalloc_range(vma, still_priv->memory.slots[index].vaddr, offset);
+}
+
+static __poll_t canon_r5_still_poll(struct file *file, poll_table *wait)
+{
+	struct canon_r5_still *still_priv = file->private_data;
+	struct canon_r5_still_device *still = &still_priv->device;
+
+	poll_wait(file, &still->capture_wait, wait);
+
+	if (READ_ONCE(still_priv->memory.nr_ready))
+		return EPOLLIN | EPOLLRDNORM;
+	if (!READ_ONCE(still->initialized))
+		return EPOLLERR | EPOLLHUP;
+	return 0;
+}
+
+static int still_ioctl_dqbuf(struct canon_r5_still *still_priv, struct file *file,
+			     struct canon_r5_still_buffer __user *argp)
+{
+	struct canon_r5_still_device *still = &still_priv->device;
+	struct canon_r5_still_buffer buf = {};
+	struct canon_r5_still_slot *slot;
+	int index, ret;
+
+	for (;;) {
+		index = still_slot_dequeue(still_priv, file);
+		if (index >= 0)
+			break;
+
+		if (file->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+
+		ret = wait_event_interruptible(still->capture_wait,
+					       READ_ONCE(still_priv->memory.nr_ready) ||
+					       !READ_ONCE(still->initialized));
+		if (ret)
+			return ret;
+		if (!READ_ONCE(still->initialized))
+			return -ENODEV;
+	}
+
+	slot = &still_priv->memory.slots[index];
+	buf.index = index;
+	buf.sequence = slot->sequence;
+	buf.bytesused = slot->bytesused;
+	buf.timestamp = slot->metadata.timestamp;
+
+	if (copy_to_user(argp, &buf, sizeof(buf))) {
+		still_slot_put(still_priv, index, file);
+		return -EFAULT;
+	}
+
+	return 0;
+}
+
+static long canon_r5_still_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
+{
+	struct canon_r5_still *still_priv = file->private_data;
+	struct canon_r5_still_device *still = &still_priv->device;
+	void __user *argp = (void __user *)arg;
+	struct canon_r5_still_ring_info info = {};
+	u32 value;
+
+	if (!READ_ONCE(still->initialized))
+		return -ENODEV;
+
+	switch (cmd) {
+	case CANON_R5_STILL_IOC_QUERYRING:
+		info.nr_slots = still_priv->memory.nr_buffers;
+		info.slot_size = still_priv->memory.buffer_size;
+		return copy_to_user(argp, &info, sizeof(info)) ? -EFAULT : 0;
+
+	case CANON_R5_STILL_IOC_DQBUF:
+		return still_ioctl_dqbuf(still_priv, file, argp);
+
+	case CANON_R5_STILL_IOC_QBUF:
+		if (get_user(value, (u32 __user *)argp))
+			return -EFAULT;
+		return still_slot_put(still_priv, value, file);
+
+	case CANON_R5_STILL_IOC_CAPTURE:
+		return canon_r5_still_capture_single(still);
+
+	case CANON_R5_STILL_IOC_BURST:
+		if (get_user(value, (u32 __user *)argp))
+			return -EFAULT;
+		if (value > U16_MAX)
+			return -EINVAL;
+		return canon_r5_still_capture_burst(still, value);
+
+	default:
+		return -ENOTTY;
+	}
+}
+
+static const struct file_operations canon_r5_still_fops = {
+	.owner = THIS_MODULE,
+	.open = canon_r5_still_open,
+	.release = canon_r5_still_release,
+	.mmap = canon_r5_still_mmap,
+	.poll = canon_r5_still_poll,
+	.unlocked_ioctl = canon_r5_still_ioctl,
+	.compat_ioctl = compat_ptr_ioctl,
+};
+
 /* Initialization and cleanup */
 
 int canon_r5_still_init(struct canon_r5_device *dev)
 {
 	struct canon_r5_still *still_priv;
 	struct canon_r5_still_device *still;
+	unsigned int i;
 	int ret;
 	
 	if (!dev) {
@@ -736,11 +1664,17 @@ int canon_r5_still_init(struct canon_r5_device *dev)
 	
 	still = &still_priv->device;
 	still->canon_dev = dev;
+	kref_init(&still_priv->ref);
 	
 	/* Initialize device structure */
 	mutex_init(&still->lock);
 	still->initialized = false;
 	still->capture_active = false;
+	spin_lock_init(&still_priv->memory.lock);
+	init_waitqueue_head(&still_priv->memory.wait);
+	INIT_KFIFO(still_priv->events.handles);
+	spin_lock_init(&still_priv->events.lock);
+	init_waitqueue_head(&still_priv->events.wait);
 	
 	/* Set default image quality */
 	still->quality.format = CANON_R5_STILL_JPEG;
@@ -762,22 +1696,50 @@ int canon_r5_still_init(struct canon_r5_device *dev)
 	still->settings.burst_count = 10;
 	
 	/* Initialize image management */
-	INIT_LIST_HEAD(&still->captured_images);
-	spin_lock_init(&still->image_list_lock);
-	INIT_KFIFO(still->image_queue);
 	init_waitqueue_head(&still->capture_wait);
 	atomic_set(&still->pending_captures, 0);
 	
-	/* Initialize work structures */
-	INIT_WORK(&still->capture_work, canon_r5_still_capture_work);
-	still->capture_wq = create_singlethread_workqueue("canon-r5-still-capture");
+	/* Initialize image buffer pool */
+	ret = still_pool_alloc(still_priv, canon_r5_still_buffer_size(&still->quality));
+	if (ret)
+		goto error_free;
+	
+	still_priv->memory.image_pool =
+		mempool_create_kmalloc_pool(CANON_R5_STILL_POOL_MAX_BUFFERS,
+					    sizeof(struct canon_r5_captured_image));
+	if (!still_priv->memory.image_pool) {
+		ret = -ENOMEM;
+		goto error_free_pool;
+	}
+	
+	/* Initialize the capture pipeline */
+	atomic_set(&still_priv->pipeline.queued, 0);
+	atomic_set(&still_priv->pipeline.in_camera, 0);
+	atomic_set(&still_priv->pipeline.downloading, 0);
+	
+	for (i = 0; i < CANON_R5_STILL_DOWNLOADERS; i++) {
+		struct canon_r5_still_downloader *downloader;
+		
+		downloader = kzalloc(sizeof(*downloader), GFP_KERNEL);
+		if (!downloader) {
+			ret = -ENOMEM;
+			goto error_free_downloaders;
+		}
+		downloader->still_priv = still_priv;
+		INIT_WORK(&downloader->work, canon_r5_still_capture_work);
+		still_priv->downloaders[i] = downloader;
+	}
+	
+	/* Unbound so downloads overlap each other and the continuous trigger */
+	still->capture_wq = canon_r5_workqueue_get(dev, CANON_R5_WORK_BULK, "canon-r5-still-capture",
+						   WQ_UNBOUND, 0);
 	if (!still->capture_wq) {
 		ret = -ENOMEM;
-		goto error_free;
+		goto error_free_downloaders;
 	}
 	
-	/* Initialize continuous timer */
-	timer_setup(&still->continuous_timer, canon_r5_still_continuous_timer, 0);
+	/* Initialize continuous shooting */
+	INIT_DELAYED_WORK(&still->trigger_work, canon_r5_still_trigger_work);
 	still->continuous_active = false;
 	
 	/* Initialize focus system */
@@ -786,20 +1748,69 @@ int canon_r5_still_init(struct canon_r5_device *dev)
 	init_completion(&still->focus.af_complete);
 	INIT_WORK(&still->focus.af_work, canon_r5_still_af_work);
 	
+	ret = canon_r5_counters_register(dev, &still->counters, "still", still_counter_names,
+					 CANON_R5_STILL_COUNTERS);
+	if (ret)
+		goto error_cleanup;
+	
 	/* Register with core driver */
 	ret = canon_r5_register_still_driver(dev, still_priv);
 	if (ret) {
 		canon_r5_err(dev, "Failed to register still driver: %d", ret);
-		goto error_cleanup;
+		goto error_counters;
+	}
+	WRITE_ONCE(dev->event_handler.still_capture_complete, still_object_ready);
+	
+	/* Expose the capture ring */
+	still_priv->minor_id = ida_alloc(&canon_r5_still_ida, GFP_KERNEL);
+	if (still_priv->minor_id < 0) {
+		ret = still_priv->minor_id;
+		goto error_unregister;
 	}
 	
+	snprintf(still_priv->name, sizeof(still_priv->name), "canon-r5-still%d",
+		 still_priv->minor_id);
+	still_priv->miscdev.minor = MISC_DYNAMIC_MINOR;
+	still_priv->miscdev.name = still_priv->name;
+	still_priv->miscdev.fops = &canon_r5_still_fops;
+	still_priv->miscdev.parent = dev->dev;
+	
+	/* Dropped by still_release() once the last file is closed */
+	canon_r5_device_get(dev);
 	still->initialized = true;
+	
+	ret = misc_register(&still_priv->miscdev);
+	if (ret) {
+		canon_r5_err(dev, "Failed to register still capture device: %d", ret);
+		still->initialized = false;
+		canon_r5_device_put(dev);
+		goto error_free_minor;
+	}
+	
+	if (canon_r5_stats_debugfs_dir(dev))
+		still_priv->debugfs = debugfs_create_file("still_stats", 0444,
+							  canon_r5_stats_debugfs_dir(dev),
+							  still, &still_stats_fops);
+	
 	canon_r5_info(dev, "Still image capture driver initialized successfully");
 	
 	return 0;
 
+error_free_minor:
+	ida_free(&canon_r5_still_ida, still_priv->minor_id);
+error_unregister:
+	WRITE_ONCE(dev->event_handler.still_capture_complete, NULL);
+	flush_work(&dev->ptp.event_work);
+	canon_r5_unregister_still_driver(dev);
+error_counters:
+	canon_r5_counters_unregister(&still->counters);
 error_cleanup:
-	destroy_workqueue(still->capture_wq);
+	canon_r5_workqueue_put(dev, still->capture_wq);
+error_free_downloaders:
+	still_downloaders_free(still_priv);
+	mempool_destroy(still_priv->memory.image_pool);
+error_free_pool:
+	still_pool_free(still_priv);
 error_free:
 	kfree(still_priv);
 	return ret;
@@ -810,7 +1821,7 @@ void canon_r5_still_cleanup(struct canon_r5_device *dev)
 {
 	struct canon_r5_still *still_priv;
 	struct canon_r5_still_device *still;
-	struct canon_r5_captured_image *image, *tmp;
+	unsigned int i;
 	
 	if (!dev)
 		return;
@@ -828,27 +1839,68 @@ void canon_r5_still_cleanup(struct canon_r5_device *dev)
 		canon_r5_still_stop_continuous(still);
 	}
 	
+	/* Fail new requests and wake anyone waiting on the ring */
+	mutex_lock(&still->lock);
+	still->initialized = false;
+	mutex_unlock(&still->lock);
+	
+	/* No event dispatch may reach still_priv once the handler is gone */
+	WRITE_ONCE(dev->event_handler.still_capture_complete, NULL);
+	flush_work(&dev->ptp.event_work);
+	
+	wake_up_all(&still->capture_wait);
+	wake_up_all(&still_priv->memory.wait);
+	wake_up_all(&still_priv->events.wait);
+	
+	debugfs_remove(still_priv->debugfs);
+	misc_deregister(&still_priv->miscdev);
+	ida_free(&canon_r5_still_ida, still_priv->minor_id);
+	
 	/* Cancel work and destroy workqueue */
-	cancel_work_sync(&still->capture_work);
-	destroy_workqueue(still->capture_wq);
-	
-	/* Free all captured images */
-	spin_lock(&still->image_list_lock);
-	list_for_each_entry_safe(image, tmp, &still->captured_images, list) {
-		list_del(&image->list);
-		if (image->data) {
-			canon_r5_still_free_image_buffer(still, image->data);
-		}
-		kfree(image);
-	}
-	spin_unlock(&still->image_list_lock);
+	cancel_delayed_work_sync(&still->trigger_work);
+	for (i = 0; i < CANON_R5_STILL_DOWNLOADERS; i++)
+		cancel_work_sync(&still_priv->downloaders[i]->work);
+	cancel_work_sync(&still->focus.af_work);
+	canon_r5_workqueue_put(dev, still->capture_wq);
 	
 	/* Unregister from core driver */
 	canon_r5_unregister_still_driver(dev);
+	canon_r5_counters_unregister(&still->counters);
 	
-	/* Free private data */
-	kfree(still_priv);
+	/*
+	 * Open files and their mappings keep the ring alive; in-kernel
+	 * consumers must have released their images by now.
+	 */
+	kref_put(&still_priv->ref, still_release);
 	
 	canon_r5_info(dev, "Still image capture driver cleaned up");
 }
 EXPORT_SYMBOL_GPL(canon_r5_still_cleanup);
+
+static const struct canon_r5_bringup_ops canon_r5_still_bringup_ops = {
+	.run = canon_r5_still_init,
+	.teardown = canon_r5_still_cleanup,
+};
+
+static int __init canon_r5_still_module_init(void)
+{
+	int ret;
+	
+	ret = canon_r5_bringup_register(CANON_R5_BRINGUP_STILL, &canon_r5_still_bringup_ops);
+	if (ret) {
+		pr_err("Failed to register still bring-up step: %d\n", ret);
+		return ret;
+	}
+	
+	pr_info("Canon R5 Still Capture Driver loaded\n");
+	return 0;
+}
+
+static void __exit canon_r5_still_module_exit(void)
+{
+	canon_r5_bringup_unregister(CANON_R5_BRINGUP_STILL);
+	pr_info("Canon R5 Still Capture Driver unloaded\n");
+}
+
+module_init(canon_r5_still_module_init);
+module_exit(canon_r5_still_module_exit);
@@ -21,15 +21,28 @@
 #include <linux/time.h>
 #include <linux/slab.h>
 #include <linux/vmalloc.h>
+#include <linux/highmem.h>
+#include <linux/backing-dev.h>
+#include <linux/sizes.h>
 #include <linux/version.h>
 
 #include "../../include/core/canon-r5.h"
+#include "../../include/core/canon-r5-ptp.h"
 #include "../../include/storage/canon-r5-storage.h"
 
 /* Filesystem constants */
 #define CANON_R5_FS_NAME		"canon_r5_fs"
 #define CANON_R5_FS_MAGIC		0x43355235  /* "C5R5" */
-#define CANON_R5_CACHE_MAX_SIZE		(64 * 1024 * 1024)  /* 64MB */
+
+/* Readahead window: every chunk the partial-object reader keeps in flight */
+#define CANON_R5_FS_READAHEAD_SIZE	(CANON_R5_PTP_READER_CHUNK_SIZE * CANON_R5_PTP_READER_DEPTH)
+
+/* Pages SendObject holds under writeback at a time; sent windows are unpinned */
+#define CANON_R5_FS_UPLOAD_WINDOW	(SZ_4M >> PAGE_SHIFT)
+
+static unsigned int cache_size_mb = 64;
+module_param(cache_size_mb, uint, 0444);
+MODULE_PARM_DESC(cache_size_mb, "Default per-mount object cache budget in MiB (0 disables, default 64)");
 
 /* Filesystem mount options */
 enum {
@@ -51,13 +64,15 @@ static struct inode *canon_r5_fs_alloc_inode(struct super_block *sb);
 static void canon_r5_fs_destroy_inode(struct inode *inode);
 static int canon_r5_fs_statfs(struct dentry *dentry, struct kstatfs *buf);
 static int canon_r5_fs_show_options(struct seq_file *m, struct dentry *root);
+static long canon_r5_fs_nr_cached_objects(struct super_block *sb, struct shrink_control *sc);
+static long canon_r5_fs_free_cached_objects(struct super_block *sb, struct shrink_control *sc);
 
 /* File operations forward declarations */
 static int canon_r5_fs_readdir(struct file *file, struct dir_context *ctx);
 static loff_t canon_r5_fs_dir_llseek(struct file *file, loff_t offset, int whence);
 
-static ssize_t canon_r5_fs_read(struct file *file, char __user *buf, size_t count, loff_t *ppos);
-static ssize_t canon_r5_fs_write(struct file *file, const char __user *buf, size_t count, loff_t *ppos);
+static int canon_r5_fs_flush(struct file *file, fl_owner_t id);
+static int canon_r5_fs_fsync(struct file *file, loff_t start, loff_t end, int datasync);
 static loff_t canon_r5_fs_file_llseek(struct file *file, loff_t offset, int whence);
 
 /* Inode operations forward declarations */
@@ -71,19 +86,30 @@ static int canon_r5_fs_create(CR5_IDMAP *mnt_userns, struct inode *dir, struct d
 static int canon_r5_fs_unlink(struct inode *dir, struct dentry *dentry);
 static int canon_r5_fs_mkdir(CR5_IDMAP *mnt_userns, struct inode *dir, struct dentry *dentry, umode_t mode);
 static int canon_r5_fs_rmdir(struct inode *dir, struct dentry *dentry);
+static int canon_r5_fs_setattr(CR5_IDMAP *mnt_userns, struct dentry *dentry, struct iattr *attr);
 
 /* Address space operations forward declarations */
 static int canon_r5_fs_read_folio(struct file *file, struct folio *folio);
+static void canon_r5_fs_readahead(struct readahead_control *rac);
 static int canon_r5_fs_write_begin(struct file *file, struct address_space *mapping,
 				   loff_t pos, unsigned len, struct page **pagep, void **fsdata);
 static int canon_r5_fs_write_end(struct file *file, struct address_space *mapping,
 				 loff_t pos, unsigned len, unsigned copied,
 				 struct page *page, void *fsdata);
+static int canon_r5_fs_writepages(struct address_space *mapping, struct writeback_control *wbc);
+static int canon_r5_fs_upload(struct inode *inode);
+static int canon_r5_fs_store(struct inode *inode);
 
-/* Filesystem inode structure */
+/*
+ * Filesystem inode structure. A file created on the mount has a file_obj
+ * naming it but no object_handle until its first upload stores it.
+ */
 struct canon_r5_inode_info {
 	struct canon_r5_file_object *file_obj;
 	u32 object_handle;
+	loff_t stored_size;		/* Leading bytes still read from the object */
+	bool changed;			/* Written or truncated since the last upload */
+	struct mutex upload_lock;	/* One whole-object upload at a time */
 	struct inode vfs_inode;
 };
 
@@ -99,6 +125,8 @@ const struct super_operations canon_r5_storage_super_ops = {
 	.destroy_inode	= canon_r5_fs_destroy_inode,
 	.statfs		= canon_r5_fs_statfs,
 	.show_options	= canon_r5_fs_show_options,
+	.nr_cached_objects	= canon_r5_fs_nr_cached_objects,
+	.free_cached_objects	= canon_r5_fs_free_cached_objects,
 };
 
 /* Directory inode operations */
@@ -112,6 +140,7 @@ const struct inode_operations canon_r5_storage_dir_inode_ops = {
 
 /* File inode operations */
 const struct inode_operations canon_r5_storage_file_inode_ops = {
+	.setattr	= canon_r5_fs_setattr,
 };
 
 /* Directory file operations */
@@ -126,10 +155,19 @@ const struct file_operations canon_r5_storage_dir_file_ops = {
 /* Regular file operations */
 const struct file_operations canon_r5_storage_file_ops = {
 	.llseek		= canon_r5_fs_file_llseek,
-	.read		= canon_r5_fs_read,
-	.write		= canon_r5_fs_write,
+	.read_iter	= generic_file_read_iter,
+	.write_iter	= generic_file_write_iter,
+	.flush		= canon_r5_fs_flush,
+	.fsync		= canon_r5_fs_fsync,
 	.mmap		= generic_file_readonly_mmap,
-#if LINUX_VERSION_CODE < KERNEL_VERSION(6,6,0)
+	/*
+	 * sendfile and copy_file_range go through the page cache, whose
+	 * readahead is one chunked partial-object transfer, and splice the
+	 * filled folios into the pipe without copying them again.
+	 */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,5,0)
+	.splice_read	= filemap_splice_read,
+#else
 	.splice_read	= generic_file_splice_read,
 #endif
 };
@@ -137,8 +175,11 @@ const struct file_operations canon_r5_storage_file_ops = {
 /* Address space operations */
 const struct address_space_operations canon_r5_storage_aops = {
 	.read_folio	= canon_r5_fs_read_folio,
+	.readahead	= canon_r5_fs_readahead,
 	.write_begin	= canon_r5_fs_write_begin,
 	.write_end	= canon_r5_fs_write_end,
+	.writepages	= canon_r5_fs_writepages,
+	.dirty_folio	= filemap_dirty_folio,
 };
 
 /* Filesystem operations implementation */
@@ -152,6 +193,9 @@ static struct inode *canon_r5_fs_alloc_inode(struct super_block *sb __attribute_
 		
 	info->file_obj = NULL;
 	info->object_handle = 0;
+	info->stored_size = 0;
+	info->changed = false;
+	mutex_init(&info->upload_lock);
 	
 	return &info->vfs_inode;
 }
@@ -200,22 +244,37 @@ static int canon_r5_fs_show_options(struct seq_file *m, struct dentry *root)
 	
 	seq_printf(m, ",slot=%d", storage->active_card);
 	
-	if (fs_info->cache.max_size != CANON_R5_CACHE_MAX_SIZE)
-		seq_printf(m, ",cache_size=%zu", fs_info->cache.max_size);
+	if (fs_info->cache.max_size != (size_t)cache_size_mb * SZ_1M)
+		seq_printf(m, ",cache_size=%zu", fs_info->cache.max_size / SZ_1M);
 		
 	return 0;
 }
 
+/* The superblock shrinker reclaims cached extents under memory pressure */
+static long canon_r5_fs_nr_cached_objects(struct super_block *sb, struct shrink_control *sc __attribute__((unused)))
+{
+	struct canon_r5_fs_info *fs_info = sb->s_fs_info;
+	
+	return READ_ONCE(fs_info->cache.nr_extents);
+}
+
+static long canon_r5_fs_free_cached_objects(struct super_block *sb, struct shrink_control *sc)
+{
+	struct canon_r5_fs_info *fs_info = sb->s_fs_info;
+	
+	return canon_r5_storage_cache_shrink(fs_info, sc->nr_to_scan);
+}
+
 /* Directory operations */
+#define CANON_R5_FS_READDIR_BATCH	16
+
 static int canon_r5_fs_readdir(struct file *file, struct dir_context *ctx)
 {
 	struct inode *inode = file_inode(file);
 	struct canon_r5_fs_info *fs_info = inode->i_sb->s_fs_info;
-	struct canon_r5_storage_device *storage = fs_info->storage;
 	struct canon_r5_inode_info *info = CANON_R5_I(inode);
-	struct list_head entries;
-	struct canon_r5_dir_entry *entry, *tmp;
-	int ret;
+	struct canon_r5_dir_entry *entries, *cursor;
+	int count, i, ret;
 	
 	if (ctx->pos == 0) {
 		if (!dir_emit_dot(file, ctx))
@@ -229,35 +288,40 @@ static int canon_r5_fs_readdir(struct file *file, struct dir_context *ctx)
 		ctx->pos = 2;
 	}
 	
-	/* Get directory entries from storage */
-	ret = canon_r5_storage_list_directory(storage, info->object_handle, &entries);
-	if (ret < 0)
+	ret = canon_r5_storage_index_build(fs_info);
+	if (ret)
 		return ret;
-		
-	/* Emit directory entries */
-	list_for_each_entry_safe(entry, tmp, &entries, list) {
-		if (ctx->pos < 2) {
-			ctx->pos = 2;
-			continue;
+	
+	/* The extra entry holds the name the next batch resumes after */
+	entries = kmalloc_array(CANON_R5_FS_READDIR_BATCH + 1, sizeof(*entries), GFP_KERNEL);
+	if (!entries)
+		return -ENOMEM;
+	cursor = &entries[CANON_R5_FS_READDIR_BATCH];
+	
+	/* Entries are copied out of the index, so dir_emit never runs under file_lock */
+	count = canon_r5_storage_index_children(fs_info, info->object_handle, NULL,
+						ctx->pos - 2, entries,
+						CANON_R5_FS_READDIR_BATCH);
+	while (count > 0) {
+		for (i = 0; i < count; i++) {
+			if (!dir_emit(ctx, entries[i].name, strlen(entries[i].name),
+				      entries[i].object_handle,
+				      entries[i].is_directory ? DT_DIR : DT_REG))
+				goto out;
+			ctx->pos++;
 		}
 		
-		if (!dir_emit(ctx, entry->name, strlen(entry->name),
-			      entry->object_handle,
-			      entry->is_directory ? DT_DIR : DT_REG)) {
+		if (count < CANON_R5_FS_READDIR_BATCH)
 			break;
-		}
 		
-		ctx->pos++;
-		list_del(&entry->list);
-		kfree(entry);
-	}
-	
-	/* Clean up remaining entries */
-	list_for_each_entry_safe(entry, tmp, &entries, list) {
-		list_del(&entry->list);
-		kfree(entry);
+		strscpy(cursor->name, entries[count - 1].name, sizeof(cursor->name));
+		count = canon_r5_storage_index_children(fs_info, info->object_handle,
+							cursor->name, 0, entries,
+							CANON_R5_FS_READDIR_BATCH);
 	}
 	
+out:
+	kfree(entries);
 	return 0;
 }
 
@@ -267,87 +331,21 @@ static loff_t canon_r5_fs_dir_llseek(struct file *file, loff_t offset, int whenc
 }
 
 /* File operations */
-static ssize_t canon_r5_fs_read(struct file *file, char __user *buf, size_t count, loff_t *ppos)
+
+/* Closing a file that was written stores it on the card and reports any failure */
+static int canon_r5_fs_flush(struct file *file, fl_owner_t id __attribute__((unused)))
 {
-	struct inode *inode = file_inode(file);
-	struct canon_r5_fs_info *fs_info = inode->i_sb->s_fs_info;
-	struct canon_r5_storage_device *storage = fs_info->storage;
-	struct canon_r5_inode_info *info = CANON_R5_I(inode);
-	void *kernel_buf;
-	size_t bytes_read = 0;
-	ssize_t ret;
-	
-	if (!info->file_obj)
-		return -ENOENT;
-		
-	if (*ppos >= info->file_obj->file_size)
+	if (!(file->f_mode & FMODE_WRITE))
 		return 0;
-		
-	count = min_t(size_t, count, info->file_obj->file_size - *ppos);
-	
-	kernel_buf = vmalloc(count);
-	if (!kernel_buf)
-		return -ENOMEM;
-		
-	ret = canon_r5_storage_read_file(storage, info->file_obj, kernel_buf, count, *ppos, &bytes_read);
-	if (ret) {
-		vfree(kernel_buf);
-		return ret;
-	}
-	
-	if (copy_to_user(buf, kernel_buf, bytes_read)) {
-		vfree(kernel_buf);
-		return -EFAULT;
-	}
-	
-	vfree(kernel_buf);
-	*ppos += bytes_read;
 	
-	return bytes_read;
+	return canon_r5_fs_store(file_inode(file));
 }
 
-static ssize_t canon_r5_fs_write(struct file *file, const char __user *buf, size_t count, loff_t *ppos)
+/* The object is rewritten whole, whatever range was asked for */
+static int canon_r5_fs_fsync(struct file *file, loff_t start __attribute__((unused)),
+			     loff_t end __attribute__((unused)), int datasync __attribute__((unused)))
 {
-	struct inode *inode = file_inode(file);
-	struct canon_r5_fs_info *fs_info = inode->i_sb->s_fs_info;
-	struct canon_r5_storage_device *storage = fs_info->storage;
-	void *kernel_buf;
-	struct canon_r5_file_object *new_file = NULL;
-	ssize_t ret;
-	
-	if (canon_r5_storage_is_write_protected(storage, storage->active_card))
-		return -EROFS;
-		
-	kernel_buf = vmalloc(count);
-	if (!kernel_buf)
-		return -ENOMEM;
-		
-	if (copy_from_user(kernel_buf, buf, count)) {
-		vfree(kernel_buf);
-		return -EFAULT;
-	}
-	
-	ret = canon_r5_storage_write_file(storage, file->f_path.dentry->d_name.name,
-					  kernel_buf, count, &new_file);
-	if (ret) {
-		vfree(kernel_buf);
-		return ret;
-	}
-	
-	vfree(kernel_buf);
-	
-	/* Update inode size */
-	if (new_file) {
-		struct canon_r5_inode_info *info = CANON_R5_I(inode);
-		if (info->file_obj)
-			canon_r5_storage_put_file(info->file_obj);
-		info->file_obj = new_file;
-		info->object_handle = new_file->object_handle;
-		inode->i_size = new_file->file_size;
-	}
-	
-	*ppos += count;
-	return count;
+	return canon_r5_fs_store(file_inode(file));
 }
 
 static loff_t canon_r5_fs_file_llseek(struct file *file, loff_t offset, int whence)
@@ -359,69 +357,98 @@ static loff_t canon_r5_fs_file_llseek(struct file *file, loff_t offset, int when
 static struct dentry *canon_r5_fs_lookup(struct inode *dir, struct dentry *dentry, unsigned int flags __attribute__((unused)))
 {
 	struct canon_r5_fs_info *fs_info = dir->i_sb->s_fs_info;
-	struct canon_r5_storage_device *storage = fs_info->storage;
 	struct canon_r5_inode_info *dir_info = CANON_R5_I(dir);
-	struct list_head entries;
-	struct canon_r5_dir_entry *entry, *tmp;
-	struct inode *inode = NULL;
+	struct canon_r5_file_object *file;
+	struct inode *inode;
 	int ret;
 	
-	/* Search for the requested file/directory */
-	ret = canon_r5_storage_list_directory(storage, dir_info->object_handle, &entries);
-	if (ret < 0)
+	ret = canon_r5_storage_index_build(fs_info);
+	if (ret)
 		return ERR_PTR(ret);
-		
-	list_for_each_entry_safe(entry, tmp, &entries, list) {
-		if (strcmp(entry->name, dentry->d_name.name) == 0) {
-			/* Found the entry - create an inode */
-			inode = new_inode(dir->i_sb);
-			if (inode) {
-				struct canon_r5_inode_info *info = CANON_R5_I(inode);
-				
-				info->object_handle = entry->object_handle;
-				info->file_obj = canon_r5_storage_get_file(storage, entry->object_handle);
-				
-				inode->i_ino = entry->object_handle;
-				inode->i_size = entry->size;
+	
+	/* Served from the (parent, name) index, no camera round trip */
+	file = canon_r5_storage_index_lookup(fs_info, dir_info->object_handle,
+					     dentry->d_name.name);
+	if (!file)
+		return d_splice_alias(NULL, dentry);
+	
+	inode = new_inode(dir->i_sb);
+	if (!inode) {
+		canon_r5_storage_put_file(file);
+		return ERR_PTR(-ENOMEM);
+	}
+	
+	CANON_R5_I(inode)->object_handle = file->object_handle;
+	CANON_R5_I(inode)->stored_size = file->file_size;
+	CANON_R5_I(inode)->file_obj = file;
+	
+	inode->i_ino = file->object_handle;
+	inode->i_size = file->file_size;
 #if LINUX_VERSION_CODE < KERNEL_VERSION(6,11,0)
-				inode->i_mtime = ns_to_timespec64(ktime_to_ns(entry->mtime));
-				inode->i_atime = inode->i_mtime;
-				inode->i_ctime = inode->i_mtime;
+	inode->i_mtime = ns_to_timespec64(ktime_to_ns(file->modification_time));
+	inode->i_atime = inode->i_mtime;
+	inode->i_ctime = inode->i_mtime;
 #endif
-				
-				if (entry->is_directory) {
-					inode->i_mode = S_IFDIR | 0755;
-					inode->i_op = &canon_r5_storage_dir_inode_ops;
-					inode->i_fop = &canon_r5_storage_dir_file_ops;
-					set_nlink(inode, 2);
-				} else {
-					inode->i_mode = S_IFREG | 0644;
-					inode->i_op = &canon_r5_storage_file_inode_ops;
-					inode->i_fop = &canon_r5_storage_file_ops;
-					inode->i_mapping->a_ops = &canon_r5_storage_aops;
-					set_nlink(inode, 1);
-				}
-			}
-			break;
-		}
-		
-		list_del(&entry->list);
-		kfree(entry);
-	}
 	
-	/* Clean up remaining entries */
-	list_for_each_entry_safe(entry, tmp, &entries, list) {
-		list_del(&entry->list);
-		kfree(entry);
+	if (file->file_type == CANON_R5_FILE_FOLDER) {
+		inode->i_mode = S_IFDIR | 0755;
+		inode->i_op = &canon_r5_storage_dir_inode_ops;
+		inode->i_fop = &canon_r5_storage_dir_file_ops;
+		set_nlink(inode, 2);
+	} else {
+		inode->i_mode = S_IFREG | 0644;
+		inode->i_op = &canon_r5_storage_file_inode_ops;
+		inode->i_fop = &canon_r5_storage_file_ops;
+		inode->i_mapping->a_ops = &canon_r5_storage_aops;
+		set_nlink(inode, 1);
 	}
 	
 	return d_splice_alias(inode, dentry);
 }
 
-static int canon_r5_fs_create(CR5_IDMAP *mnt_userns __attribute__((unused)), struct inode *dir __attribute__((unused)), struct dentry *dentry __attribute__((unused)), umode_t mode __attribute__((unused)), bool excl __attribute__((unused)))
+/* The object itself is created by the first upload, when the file is closed or synced */
+static int canon_r5_fs_create(CR5_IDMAP *mnt_userns __attribute__((unused)), struct inode *dir, struct dentry *dentry, umode_t mode __attribute__((unused)), bool excl __attribute__((unused)))
 {
-	/* File creation through PTP is complex and typically done by the camera */
-	return -EPERM;
+	struct canon_r5_fs_info *fs_info = dir->i_sb->s_fs_info;
+	struct canon_r5_storage_device *storage = fs_info->storage;
+	struct canon_r5_file_object *file;
+	struct inode *inode;
+	
+	if (canon_r5_storage_is_write_protected(storage, storage->active_card))
+		return -EROFS;
+	
+	if (dentry->d_name.len >= 255)
+		return -ENAMETOOLONG;
+	
+	file = kzalloc(sizeof(*file), GFP_KERNEL);
+	if (!file)
+		return -ENOMEM;
+	
+	INIT_LIST_HEAD(&file->list);
+	RB_CLEAR_NODE(&file->rb_node);
+	RB_CLEAR_NODE(&file->name_node);
+	kref_init(&file->ref_count);
+	file->parent_handle = CANON_R5_I(dir)->object_handle;
+	strscpy(file->filename, dentry->d_name.name, sizeof(file->filename));
+	file->file_type = canon_r5_storage_detect_file_type(file->filename);
+	file->storage_id = canon_r5_storage_slot_id(fs_info->slot);
+	
+	inode = new_inode(dir->i_sb);
+	if (!inode) {
+		canon_r5_storage_put_file(file);
+		return -ENOMEM;
+	}
+	
+	CANON_R5_I(inode)->file_obj = file;
+	inode->i_ino = get_next_ino();
+	inode->i_mode = S_IFREG | 0644;
+	inode->i_op = &canon_r5_storage_file_inode_ops;
+	inode->i_fop = &canon_r5_storage_file_ops;
+	inode->i_mapping->a_ops = &canon_r5_storage_aops;
+	set_nlink(inode, 1);
+	
+	d_instantiate(dentry, inode);
+	return 0;
 }
 
 static int canon_r5_fs_unlink(struct inode *dir __attribute__((unused)), struct dentry *dentry)
@@ -430,11 +457,21 @@ static int canon_r5_fs_unlink(struct inode *dir __attribute__((unused)), struct
 	struct canon_r5_storage_device *storage = fs_info->storage;
 	struct inode *inode = d_inode(dentry);
 	struct canon_r5_inode_info *info = CANON_R5_I(inode);
+	int ret;
 	
 	if (!info->file_obj)
 		return -ENOENT;
-		
-	return canon_r5_storage_delete_file(storage, info->file_obj);
+	
+	/* Not on the card yet; no upload will store it now */
+	if (!info->object_handle) {
+		drop_nlink(inode);
+		return 0;
+	}
+	
+	ret = canon_r5_storage_delete_file(storage, info->file_obj);
+	if (!ret)
+		drop_nlink(inode);
+	return ret;
 }
 
 static int canon_r5_fs_mkdir(CR5_IDMAP *mnt_userns __attribute__((unused)), struct inode *dir __attribute__((unused)), struct dentry *dentry __attribute__((unused)), umode_t mode __attribute__((unused)))
@@ -449,10 +486,36 @@ static int canon_r5_fs_rmdir(struct inode *dir __attribute__((unused)), struct d
 	return -EPERM;
 }
 
+/* Truncation is stored like a write, by the next close or fsync */
+static int canon_r5_fs_setattr(CR5_IDMAP *mnt_userns, struct dentry *dentry, struct iattr *attr)
+{
+	struct inode *inode = d_inode(dentry);
+	struct canon_r5_inode_info *info = CANON_R5_I(inode);
+	int ret;
+	
+	ret = setattr_prepare(mnt_userns, dentry, attr);
+	if (ret)
+		return ret;
+	
+	if ((attr->ia_valid & ATTR_SIZE) && attr->ia_size != i_size_read(inode)) {
+		/* Not under an upload, which copies up to the old size */
+		mutex_lock(&info->upload_lock);
+		/* Cut-off bytes must not come back from the object if the file grows again */
+		if (attr->ia_size < READ_ONCE(info->stored_size))
+			WRITE_ONCE(info->stored_size, attr->ia_size);
+		truncate_setsize(inode, attr->ia_size);
+		WRITE_ONCE(info->changed, true);
+		mutex_unlock(&info->upload_lock);
+	}
+	
+	setattr_copy(mnt_userns, inode, attr);
+	return 0;
+}
+
 /* Address space operations */
-static int canon_r5_fs_read_folio(struct file *file, struct folio *folio)
+static int canon_r5_fs_read_folio(struct file *file __attribute__((unused)), struct folio *folio)
 {
-	struct inode *inode = file_inode(file);
+	struct inode *inode = folio->mapping->host;
 	struct canon_r5_fs_info *fs_info = inode->i_sb->s_fs_info;
 	struct canon_r5_storage_device *storage = fs_info->storage;
 	struct canon_r5_inode_info *info = CANON_R5_I(inode);
@@ -468,6 +531,14 @@ static int canon_r5_fs_read_folio(struct file *file, struct folio *folio)
 		return -ENOENT;
 	}
 	
+	/* A file not yet stored on the card reads as zeroes past what was written */
+	if (!info->object_handle || offset >= READ_ONCE(info->stored_size)) {
+		zero_user(page, 0, PAGE_SIZE);
+		SetPageUptodate(page);
+		unlock_page(page);
+		return 0;
+	}
+	
 	kaddr = kmap(page);
 	if (!kaddr) {
 		SetPageError(page);
@@ -475,7 +546,10 @@ static int canon_r5_fs_read_folio(struct file *file, struct folio *folio)
 		return -ENOMEM;
 	}
 	
-	ret = canon_r5_storage_read_file(storage, info->file_obj, kaddr, PAGE_SIZE, offset, &bytes_read);
+	/* The page cache keeps what it reads; a second copy in the extent cache is waste */
+	ret = canon_r5_storage_read_file(storage, info->file_obj, kaddr,
+					 min_t(loff_t, PAGE_SIZE, READ_ONCE(info->stored_size) - offset),
+					 offset, CANON_R5_STORAGE_STREAM_NOCACHE, &bytes_read);
 	if (ret) {
 		kunmap(page);
 		SetPageError(page);
@@ -493,36 +567,479 @@ static int canon_r5_fs_read_folio(struct file *file, struct folio *folio)
 	return 0;
 }
 
-static int canon_r5_fs_write_begin(struct file *file __attribute__((unused)), struct address_space *mapping,
+struct canon_r5_fs_readahead_ctx {
+	struct readahead_control *rac;
+	struct folio *folio;	/* Locked folio being filled */
+	size_t offset;		/* Fill level of folio */
+};
+
+static void canon_r5_fs_readahead_finish(struct canon_r5_fs_readahead_ctx *ctx)
+{
+	folio_mark_uptodate(ctx->folio);
+	folio_unlock(ctx->folio);
+	ctx->folio = NULL;
+}
+
+/* Scatter one chunk across the readahead folios in order */
+static int canon_r5_fs_readahead_chunk(void *context, loff_t offset __attribute__((unused)),
+				       const void *data, size_t len)
+{
+	struct canon_r5_fs_readahead_ctx *ctx = context;
+	void *kaddr;
+	size_t n;
+	
+	while (len) {
+		if (!ctx->folio) {
+			ctx->folio = readahead_folio(ctx->rac);
+			ctx->offset = 0;
+			if (!ctx->folio)
+				return 0;
+		}
+		
+		n = min(len, folio_size(ctx->folio) - ctx->offset);
+		n = min_t(size_t, n, PAGE_SIZE - offset_in_page(ctx->offset));
+		
+		kaddr = kmap_local_folio(ctx->folio, ctx->offset);
+		memcpy(kaddr, data, n);
+		kunmap_local(kaddr);
+		
+		data += n;
+		len -= n;
+		ctx->offset += n;
+		
+		if (ctx->offset == folio_size(ctx->folio))
+			canon_r5_fs_readahead_finish(ctx);
+	}
+	
+	return 0;
+}
+
+/*
+ * Fetch the whole readahead window as one chunked partial-object transfer
+ * rather than a PTP round trip per page.
+ */
+static void canon_r5_fs_readahead(struct readahead_control *rac)
+{
+	struct inode *inode = rac->mapping->host;
+	struct canon_r5_fs_info *fs_info = inode->i_sb->s_fs_info;
+	struct canon_r5_storage_device *storage = fs_info->storage;
+	struct canon_r5_inode_info *info = CANON_R5_I(inode);
+	struct canon_r5_fs_readahead_ctx ctx = { .rac = rac };
+	loff_t stored_size = READ_ONCE(info->stored_size);
+	size_t bytes_read = 0;
+	int ret;
+	
+	/* Folios left in rac are unlocked and dropped by the caller */
+	if (!info->file_obj || !info->object_handle || readahead_pos(rac) >= stored_size)
+		return;
+	
+	/* Readahead also feeds splice and sendfile; the page cache holds the copy */
+	ret = canon_r5_storage_stream_file(storage, info->file_obj, readahead_pos(rac),
+					   min_t(loff_t, readahead_length(rac),
+						 stored_size - readahead_pos(rac)),
+					   CANON_R5_STORAGE_STREAM_NOCACHE,
+					   canon_r5_fs_readahead_chunk, &ctx, &bytes_read);
+	if (ret) {
+		if (ctx.folio)
+			folio_unlock(ctx.folio);
+		return;
+	}
+	
+	/* Anything past the end of the object reads as zeroes */
+	if (ctx.folio) {
+		folio_zero_segment(ctx.folio, ctx.offset, folio_size(ctx.folio));
+		canon_r5_fs_readahead_finish(&ctx);
+	}
+	
+	while ((ctx.folio = readahead_folio(rac))) {
+		folio_zero_segment(ctx.folio, 0, folio_size(ctx.folio));
+		canon_r5_fs_readahead_finish(&ctx);
+	}
+}
+
+/*
+ * Writes land in the page cache and reach the camera as a whole object on
+ * close, fsync or writeback under dirty pressure. A partial write into a page the object already has reads it
+ * in first; anything past the end of the object starts out zeroed.
+ */
+static int canon_r5_fs_write_begin(struct file *file, struct address_space *mapping,
 				   loff_t pos, unsigned len, struct page **pagep, void **fsdata __attribute__((unused)))
 {
-	return simple_write_begin(file, mapping, pos, len, pagep, fsdata);
+	struct inode *inode = mapping->host;
+	struct canon_r5_inode_info *info = CANON_R5_I(inode);
+	unsigned int from = offset_in_page(pos);
+	struct page *page;
+	int ret;
+	
+retry:
+	page = grab_cache_page_write_begin(mapping, pos >> PAGE_SHIFT);
+	if (!page)
+		return -ENOMEM;
+	
+	*pagep = page;
+	if (PageUptodate(page) || len == PAGE_SIZE)
+		return 0;
+	
+	if (!info->object_handle || page_offset(page) >= READ_ONCE(info->stored_size)) {
+		zero_user_segments(page, 0, from, from + len, PAGE_SIZE);
+		return 0;
+	}
+	
+	/* read_folio unlocks the page */
+	ret = canon_r5_fs_read_folio(file, page_folio(page));
+	if (!ret) {
+		lock_page(page);
+		if (page->mapping != mapping) {
+			/* Truncated while unlocked */
+			unlock_page(page);
+			put_page(page);
+			goto retry;
+		}
+		if (PageUptodate(page))
+			return 0;
+		
+		unlock_page(page);
+		ret = -EIO;
+	}
+	
+	put_page(page);
+	return ret;
 }
 
 static int canon_r5_fs_write_end(struct file *file __attribute__((unused)), struct address_space *mapping,
 				 loff_t pos, unsigned len, unsigned copied,
 				 struct page *page, void *fsdata __attribute__((unused)))
 {
-	/* Simple write end implementation */
-	SetPageUptodate(page);
-	if (!PageUptodate(page))
-		SetPageError(page);
-	if (pos + copied > mapping->host->i_size)
-		i_size_write(mapping->host, pos + copied);
+	struct inode *inode = mapping->host;
+	
+	/* Everything outside the copy was read or zeroed by write_begin */
+	if (!PageUptodate(page)) {
+		if (copied < len)
+			zero_user(page, offset_in_page(pos) + copied, len - copied);
+		SetPageUptodate(page);
+	}
+	
+	if (pos + copied > inode->i_size)
+		i_size_write(inode, pos + copied);
+	
+	WRITE_ONCE(CANON_R5_I(inode)->changed, true);
 	set_page_dirty(page);
 	unlock_page(page);
 	put_page(page);
 	return copied;
 }
 
+struct canon_r5_fs_upload_ctx {
+	struct address_space *mapping;
+	pgoff_t nr_pages;
+	pgoff_t start, end;		/* Window under writeback */
+};
+
+/* Drop the references upload_prepare holds on [@index, @end) */
+static void canon_r5_fs_upload_unpin(struct address_space *mapping, pgoff_t index, pgoff_t end)
+{
+	struct folio *folio;
+	
+	while (index < end) {
+		folio = filemap_get_folio(mapping, index);
+		if (IS_ERR_OR_NULL(folio)) {
+			index++;
+			continue;
+		}
+		
+		index = folio->index + folio_nr_pages(folio);
+		folio_put(folio);
+		folio_put(folio);
+	}
+}
+
+/*
+ * SendObject replaces the whole object and its data phase leaves the pipe to
+ * nothing else, so ranges the writer left alone are read in from the stored
+ * object first. Each folio is held by a reference rather than dirtied: reclaim
+ * leaves it alone, dirty accounting only sees what was written, and the
+ * reference goes as soon as its window has been sent.
+ */
+static int canon_r5_fs_upload_prepare(struct address_space *mapping, pgoff_t nr_pages)
+{
+	struct file_ra_state ra;
+	struct folio *folio;
+	pgoff_t index = 0;
+	
+	file_ra_state_init(&ra, mapping);
+	
+	while (index < nr_pages) {
+		folio = filemap_get_folio(mapping, index);
+		if (IS_ERR_OR_NULL(folio))
+			page_cache_sync_readahead(mapping, &ra, NULL, index, nr_pages - index);
+		else
+			folio_put(folio);
+		
+		/* Truncation waits for upload_lock; the folio stays in the mapping */
+		folio = read_mapping_folio(mapping, index, NULL);
+		if (IS_ERR(folio)) {
+			canon_r5_fs_upload_unpin(mapping, 0, index);
+			return PTR_ERR(folio);
+		}
+		
+		index = folio->index + folio_nr_pages(folio);
+	}
+	
+	return 0;
+}
+
+/* Start writeback on the window from @index; pages written from here on are dirtied again */
+static int canon_r5_fs_upload_window(struct canon_r5_fs_upload_ctx *ctx, pgoff_t index)
+{
+	pgoff_t last = min_t(pgoff_t, index + CANON_R5_FS_UPLOAD_WINDOW, ctx->nr_pages);
+	struct folio *folio;
+	
+	ctx->start = index;
+	ctx->end = index;
+	
+	while (ctx->end < last) {
+		folio = filemap_get_folio(ctx->mapping, ctx->end);
+		if (IS_ERR_OR_NULL(folio))
+			return -EIO;
+		
+		folio_lock(folio);
+		if (folio->mapping != ctx->mapping) {
+			folio_unlock(folio);
+			folio_put(folio);
+			return -EIO;
+		}
+		folio_wait_writeback(folio);
+		folio_clear_dirty_for_io(folio);
+		folio_start_writeback(folio);
+		folio_unlock(folio);
+		
+		ctx->end = folio->index + folio_nr_pages(folio);
+		folio_put(folio);
+	}
+	
+	return 0;
+}
+
+/* End writeback on the current window and unpin it; a failed upload leaves its pages dirty */
+static void canon_r5_fs_upload_window_end(struct canon_r5_fs_upload_ctx *ctx, int error)
+{
+	struct folio *folio;
+	pgoff_t index = ctx->start;
+	
+	while (index < ctx->end) {
+		folio = filemap_get_folio(ctx->mapping, index);
+		if (IS_ERR_OR_NULL(folio)) {
+			index++;
+			continue;
+		}
+		
+		if (folio_test_writeback(folio)) {
+			if (error) {
+				folio_lock(folio);
+				folio_mark_dirty(folio);
+				folio_unlock(folio);
+			}
+			folio_end_writeback(folio);
+		}
+		
+		index = folio->index + folio_nr_pages(folio);
+		folio_put(folio);
+		folio_put(folio);
+	}
+	
+	ctx->start = ctx->end;
+}
+
+/*
+ * Runs in the PTP transmit work, which cannot fetch unchanged ranges of the
+ * old object itself; upload_prepare pinned every page in the page cache. Only
+ * the window being copied is under writeback, so sent pages come clean and
+ * unpinned and can be reclaimed while the rest of the file goes out.
+ */
+static int canon_r5_fs_upload_chunk(void *context, loff_t offset, void *data, size_t len)
+{
+	struct canon_r5_fs_upload_ctx *ctx = context;
+	struct folio *folio;
+	pgoff_t index;
+	void *kaddr;
+	size_t n;
+	int ret;
+	
+	while (len) {
+		index = offset >> PAGE_SHIFT;
+		if (index >= ctx->end) {
+			canon_r5_fs_upload_window_end(ctx, 0);
+			ret = canon_r5_fs_upload_window(ctx, index);
+			if (ret)
+				return ret;
+		}
+		
+		folio = filemap_get_folio(ctx->mapping, index);
+		if (IS_ERR_OR_NULL(folio))
+			return -EIO;
+		
+		n = min_t(size_t, len, PAGE_SIZE - offset_in_page(offset));
+		kaddr = kmap_local_folio(folio, offset_in_folio(folio, offset));
+		memcpy(data, kaddr, n);
+		kunmap_local(kaddr);
+		folio_put(folio);
+		
+		data += n;
+		offset += n;
+		len -= n;
+	}
+	
+	return 0;
+}
+
+/* Dirty what a failed upload already sent, so the next store sends it again */
+static void canon_r5_fs_upload_redirty(struct address_space *mapping, pgoff_t nr_pages)
+{
+	struct folio *folio;
+	pgoff_t index = 0;
+	
+	while (index < nr_pages) {
+		folio = filemap_get_folio(mapping, index);
+		if (IS_ERR_OR_NULL(folio)) {
+			index++;
+			continue;
+		}
+		
+		folio_lock(folio);
+		if (folio->mapping == mapping)
+			folio_mark_dirty(folio);
+		folio_unlock(folio);
+		
+		index = folio->index + folio_nr_pages(folio);
+		folio_put(folio);
+	}
+}
+
+/*
+ * Store the whole file as a new object and retire the old one; PTP has no
+ * way to rewrite part of an object. Called with info->upload_lock held.
+ */
+static int canon_r5_fs_upload(struct inode *inode)
+{
+	struct address_space *mapping = inode->i_mapping;
+	struct canon_r5_fs_info *fs_info = inode->i_sb->s_fs_info;
+	struct canon_r5_storage_device *storage = fs_info->storage;
+	struct canon_r5_inode_info *info = CANON_R5_I(inode);
+	struct canon_r5_file_object *old = info->file_obj, *new_file = NULL;
+	loff_t size = i_size_read(inode);
+	struct canon_r5_fs_upload_ctx ctx = {
+		.mapping = mapping,
+		.nr_pages = DIV_ROUND_UP(size, PAGE_SIZE),
+	};
+	int ret, err;
+	
+	if (!old)
+		return -ENOENT;
+	
+	/* Unlinked while open: nothing to store */
+	if (!inode->i_nlink)
+		return 0;
+	
+	if (canon_r5_storage_is_write_protected(storage, storage->active_card))
+		return -EROFS;
+	
+	/* Writes from here on are picked up by the next upload */
+	WRITE_ONCE(info->changed, false);
+	
+	ret = canon_r5_fs_upload_prepare(mapping, ctx.nr_pages);
+	if (!ret) {
+		ret = canon_r5_storage_upload_file(storage, old->storage_id, old->parent_handle,
+						   old->filename, size, canon_r5_fs_upload_chunk,
+						   &ctx, &new_file);
+		canon_r5_fs_upload_window_end(&ctx, ret);
+		/* Whatever the data phase did not reach */
+		canon_r5_fs_upload_unpin(mapping, ctx.start, ctx.nr_pages);
+	}
+	
+	if (ret) {
+		/* Earlier windows ended clean; whatever reclaim has not taken yet is kept */
+		canon_r5_fs_upload_redirty(mapping, ctx.start);
+		canon_r5_storage_err(storage, "Failed to store %s: %d", old->filename, ret);
+		WRITE_ONCE(info->changed, true);
+		mapping_set_error(mapping, ret);
+		return ret;
+	}
+	
+	if (info->object_handle) {
+		err = canon_r5_storage_delete_file(storage, old);
+		if (err)
+			canon_r5_storage_warn(storage, "Previous %s left on the card: %d",
+					      old->filename, err);
+		canon_r5_storage_cache_invalidate(fs_info, info->object_handle);
+	}
+	
+	/* The index holds its own reference */
+	kref_get(&new_file->ref_count);
+	canon_r5_storage_index_insert(fs_info, new_file);
+	
+	info->file_obj = new_file;
+	info->object_handle = new_file->object_handle;
+	WRITE_ONCE(info->stored_size, size);
+	canon_r5_storage_put_file(old);
+	
+	return 0;
+}
+
+/* Each upload stores the whole file, so a writer's close or sync stores it once */
+static int canon_r5_fs_store(struct inode *inode)
+{
+	struct canon_r5_inode_info *info = CANON_R5_I(inode);
+	int ret = 0;
+	
+	mutex_lock(&info->upload_lock);
+	/* Created but never written: still create the empty object */
+	if (!info->object_handle || READ_ONCE(info->changed))
+		ret = canon_r5_fs_upload(inode);
+	mutex_unlock(&info->upload_lock);
+	
+	return ret;
+}
+
+/*
+ * Dirty pages are accounted against this bdi and throttle the writer, and
+ * background writeback cleans them by storing the file. Periodic writeback
+ * is left to close and fsync: it would resend the whole object every
+ * dirty_expire interval while a slow copy runs.
+ */
+static int canon_r5_fs_writepages(struct address_space *mapping, struct writeback_control *wbc)
+{
+	struct inode *inode = mapping->host;
+	struct canon_r5_inode_info *info = CANON_R5_I(inode);
+	int ret = 0;
+	
+	if (wbc->for_kupdate)
+		return 0;
+	
+	if (wbc->sync_mode == WB_SYNC_ALL)
+		return canon_r5_fs_store(inode);
+	
+	/* An upload in progress is cleaning it already */
+	if (!mutex_trylock(&info->upload_lock))
+		return 0;
+	if (!info->object_handle || READ_ONCE(info->changed))
+		ret = canon_r5_fs_upload(inode);
+	mutex_unlock(&info->upload_lock);
+	
+	return ret;
+}
+
 /* Filesystem registration */
 static int canon_r5_fs_fill_super(struct super_block *sb, void *data, int silent __attribute__((unused)))
 {
+	struct canon_r5_storage *storage = container_of(sb->s_type, struct canon_r5_storage, fs_type);
+	struct canon_r5_storage_device *device = &storage->device;
 	struct canon_r5_fs_info *fs_info;
 	struct inode *root_inode;
 	char *options = data;
 	char *p;
 	int slot = 0;
+	size_t cache_size = (size_t)cache_size_mb * SZ_1M;
+	int ret;
 	
 	/* Parse mount options */
 	if (options) {
@@ -544,7 +1061,10 @@ static int canon_r5_fs_fill_super(struct super_block *sb, void *data, int silent
 				sb->s_flags |= SB_RDONLY;
 				break;
 			case Opt_cache_size:
-				/* Cache size option - not implemented yet */
+				/* In MiB, like cache_size_mb */
+				if (match_int(&args[0], &option) || option < 0)
+					return -EINVAL;
+				cache_size = (size_t)option * SZ_1M;
 				break;
 			default:
 				return -EINVAL;
@@ -558,8 +1078,11 @@ static int canon_r5_fs_fill_super(struct super_block *sb, void *data, int silent
 		return -ENOMEM;
 		
 	/* Initialize filesystem info */
+	fs_info->storage = device;
+	fs_info->slot = slot;
 	mutex_init(&fs_info->lock);
 	fs_info->file_tree = RB_ROOT;
+	fs_info->name_tree = RB_ROOT;
 	INIT_LIST_HEAD(&fs_info->file_list);
 	spin_lock_init(&fs_info->file_lock);
 	
@@ -568,30 +1091,31 @@ static int canon_r5_fs_fill_super(struct super_block *sb, void *data, int silent
 	mutex_init(&fs_info->dir_cache.lock);
 	fs_info->dir_cache.valid = false;
 	
-	/* Initialize file cache */
-	INIT_LIST_HEAD(&fs_info->cache.lru_list);
-	fs_info->cache.max_size = CANON_R5_CACHE_MAX_SIZE;
-	fs_info->cache.total_size = 0;
-	fs_info->cache.cleanup_wq = alloc_workqueue("canon_r5_fs_cache", WQ_MEM_RECLAIM, 0);
-	if (!fs_info->cache.cleanup_wq) {
-		kfree(fs_info);
-		return -ENOMEM;
-	}
+	/* Initialize extent cache */
+	canon_r5_storage_cache_init(fs_info, cache_size);
 	INIT_WORK(&fs_info->cache.cleanup_work, canon_r5_storage_cache_cleanup_work);
 	
+	/* From here on every failure is torn down by kill_sb */
+	sb->s_fs_info = fs_info;
+	
+	/* A bdi of our own carries the readahead window below */
+	ret = super_setup_bdi(sb);
+	if (ret)
+		return ret;
+	
+	/* Let one readahead window keep the chunked reader's pipeline full */
+	sb->s_bdi->ra_pages = CANON_R5_FS_READAHEAD_SIZE / PAGE_SIZE;
+	sb->s_bdi->io_pages = sb->s_bdi->ra_pages;
+	
 	/* Set up superblock */
 	sb->s_magic = CANON_R5_FS_MAGIC;
 	sb->s_op = &canon_r5_storage_super_ops;
 	sb->s_time_gran = 1;
-	sb->s_fs_info = fs_info;
 	
 	/* Create root inode */
 	root_inode = new_inode(sb);
-	if (!root_inode) {
-		destroy_workqueue(fs_info->cache.cleanup_wq);
-		kfree(fs_info);
+	if (!root_inode)
 		return -ENOMEM;
-	}
 	
 	root_inode->i_ino = 1;
 	root_inode->i_mode = S_IFDIR | 0755;
@@ -607,11 +1131,23 @@ static int canon_r5_fs_fill_super(struct super_block *sb, void *data, int silent
 	CANON_R5_I(root_inode)->file_obj = NULL;
 	
 	sb->s_root = d_make_root(root_inode);
-	if (!sb->s_root) {
-		destroy_workqueue(fs_info->cache.cleanup_wq);
-		kfree(fs_info);
+	if (!sb->s_root)
 		return -ENOMEM;
+	
+	/* One mounted card receives object events at a time */
+	mutex_lock(&device->lock);
+	if (device->fs_info) {
+		mutex_unlock(&device->lock);
+		return -EBUSY;
 	}
+	device->fs_info = fs_info;
+	device->sb = sb;
+	mutex_unlock(&device->lock);
+	
+	/* A failed walk is retried by the first lookup */
+	ret = canon_r5_storage_index_build(fs_info);
+	if (ret)
+		canon_r5_storage_warn(device, "Slot %d index not built: %d", slot, ret);
 	
 	return 0;
 }
@@ -626,16 +1162,32 @@ static struct dentry *canon_r5_fs_mount(struct file_system_type *fs_type,
 static void canon_r5_fs_kill_sb(struct super_block *sb)
 {
 	struct canon_r5_fs_info *fs_info = sb->s_fs_info;
+	struct canon_r5_storage_device *device;
 	
 	if (fs_info) {
-		if (fs_info->cache.cleanup_wq) {
-			cancel_work_sync(&fs_info->cache.cleanup_work);
-			destroy_workqueue(fs_info->cache.cleanup_wq);
+		device = fs_info->storage;
+		mutex_lock(&device->lock);
+		if (device->fs_info == fs_info) {
+			device->fs_info = NULL;
+			device->sb = NULL;
 		}
-		kfree(fs_info);
+		mutex_unlock(&device->lock);
+		
+		/* An object event may still be applying to this index */
+		flush_work(&device->canon_dev->ptp.event_work);
 	}
 	
+	/* Shutdown syncs and evicts the inodes, which still reach fs_info */
 	kill_anon_super(sb);
+	
+	if (fs_info) {
+		canon_r5_storage_index_destroy(fs_info);
+		
+		/* No longer reachable from the sync work, which queued it */
+		cancel_work_sync(&fs_info->cache.cleanup_work);
+		canon_r5_storage_cache_cleanup(fs_info);
+		kfree(fs_info);
+	}
 }
 
 /* Filesystem registration */
@@ -23,6 +23,7 @@
 #include <linux/buffer_head.h>
 #include <linux/statfs.h>
 #include <linux/seq_file.h>
+#include <linux/debugfs.h>
 #include <linux/parser.h>
 #include <linux/mount.h>
 #include <linux/namei.h>
@@ -42,7 +43,6 @@ MODULE_VERSION("1.0.0");
 /* Filesystem constants */
 #define CANON_R5_FS_NAME		"canon_r5_fs"
 #define CANON_R5_FS_MAGIC		0x43355235  /* "C5R5" */
-#define CANON_R5_CACHE_MAX_SIZE		(64 * 1024 * 1024)  /* 64MB */
 #define CANON_R5_CACHE_TIMEOUT		(300 * HZ)  /* 5 minutes */
 
 /* Helper functions for validation and naming */
@@ -141,27 +141,249 @@ static void canon_r5_file_object_release(struct kref *kref)
 {
 	struct canon_r5_file_object *file = container_of(kref, struct canon_r5_file_object, ref_count);
 	
-	if (file->cache_data) {
-		vfree(file->cache_data);
-		file->cache_data = NULL;
+	kfree(file);
+}
+
+/* Extent cache: object data in fixed-size extents, evicted LRU-first */
+void canon_r5_storage_cache_init(struct canon_r5_fs_info *fs_info, size_t max_size)
+{
+	fs_info->cache.extents = RB_ROOT;
+	INIT_LIST_HEAD(&fs_info->cache.lru_list);
+	spin_lock_init(&fs_info->cache.lock);
+	fs_info->cache.total_size = 0;
+	fs_info->cache.max_size = max_size;
+	fs_info->cache.nr_extents = 0;
+}
+
+static void canon_r5_cache_extent_release(struct kref *kref)
+{
+	struct canon_r5_cache_extent *extent = container_of(kref, struct canon_r5_cache_extent, ref);
+	
+	kvfree(extent->data);
+	kfree(extent);
+}
+
+void canon_r5_storage_cache_put(struct canon_r5_cache_extent *extent)
+{
+	if (extent)
+		kref_put(&extent->ref, canon_r5_cache_extent_release);
+}
+
+static int canon_r5_cache_cmp(u32 object_handle, u64 index,
+			      const struct canon_r5_cache_extent *extent)
+{
+	if (object_handle != extent->object_handle)
+		return object_handle < extent->object_handle ? -1 : 1;
+	if (index != extent->index)
+		return index < extent->index ? -1 : 1;
+	return 0;
+}
+
+/* Detach an extent from the cache; the caller drops it after unlocking */
+static void canon_r5_cache_unlink_locked(struct canon_r5_fs_info *fs_info,
+					 struct canon_r5_cache_extent *extent,
+					 struct list_head *victims)
+{
+	rb_erase(&extent->node, &fs_info->cache.extents);
+	list_move(&extent->lru, victims);
+	fs_info->cache.total_size -= extent->len;
+	fs_info->cache.nr_extents--;
+}
+
+static unsigned long canon_r5_cache_release_victims(struct list_head *victims)
+{
+	struct canon_r5_cache_extent *extent, *tmp;
+	unsigned long freed = 0;
+	
+	list_for_each_entry_safe(extent, tmp, victims, lru) {
+		list_del(&extent->lru);
+		canon_r5_storage_cache_put(extent);
+		freed++;
 	}
 	
-	kfree(file);
+	return freed;
 }
 
-struct canon_r5_file_object *canon_r5_storage_get_file(struct canon_r5_storage_device *storage,
-						       u32 object_handle)
+/* Returns a referenced extent and marks it most recently used */
+struct canon_r5_cache_extent *canon_r5_storage_cache_lookup(struct canon_r5_fs_info *fs_info,
+							    u32 object_handle, u64 index)
 {
-	struct canon_r5_file_object *file;
+	struct canon_r5_cache_extent *extent;
 	struct rb_node *node;
-	unsigned long flags;
+	int cmp;
 	
-	if (!storage || !storage->fs_info)
-		return NULL;
+	spin_lock(&fs_info->cache.lock);
+	
+	node = fs_info->cache.extents.rb_node;
+	while (node) {
+		extent = rb_entry(node, struct canon_r5_cache_extent, node);
 		
-	spin_lock_irqsave(&storage->fs_info->file_lock, flags);
+		cmp = canon_r5_cache_cmp(object_handle, index, extent);
+		if (cmp < 0)
+			node = node->rb_left;
+		else if (cmp > 0)
+			node = node->rb_right;
+		else {
+			list_move(&extent->lru, &fs_info->cache.lru_list);
+			extent->last_used = jiffies;
+			kref_get(&extent->ref);
+			spin_unlock(&fs_info->cache.lock);
+			return extent;
+		}
+	}
+	
+	spin_unlock(&fs_info->cache.lock);
+	return NULL;
+}
+
+/* Copy @len bytes in as extent @index of an object, evicting to stay in budget */
+int canon_r5_storage_cache_insert(struct canon_r5_fs_info *fs_info, u32 object_handle,
+				  u64 index, const void *data, size_t len)
+{
+	struct canon_r5_cache_extent *extent, *entry;
+	struct rb_node **link, *parent = NULL;
+	LIST_HEAD(victims);
+	int cmp;
+	
+	if (!len || len > CANON_R5_CACHE_EXTENT_SIZE || len > fs_info->cache.max_size)
+		return -EINVAL;
+	
+	extent = kzalloc(sizeof(*extent), GFP_KERNEL);
+	if (!extent)
+		return -ENOMEM;
+	
+	extent->data = kvmalloc(len, GFP_KERNEL);
+	if (!extent->data) {
+		kfree(extent);
+		return -ENOMEM;
+	}
+	
+	memcpy(extent->data, data, len);
+	kref_init(&extent->ref);
+	extent->object_handle = object_handle;
+	extent->index = index;
+	extent->len = len;
+	extent->last_used = jiffies;
+	
+	spin_lock(&fs_info->cache.lock);
+	
+	link = &fs_info->cache.extents.rb_node;
+	while (*link) {
+		parent = *link;
+		entry = rb_entry(parent, struct canon_r5_cache_extent, node);
+		
+		cmp = canon_r5_cache_cmp(object_handle, index, entry);
+		if (cmp < 0)
+			link = &parent->rb_left;
+		else if (cmp > 0)
+			link = &parent->rb_right;
+		else {
+			/* Lost a race with another reader of the same extent */
+			spin_unlock(&fs_info->cache.lock);
+			canon_r5_storage_cache_put(extent);
+			return 0;
+		}
+	}
+	
+	rb_link_node(&extent->node, parent, link);
+	rb_insert_color(&extent->node, &fs_info->cache.extents);
+	list_add(&extent->lru, &fs_info->cache.lru_list);
+	fs_info->cache.total_size += len;
+	fs_info->cache.nr_extents++;
+	
+	while (fs_info->cache.total_size > fs_info->cache.max_size) {
+		entry = list_last_entry(&fs_info->cache.lru_list,
+					struct canon_r5_cache_extent, lru);
+		canon_r5_cache_unlink_locked(fs_info, entry, &victims);
+	}
+	
+	spin_unlock(&fs_info->cache.lock);
+	
+	canon_r5_cache_release_victims(&victims);
+	return 0;
+}
+
+/* Reclaim up to @nr_to_scan least recently used extents */
+unsigned long canon_r5_storage_cache_shrink(struct canon_r5_fs_info *fs_info,
+					    unsigned long nr_to_scan)
+{
+	struct canon_r5_cache_extent *extent;
+	LIST_HEAD(victims);
+	
+	spin_lock(&fs_info->cache.lock);
+	while (nr_to_scan-- && !list_empty(&fs_info->cache.lru_list)) {
+		extent = list_last_entry(&fs_info->cache.lru_list,
+					 struct canon_r5_cache_extent, lru);
+		canon_r5_cache_unlink_locked(fs_info, extent, &victims);
+	}
+	spin_unlock(&fs_info->cache.lock);
+	
+	return canon_r5_cache_release_victims(&victims);
+}
+
+/* Drop every extent of an object whose data may have changed */
+void canon_r5_storage_cache_invalidate(struct canon_r5_fs_info *fs_info, u32 object_handle)
+{
+	struct canon_r5_cache_extent *extent, *first = NULL;
+	struct rb_node *node, *next;
+	LIST_HEAD(victims);
+	
+	spin_lock(&fs_info->cache.lock);
+	
+	/* Leftmost extent of the object */
+	node = fs_info->cache.extents.rb_node;
+	while (node) {
+		extent = rb_entry(node, struct canon_r5_cache_extent, node);
+		
+		if (object_handle <= extent->object_handle) {
+			if (object_handle == extent->object_handle)
+				first = extent;
+			node = node->rb_left;
+		} else {
+			node = node->rb_right;
+		}
+	}
+	
+	for (node = first ? &first->node : NULL; node; node = next) {
+		extent = rb_entry(node, struct canon_r5_cache_extent, node);
+		if (extent->object_handle != object_handle)
+			break;
+		
+		next = rb_next(node);
+		canon_r5_cache_unlink_locked(fs_info, extent, &victims);
+	}
+	
+	spin_unlock(&fs_info->cache.lock);
+	
+	canon_r5_cache_release_victims(&victims);
+}
+
+void canon_r5_storage_cache_cleanup(struct canon_r5_fs_info *fs_info)
+{
+	canon_r5_storage_cache_shrink(fs_info, ULONG_MAX);
+}
+
+
+u32 canon_r5_storage_slot_id(int slot)
+{
+	return (slot == 0) ? 0x00010001 : 0x00020001;
+}
+
+/* Metadata index: file_tree is keyed by handle, name_tree by (parent, name) */
+static int canon_r5_index_cmp(u32 parent_handle, const char *name,
+			      const struct canon_r5_file_object *file)
+{
+	if (parent_handle != file->parent_handle)
+		return parent_handle < file->parent_handle ? -1 : 1;
+	return strcmp(name, file->filename);
+}
+
+static struct canon_r5_file_object *canon_r5_index_find_locked(struct canon_r5_fs_info *fs_info,
+							       u32 object_handle)
+{
+	struct rb_node *node = fs_info->file_tree.rb_node;
+	struct canon_r5_file_object *file;
 	
-	node = storage->fs_info->file_tree.rb_node;
 	while (node) {
 		file = rb_entry(node, struct canon_r5_file_object, rb_node);
 		
@@ -169,17 +391,467 @@ struct canon_r5_file_object *canon_r5_storage_get_file(struct canon_r5_storage_d
 			node = node->rb_left;
 		else if (object_handle > file->object_handle)
 			node = node->rb_right;
+		else
+			return file;
+	}
+	
+	return NULL;
+}
+
+/* First child of @parent_handle sorting after @after, or the first child if NULL */
+static struct canon_r5_file_object *canon_r5_index_next_locked(struct canon_r5_fs_info *fs_info,
+							       u32 parent_handle,
+							       const char *after)
+{
+	struct rb_node *node = fs_info->name_tree.rb_node;
+	struct canon_r5_file_object *file, *best = NULL;
+	int cmp;
+	
+	while (node) {
+		file = rb_entry(node, struct canon_r5_file_object, name_node);
+		
+		if (parent_handle != file->parent_handle)
+			cmp = parent_handle < file->parent_handle ? -1 : 1;
+		else
+			cmp = after ? strcmp(after, file->filename) : -1;
+		
+		if (cmp < 0) {
+			best = file;
+			node = node->rb_left;
+		} else {
+			node = node->rb_right;
+		}
+	}
+	
+	if (best && best->parent_handle != parent_handle)
+		return NULL;
+	return best;
+}
+
+static void canon_r5_index_erase_locked(struct canon_r5_fs_info *fs_info,
+					struct canon_r5_file_object *file)
+{
+	rb_erase(&file->rb_node, &fs_info->file_tree);
+	RB_CLEAR_NODE(&file->rb_node);
+	rb_erase(&file->name_node, &fs_info->name_tree);
+	RB_CLEAR_NODE(&file->name_node);
+	list_del_init(&file->list);
+	fs_info->nr_objects--;
+}
+
+/* Takes over the caller's reference; replaces any object with the same handle */
+void canon_r5_storage_index_insert(struct canon_r5_fs_info *fs_info,
+				   struct canon_r5_file_object *file)
+{
+	struct canon_r5_file_object *old, *entry;
+	struct rb_node **link, *parent = NULL;
+	unsigned long flags;
+	
+	spin_lock_irqsave(&fs_info->file_lock, flags);
+	
+	old = canon_r5_index_find_locked(fs_info, file->object_handle);
+	if (old)
+		canon_r5_index_erase_locked(fs_info, old);
+	
+	link = &fs_info->file_tree.rb_node;
+	while (*link) {
+		parent = *link;
+		entry = rb_entry(parent, struct canon_r5_file_object, rb_node);
+		if (file->object_handle < entry->object_handle)
+			link = &parent->rb_left;
+		else
+			link = &parent->rb_right;
+	}
+	rb_link_node(&file->rb_node, parent, link);
+	rb_insert_color(&file->rb_node, &fs_info->file_tree);
+	
+	parent = NULL;
+	link = &fs_info->name_tree.rb_node;
+	while (*link) {
+		parent = *link;
+		entry = rb_entry(parent, struct canon_r5_file_object, name_node);
+		if (canon_r5_index_cmp(file->parent_handle, file->filename, entry) < 0)
+			link = &parent->rb_left;
+		else
+			link = &parent->rb_right;
+	}
+	rb_link_node(&file->name_node, parent, link);
+	rb_insert_color(&file->name_node, &fs_info->name_tree);
+	
+	list_add_tail(&file->list, &fs_info->file_list);
+	fs_info->nr_objects++;
+	
+	spin_unlock_irqrestore(&fs_info->file_lock, flags);
+	
+	if (old) {
+		canon_r5_storage_cache_invalidate(fs_info, old->object_handle);
+		canon_r5_storage_put_file(old);
+	}
+}
+
+void canon_r5_storage_index_remove(struct canon_r5_fs_info *fs_info, u32 object_handle)
+{
+	struct canon_r5_file_object *file;
+	unsigned long flags;
+	
+	spin_lock_irqsave(&fs_info->file_lock, flags);
+	file = canon_r5_index_find_locked(fs_info, object_handle);
+	if (file)
+		canon_r5_index_erase_locked(fs_info, file);
+	spin_unlock_irqrestore(&fs_info->file_lock, flags);
+	
+	if (file) {
+		canon_r5_storage_cache_invalidate(fs_info, object_handle);
+		canon_r5_storage_put_file(file);
+	}
+}
+
+struct canon_r5_file_object *canon_r5_storage_index_lookup(struct canon_r5_fs_info *fs_info,
+							   u32 parent_handle,
+							   const char *name)
+{
+	struct canon_r5_file_object *file;
+	struct rb_node *node;
+	unsigned long flags;
+	int cmp;
+	
+	spin_lock_irqsave(&fs_info->file_lock, flags);
+	
+	node = fs_info->name_tree.rb_node;
+	while (node) {
+		file = rb_entry(node, struct canon_r5_file_object, name_node);
+		
+		cmp = canon_r5_index_cmp(parent_handle, name, file);
+		if (cmp < 0)
+			node = node->rb_left;
+		else if (cmp > 0)
+			node = node->rb_right;
 		else {
 			kref_get(&file->ref_count);
-			spin_unlock_irqrestore(&storage->fs_info->file_lock, flags);
+			spin_unlock_irqrestore(&fs_info->file_lock, flags);
 			return file;
 		}
 	}
 	
-	spin_unlock_irqrestore(&storage->fs_info->file_lock, flags);
+	spin_unlock_irqrestore(&fs_info->file_lock, flags);
 	return NULL;
 }
 
+static void canon_r5_index_fill_entry(struct canon_r5_dir_entry *entry,
+				      const struct canon_r5_file_object *file)
+{
+	strscpy(entry->name, file->filename, sizeof(entry->name));
+	entry->object_handle = file->object_handle;
+	entry->type = file->file_type;
+	entry->size = file->file_size;
+	entry->mtime = file->modification_time;
+	entry->is_directory = (file->file_type == CANON_R5_FILE_FOLDER);
+}
+
+/*
+ * Copy up to @max_entries children of @parent_handle, in name order, starting
+ * after @after (or at the first child) and skipping @skip more.  The copies
+ * let callers emit entries without holding file_lock.
+ */
+int canon_r5_storage_index_children(struct canon_r5_fs_info *fs_info, u32 parent_handle,
+				    const char *after, loff_t skip,
+				    struct canon_r5_dir_entry *entries, int max_entries)
+{
+	struct canon_r5_file_object *file;
+	struct rb_node *node;
+	unsigned long flags;
+	int count = 0;
+	
+	spin_lock_irqsave(&fs_info->file_lock, flags);
+	
+	file = canon_r5_index_next_locked(fs_info, parent_handle, after);
+	node = file ? &file->name_node : NULL;
+	
+	for (; node && count < max_entries; node = rb_next(node)) {
+		file = rb_entry(node, struct canon_r5_file_object, name_node);
+		if (file->parent_handle != parent_handle)
+			break;
+		
+		if (skip > 0) {
+			skip--;
+			continue;
+		}
+		
+		canon_r5_index_fill_entry(&entries[count++], file);
+	}
+	
+	spin_unlock_irqrestore(&fs_info->file_lock, flags);
+	return count;
+}
+
+/* Fetch one object's info from the camera and (re)index it */
+static int canon_r5_index_refresh(struct canon_r5_fs_info *fs_info, u32 object_handle)
+{
+	struct canon_r5_file_object *file;
+	int ret;
+	
+	file = kzalloc(sizeof(*file), GFP_KERNEL);
+	if (!file)
+		return -ENOMEM;
+	
+	ret = canon_r5_ptp_get_object_info(fs_info->storage->canon_dev, object_handle, file);
+	if (ret) {
+		kfree(file);
+		return ret;
+	}
+	
+	/* Events cover both cards; only the mounted one is indexed */
+	if ((u32)file->storage_id != canon_r5_storage_slot_id(fs_info->slot)) {
+		kfree(file);
+		return 0;
+	}
+	
+	INIT_LIST_HEAD(&file->list);
+	RB_CLEAR_NODE(&file->rb_node);
+	RB_CLEAR_NODE(&file->name_node);
+	
+	canon_r5_storage_index_insert(fs_info, file);
+	return 0;
+}
+
+void canon_r5_storage_index_destroy(struct canon_r5_fs_info *fs_info)
+{
+	struct canon_r5_file_object *file;
+	unsigned long flags;
+	
+	spin_lock_irqsave(&fs_info->file_lock, flags);
+	while ((file = list_first_entry_or_null(&fs_info->file_list,
+						struct canon_r5_file_object, list))) {
+		canon_r5_index_erase_locked(fs_info, file);
+		spin_unlock_irqrestore(&fs_info->file_lock, flags);
+		
+		canon_r5_storage_put_file(file);
+		
+		spin_lock_irqsave(&fs_info->file_lock, flags);
+	}
+	spin_unlock_irqrestore(&fs_info->file_lock, flags);
+}
+
+static struct canon_r5_file_object *canon_r5_index_file_from_entry(const struct canon_r5_dir_entry *entry,
+								   u32 parent_handle,
+								   u32 storage_id)
+{
+	struct canon_r5_file_object *file;
+	
+	file = kzalloc(sizeof(*file), GFP_KERNEL);
+	if (!file)
+		return NULL;
+	
+	INIT_LIST_HEAD(&file->list);
+	RB_CLEAR_NODE(&file->rb_node);
+	RB_CLEAR_NODE(&file->name_node);
+	kref_init(&file->ref_count);
+	
+	file->object_handle = entry->object_handle;
+	file->parent_handle = parent_handle;
+	strscpy(file->filename, entry->name, sizeof(file->filename));
+	file->file_type = entry->type;
+	file->file_size = entry->size;
+	file->creation_time = entry->mtime;
+	file->modification_time = entry->mtime;
+	file->storage_id = storage_id;
+	
+	return file;
+}
+
+/* One GET_FOLDER_INFO per folder, breadth first; @queue holds pending folders */
+static int canon_r5_index_walk_folders(struct canon_r5_fs_info *fs_info, u32 *queue)
+{
+	struct canon_r5_storage_device *storage = fs_info->storage;
+	u32 storage_id = canon_r5_storage_slot_id(fs_info->slot);
+	struct canon_r5_dir_entry *entry, *tmp;
+	struct canon_r5_file_object *file;
+	unsigned int head = 0, tail = 0;
+	LIST_HEAD(entries);
+	u32 parent;
+	int ret;
+	
+	/* The index keys the root as 0; PTP addresses it as 0xFFFFFFFF */
+	queue[tail++] = 0;
+	
+	while (head < tail) {
+		parent = queue[head++];
+		
+		ret = canon_r5_ptp_get_folder_entries(storage->canon_dev, storage_id,
+						      parent ? parent : 0xFFFFFFFF, &entries);
+		if (ret < 0)
+			return ret;
+		
+		ret = 0;
+		list_for_each_entry_safe(entry, tmp, &entries, list) {
+			if (!ret) {
+				file = canon_r5_index_file_from_entry(entry, parent, storage_id);
+				if (file)
+					canon_r5_storage_index_insert(fs_info, file);
+				else
+					ret = -ENOMEM;
+			}
+			
+			if (!ret && entry->is_directory) {
+				if (tail < CANON_R5_STORAGE_INDEX_MAX_OBJECTS)
+					queue[tail++] = entry->object_handle;
+				else
+					canon_r5_storage_warn(storage, "Folder 0x%08x not indexed",
+							      entry->object_handle);
+			}
+			
+			list_del(&entry->list);
+			kfree(entry);
+		}
+		if (ret)
+			return ret;
+	}
+	
+	return 0;
+}
+
+/* Fallback for firmware without GET_FOLDER_INFO: one GET_OBJECT_INFO per object */
+static int canon_r5_index_walk_handles(struct canon_r5_fs_info *fs_info, u32 *handles)
+{
+	struct canon_r5_storage_device *storage = fs_info->storage;
+	int count, i, ret;
+	
+	/* Parent 0x00000000 asks for every object on the store */
+	count = canon_r5_ptp_get_object_handles(storage->canon_dev,
+						canon_r5_storage_slot_id(fs_info->slot),
+						0x00000000, handles,
+						CANON_R5_STORAGE_INDEX_MAX_OBJECTS);
+	if (count < 0)
+		return count;
+	
+	for (i = 0; i < count; i++) {
+		ret = canon_r5_index_refresh(fs_info, handles[i]);
+		if (ret == -ENODEV || ret == -ENOTCONN || ret == -ENOMEM)
+			return ret;
+		if (ret)
+			canon_r5_storage_dbg(storage, "Skipping object 0x%08x: %d", handles[i], ret);
+	}
+	
+	return 0;
+}
+
+/*
+ * Walk every object on the card once.  Afterwards lookups and listings are
+ * served from memory; object events keep the index current, and a missed
+ * event clears dir_cache.valid so the next lookup rebuilds it here.
+ */
+int canon_r5_storage_index_build(struct canon_r5_fs_info *fs_info)
+{
+	struct canon_r5_storage_device *storage = fs_info->storage;
+	u32 *handles;
+	int ret = 0;
+	
+	if (READ_ONCE(fs_info->dir_cache.valid))
+		return 0;
+	
+	mutex_lock(&fs_info->dir_cache.lock);
+	
+	if (fs_info->dir_cache.valid)
+		goto unlock;
+	
+	handles = kvmalloc_array(CANON_R5_STORAGE_INDEX_MAX_OBJECTS, sizeof(*handles),
+				 GFP_KERNEL);
+	if (!handles) {
+		ret = -ENOMEM;
+		goto unlock;
+	}
+	
+	canon_r5_storage_index_destroy(fs_info);
+	
+	ret = canon_r5_index_walk_folders(fs_info, handles);
+	if (ret == -EOPNOTSUPP) {
+		canon_r5_storage_index_destroy(fs_info);
+		ret = canon_r5_index_walk_handles(fs_info, handles);
+	}
+	if (ret)
+		goto free_handles;
+	
+	fs_info->dir_cache.cache_time = ktime_get();
+	WRITE_ONCE(fs_info->dir_cache.valid, true);
+	
+	canon_r5_storage_dbg(storage, "Indexed %u objects in slot %d",
+			     fs_info->nr_objects, fs_info->slot);
+	
+free_handles:
+	kvfree(handles);
+unlock:
+	mutex_unlock(&fs_info->dir_cache.lock);
+	return ret;
+}
+
+/* Apply an object event from the camera to the mounted card's index */
+void canon_r5_storage_object_event(struct canon_r5_device *dev, u16 event_code,
+				   u32 object_handle)
+{
+	struct canon_r5_storage_device *storage;
+	struct canon_r5_fs_info *fs_info;
+	int ret = 0;
+	
+	storage = canon_r5_get_storage_driver(dev);
+	if (!storage)
+		return;
+	
+	/*
+	 * Not held across the round trip below: kill_sb unhooks fs_info under
+	 * the lock and then flushes this work before freeing it.
+	 */
+	mutex_lock(&storage->lock);
+	fs_info = storage->fs_info;
+	mutex_unlock(&storage->lock);
+	
+	if (!fs_info || !READ_ONCE(fs_info->dir_cache.valid))
+		return;
+	
+	switch (event_code) {
+	case PTP_EC_UNREPORTED_STATUS:
+		/* Events were lost; rebuild from the camera on next lookup */
+		canon_r5_storage_info(storage, "Object events lost, invalidating index");
+		WRITE_ONCE(fs_info->dir_cache.valid, false);
+		break;
+	case PTP_EC_OBJECT_ADDED:
+	case PTP_EC_OBJECT_INFO_CHANGED:
+	case CANON_PTP_EC_OBJECT_CREATED:
+		ret = canon_r5_index_refresh(fs_info, object_handle);
+		break;
+	case PTP_EC_OBJECT_REMOVED:
+	case CANON_PTP_EC_OBJECT_REMOVED:
+		canon_r5_storage_index_remove(fs_info, object_handle);
+		break;
+	default:
+		break;
+	}
+	
+	if (ret) {
+		canon_r5_storage_warn(storage, "Object 0x%08x event 0x%04x not applied: %d",
+				      object_handle, event_code, ret);
+		WRITE_ONCE(fs_info->dir_cache.valid, false);
+	}
+}
+
+struct canon_r5_file_object *canon_r5_storage_get_file(struct canon_r5_storage_device *storage,
+						       u32 object_handle)
+{
+	struct canon_r5_file_object *file;
+	unsigned long flags;
+	
+	if (!storage || !storage->fs_info)
+		return NULL;
+		
+	spin_lock_irqsave(&storage->fs_info->file_lock, flags);
+	
+	file = canon_r5_index_find_locked(storage->fs_info, object_handle);
+	if (file)
+		kref_get(&file->ref_count);
+	
+	spin_unlock_irqrestore(&storage->fs_info->file_lock, flags);
+	return file;
+}
+
 void canon_r5_storage_put_file(struct canon_r5_file_object *file)
 {
 	if (file)
@@ -237,51 +909,322 @@ int canon_r5_ptp_get_object_handles(struct canon_r5_device *dev, u32 storage_id,
 				    u32 parent_handle, u32 *handles, int max_handles)
 {
 	u32 params[3] = { storage_id, 0x00000000, parent_handle }; /* All file formats */
-	u8 response[1024];
-	u16 response_code = 0;
+	struct canon_r5_ptp_transaction trans;
+	size_t size, count, i;
+	__le32 *array;
 	int ret;
 	
-	ret = canon_r5_ptp_command(dev, 0x1007, params, 3, response, sizeof(response), &response_code);
+	if (!dev || !handles || max_handles <= 0)
+		return -EINVAL;
+	
+	/* Array dataset: element count, then one handle per element */
+	size = sizeof(*array) * ((size_t)max_handles + 1);
+	array = kvmalloc(size, GFP_KERNEL);
+	if (!array)
+		return -ENOMEM;
+	
+	canon_r5_ptp_transaction_init(&trans, PTP_OP_GET_OBJECT_HANDLES,
+				      params, ARRAY_SIZE(params));
+	trans.data_in = array;
+	trans.data_in_len = size;
+	
+	ret = canon_r5_ptp_transact(dev, &trans);
 	if (ret)
-		return ret;
-		
-	if (response_code == 0x2001) {
-		/* Parse object handles from response - simulate some files */
-		int count = min(max_handles, 10);
-		for (int i = 0; i < count; i++) {
-			handles[i] = 0x00010000 + i + 1; /* Generate handle IDs */
-		}
-		return count;
+		goto out;
+	
+	if (trans.response_code != PTP_RC_OK) {
+		canon_r5_dbg(dev, "Get object handles 0x%08x failed: 0x%04x",
+			     parent_handle, trans.response_code);
+		ret = -EIO;
+		goto out;
 	}
 	
-	return 0;
+	if (trans.data_in_actual < sizeof(*array)) {
+		ret = -EPROTO;
+		goto out;
+	}
+	
+	count = le32_to_cpu(array[0]);
+	if (count > trans.data_in_actual / sizeof(*array) - 1) {
+		canon_r5_dbg(dev, "Object handles 0x%08x truncated to %zu of %zu",
+			     parent_handle, trans.data_in_actual / sizeof(*array) - 1, count);
+		count = trans.data_in_actual / sizeof(*array) - 1;
+	}
+	
+	for (i = 0; i < count; i++)
+		handles[i] = le32_to_cpu(array[i + 1]);
+	ret = count;
+	
+out:
+	kvfree(array);
+	return ret;
+}
+
+/* PTP string: character count including the NUL, then UTF-16LE characters */
+#define CANON_R5_PTP_STRING_MAX		255
+
+/* Fixed part plus filename, capture date, modification date and keywords */
+#define CANON_R5_OBJECT_INFO_SIZE	(sizeof(struct canon_r5_object_info) + \
+					 4 * (1 + 2 * CANON_R5_PTP_STRING_MAX))
+
+/* Decode a PTP string into @str, truncating to @size; returns the bytes consumed */
+static int canon_r5_ptp_get_string(const u8 *buf, size_t len, char *str, size_t size)
+{
+	size_t count, i, n = 0;
+	u16 c;
+	
+	if (!len)
+		return -EPROTO;
+	
+	count = buf[0];
+	if (2 * count > len - 1)
+		return -EPROTO;
+	
+	for (i = 0; i < count; i++) {
+		c = buf[1 + 2 * i] | (buf[2 + 2 * i] << 8);
+		if (!c)
+			break;
+		/* Card filenames follow DCF, plain ASCII */
+		if (c >= 0x80)
+			return -EILSEQ;
+		if (n + 1 < size)
+			str[n++] = c;
+	}
+	str[n] = '\0';
+	
+	return 1 + 2 * count;
+}
+
+/* PTP DateTime "YYYYMMDDThhmmss", optionally followed by tenths and a zone */
+static ktime_t canon_r5_ptp_parse_date(const char *str)
+{
+	unsigned int year, mon, day, hour, min, sec;
+	
+	if (sscanf(str, "%4u%2u%2uT%2u%2u%2u", &year, &mon, &day, &hour, &min, &sec) != 6)
+		return 0;
+	
+	return ktime_set(mktime64(year, mon, day, hour, min, sec), 0);
 }
 
 int canon_r5_ptp_get_object_info(struct canon_r5_device *dev, u32 object_handle,
 				 struct canon_r5_file_object *info)
 {
-	u8 response[256];
-	u16 response_code = 0;
+	const struct canon_r5_object_info *dataset;
+	struct canon_r5_ptp_transaction trans;
+	size_t pos, len;
+	char date[32];
+	u8 *buffer;
+	u32 size;
 	int ret;
 	
-	ret = canon_r5_ptp_command(dev, 0x1008, &object_handle, 1, response, sizeof(response), &response_code);
+	if (!dev || !info)
+		return -EINVAL;
+	
+	buffer = kmalloc(CANON_R5_OBJECT_INFO_SIZE, GFP_KERNEL);
+	if (!buffer)
+		return -ENOMEM;
+	
+	canon_r5_ptp_transaction_init(&trans, PTP_OP_GET_OBJECT_INFO, &object_handle, 1);
+	trans.data_in = buffer;
+	trans.data_in_len = CANON_R5_OBJECT_INFO_SIZE;
+	
+	ret = canon_r5_ptp_transact(dev, &trans);
 	if (ret)
-		return ret;
+		goto out;
+	
+	if (trans.response_code == PTP_RC_INVALID_OBJECT_HANDLE) {
+		ret = -ENOENT;
+		goto out;
+	}
+	
+	if (trans.response_code != PTP_RC_OK) {
+		canon_r5_dbg(dev, "Get object info 0x%08x failed: 0x%04x",
+			     object_handle, trans.response_code);
+		ret = -EIO;
+		goto out;
+	}
+	
+	len = trans.data_in_actual;
+	if (len < sizeof(*dataset)) {
+		ret = -EPROTO;
+		goto out;
+	}
+	
+	dataset = (const struct canon_r5_object_info *)buffer;
+	
+	/* Over 4 GiB; only GET_FOLDER_INFO carries the high word */
+	size = le32_to_cpu(dataset->size);
+	if (size == 0xFFFFFFFF) {
+		ret = -EOVERFLOW;
+		goto out;
+	}
+	
+	memset(info, 0, sizeof(*info));
+	pos = sizeof(*dataset);
+	
+	ret = canon_r5_ptp_get_string(buffer + pos, len - pos, info->filename,
+				      sizeof(info->filename));
+	if (ret < 0)
+		goto out;
+	pos += ret;
+	
+	/* Nothing a dentry could be made of */
+	if (!info->filename[0] || strchr(info->filename, '/')) {
+		ret = -EPROTO;
+		goto out;
+	}
+	
+	ret = canon_r5_ptp_get_string(buffer + pos, len - pos, date, sizeof(date));
+	if (ret < 0)
+		goto out;
+	pos += ret;
+	info->creation_time = canon_r5_ptp_parse_date(date);
+	
+	ret = canon_r5_ptp_get_string(buffer + pos, len - pos, date, sizeof(date));
+	if (ret < 0)
+		goto out;
+	info->modification_time = canon_r5_ptp_parse_date(date) ?: info->creation_time;
+	
+	info->object_handle = object_handle;
+	info->parent_handle = le32_to_cpu(dataset->parent_handle);
+	info->storage_id = le32_to_cpu(dataset->storage_id);
+	info->file_size = size;
+	info->file_type = le16_to_cpu(dataset->format) == CANON_R5_FOLDER_FORMAT ?
+			  CANON_R5_FILE_FOLDER :
+			  canon_r5_storage_detect_file_type(info->filename);
+	info->metadata.image_width = le32_to_cpu(dataset->image_width);
+	info->metadata.image_height = le32_to_cpu(dataset->image_height);
+	kref_init(&info->ref_count);
+	ret = 0;
+	
+out:
+	kfree(buffer);
+	return ret;
+}
+
+static void canon_r5_storage_free_entries(struct list_head *entries)
+{
+	struct canon_r5_dir_entry *entry, *tmp;
+	
+	list_for_each_entry_safe(entry, tmp, entries, list) {
+		list_del(&entry->list);
+		kfree(entry);
+	}
+}
+
+/* Parse a GET_FOLDER_INFO data phase straight into directory entries */
+static int canon_r5_storage_parse_folder(const u8 *data, size_t len,
+					 struct list_head *entries)
+{
+	const struct canon_r5_folder_record *rec;
+	struct canon_r5_dir_entry *entry;
+	size_t pos = sizeof(__le32);
+	size_t size, name_len;
+	u32 count, i;
+	int parsed = 0;
+	
+	if (len < sizeof(__le32))
+		return -EPROTO;
+	
+	count = le32_to_cpup((const __le32 *)data);
+	
+	for (i = 0; i < count; i++, pos += size) {
+		if (len - pos < sizeof(*rec))
+			return -EPROTO;
 		
-	if (response_code == 0x2001) {
-		/* Parse object information from response */
-		memset(info, 0, sizeof(*info));
-		info->object_handle = object_handle;
-		info->parent_handle = 0x00000000; /* Root directory */
-		snprintf(info->filename, sizeof(info->filename), "IMG_%04u.CR3", object_handle & 0xFFFF);
-		info->file_type = CANON_R5_FILE_RAW_CR3;
-		info->file_size = 50 * 1024 * 1024; /* 50MB default */
-		info->creation_time = ktime_get();
-		info->modification_time = info->creation_time;
-		info->storage_id = (object_handle >> 16) & 0xFF;
-		kref_init(&info->ref_count);
+		rec = (const struct canon_r5_folder_record *)(data + pos);
+		size = le32_to_cpu(rec->size);
+		if (size < sizeof(*rec) || size > len - pos)
+			return -EPROTO;
+		
+		/* Nothing a dentry could be made of */
+		name_len = strnlen(rec->name, size - sizeof(*rec));
+		if (!name_len || memchr(rec->name, '/', name_len))
+			continue;
+		
+		entry = kzalloc(sizeof(*entry), GFP_KERNEL);
+		if (!entry)
+			return -ENOMEM;
+		
+		memcpy(entry->name, rec->name, min(name_len, sizeof(entry->name) - 1));
+		entry->object_handle = le32_to_cpu(rec->object_handle);
+		entry->size = ((u64)le32_to_cpu(rec->object_size_high) << 32) |
+			      le32_to_cpu(rec->object_size);
+		entry->mtime = ktime_set(le32_to_cpu(rec->mtime), 0);
+		entry->is_directory = le16_to_cpu(rec->format) == CANON_R5_FOLDER_FORMAT;
+		entry->type = entry->is_directory ? CANON_R5_FILE_FOLDER :
+			      canon_r5_storage_detect_file_type(entry->name);
+		
+		list_add_tail(&entry->list, entries);
+		parsed++;
+	}
+	
+	return parsed;
+}
+
+/*
+ * Enumerate one folder from a single GET_FOLDER_INFO data phase instead of
+ * GET_OBJECT_HANDLES plus a GET_OBJECT_INFO round trip per object.  Returns
+ * the number of entries, or -EOPNOTSUPP if the camera lacks the operation.
+ */
+int canon_r5_ptp_get_folder_entries(struct canon_r5_device *dev, u32 storage_id,
+				    u32 parent_handle, struct list_head *entries)
+{
+	u32 params[3] = { storage_id, 0x00000000, parent_handle }; /* All file formats */
+	struct canon_r5_ptp_transaction trans;
+	size_t size = CANON_R5_FOLDER_INFO_SIZE;
+	bool regrown = false;
+	void *buffer;
+	int ret;
+	
+	if (!dev || !entries)
+		return -EINVAL;
+	
+	INIT_LIST_HEAD(entries);
+	
+retry:
+	buffer = kvmalloc(size, GFP_KERNEL);
+	if (!buffer)
+		return -ENOMEM;
+	
+	canon_r5_ptp_transaction_init(&trans, CANON_PTP_OP_GET_FOLDER_INFO,
+				      params, ARRAY_SIZE(params));
+	trans.data_in = buffer;
+	trans.data_in_len = size;
+	
+	ret = canon_r5_ptp_transact(dev, &trans);
+	if (ret)
+		goto out;
+	
+	if (trans.response_code == PTP_RC_OPERATION_NOT_SUPPORTED ||
+	    trans.response_code == CANON_PTP_RC_UNKNOWN_COMMAND) {
+		ret = -EOPNOTSUPP;
+		goto out;
+	}
+	
+	if (trans.response_code != PTP_RC_OK) {
+		canon_r5_dbg(dev, "Get folder info 0x%08x failed: 0x%04x",
+			     parent_handle, trans.response_code);
+		ret = -EIO;
+		goto out;
 	}
 	
+	/* Large folders: retry once with the length the camera announced */
+	if (trans.data_in_length > trans.data_in_actual) {
+		kvfree(buffer);
+		if (regrown || trans.data_in_length > CANON_R5_FOLDER_INFO_MAX_SIZE)
+			return -EMSGSIZE;
+		size = trans.data_in_length;
+		regrown = true;
+		goto retry;
+	}
+	
+	ret = canon_r5_storage_parse_folder(buffer, trans.data_in_actual, entries);
+	if (ret < 0)
+		canon_r5_storage_free_entries(entries);
+	
+out:
+	kvfree(buffer);
 	return ret;
 }
 
@@ -289,46 +1232,153 @@ int canon_r5_ptp_get_object_data(struct canon_r5_device *dev, u32 object_handle,
 				 void *buffer, size_t size, size_t offset,
 				 size_t *bytes_read)
 {
-	u8 response[1024];
-	u16 response_code = 0;
+	struct canon_r5_ptp_object_reader *reader;
 	int ret;
 	
-	/* For this stub implementation, we'll simulate reading file data */
-	ret = canon_r5_ptp_command(dev, 0x1009, &object_handle, 1, response, sizeof(response), &response_code);
-	if (ret)
-		return ret;
-		
-	if (response_code == 0x2001) {
-		/* Simulate file data by filling buffer with pattern */
-		size_t to_read = min(size, sizeof(response));
-		memset(buffer, 0x55, to_read); /* Fill with pattern */
-		*bytes_read = to_read;
-	}
+	if (!dev || !buffer || !bytes_read)
+		return -EINVAL;
+	
+	*bytes_read = 0;
+	if (!size)
+		return 0;
 	
+	/* Too large for the stack: one transaction per chunk in flight */
+	reader = kmalloc(sizeof(*reader), GFP_KERNEL);
+	if (!reader)
+		return -ENOMEM;
+	
+	canon_r5_ptp_reader_init(reader, dev, object_handle, offset, size, buffer);
+	ret = canon_r5_ptp_reader_run(reader);
+	if (!ret)
+		*bytes_read = reader->consumed;
+	
+	kfree(reader);
 	return ret;
 }
 
-int canon_r5_ptp_send_object_data(struct canon_r5_device *dev, const char *filename,
-				  const void *buffer, size_t size, u32 parent_handle,
+static int canon_r5_ptp_put_string(u8 *buf, const char *str)
+{
+	size_t len = strlen(str);
+	size_t i;
+	
+	if (len + 1 > CANON_R5_PTP_STRING_MAX)
+		return -ENAMETOOLONG;
+	
+	buf[0] = len + 1;
+	for (i = 0; i < len; i++) {
+		/* Card filenames follow DCF, plain ASCII */
+		if ((u8)str[i] >= 0x80)
+			return -EINVAL;
+		buf[1 + 2 * i] = str[i];
+		buf[2 + 2 * i] = 0;
+	}
+	buf[1 + 2 * len] = 0;
+	buf[2 + 2 * len] = 0;
+	
+	return 1 + 2 * (len + 1);
+}
+
+static int canon_r5_ptp_send_status(u16 response_code)
+{
+	switch (response_code) {
+	case PTP_RC_OK:
+		return 0;
+	case PTP_RC_STORAGE_FULL:
+		return -ENOSPC;
+	case PTP_RC_STORE_READ_ONLY:
+	case PTP_RC_OBJECT_WRITE_PROTECTED:
+		return -EROFS;
+	case PTP_RC_ACCESS_DENIED:
+		return -EACCES;
+	case PTP_RC_OPERATION_NOT_SUPPORTED:
+		return -EOPNOTSUPP;
+	default:
+		return -EIO;
+	}
+}
+
+/* Announce a new object; the camera answers with the handle it will store it under */
+int canon_r5_ptp_send_object_info(struct canon_r5_device *dev, u32 storage_id,
+				  u32 parent_handle, const char *filename, u32 size,
 				  u32 *new_handle)
 {
-	u32 params[2] = { parent_handle, (u32)size };
-	u8 response[64];
-	u16 response_code = 0;
+	struct canon_r5_ptp_transaction trans;
+	struct canon_r5_object_info *info;
+	u32 params[2] = { storage_id, parent_handle };
+	u8 *dataset;
 	int ret;
 	
-	/* This is a stub - real implementation would send the file data */
-	ret = canon_r5_ptp_command(dev, 0x100C, params, 2, response, sizeof(response), &response_code);
+	/* The three empty strings after the filename are single zero bytes */
+	dataset = kzalloc(sizeof(*info) + 1 + 2 * CANON_R5_PTP_STRING_MAX + 3, GFP_KERNEL);
+	if (!dataset)
+		return -ENOMEM;
+	
+	info = (struct canon_r5_object_info *)dataset;
+	info->storage_id = cpu_to_le32(storage_id);
+	info->format = cpu_to_le16(CANON_R5_UNDEFINED_FORMAT);
+	info->size = cpu_to_le32(size);
+	info->parent_handle = cpu_to_le32(parent_handle);
+	
+	ret = canon_r5_ptp_put_string(dataset + sizeof(*info), filename);
+	if (ret < 0)
+		goto out;
+	
+	canon_r5_ptp_transaction_init(&trans, PTP_OP_SEND_OBJECT_INFO, params, ARRAY_SIZE(params));
+	trans.data_out = dataset;
+	trans.data_out_len = sizeof(*info) + ret + 3;
+	
+	ret = canon_r5_ptp_transact(dev, &trans);
 	if (ret)
-		return ret;
-		
-	if (response_code == 0x2001) {
-		*new_handle = 0x00010000 + (u32)ktime_get_ns(); /* Generate new handle */
+		goto out;
+	
+	ret = canon_r5_ptp_send_status(trans.response_code);
+	if (ret) {
+		canon_r5_dbg(dev, "Send object info for %s failed: 0x%04x",
+			     filename, trans.response_code);
+		goto out;
+	}
+	
+	/* Responds with the storage, parent and handle the camera chose */
+	if (trans.response_param_count < 3) {
+		ret = -EPROTO;
+		goto out;
 	}
+	*new_handle = trans.response_params[2];
 	
+out:
+	kfree(dataset);
 	return ret;
 }
 
+/*
+ * Send the object announced by the last SEND_OBJECT_INFO as one data phase,
+ * produced a transmit chunk at a time by @fill. The timeout allows for the
+ * whole object at 10 MB/s on top of the usual command time.
+ */
+int canon_r5_ptp_send_object(struct canon_r5_device *dev, u32 size,
+			     canon_r5_ptp_fill_fn fill, void *context)
+{
+	struct canon_r5_ptp_transaction trans;
+	unsigned int timeout_ms;
+	int ret;
+	
+	canon_r5_ptp_transaction_init(&trans, PTP_OP_SEND_OBJECT, NULL, 0);
+	trans.data_out_fill = fill;
+	trans.data_out_len = size;
+	trans.context = context;
+	
+	ret = canon_r5_ptp_submit(dev, &trans);
+	if (ret)
+		return ret;
+	
+	timeout_ms = CANON_R5_PTP_TIMEOUT_MS + size / (10 * 1000);
+	ret = canon_r5_ptp_wait(dev, &trans, timeout_ms);
+	if (ret)
+		return ret;
+	
+	return canon_r5_ptp_send_status(trans.response_code);
+}
+
 int canon_r5_ptp_delete_object(struct canon_r5_device *dev, u32 object_handle)
 {
 	u16 response_code = 0;
@@ -366,16 +1416,28 @@ void canon_r5_storage_refresh_work(struct work_struct *work)
 void canon_r5_storage_card_event_work(struct work_struct *work)
 {
 	struct canon_r5_storage_device *storage = container_of(work, struct canon_r5_storage_device, events.card_event_work);
-	int slot = storage->events.event_card_slot;
-	enum canon_r5_storage_status status = storage->events.event_status;
-	
-	canon_r5_storage_info(storage, "Storage card event: slot %d, status %s", 
-			      slot, canon_r5_storage_status_name(status));
-	
-	mutex_lock(&storage->lock);
+	enum canon_r5_storage_status status;
+	int slot, ret;
 	
-	if (canon_r5_storage_slot_valid(slot)) {
-		storage->cards[slot].status = status;
+	for (slot = 0; slot < CANON_R5_MAX_STORAGE_CARDS; slot++) {
+		if (!test_and_clear_bit(slot, &storage->events.pending_slots))
+			continue;
+		
+		/* mount_card/unmount_card take storage->lock themselves */
+		mutex_lock(&storage->lock);
+		status = storage->cards[slot].status;
+		if (status == CANON_R5_STORAGE_STATUS_INSERTED) {
+			ret = canon_r5_ptp_get_storage_info(storage->canon_dev,
+							    canon_r5_storage_slot_id(slot),
+							    &storage->cards[slot]);
+			if (ret)
+				canon_r5_storage_warn(storage, "Failed to get storage info for slot %d: %d",
+						      slot, ret);
+		}
+		mutex_unlock(&storage->lock);
+		
+		canon_r5_storage_info(storage, "Storage card event: slot %d, status %s",
+				      slot, canon_r5_storage_status_name(status));
 		
 		if (status == CANON_R5_STORAGE_STATUS_INSERTED) {
 			/* Auto-mount inserted cards */
@@ -385,32 +1447,60 @@ void canon_r5_storage_card_event_work(struct work_struct *work)
 			canon_r5_storage_unmount_card(storage, slot);
 		}
 	}
+}
+
+/* Record a store event from the PTP event work and defer the (un)mount */
+static void canon_r5_storage_card_event(struct canon_r5_device *dev, int slot,
+					enum canon_r5_storage_status status)
+{
+	struct canon_r5_storage_device *storage;
+	struct canon_r5_storage *priv;
+	
+	storage = canon_r5_get_storage_driver(dev);
+	if (!storage || !canon_r5_storage_slot_valid(slot))
+		return;
+	
+	priv = container_of(storage, struct canon_r5_storage, device);
 	
+	mutex_lock(&storage->lock);
+	if (status == CANON_R5_STORAGE_STATUS_EMPTY ||
+	    storage->cards[slot].status == CANON_R5_STORAGE_STATUS_EMPTY)
+		storage->cards[slot].status = status;
 	mutex_unlock(&storage->lock);
+	
+	set_bit(slot, &storage->events.pending_slots);
+	canon_r5_queue_work(dev, priv->background.wq, &storage->events.card_event_work);
+}
+
+void canon_r5_storage_card_inserted(struct canon_r5_device *dev, int slot)
+{
+	canon_r5_storage_card_event(dev, slot, CANON_R5_STORAGE_STATUS_INSERTED);
+}
+
+void canon_r5_storage_card_removed(struct canon_r5_device *dev, int slot)
+{
+	canon_r5_storage_card_event(dev, slot, CANON_R5_STORAGE_STATUS_EMPTY);
 }
 
+/* Age out extents nobody has read for CANON_R5_CACHE_TIMEOUT */
 void canon_r5_storage_cache_cleanup_work(struct work_struct *work)
 {
 	struct canon_r5_fs_info *fs_info = container_of(work, struct canon_r5_fs_info, cache.cleanup_work);
-	struct canon_r5_file_object *file, *tmp;
-	ktime_t now = ktime_get();
-	ktime_t timeout = ktime_sub(now, ns_to_ktime(CANON_R5_CACHE_TIMEOUT));
-	
-	mutex_lock(&fs_info->lock);
-	
-	list_for_each_entry_safe(file, tmp, &fs_info->cache.lru_list, list) {
-		if (file->cached && ktime_before(file->modification_time, timeout)) {
-			if (file->cache_data) {
-				vfree(file->cache_data);
-				file->cache_data = NULL;
-				file->cache_size = 0;
-				file->cached = false;
-				fs_info->cache.total_size -= file->cache_size;
-			}
-		}
+	struct canon_r5_cache_extent *extent;
+	unsigned long expiry = jiffies - CANON_R5_CACHE_TIMEOUT;
+	LIST_HEAD(victims);
+	
+	spin_lock(&fs_info->cache.lock);
+	while (!list_empty(&fs_info->cache.lru_list)) {
+		extent = list_last_entry(&fs_info->cache.lru_list,
+					 struct canon_r5_cache_extent, lru);
+		if (time_after(extent->last_used, expiry))
+			break;
+		canon_r5_cache_unlink_locked(fs_info, extent, &victims);
 	}
+	spin_unlock(&fs_info->cache.lock);
 	
-	mutex_unlock(&fs_info->lock);
+	canon_r5_cache_release_victims(&victims);
 }
 
 void canon_r5_storage_sync_work(struct work_struct *work)
@@ -420,8 +1510,15 @@ void canon_r5_storage_sync_work(struct work_struct *work)
 	/* Periodic sync and maintenance operations */
 	canon_r5_storage_dbg(&storage->device, "Performing background sync");
 	
+	mutex_lock(&storage->device.lock);
+	if (storage->device.fs_info)
+		canon_r5_queue_work(storage->device.canon_dev, storage->background.wq,
+				    &storage->device.fs_info->cache.cleanup_work);
+	mutex_unlock(&storage->device.lock);
+	
 	/* Schedule next sync in 30 seconds */
-	queue_delayed_work(storage->background.wq, &storage->background.sync_work, 30 * HZ);
+	canon_r5_queue_delayed_work(storage->device.canon_dev, storage->background.wq,
+				    &storage->background.sync_work, 30 * HZ);
 }
 
 /* Storage card management */
@@ -545,74 +1642,314 @@ unlock:
 }
 
 /* File operations */
+struct canon_r5_storage_copy {
+	void *buffer;
+	loff_t pos;
+};
+
+static int canon_r5_storage_copy_chunk(void *context, loff_t offset, const void *data, size_t len)
+{
+	struct canon_r5_storage_copy *copy = context;
+	
+	memcpy((u8 *)copy->buffer + (offset - copy->pos), data, len);
+	return 0;
+}
+
 int canon_r5_storage_read_file(struct canon_r5_storage_device *storage,
 			       struct canon_r5_file_object *file,
 			       void *buffer, size_t size, loff_t offset,
-			       size_t *bytes_read)
+			       unsigned int flags, size_t *bytes_read)
+{
+	struct canon_r5_storage_copy copy = { .buffer = buffer, .pos = offset };
+	
+	if (!buffer)
+		return -EINVAL;
+	
+	return canon_r5_storage_stream_file(storage, file, offset, size, flags,
+					    canon_r5_storage_copy_chunk, &copy, bytes_read);
+}
+
+struct canon_r5_storage_stream {
+	struct canon_r5_fs_info *fs_info;	/* NULL when not caching */
+	u32 object_handle;
+	loff_t pos;				/* caller's range within the fetch */
+	loff_t end;
+	size_t delivered;
+	canon_r5_storage_stream_fn fn;
+	void *context;
+};
+
+/* Cache whole extents as they arrive, then pass on the part that was asked for */
+static int canon_r5_storage_stream_chunk(struct canon_r5_ptp_object_reader *reader,
+					 u64 offset, const void *data, size_t len)
+{
+	struct canon_r5_storage_stream *stream = reader->context;
+	u64 start, stop;
+	int ret;
+	
+	if (stream->fs_info)
+		canon_r5_storage_cache_insert(stream->fs_info, stream->object_handle,
+					      offset >> CANON_R5_CACHE_EXTENT_SHIFT, data, len);
+	
+	start = max_t(u64, offset, stream->pos);
+	stop = min_t(u64, offset + len, stream->end);
+	if (start >= stop)
+		return 0;
+	
+	ret = stream->fn(stream->context, start, (const u8 *)data + (start - offset),
+			 stop - start);
+	if (!ret)
+		stream->delivered += stop - start;
+	return ret;
+}
+
+static int canon_r5_storage_stream_fetch(struct canon_r5_storage_device *storage,
+					 struct canon_r5_storage_stream *stream,
+					 u64 start, u64 len, size_t chunk_size)
 {
+	struct canon_r5_ptp_object_reader *reader;
 	int ret;
 	
-	if (!storage || !file || !buffer || !bytes_read)
+	reader = kmalloc(sizeof(*reader), GFP_KERNEL);
+	if (!reader)
+		return -ENOMEM;
+	
+	canon_r5_ptp_reader_init(reader, storage->canon_dev, stream->object_handle,
+				 start, len, NULL);
+	reader->chunk_size = chunk_size;
+	reader->depth = min_t(u64, DIV_ROUND_UP(len, chunk_size), CANON_R5_PTP_READER_DEPTH);
+	reader->consume = canon_r5_storage_stream_chunk;
+	reader->context = stream;
+	
+	ret = canon_r5_ptp_reader_run(reader);
+	canon_r5_counter_inc(&storage->counters, CANON_R5_STORAGE_CACHE_MISSES);
+	
+	kfree(reader);
+	return ret;
+}
+
+/*
+ * Stream part of a file to @fn in offset order.  Cached extents are served
+ * from memory; each run of missing extents is fetched with one chunked
+ * partial-object transfer and cached on the way through.  Without a
+ * mounted cache, or with CANON_R5_STORAGE_STREAM_NOCACHE, only the
+ * requested range is read, with the chunk ring scaled down for small reads.
+ */
+int canon_r5_storage_stream_file(struct canon_r5_storage_device *storage,
+				 struct canon_r5_file_object *file,
+				 loff_t offset, size_t size, unsigned int flags,
+				 canon_r5_storage_stream_fn fn, void *context,
+				 size_t *bytes_read)
+{
+	struct canon_r5_storage_stream stream = { .fn = fn, .context = context };
+	struct canon_r5_fs_info *fs_info;
+	struct canon_r5_cache_extent *extent;
+	u64 index, next, last, skip, n;
+	loff_t pos, end;
+	int ret = 0;
+	
+	if (!storage || !file || !fn || !bytes_read || offset < 0)
 		return -EINVAL;
-		
-	/* Check if file is cached */
-	if (file->cached && file->cache_data && offset < file->cache_size) {
-		size_t to_copy = min(size, file->cache_size - (size_t)offset);
-		memcpy(buffer, (char *)file->cache_data + offset, to_copy);
-		*bytes_read = to_copy;
-		storage->stats.cache_hits++;
+	
+	*bytes_read = 0;
+	
+	if (offset >= file->file_size)
+		return 0;
+	size = min_t(u64, size, file->file_size - offset);
+	if (!size)
 		return 0;
+	
+	stream.object_handle = file->object_handle;
+	fs_info = storage->fs_info;
+	
+	if (!fs_info || !fs_info->cache.max_size || (flags & CANON_R5_STORAGE_STREAM_NOCACHE)) {
+		stream.pos = offset;
+		stream.end = offset + size;
+		ret = canon_r5_storage_stream_fetch(storage, &stream, offset, size,
+						    min_t(size_t, PAGE_ALIGN(size),
+							  CANON_R5_PTP_READER_CHUNK_SIZE));
+		goto out;
 	}
 	
-	/* Read from camera via PTP */
-	ret = canon_r5_ptp_get_object_data(storage->canon_dev, file->object_handle,
-					   buffer, size, offset, bytes_read);
-	if (!ret) {
-		storage->stats.files_read++;
-		storage->stats.bytes_read += *bytes_read;
+	stream.fs_info = fs_info;
+	pos = offset;
+	end = offset + size;
+	last = (end - 1) >> CANON_R5_CACHE_EXTENT_SHIFT;
+	
+	while (pos < end) {
+		index = pos >> CANON_R5_CACHE_EXTENT_SHIFT;
+		skip = pos - (index << CANON_R5_CACHE_EXTENT_SHIFT);
+		
+		extent = canon_r5_storage_cache_lookup(fs_info, file->object_handle, index);
+		if (extent && skip < extent->len) {
+			n = min_t(u64, extent->len - skip, end - pos);
+			ret = fn(context, pos, (u8 *)extent->data + skip, n);
+			canon_r5_storage_cache_put(extent);
+			if (ret)
+				break;
+			
+			stream.delivered += n;
+			canon_r5_counter_inc(&storage->counters, CANON_R5_STORAGE_CACHE_HITS);
+			pos += n;
+			continue;
+		}
+		
+		/* A short extent short of this offset means the object changed */
+		if (extent) {
+			canon_r5_storage_cache_put(extent);
+			canon_r5_storage_cache_invalidate(fs_info, file->object_handle);
+		}
+		
+		for (next = index + 1; next <= last; next++) {
+			extent = canon_r5_storage_cache_lookup(fs_info, file->object_handle, next);
+			if (extent) {
+				canon_r5_storage_cache_put(extent);
+				break;
+			}
+		}
+		
+		stream.pos = pos;
+		stream.end = min_t(u64, end, next << CANON_R5_CACHE_EXTENT_SHIFT);
+		ret = canon_r5_storage_stream_fetch(storage, &stream,
+						    index << CANON_R5_CACHE_EXTENT_SHIFT,
+						    min_t(u64, next << CANON_R5_CACHE_EXTENT_SHIFT,
+							  file->file_size) -
+						    (index << CANON_R5_CACHE_EXTENT_SHIFT),
+						    CANON_R5_CACHE_EXTENT_SIZE);
+		if (ret)
+			break;
+		
+		/* The camera ended the object early */
+		if (offset + stream.delivered == pos)
+			break;
+		pos = offset + stream.delivered;
+	}
+	
+out:
+	*bytes_read = stream.delivered;
+	if (stream.delivered) {
+		canon_r5_counter_inc(&storage->counters, CANON_R5_STORAGE_FILES_READ);
+		canon_r5_counter_add(&storage->counters, CANON_R5_STORAGE_BYTES_READ,
+				     stream.delivered);
 		storage->stats.last_operation = ktime_get();
-		storage->stats.cache_misses++;
 	}
 	
 	return ret;
 }
 
-int canon_r5_storage_write_file(struct canon_r5_storage_device *storage,
-				const char *filename, const void *buffer,
-				size_t size, struct canon_r5_file_object **new_file)
+struct canon_r5_storage_upload {
+	canon_r5_storage_fill_fn fn;
+	void *context;
+};
+
+static int canon_r5_storage_upload_fill(struct canon_r5_ptp_transaction *trans,
+					u64 offset, void *buf, size_t len)
 {
-	u32 new_handle;
+	struct canon_r5_storage_upload *upload = trans->context;
+	
+	return upload->fn(upload->context, offset, buf, len);
+}
+
+/*
+ * Create @filename under @parent_handle and stream @size bytes into it: one
+ * SEND_OBJECT_INFO, then a single SEND_OBJECT data phase pulled from @fn a
+ * transmit chunk at a time, so memory use does not grow with the file.
+ */
+int canon_r5_storage_upload_file(struct canon_r5_storage_device *storage,
+				 u32 storage_id, u32 parent_handle,
+				 const char *filename, u64 size,
+				 canon_r5_storage_fill_fn fn, void *context,
+				 struct canon_r5_file_object **new_file)
+{
+	struct canon_r5_storage_upload upload = { .fn = fn, .context = context };
+	struct canon_r5_file_object *file = NULL;
+	ktime_t start;
+	u32 handle;
+	s64 us;
 	int ret;
 	
-	if (!storage || !filename || !buffer || size == 0)
+	if (!storage || !filename || !fn)
 		return -EINVAL;
-		
+	
 	if (storage->active_card < 0)
 		return -ENODEV;
-		
-	ret = canon_r5_ptp_send_object_data(storage->canon_dev, filename, buffer, size, 0, &new_handle);
+	
+	if (size > U32_MAX - PTP_CONTAINER_HEADER_SIZE)
+		return -EFBIG;
+	
+	/* Allocated up front so a stored object is never left untracked */
+	if (new_file) {
+		file = kzalloc(sizeof(*file), GFP_KERNEL);
+		if (!file)
+			return -ENOMEM;
+	}
+	
+	start = ktime_get();
+	
+	ret = canon_r5_ptp_send_object_info(storage->canon_dev, storage_id, parent_handle,
+					    filename, size, &handle);
 	if (ret)
-		return ret;
+		goto error_free;
+	
+	ret = canon_r5_ptp_send_object(storage->canon_dev, size,
+				       canon_r5_storage_upload_fill, &upload);
+	if (ret) {
+		/* Don't leave a truncated object on the card */
+		canon_r5_ptp_delete_object(storage->canon_dev, handle);
+		goto error_free;
+	}
+	
+	if (file) {
+		INIT_LIST_HEAD(&file->list);
+		RB_CLEAR_NODE(&file->rb_node);
+		RB_CLEAR_NODE(&file->name_node);
+		kref_init(&file->ref_count);
 		
-	/* Create new file object */
-	if (new_file) {
-		*new_file = kzalloc(sizeof(**new_file), GFP_KERNEL);
-		if (*new_file) {
-			(*new_file)->object_handle = new_handle;
-			strncpy((*new_file)->filename, filename, sizeof((*new_file)->filename) - 1);
-			(*new_file)->file_type = canon_r5_storage_detect_file_type(filename);
-			(*new_file)->file_size = size;
-			(*new_file)->creation_time = ktime_get();
-			(*new_file)->modification_time = (*new_file)->creation_time;
-			kref_init(&(*new_file)->ref_count);
-		}
+		file->object_handle = handle;
+		file->parent_handle = parent_handle;
+		strscpy(file->filename, filename, sizeof(file->filename));
+		file->file_type = canon_r5_storage_detect_file_type(filename);
+		file->file_size = size;
+		file->creation_time = ktime_get();
+		file->modification_time = file->creation_time;
+		file->storage_id = storage_id;
+		*new_file = file;
 	}
 	
-	storage->stats.files_written++;
-	storage->stats.bytes_written += size;
+	us = ktime_us_delta(ktime_get(), start);
+	canon_r5_counter_inc(&storage->counters, CANON_R5_STORAGE_FILES_WRITTEN);
+	canon_r5_counter_add(&storage->counters, CANON_R5_STORAGE_BYTES_WRITTEN, size);
+	if (us > 0)
+		storage->stats.avg_write_speed = div64_u64(size * USEC_PER_SEC / 1024, us);
 	storage->stats.last_operation = ktime_get();
 	
 	return 0;
+
+error_free:
+	kfree(file);
+	return ret;
+}
+
+static int canon_r5_storage_buffer_fill(void *context, loff_t offset, void *data, size_t len)
+{
+	memcpy(data, (const u8 *)context + offset, len);
+	return 0;
+}
+
+/* Upload a file held in one kernel buffer to the root of the active card */
+int canon_r5_storage_write_file(struct canon_r5_storage_device *storage,
+				const char *filename, const void *buffer,
+				size_t size, struct canon_r5_file_object **new_file)
+{
+	if (!storage || !filename || !buffer || size == 0)
+		return -EINVAL;
+	
+	if (storage->active_card < 0)
+		return -ENODEV;
+	
+	return canon_r5_storage_upload_file(storage, canon_r5_storage_slot_id(storage->active_card),
+					    0, filename, size, canon_r5_storage_buffer_fill,
+					    (void *)buffer, new_file);
 }
 
 int canon_r5_storage_delete_file(struct canon_r5_storage_device *storage,
@@ -625,20 +1962,9 @@ int canon_r5_storage_delete_file(struct canon_r5_storage_device *storage,
 		
 	ret = canon_r5_ptp_delete_object(storage->canon_dev, file->object_handle);
 	if (!ret) {
-		/* Remove from filesystem cache if present */
-		if (storage->fs_info) {
-			struct rb_node *node;
-			unsigned long flags;
-			
-			spin_lock_irqsave(&storage->fs_info->file_lock, flags);
-			node = &file->rb_node;
-			if (!RB_EMPTY_NODE(node)) {
-				rb_erase(node, &storage->fs_info->file_tree);
-				RB_CLEAR_NODE(node);
-			}
-			list_del_init(&file->list);
-			spin_unlock_irqrestore(&storage->fs_info->file_lock, flags);
-		}
+		/* Drop it from the index rather than wait for OBJECT_REMOVED */
+		if (storage->fs_info)
+			canon_r5_storage_index_remove(storage->fs_info, file->object_handle);
 		
 		storage->stats.last_operation = ktime_get();
 	}
@@ -647,12 +1973,45 @@ int canon_r5_storage_delete_file(struct canon_r5_storage_device *storage,
 }
 
 /* Directory operations */
+static int canon_r5_storage_list_indexed(struct canon_r5_fs_info *fs_info,
+					 u32 parent_handle,
+					 struct list_head *entries)
+{
+	struct canon_r5_dir_entry *entry, *last = NULL;
+	int count = 0, ret;
+	
+	ret = canon_r5_storage_index_build(fs_info);
+	if (ret)
+		return ret;
+	
+	for (;;) {
+		entry = kzalloc(sizeof(*entry), GFP_KERNEL);
+		if (!entry)
+			break;
+		
+		if (canon_r5_storage_index_children(fs_info, parent_handle,
+						    last ? last->name : NULL, 0,
+						    entry, 1) != 1) {
+			kfree(entry);
+			break;
+		}
+		
+		list_add_tail(&entry->list, entries);
+		last = entry;
+		count++;
+	}
+	
+	return count;
+}
+
 int canon_r5_storage_list_directory(struct canon_r5_storage_device *storage,
 				    u32 parent_handle,
 				    struct list_head *entries)
 {
-	u32 handles[256];
-	int count, i, ret;
+	int max = CANON_R5_STORAGE_LIST_HANDLES;
+	int count, filled = 0, i, ret;
+	bool regrown = false;
+	u32 *handles;
 	
 	if (!storage || !entries)
 		return -EINVAL;
@@ -662,12 +2021,37 @@ int canon_r5_storage_list_directory(struct canon_r5_storage_device *storage,
 		
 	INIT_LIST_HEAD(entries);
 	
+	if (storage->fs_info)
+		return canon_r5_storage_list_indexed(storage->fs_info, parent_handle, entries);
+	
 	u32 storage_id = (storage->active_card == 0) ? 0x00010001 : 0x00020001;
-	count = canon_r5_ptp_get_object_handles(storage->canon_dev, storage_id, parent_handle,
-						handles, ARRAY_SIZE(handles));
-	if (count < 0)
+	count = canon_r5_ptp_get_folder_entries(storage->canon_dev, storage_id,
+						parent_handle ? parent_handle : 0xFFFFFFFF,
+						entries);
+	if (count != -EOPNOTSUPP)
 		return count;
-		
+	
+retry:
+	handles = kvmalloc_array(max, sizeof(*handles), GFP_KERNEL);
+	if (!handles)
+		return -ENOMEM;
+	
+	count = canon_r5_ptp_get_object_handles(storage->canon_dev, storage_id,
+						parent_handle ? parent_handle : 0xFFFFFFFF,
+						handles, max);
+	if (count < 0) {
+		kvfree(handles);
+		return count;
+	}
+	
+	/* A full buffer may hold a truncated list: retry once at the index limit */
+	if (count == max && !regrown) {
+		kvfree(handles);
+		max = CANON_R5_STORAGE_INDEX_MAX_OBJECTS;
+		regrown = true;
+		goto retry;
+	}
+	
 	/* Create directory entries */
 	for (i = 0; i < count; i++) {
 		struct canon_r5_dir_entry *entry;
@@ -689,21 +2073,33 @@ int canon_r5_storage_list_directory(struct canon_r5_storage_device *storage,
 		entry->is_directory = (file_info.file_type == CANON_R5_FILE_FOLDER);
 		
 		list_add_tail(&entry->list, entries);
+		filled++;
 	}
 	
-	return count;
+	kvfree(handles);
+	return filled;
 }
 
 /* Statistics */
 int canon_r5_storage_get_stats(struct canon_r5_storage_device *storage,
 			       struct canon_r5_storage_stats *stats)
 {
+	u64 counters[CANON_R5_STORAGE_COUNTERS] = {};
+	
 	if (!storage || !stats)
 		return -EINVAL;
-		
-	mutex_lock(&storage->lock);
+	
 	*stats = storage->stats;
-	mutex_unlock(&storage->lock);
+	
+	canon_r5_counters_read(&storage->counters, counters);
+	stats->files_read = counters[CANON_R5_STORAGE_FILES_READ];
+	stats->files_written = counters[CANON_R5_STORAGE_FILES_WRITTEN];
+	stats->bytes_read = counters[CANON_R5_STORAGE_BYTES_READ];
+	stats->bytes_written = counters[CANON_R5_STORAGE_BYTES_WRITTEN];
+	stats->cache_hits = counters[CANON_R5_STORAGE_CACHE_HITS];
+	stats->cache_misses = counters[CANON_R5_STORAGE_CACHE_MISSES];
+	stats->ptp_operations = counters[CANON_R5_STORAGE_PTP_OPERATIONS];
+	stats->ptp_errors = counters[CANON_R5_STORAGE_PTP_ERRORS];
 	
 	return 0;
 }
@@ -712,11 +2108,45 @@ void canon_r5_storage_reset_stats(struct canon_r5_storage_device *storage)
 {
 	if (!storage)
 		return;
-		
-	mutex_lock(&storage->lock);
+	
 	memset(&storage->stats, 0, sizeof(storage->stats));
-	mutex_unlock(&storage->lock);
+	canon_r5_counters_reset(&storage->counters);
+}
+
+static const char * const canon_r5_storage_counter_names[CANON_R5_STORAGE_COUNTERS] = {
+	[CANON_R5_STORAGE_FILES_READ]		= "files_read",
+	[CANON_R5_STORAGE_FILES_WRITTEN]	= "files_written",
+	[CANON_R5_STORAGE_BYTES_READ]		= "bytes_read",
+	[CANON_R5_STORAGE_BYTES_WRITTEN]	= "bytes_written",
+	[CANON_R5_STORAGE_CACHE_HITS]		= "cache_hits",
+	[CANON_R5_STORAGE_CACHE_MISSES]		= "cache_misses",
+	[CANON_R5_STORAGE_PTP_OPERATIONS]	= "ptp_operations",
+	[CANON_R5_STORAGE_PTP_ERRORS]		= "ptp_errors",
+};
+
+static int canon_r5_storage_stats_show(struct seq_file *m, void *v)
+{
+	struct canon_r5_storage_device *storage = m->private;
+	struct canon_r5_storage_stats stats;
+	
+	canon_r5_storage_get_stats(storage, &stats);
+	
+	seq_printf(m, "files_read: %llu\n", stats.files_read);
+	seq_printf(m, "files_written: %llu\n", stats.files_written);
+	seq_printf(m, "bytes_read: %llu\n", stats.bytes_read);
+	seq_printf(m, "bytes_written: %llu\n", stats.bytes_written);
+	seq_printf(m, "cache_hits: %llu\n", stats.cache_hits);
+	seq_printf(m, "cache_misses: %llu\n", stats.cache_misses);
+	seq_printf(m, "ptp_operations: %llu\n", stats.ptp_operations);
+	seq_printf(m, "ptp_errors: %llu\n", stats.ptp_errors);
+	seq_printf(m, "avg_read_speed_kbps: %u\n", stats.avg_read_speed);
+	seq_printf(m, "avg_write_speed_kbps: %u\n", stats.avg_write_speed);
+	seq_printf(m, "avg_response_time_us: %u\n", stats.avg_response_time);
+	seq_printf(m, "last_operation_ns: %lld\n", ktime_to_ns(stats.last_operation));
+	
+	return 0;
 }
+DEFINE_SHOW_ATTRIBUTE(canon_r5_storage_stats);
 
 /* Utility functions */
 u64 canon_r5_storage_get_free_space(struct canon_r5_storage_device *storage, int slot)
@@ -770,20 +2200,16 @@ int canon_r5_storage_init(struct canon_r5_device *dev)
 	/* Initialize PTP operations */
 	mutex_init(&storage->ptp.lock);
 	INIT_WORK(&storage->ptp.refresh_work, canon_r5_storage_refresh_work);
-	storage->ptp.refresh_wq = alloc_workqueue("canon_r5_storage_refresh", WQ_MEM_RECLAIM, 0);
-	if (!storage->ptp.refresh_wq) {
-		ret = -ENOMEM;
-		goto error_cleanup;
-	}
 	
 	/* Initialize event handling */
 	INIT_WORK(&storage->events.card_event_work, canon_r5_storage_card_event_work);
 	
 	/* Initialize background operations */
-	priv->background.wq = alloc_workqueue("canon_r5_storage_bg", WQ_MEM_RECLAIM, 0);
+	priv->background.wq = canon_r5_workqueue_get(dev, CANON_R5_WORK_BULK, "canon_r5_storage_bg",
+						     WQ_MEM_RECLAIM, 0);
 	if (!priv->background.wq) {
 		ret = -ENOMEM;
-		goto error_refresh_wq;
+		goto error_cleanup;
 	}
 	
 	INIT_DELAYED_WORK(&priv->background.sync_work, canon_r5_storage_sync_work);
@@ -793,13 +2219,22 @@ int canon_r5_storage_init(struct canon_r5_device *dev)
 	mutex_init(&priv->mounts.lock);
 	priv->mounts.mount_count = 0;
 	
+	ret = canon_r5_counters_register(dev, &storage->counters, "storage",
+					 canon_r5_storage_counter_names, CANON_R5_STORAGE_COUNTERS);
+	if (ret)
+		goto error_bg_wq;
+	
 	/* Register with core driver */
 	ret = canon_r5_register_storage_driver(dev, storage);
 	if (ret) {
 		dev_err(dev->dev, "Failed to register storage driver: %d\n", ret);
-		goto error_bg_wq;
+		goto error_counters;
 	}
 	
+	WRITE_ONCE(dev->event_handler.object_changed, canon_r5_storage_object_event);
+	WRITE_ONCE(dev->event_handler.card_inserted, canon_r5_storage_card_inserted);
+	WRITE_ONCE(dev->event_handler.card_removed, canon_r5_storage_card_removed);
+	
 	/* Scan for storage cards */
 	ret = canon_r5_storage_scan_cards(storage);
 	if (ret > 0) {
@@ -808,17 +2243,22 @@ int canon_r5_storage_init(struct canon_r5_device *dev)
 	}
 	
 	/* Start background sync */
-	queue_delayed_work(priv->background.wq, &priv->background.sync_work, 10 * HZ);
+	canon_r5_queue_delayed_work(dev, priv->background.wq, &priv->background.sync_work, 10 * HZ);
+	
+	if (canon_r5_stats_debugfs_dir(dev))
+		priv->debugfs = debugfs_create_file("storage_stats", 0444,
+						    canon_r5_stats_debugfs_dir(dev), storage,
+						    &canon_r5_storage_stats_fops);
 	
 	storage->initialized = true;
 	dev_info(dev->dev, "Canon R5 storage driver initialized successfully\n");
 	
 	return 0;
 	
+error_counters:
+	canon_r5_counters_unregister(&storage->counters);
 error_bg_wq:
-	destroy_workqueue(priv->background.wq);
-error_refresh_wq:
-	destroy_workqueue(storage->ptp.refresh_wq);
+	canon_r5_workqueue_put(dev, priv->background.wq);
 error_cleanup:
 	kfree(priv);
 	return ret;
@@ -840,20 +2280,23 @@ void canon_r5_storage_cleanup(struct canon_r5_device *dev)
 	
 	dev_info(dev->dev, "Cleaning up Canon R5 storage driver\n");
 	
-	/* Stop background operations */
+	debugfs_remove(priv->debugfs);
+	
+	/* Stop event dispatch before the workqueues it feeds go away */
+	WRITE_ONCE(dev->event_handler.object_changed, NULL);
+	WRITE_ONCE(dev->event_handler.card_inserted, NULL);
+	WRITE_ONCE(dev->event_handler.card_removed, NULL);
+	flush_work(&dev->ptp.event_work);
+	
+	/* Stop background operations and event handling */
 	if (priv->background.wq) {
 		cancel_delayed_work_sync(&priv->background.sync_work);
-		destroy_workqueue(priv->background.wq);
+		cancel_work_sync(&storage->events.card_event_work);
+		canon_r5_workqueue_put(dev, priv->background.wq);
 	}
 	
 	/* Stop refresh operations */
-	if (storage->ptp.refresh_wq) {
-		cancel_work_sync(&storage->ptp.refresh_work);
-		destroy_workqueue(storage->ptp.refresh_wq);
-	}
-	
-	/* Stop event handling */
-	cancel_work_sync(&storage->events.card_event_work);
+	cancel_work_sync(&storage->ptp.refresh_work);
 	
 	/* Unmount all cards */
 	for (int i = 0; i < CANON_R5_MAX_STORAGE_CARDS; i++) {
@@ -861,18 +2304,34 @@ void canon_r5_storage_cleanup(struct canon_r5_device *dev)
 	}
 	
 	canon_r5_unregister_storage_driver(dev);
+	canon_r5_counters_unregister(&storage->counters);
 	kfree(priv);
 }
 
 /* Module functions */
+static const struct canon_r5_bringup_ops canon_r5_storage_bringup_ops = {
+	.run = canon_r5_storage_init,
+	.teardown = canon_r5_storage_cleanup,
+};
+
 static int __init canon_r5_storage_module_init(void)
 {
+	int ret;
+	
+	/* Card scanning runs alongside the other post-session steps */
+	ret = canon_r5_bringup_register(CANON_R5_BRINGUP_STORAGE, &canon_r5_storage_bringup_ops);
+	if (ret) {
+		pr_err("Failed to register storage bring-up step: %d\n", ret);
+		return ret;
+	}
+	
 	pr_info("Canon R5 Storage Driver v%s loaded\n", "1.0.0");
 	return 0;
 }
 
 static void __exit canon_r5_storage_module_exit(void)
 {
+	canon_r5_bringup_unregister(CANON_R5_BRINGUP_STORAGE);
 	pr_info("Canon R5 Storage Driver unloaded\n");
 }
 
@@ -889,8 +2348,25 @@ EXPORT_SYMBOL_GPL(canon_r5_storage_format_card);
 EXPORT_SYMBOL_GPL(canon_r5_storage_get_file);
 EXPORT_SYMBOL_GPL(canon_r5_storage_put_file);
 EXPORT_SYMBOL_GPL(canon_r5_storage_read_file);
+EXPORT_SYMBOL_GPL(canon_r5_storage_stream_file);
+EXPORT_SYMBOL_GPL(canon_r5_storage_upload_file);
 EXPORT_SYMBOL_GPL(canon_r5_storage_write_file);
 EXPORT_SYMBOL_GPL(canon_r5_storage_delete_file);
+EXPORT_SYMBOL_GPL(canon_r5_storage_index_insert);
+EXPORT_SYMBOL_GPL(canon_r5_storage_index_remove);
+EXPORT_SYMBOL_GPL(canon_r5_storage_index_lookup);
+EXPORT_SYMBOL_GPL(canon_r5_storage_index_children);
+EXPORT_SYMBOL_GPL(canon_r5_storage_index_destroy);
+EXPORT_SYMBOL_GPL(canon_r5_storage_object_event);
+EXPORT_SYMBOL_GPL(canon_r5_storage_card_inserted);
+EXPORT_SYMBOL_GPL(canon_r5_storage_card_removed);
 EXPORT_SYMBOL_GPL(canon_r5_storage_list_directory);
+EXPORT_SYMBOL_GPL(canon_r5_ptp_get_folder_entries);
+EXPORT_SYMBOL_GPL(canon_r5_storage_cache_init);
+EXPORT_SYMBOL_GPL(canon_r5_storage_cache_lookup);
+EXPORT_SYMBOL_GPL(canon_r5_storage_cache_insert);
+EXPORT_SYMBOL_GPL(canon_r5_storage_cache_put);
+EXPORT_SYMBOL_GPL(canon_r5_storage_cache_shrink);
+EXPORT_SYMBOL_GPL(canon_r5_storage_cache_invalidate);
 EXPORT_SYMBOL_GPL(canon_r5_storage_get_stats);
 EXPORT_SYMBOL_GPL(canon_r5_storage_reset_stats);
\ No newline at end of file
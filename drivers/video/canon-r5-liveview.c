@@ -11,30 +11,915 @@
 #include <linux/slab.h>
 #include <linux/workqueue.h>
 #include <linux/jiffies.h>
-#include <linux/timer.h>
+#include <linux/wait.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
 
 #include "../../include/core/canon-r5.h"
 #include "../../include/core/canon-r5-ptp.h"
 #include "../../include/video/canon-r5-v4l2.h"
 
 /* Forward declarations */
-extern void canon_r5_video_frame_work(struct work_struct *work);
 extern int canon_r5_vb2_queue_init(struct canon_r5_video_device *vdev);
 extern void canon_r5_vb2_return_all_buffers(struct canon_r5_video_device *vdev,
 					    enum vb2_buffer_state state);
 
-/* Live view frame timer callback */
-static void canon_r5_liveview_timer_callback(struct timer_list *t)
+/* Live view scheduler tuning */
+#define CANON_R5_LV_BACKOFF_MIN_US	1000
+#define CANON_R5_LV_BACKOFF_MAX_US	50000
+
+static unsigned int video_nodes = 1;
+module_param(video_nodes, uint, 0444);
+MODULE_PARM_DESC(video_nodes, "Number of capture nodes sharing the live view (1-3, default: 1)");
+
+static void canon_r5_video_frame_complete(struct canon_r5_device *dev,
+					  struct canon_r5_ptp_transaction *trans);
+static void canon_r5_video_producer_complete(struct canon_r5_device *dev,
+					     struct canon_r5_ptp_transaction *trans);
+
+/* Responses meaning the camera has no new frame yet */
+static bool canon_r5_video_lv_not_ready(u16 code)
+{
+	return code == CANON_PTP_RC_OBJECT_NOTREADY ||
+	       code == CANON_PTP_RC_DEVICE_BUSY ||
+	       code == PTP_RC_DEVICE_BUSY;
+}
+
+/* Capture time of a received frame on the shared camera timeline */
+static ktime_t canon_r5_video_lv_time(struct canon_r5_device *dev,
+				      const struct canon_liveview_header *header,
+				      ktime_t arrival)
+{
+	u32 stamp = le32_to_cpu(header->timestamp);
+	
+	if (!stamp)
+		return arrival;
+	
+	return canon_r5_clock_stamp(dev, canon_r5_clock_extend(dev, stamp), arrival);
+}
+
+/* Classify a finished GET_LIVEVIEW; -EAGAIN means no new frame yet */
+static int canon_r5_video_lv_result(struct canon_r5_device *dev,
+				    const struct canon_r5_ptp_transaction *trans,
+				    const struct canon_liveview_header *header,
+				    void *data, size_t *frame_size)
+{
+	int ret = trans->status;
+	
+	*frame_size = 0;
+	
+	if (!ret && trans->response_code != PTP_RC_OK)
+		ret = canon_r5_video_lv_not_ready(trans->response_code) ? -EAGAIN : -EIO;
+	if (!ret)
+		ret = canon_r5_ptp_liveview_parse(dev, trans, header, data, frame_size);
+	if (!ret && !*frame_size)
+		ret = -EAGAIN;
+	
+	return ret;
+}
+
+/* Next retry delay, doubling up to half a frame interval */
+static unsigned long canon_r5_video_lv_backoff(unsigned int *backoff_us, u64 interval_ns)
+{
+	u64 limit = CANON_R5_LV_BACKOFF_MAX_US;
+	
+	if (interval_ns)
+		limit = clamp_t(u64, div_u64(interval_ns, 2 * NSEC_PER_USEC),
+				CANON_R5_LV_BACKOFF_MIN_US, CANON_R5_LV_BACKOFF_MAX_US);
+	
+	if (!*backoff_us)
+		*backoff_us = CANON_R5_LV_BACKOFF_MIN_US;
+	else
+		*backoff_us = min_t(u64, *backoff_us * 2, limit);
+	
+	return usecs_to_jiffies(*backoff_us);
+}
+
+/* Update cadence and request latency for a delivered frame */
+static void canon_r5_video_account_frame(struct canon_r5_video_stream *stream,
+					 ktime_t now, ktime_t request_time)
+{
+	u64 latency, interval;
+	
+	if (stream->frame_count) {
+		interval = ktime_to_ns(ktime_sub(now, stream->last_frame_time));
+		stream->frame_interval_ns = stream->frame_interval_ns ?
+			(stream->frame_interval_ns * 7 + interval) >> 3 : interval;
+	}
+	latency = ktime_to_ns(ktime_sub(now, request_time));
+	stream->latency_last_ns = latency;
+	stream->latency_avg_ns = stream->latency_avg_ns ?
+		(stream->latency_avg_ns * 7 + latency) >> 3 : latency;
+	stream->latency_max_ns = max(stream->latency_max_ns, latency);
+	stream->last_frame_time = now;
+}
+
+static void canon_r5_video_count_frame(struct canon_r5_video_stream *stream, size_t bytes)
+{
+	canon_r5_counter_inc(&stream->counters, CANON_R5_VIDEO_FRAMES);
+	canon_r5_counter_add(&stream->counters, CANON_R5_VIDEO_BYTES, bytes);
+}
+
+/* Copy @rows of @units, @size bytes each, keeping every @step-th unit and row */
+static void canon_r5_video_crop_plane(u8 *dst, size_t dst_pitch,
+				      const u8 *src, size_t src_pitch,
+				      u32 units, u32 rows, unsigned int size, unsigned int step)
+{
+	const u8 *s;
+	u32 row, unit;
+	u8 *d;
+	unsigned int i;
+	
+	for (row = 0; row < rows; row++) {
+		d = dst + row * dst_pitch;
+		s = src + (size_t)row * step * src_pitch;
+		
+		if (step == 1) {
+			memmove(d, s, (size_t)units * size);
+			continue;
+		}
+		
+		/* Forwards only: the write position never passes the read position */
+		for (unit = 0; unit < units; unit++, s += step * size)
+			for (i = 0; i < size; i++)
+				*d++ = s[i];
+	}
+}
+
+/*
+ * Cut the node's crop out of a received frame covering @window, keeping
+ * every decimation-th pixel and line. Data only moves towards the start of
+ * the plane, so @dst may be @src and a received plane is cropped in place.
+ * Returns the cropped image size, or -EPROTO if the frame cannot hold it.
+ */
+ssize_t canon_r5_video_crop_frame(const struct canon_r5_video_stream *stream,
+				  const struct v4l2_rect *window,
+				  void *dst, const void *src, size_t len)
+{
+	const struct canon_r5_video_format *fmt = stream->format;
+	const struct v4l2_rect *crop = &stream->crop;
+	struct v4l2_pix_format in = {
+		.width = window->width,
+		.height = window->height,
+	};
+	struct v4l2_pix_format out = {
+		.width = stream->compose.width,
+		.height = stream->compose.height,
+	};
+	unsigned int dec = stream->decimation;
+	const u8 *s = src;
+	u8 *d = dst;
+	u32 x, y;
+	
+	if (crop->left < window->left || crop->top < window->top ||
+	    crop->left + crop->width > window->left + window->width ||
+	    crop->top + crop->height > window->top + window->height)
+		return -EPROTO;
+	
+	x = crop->left - window->left;
+	y = crop->top - window->top;
+	
+	/* A compressed frame can only be the crop itself */
+	if (fmt->compressed) {
+		if (x || y || window->width != out.width || window->height != out.height)
+			return -EPROTO;
+		if (dst != src)
+			memcpy(dst, src, len);
+		return len;
+	}
+	
+	canon_r5_video_fill_pix(fmt, &in);
+	canon_r5_video_fill_pix(fmt, &out);
+	if (len < in.sizeimage)
+		return -EPROTO;
+	
+	if (dec == 1 && !x && !y && in.width == out.width && in.height == out.height) {
+		if (dst != src)
+			memcpy(dst, src, out.sizeimage);
+		return out.sizeimage;
+	}
+	
+	if (fmt->fourcc == V4L2_PIX_FMT_NV12) {
+		/* Luma, then interleaved CbCr pairs at half height */
+		canon_r5_video_crop_plane(d, out.bytesperline,
+					  s + (size_t)y * in.bytesperline + x, in.bytesperline,
+					  out.width, out.height, 1, dec);
+		canon_r5_video_crop_plane(d + (size_t)out.bytesperline * out.height,
+					  out.bytesperline,
+					  s + (size_t)in.bytesperline * in.height +
+					  (size_t)(y / 2) * in.bytesperline + x, in.bytesperline,
+					  out.width / 2, out.height / 2, 2, dec);
+	} else {
+		/* Packed 4:2:2 keeps whole Y0 Cb Y1 Cr pairs */
+		canon_r5_video_crop_plane(d, out.bytesperline,
+					  s + (size_t)y * in.bytesperline + x * 2, in.bytesperline,
+					  out.width / 2, out.height, 4, dec);
+	}
+	
+	return out.sizeimage;
+}
+
+/*
+ * Crop a received frame; its size tells whether it covers the whole view or
+ * the zoom window. -ESTALE means it belongs to the other side of a zoom change.
+ */
+static ssize_t canon_r5_video_crop_received(const struct canon_r5_video_stream *stream,
+					    bool zoomed, u32 width, u32 height,
+					    void *dst, const void *src, size_t len)
+{
+	const struct v4l2_rect *window = zoomed ? &stream->zoom_window : &stream->bounds;
+	
+	/* Cameras that do not report a size send what was last asked for */
+	if (width || height) {
+		if (width == stream->bounds.width && height == stream->bounds.height)
+			window = &stream->bounds;
+		else if (!zoomed || width != window->width || height != window->height)
+			return -ESTALE;
+	}
+	
+	return canon_r5_video_crop_frame(stream, window, dst, src, len);
+}
+
+/* Hand the next queued buffer to the camera. Needs buf_lock */
+static void canon_r5_video_submit_locked(struct canon_r5_video_device *vdev)
+{
+	struct canon_r5_video_stream *stream = &vdev->stream;
+	struct canon_r5_video_buffer *buf;
+	int ret;
+	
+	if (stream->state != CANON_R5_STREAMING_ACTIVE || stream->shared || stream->lv_buf ||
+	    delayed_work_pending(&stream->frame_work) || list_empty(&stream->buf_list))
+		return;
+	
+	buf = list_first_entry(&stream->buf_list, struct canon_r5_video_buffer, list);
+	list_del(&buf->list);
+	
+	/* Each received transfer is copied once, into the plane; no frame buffer in between */
+	canon_r5_ptp_liveview_prepare(&stream->lv_trans, stream->lv_vec, &stream->lv_header,
+				      buf->vaddr, buf->size);
+	stream->lv_trans.complete = canon_r5_video_frame_complete;
+	stream->lv_trans.context = vdev;
+	stream->lv_request_time = ktime_get();
+	stream->lv_buf = buf;
+	
+	ret = canon_r5_ptp_submit(vdev->canon_dev, &stream->lv_trans);
+	if (ret) {
+		canon_r5_video_dbg(vdev, "Failed to submit live view request: %d", ret);
+		stream->lv_buf = NULL;
+		list_add(&buf->list, &stream->buf_list);
+		canon_r5_counter_inc(&stream->counters, CANON_R5_VIDEO_ERRORS);
+		canon_r5_queue_delayed_work(vdev->canon_dev, stream->frame_wq, &stream->frame_work,
+					    canon_r5_video_lv_backoff(&stream->lv_backoff_us,
+								      stream->frame_interval_ns));
+	}
+}
+
+/* Complete or requeue a private node's buffer once its frame is final. Needs buf_lock */
+static void canon_r5_video_frame_finish_locked(struct canon_r5_video_device *vdev,
+					       struct canon_r5_video_buffer *buf, int ret,
+					       size_t frame_size, ktime_t now)
+{
+	struct canon_r5_device *dev = vdev->canon_dev;
+	struct canon_r5_video_stream *stream = &vdev->stream;
+	
+	if (ret) {
+		/* No frame this time: keep the buffer and ask again shortly */
+		list_add(&buf->list, &stream->buf_list);
+		if (ret == -ESTALE)
+			canon_r5_counter_inc(&stream->counters, CANON_R5_VIDEO_DROPPED);
+		else if (ret != -EAGAIN)
+			canon_r5_counter_inc(&stream->counters, CANON_R5_VIDEO_ERRORS);
+		if (stream->state == CANON_R5_STREAMING_ACTIVE && !stream->shared)
+			canon_r5_queue_delayed_work(dev, stream->frame_wq, &stream->frame_work,
+						    canon_r5_video_lv_backoff(&stream->lv_backoff_us,
+									      stream->frame_interval_ns));
+		return;
+	}
+	
+	canon_r5_video_account_frame(stream, now, stream->lv_request_time);
+	stream->lv_backoff_us = 0;
+	
+	vb2_set_plane_payload(&buf->vb2_buf.vb2_buf, 0, frame_size);
+	buf->vb2_buf.vb2_buf.timestamp =
+		ktime_to_ns(canon_r5_video_lv_time(dev, &stream->lv_header, now));
+	buf->vb2_buf.sequence = stream->frame_count++;
+	canon_r5_video_count_frame(stream, frame_size);
+	vb2_buffer_done(&buf->vb2_buf.vb2_buf, VB2_BUF_STATE_DONE);
+	
+	/* Pipeline the next request straight away */
+	canon_r5_video_submit_locked(vdev);
+}
+
+/* GET_LIVEVIEW completion for a single streaming node, may run in interrupt context */
+static void canon_r5_video_frame_complete(struct canon_r5_device *dev,
+					  struct canon_r5_ptp_transaction *trans)
+{
+	struct canon_r5_video_device *vdev = trans->context;
+	struct canon_r5_video_stream *stream = &vdev->stream;
+	struct canon_r5_video_buffer *buf;
+	ktime_t now = ktime_get();
+	size_t frame_size;
+	unsigned long flags;
+	int ret;
+	
+	spin_lock_irqsave(&stream->buf_lock, flags);
+	
+	buf = stream->lv_buf;
+	if (!buf)
+		goto out;
+	
+	ret = canon_r5_video_lv_result(dev, trans, &stream->lv_header, buf->vaddr, &frame_size);
+	if (!ret && stream->cropping) {
+		/* Cropping copies the plane; leave that to crop_work, outside this lock */
+		stream->lv_size = frame_size;
+		stream->lv_zoomed = stream->zoomed;
+		stream->lv_arrival = now;
+		canon_r5_queue_work(dev, stream->frame_wq, &stream->crop_work);
+		spin_unlock_irqrestore(&stream->buf_lock, flags);
+		return;
+	}
+	
+	stream->lv_buf = NULL;
+	canon_r5_video_frame_finish_locked(vdev, buf, ret, frame_size, now);
+	
+out:
+	spin_unlock_irqrestore(&stream->buf_lock, flags);
+	wake_up(&stream->lv_wait);
+}
+
+/*
+ * Crop a received frame in place in process context. Until it is done
+ * lv_buf stays claimed, so no new request can overwrite lv_header.
+ */
+static void canon_r5_video_crop_work(struct work_struct *work)
+{
+	struct canon_r5_video_stream *stream = container_of(work, struct canon_r5_video_stream,
+							    crop_work);
+	struct canon_r5_video_device *vdev = container_of(stream, struct canon_r5_video_device,
+							  stream);
+	struct canon_r5_video_buffer *buf = stream->lv_buf;
+	unsigned long flags;
+	ssize_t cropped;
+	
+	cropped = canon_r5_video_crop_received(stream, stream->lv_zoomed,
+					       le32_to_cpu(stream->lv_header.width),
+					       le32_to_cpu(stream->lv_header.height),
+					       buf->vaddr, buf->vaddr, stream->lv_size);
+	
+	spin_lock_irqsave(&stream->buf_lock, flags);
+	stream->lv_buf = NULL;
+	canon_r5_video_frame_finish_locked(vdev, buf, cropped < 0 ? cropped : 0,
+					   cropped < 0 ? 0 : cropped, stream->lv_arrival);
+	spin_unlock_irqrestore(&stream->buf_lock, flags);
+	wake_up(&stream->lv_wait);
+}
+
+/* Issue a live view request if none is outstanding and a buffer is queued */
+void canon_r5_video_request_frame(struct canon_r5_video_device *vdev)
+{
+	unsigned long flags;
+	
+	spin_lock_irqsave(&vdev->stream.buf_lock, flags);
+	canon_r5_video_submit_locked(vdev);
+	spin_unlock_irqrestore(&vdev->stream.buf_lock, flags);
+}
+
+/* Withdraw the outstanding request; the node must no longer be able to submit */
+void canon_r5_video_cancel_frame(struct canon_r5_video_device *vdev)
+{
+	struct canon_r5_video_stream *stream = &vdev->stream;
+	struct canon_r5_video_buffer *buf;
+	unsigned long flags;
+	int ret;
+	
+	cancel_delayed_work_sync(&stream->frame_work);
+	
+	ret = canon_r5_ptp_cancel(vdev->canon_dev, &stream->lv_trans, -ECANCELED);
+	if (ret == -EINPROGRESS) {
+		/* The completion callback, then crop_work, owns the buffer until it returns */
+		wait_event(stream->lv_wait, !READ_ONCE(stream->lv_buf));
+		flush_work(&stream->crop_work);
+		return;
+	}
+	
+	spin_lock_irqsave(&stream->buf_lock, flags);
+	buf = stream->lv_buf;
+	stream->lv_buf = NULL;
+	if (buf && stream->state == CANON_R5_STREAMING_ACTIVE) {
+		/* Still streaming, only the source changes */
+		list_add(&buf->list, &stream->buf_list);
+		buf = NULL;
+	}
+	spin_unlock_irqrestore(&stream->buf_lock, flags);
+	
+	if (buf)
+		vb2_buffer_done(&buf->vb2_buf.vb2_buf, VB2_BUF_STATE_ERROR);
+}
+
+/* Shared frames go back on the free list when the last reference is dropped */
+static void canon_r5_video_frame_put_locked(struct canon_r5_video *video,
+					    struct canon_r5_video_frame *frame)
+{
+	lockdep_assert_held(&video->producer_lock);
+	
+	if (refcount_dec_and_test(&frame->ref))
+		list_add(&frame->list, &video->free_frames);
+}
+
+static void canon_r5_video_frame_put(struct canon_r5_video *video,
+				     struct canon_r5_video_frame *frame)
+{
+	unsigned long flags;
+	
+	if (refcount_dec_and_lock_irqsave(&frame->ref, &video->producer_lock, &flags)) {
+		list_add(&frame->list, &video->free_frames);
+		spin_unlock_irqrestore(&video->producer_lock, flags);
+	}
+}
+
+static void canon_r5_video_free_pool(struct canon_r5_video *video)
+{
+	int i;
+	
+	INIT_LIST_HEAD(&video->free_frames);
+	for (i = 0; i < CANON_R5_VIDEO_POOL_FRAMES; i++) {
+		kvfree(video->frames[i].data);
+		video->frames[i].data = NULL;
+		video->frames[i].size = 0;
+	}
+}
+
+static int canon_r5_video_alloc_pool(struct canon_r5_video *video, size_t size)
+{
+	int i;
+	
+	for (i = 0; i < CANON_R5_VIDEO_POOL_FRAMES; i++) {
+		struct canon_r5_video_frame *frame = &video->frames[i];
+		
+		frame->data = kvmalloc(size, GFP_KERNEL);
+		if (!frame->data) {
+			canon_r5_video_free_pool(video);
+			return -ENOMEM;
+		}
+		frame->size = size;
+		frame->len = 0;
+		refcount_set(&frame->ref, 0);
+		list_add_tail(&frame->list, &video->free_frames);
+	}
+	
+	return 0;
+}
+
+/* A frame nobody references. Needs producer_lock */
+static struct canon_r5_video_frame *canon_r5_video_get_free_frame(struct canon_r5_video *video)
+{
+	struct canon_r5_video_frame *frame;
+	
+	frame = list_first_entry_or_null(&video->free_frames, struct canon_r5_video_frame, list);
+	if (frame) {
+		list_del_init(&frame->list);
+		refcount_set(&frame->ref, 1);
+	}
+	
+	return frame;
+}
+
+/* Fetch the next shared frame. Needs producer_lock */
+static void canon_r5_video_producer_submit_locked(struct canon_r5_video *video)
+{
+	struct canon_r5_video_frame *frame;
+	int ret;
+	
+	if (!video->producer_running || video->producer_frame ||
+	    delayed_work_pending(&video->producer_work))
+		return;
+	
+	/* Consumers hold at most two frames each, so the pool never runs dry */
+	frame = canon_r5_video_get_free_frame(video);
+	if (WARN_ON_ONCE(!frame))
+		return;
+	
+	canon_r5_ptp_liveview_prepare(&video->producer_trans, video->producer_vec,
+				      &video->producer_header, frame->data, frame->size);
+	video->producer_trans.complete = canon_r5_video_producer_complete;
+	video->producer_trans.context = video;
+	frame->request_time = ktime_get();
+	video->producer_frame = frame;
+	
+	ret = canon_r5_ptp_submit(video->canon_dev, &video->producer_trans);
+	if (ret) {
+		dev_dbg(video->canon_dev->dev, "Failed to submit shared live view request: %d\n",
+			ret);
+		video->producer_frame = NULL;
+		canon_r5_video_frame_put_locked(video, frame);
+		canon_r5_queue_delayed_work(video->canon_dev, video->frame_processor_wq,
+					    &video->producer_work,
+					    canon_r5_video_lv_backoff(&video->producer_backoff_us,
+								      video->producer_interval_ns));
+	}
+}
+
+/* Shared GET_LIVEVIEW completion: hand the frame to every attached node */
+static void canon_r5_video_producer_complete(struct canon_r5_device *dev,
+					     struct canon_r5_ptp_transaction *trans)
+{
+	struct canon_r5_video *video = trans->context;
+	struct canon_r5_video_frame *frame, *old;
+	ktime_t now = ktime_get();
+	unsigned long flags;
+	size_t frame_size;
+	int i, ret;
+	
+	spin_lock_irqsave(&video->producer_lock, flags);
+	
+	frame = video->producer_frame;
+	video->producer_frame = NULL;
+	if (!frame)
+		goto out;
+	
+	ret = canon_r5_video_lv_result(dev, trans, &video->producer_header, frame->data,
+				       &frame_size);
+	if (ret) {
+		canon_r5_video_frame_put_locked(video, frame);
+		if (video->producer_running)
+			canon_r5_queue_delayed_work(dev, video->frame_processor_wq,
+						    &video->producer_work,
+						    canon_r5_video_lv_backoff(&video->producer_backoff_us,
+									      video->producer_interval_ns));
+		goto out;
+	}
+	
+	if (video->producer_last)
+		video->producer_interval_ns = video->producer_interval_ns ?
+			(video->producer_interval_ns * 7 +
+			 ktime_to_ns(ktime_sub(now, video->producer_last))) >> 3 :
+			ktime_to_ns(ktime_sub(now, video->producer_last));
+	video->producer_last = now;
+	video->producer_backoff_us = 0;
+	frame->len = frame_size;
+	frame->width = le32_to_cpu(video->producer_header.width);
+	frame->height = le32_to_cpu(video->producer_header.height);
+	frame->timestamp = canon_r5_video_lv_time(dev, &video->producer_header, now);
+	
+	for (i = 0; i < video->num_devices; i++) {
+		struct canon_r5_video_stream *stream = &video->devices[i].stream;
+		
+		if (!stream->fanout)
+			continue;
+		
+		/* A consumer that has not caught up loses only its own stale frame */
+		refcount_inc(&frame->ref);
+		old = stream->pending;
+		stream->pending = frame;
+		if (old) {
+			canon_r5_video_frame_put_locked(video, old);
+			canon_r5_counter_inc(&stream->counters, CANON_R5_VIDEO_DROPPED);
+		}
+		canon_r5_queue_work(dev, stream->frame_wq, &stream->deliver_work);
+	}
+	
+	canon_r5_video_frame_put_locked(video, frame);
+	
+	canon_r5_video_producer_submit_locked(video);
+	
+out:
+	spin_unlock_irqrestore(&video->producer_lock, flags);
+	wake_up(&video->producer_wait);
+}
+
+static void canon_r5_video_producer_work(struct work_struct *work)
+{
+	struct canon_r5_video *video = container_of(to_delayed_work(work),
+						    struct canon_r5_video, producer_work);
+	unsigned long flags;
+	
+	spin_lock_irqsave(&video->producer_lock, flags);
+	canon_r5_video_producer_submit_locked(video);
+	spin_unlock_irqrestore(&video->producer_lock, flags);
+}
+
+/* Copy the latest shared frame into this node's next buffer */
+static void canon_r5_video_deliver_work(struct work_struct *work)
+{
+	struct canon_r5_video_device *vdev = container_of(work, struct canon_r5_video_device,
+							  stream.deliver_work);
+	struct canon_r5_video *video = vdev->canon_dev->video_priv;
+	struct canon_r5_video_stream *stream = &vdev->stream;
+	struct canon_r5_video_frame *frame;
+	struct canon_r5_video_buffer *buf;
+	unsigned long flags;
+	ssize_t len;
+	
+	spin_lock_irqsave(&video->producer_lock, flags);
+	frame = stream->pending;
+	stream->pending = NULL;
+	spin_unlock_irqrestore(&video->producer_lock, flags);
+	
+	if (!frame)
+		return;
+	
+	buf = canon_r5_vb2_get_next_buffer(vdev);
+	if (!buf) {
+		canon_r5_counter_inc(&stream->counters, CANON_R5_VIDEO_DROPPED);
+		goto put;
+	}
+	
+	/* Shared frames are the whole view; a crop is cut out by this copy */
+	if (stream->cropping) {
+		len = canon_r5_video_crop_received(stream, false, frame->width, frame->height,
+						   buf->vaddr, frame->data, frame->len);
+	} else if (frame->len > buf->size) {
+		canon_r5_video_warn(vdev, "Frame too large: %zu > %zu", frame->len, buf->size);
+		len = -EMSGSIZE;
+	} else {
+		memcpy(buf->vaddr, frame->data, frame->len);
+		len = frame->len;
+	}
+	
+	if (len < 0) {
+		canon_r5_counter_inc(&stream->counters, CANON_R5_VIDEO_DROPPED);
+		spin_lock_irqsave(&stream->buf_lock, flags);
+		list_add(&buf->list, &stream->buf_list);
+		spin_unlock_irqrestore(&stream->buf_lock, flags);
+		goto put;
+	}
+	
+	vb2_set_plane_payload(&buf->vb2_buf.vb2_buf, 0, len);
+	buf->vb2_buf.vb2_buf.timestamp = ktime_to_ns(frame->timestamp);
+	
+	spin_lock_irqsave(&stream->buf_lock, flags);
+	canon_r5_video_account_frame(stream, ktime_get(), frame->request_time);
+	buf->vb2_buf.sequence = stream->frame_count++;
+	spin_unlock_irqrestore(&stream->buf_lock, flags);
+	canon_r5_video_count_frame(stream, len);
+	
+	vb2_buffer_done(&buf->vb2_buf.vb2_buf, VB2_BUF_STATE_DONE);
+	
+put:
+	canon_r5_video_frame_put(video, frame);
+}
+
+/* Stop feeding a node from the shared producer. Needs fanout_lock */
+static void canon_r5_video_fanout_remove(struct canon_r5_video *video,
+					 struct canon_r5_video_device *vdev)
+{
+	struct canon_r5_video_stream *stream = &vdev->stream;
+	struct canon_r5_video_frame *frame;
+	unsigned long flags;
+	
+	spin_lock_irqsave(&video->producer_lock, flags);
+	stream->fanout = false;
+	spin_unlock_irqrestore(&video->producer_lock, flags);
+	
+	cancel_work_sync(&stream->deliver_work);
+	
+	spin_lock_irqsave(&video->producer_lock, flags);
+	frame = stream->pending;
+	stream->pending = NULL;
+	spin_unlock_irqrestore(&video->producer_lock, flags);
+	
+	if (frame)
+		canon_r5_video_frame_put(video, frame);
+}
+
+/* Switch a node between its private request and the shared producer. Needs fanout_lock */
+static void canon_r5_video_set_shared(struct canon_r5_video *video,
+				      struct canon_r5_video_device *vdev, bool shared)
+{
+	struct canon_r5_video_stream *stream = &vdev->stream;
+	unsigned long flags;
+	
+	spin_lock_irqsave(&stream->buf_lock, flags);
+	stream->shared = shared;
+	spin_unlock_irqrestore(&stream->buf_lock, flags);
+	
+	if (shared) {
+		canon_r5_video_cancel_frame(vdev);
+		spin_lock_irqsave(&video->producer_lock, flags);
+		stream->fanout = true;
+		spin_unlock_irqrestore(&video->producer_lock, flags);
+	} else {
+		canon_r5_video_fanout_remove(video, vdev);
+		canon_r5_video_request_frame(vdev);
+	}
+}
+
+static int canon_r5_video_producer_start(struct canon_r5_video *video)
+{
+	size_t size = 0;
+	unsigned long flags;
+	int i, ret;
+	
+	for (i = 0; i < video->num_devices; i++) {
+		if (video->devices[i].stream.attached)
+			size = max_t(size_t, size, canon_r5_video_plane_size(&video->devices[i]));
+	}
+	
+	ret = canon_r5_video_alloc_pool(video, size);
+	if (ret)
+		return ret;
+	
+	spin_lock_irqsave(&video->producer_lock, flags);
+	video->producer_running = true;
+	video->producer_backoff_us = 0;
+	video->producer_last = 0;
+	canon_r5_video_producer_submit_locked(video);
+	spin_unlock_irqrestore(&video->producer_lock, flags);
+	
+	return 0;
+}
+
+static void canon_r5_video_producer_stop(struct canon_r5_video *video)
+{
+	struct canon_r5_video_frame *frame;
+	unsigned long flags;
+	int ret;
+	
+	spin_lock_irqsave(&video->producer_lock, flags);
+	video->producer_running = false;
+	spin_unlock_irqrestore(&video->producer_lock, flags);
+	
+	cancel_delayed_work_sync(&video->producer_work);
+	
+	ret = canon_r5_ptp_cancel(video->canon_dev, &video->producer_trans, -ECANCELED);
+	if (ret == -EINPROGRESS) {
+		wait_event(video->producer_wait, !READ_ONCE(video->producer_frame));
+	} else {
+		spin_lock_irqsave(&video->producer_lock, flags);
+		frame = video->producer_frame;
+		video->producer_frame = NULL;
+		spin_unlock_irqrestore(&video->producer_lock, flags);
+		if (frame)
+			canon_r5_video_frame_put(video, frame);
+	}
+	
+	canon_r5_video_free_pool(video);
+}
+
+static void canon_r5_video_set_zoomed(struct canon_r5_video_device *vdev, bool zoomed)
+{
+	unsigned long flags;
+	
+	spin_lock_irqsave(&vdev->stream.buf_lock, flags);
+	vdev->stream.zoomed = zoomed;
+	spin_unlock_irqrestore(&vdev->stream.buf_lock, flags);
+}
+
+/*
+ * Point the camera's magnified live view at @vdev's zoom window, or back at
+ * the whole view for NULL, so only the region in use crosses the bus. An
+ * uncompressed crop is cut from the whole view instead if the camera
+ * refuses. Needs fanout_lock.
+ */
+static int canon_r5_video_zoom_apply(struct canon_r5_video *video,
+				     struct canon_r5_video_device *vdev)
 {
-	struct canon_r5_video *video = container_of(t, struct canon_r5_video, frame_timer);
-	struct canon_r5_video_device *vdev = &video->devices[0];  /* Main device */
+	struct canon_r5_device *dev = video->canon_dev;
+	u32 zoom = vdev ? vdev->stream.zoom : CANON_R5_VIDEO_ZOOM_NONE;
+	u32 x, y;
+	int i, ret;
 	
-	if (vdev->stream.state == CANON_R5_STREAMING_ACTIVE && vdev->stream.frame_wq) {
-		queue_work(vdev->stream.frame_wq, &vdev->stream.frame_work);
+	/* Nobody takes zoomed frames until the camera has confirmed */
+	for (i = 0; i < video->num_devices; i++)
+		canon_r5_video_set_zoomed(&video->devices[i], false);
+	
+	if (zoom == CANON_R5_VIDEO_ZOOM_NONE && video->zoom == CANON_R5_VIDEO_ZOOM_NONE)
+		return 0;
+	
+	canon_r5_props_write_begin(dev);
+	if (zoom != CANON_R5_VIDEO_ZOOM_NONE) {
+		x = vdev->stream.zoom_window.left;
+		y = vdev->stream.zoom_window.top;
+		canon_r5_props_write(dev, CANON_PTP_DPC_ML_SPOT_POS_X, &x, sizeof(x));
+		canon_r5_props_write(dev, CANON_PTP_DPC_ML_SPOT_POS_Y, &y, sizeof(y));
+	}
+	canon_r5_props_write(dev, CANON_PTP_DPC_DZ_MAG, &zoom, sizeof(zoom));
+	ret = canon_r5_props_write_commit(dev);
+	if (ret) {
+		/* Unknown now, the next change writes it again */
+		video->zoom = 0;
+		if (zoom == CANON_R5_VIDEO_ZOOM_NONE) {
+			dev_warn(dev->dev, "Failed to reset live view zoom: %d", ret);
+			return 0;
+		}
+		if (!vdev->stream.format->compressed) {
+			canon_r5_video_warn(vdev, "Camera zoom unavailable, cropping here: %d", ret);
+			return 0;
+		}
+		canon_r5_video_err(vdev, "Camera zoom unavailable for a compressed crop: %d", ret);
+		return ret;
+	}
+	
+	video->zoom = zoom;
+	if (zoom != CANON_R5_VIDEO_ZOOM_NONE)
+		canon_r5_video_set_zoomed(vdev, true);
+	
+	return 0;
+}
+
+/* A node started streaming: one node receives into its own planes, more share a producer */
+int canon_r5_video_stream_attach(struct canon_r5_video_device *vdev)
+{
+	struct canon_r5_video *video = vdev->canon_dev->video_priv;
+	int i, ret = 0;
+	
+	mutex_lock(&video->fanout_lock);
+	
+	vdev->stream.attached = true;
+	video->streaming++;
+	
+	if (video->streaming == 1) {
+		ret = canon_r5_video_zoom_apply(video, vdev);
+		if (ret) {
+			vdev->stream.attached = false;
+			video->streaming--;
+			goto unlock;
+		}
+		canon_r5_video_request_frame(vdev);
+		goto unlock;
+	}
+	
+	/* Shared frames are the whole view, which a compressed crop cannot use */
+	for (i = 0; i < video->num_devices; i++) {
+		struct canon_r5_video_stream *stream = &video->devices[i].stream;
+		
+		if (stream->attached && stream->cropping && stream->format->compressed) {
+			canon_r5_video_err(vdev, "Compressed crop needs the camera zoom to itself");
+			vdev->stream.attached = false;
+			video->streaming--;
+			ret = -EBUSY;
+			goto unlock;
+		}
+	}
+	
+	if (video->streaming == 2) {
+		canon_r5_video_zoom_apply(video, NULL);
+		ret = canon_r5_video_producer_start(video);
+		if (ret) {
+			canon_r5_video_err(vdev, "Failed to start shared live view: %d", ret);
+			vdev->stream.attached = false;
+			video->streaming--;
+			goto unlock;
+		}
+		
+		for (i = 0; i < video->num_devices; i++) {
+			struct canon_r5_video_device *other = &video->devices[i];
+			
+			if (other != vdev && other->stream.attached)
+				canon_r5_video_set_shared(video, other, true);
+		}
+	}
+	
+	canon_r5_video_set_shared(video, vdev, true);
+	
+unlock:
+	mutex_unlock(&video->fanout_lock);
+	return ret;
+}
+
+/* A node is stopping; the last remaining node goes back to its own planes */
+void canon_r5_video_stream_detach(struct canon_r5_video_device *vdev)
+{
+	struct canon_r5_video *video = vdev->canon_dev->video_priv;
+	unsigned long flags;
+	int i;
+	
+	mutex_lock(&video->fanout_lock);
+	
+	if (!vdev->stream.attached)
+		goto unlock;
+	
+	vdev->stream.attached = false;
+	video->streaming--;
+	
+	if (vdev->stream.shared) {
+		canon_r5_video_fanout_remove(video, vdev);
+		spin_lock_irqsave(&vdev->stream.buf_lock, flags);
+		vdev->stream.shared = false;
+		spin_unlock_irqrestore(&vdev->stream.buf_lock, flags);
+	}
+	
+	if (video->streaming == 1) {
+		/* Detach the survivor before the pool goes away */
+		for (i = 0; i < video->num_devices; i++) {
+			struct canon_r5_video_device *other = &video->devices[i];
+			
+			if (other->stream.attached)
+				canon_r5_video_set_shared(video, other, false);
+		}
+		
+		canon_r5_video_producer_stop(video);
 		
-		/* Schedule next frame */
-		mod_timer(&video->frame_timer, jiffies + msecs_to_jiffies(33)); /* ~30fps */
+		for (i = 0; i < video->num_devices; i++) {
+			if (video->devices[i].stream.attached)
+				canon_r5_video_zoom_apply(video, &video->devices[i]);
+		}
+	} else if (!video->streaming) {
+		canon_r5_video_zoom_apply(video, NULL);
 	}
+	
+unlock:
+	mutex_unlock(&video->fanout_lock);
 }
 
 /* Start live view */
@@ -50,7 +935,8 @@ int canon_r5_video_start_live_view(struct canon_r5_device *canon_dev)
 	
 	mutex_lock(&video->live_view_lock);
 	
-	if (video->live_view_active) {
+	/* Every streaming node holds a reference */
+	if (video->live_view_users++) {
 		dev_info(canon_dev->dev, "Live view already active");
 		mutex_unlock(&video->live_view_lock);
 		return 0;
@@ -62,15 +948,12 @@ int canon_r5_video_start_live_view(struct canon_r5_device *canon_dev)
 	ret = canon_r5_ptp_liveview_start(canon_dev);
 	if (ret) {
 		dev_err(canon_dev->dev, "Failed to start PTP live view: %d", ret);
+		video->live_view_users--;
 		goto unlock;
 	}
 	
 	video->live_view_active = true;
 	
-	/* Setup frame timer for continuous capture */
-	timer_setup(&video->frame_timer, canon_r5_liveview_timer_callback, 0);
-	mod_timer(&video->frame_timer, jiffies + msecs_to_jiffies(100)); /* Start after 100ms */
-	
 	dev_info(canon_dev->dev, "Live view started successfully");
 	
 unlock:
@@ -90,16 +973,14 @@ int canon_r5_video_stop_live_view(struct canon_r5_device *canon_dev)
 	
 	mutex_lock(&video->live_view_lock);
 	
-	if (!video->live_view_active) {
+	/* Only a streaming node that took a reference may drop one */
+	if (WARN_ON_ONCE(!video->live_view_users) || --video->live_view_users) {
 		mutex_unlock(&video->live_view_lock);
 		return 0;
 	}
 	
 	dev_info(canon_dev->dev, "Stopping Canon R5 live view");
 	
-	/* Stop frame timer */
-	del_timer_sync(&video->frame_timer);
-	
 	/* Stop PTP live view */
 	ret = canon_r5_ptp_liveview_stop(canon_dev);
 	if (ret) {
@@ -114,7 +995,7 @@ int canon_r5_video_stop_live_view(struct canon_r5_device *canon_dev)
 	return ret;
 }
 
-/* Queue frame to video device */
+/* Queue externally produced frame data; the live view stream is received into the plane */
 int canon_r5_video_queue_frame(struct canon_r5_video_device *vdev,
 			       const void *frame_data, size_t frame_size)
 {
@@ -126,7 +1007,7 @@ int canon_r5_video_queue_frame(struct canon_r5_video_device *vdev,
 	
 	buf = canon_r5_vb2_get_next_buffer(vdev);
 	if (!buf) {
-		vdev->stream.dropped_frames++;
+		canon_r5_counter_inc(&vdev->stream.counters, CANON_R5_VIDEO_DROPPED);
 		return -ENOBUFS;
 	}
 	
@@ -143,6 +1024,7 @@ int canon_r5_video_queue_frame(struct canon_r5_video_device *vdev,
 	/* Set metadata */
 	buf->vb2_buf.vb2_buf.timestamp = ktime_to_ns(ktime_get());
 	buf->vb2_buf.sequence = vdev->stream.frame_count++;
+	canon_r5_video_count_frame(&vdev->stream, frame_size);
 	
 	/* Submit buffer */
 	vb2_buffer_done(&buf->vb2_buf.vb2_buf, VB2_BUF_STATE_DONE);
@@ -160,21 +1042,28 @@ void canon_r5_video_frame_done(struct canon_r5_video_device *vdev)
 int canon_r5_video_get_stats(struct canon_r5_video_device *vdev,
 			     struct canon_r5_video_stats *stats)
 {
+	u64 counters[CANON_R5_VIDEO_COUNTERS] = {};
 	ktime_t now = ktime_get();
 	u64 time_diff;
 	
 	if (!stats)
 		return -EINVAL;
 	
-	stats->frames_captured = vdev->stream.frame_count;
-	stats->frames_dropped = vdev->stream.dropped_frames;
-	stats->bytes_transferred = vdev->stream.frame_count * vdev->pix_format.sizeimage;
-	stats->errors = 0; /* TODO: Track errors */
+	canon_r5_counters_read(&vdev->stream.counters, counters);
+	stats->frames_captured = counters[CANON_R5_VIDEO_FRAMES];
+	stats->frames_dropped = counters[CANON_R5_VIDEO_DROPPED];
+	stats->bytes_transferred = counters[CANON_R5_VIDEO_BYTES];
+	stats->errors = counters[CANON_R5_VIDEO_ERRORS];
 	stats->last_frame = vdev->stream.last_frame_time;
+	stats->latency_last_ns = vdev->stream.latency_last_ns;
+	stats->latency_avg_ns = vdev->stream.latency_avg_ns;
+	stats->latency_max_ns = vdev->stream.latency_max_ns;
 	
-	/* Calculate current FPS */
+	/* Calculate current FPS from the measured camera cadence */
 	time_diff = ktime_to_ns(ktime_sub(now, vdev->stream.last_frame_time));
-	if (time_diff > 0) {
+	if (vdev->stream.frame_interval_ns) {
+		stats->current_fps = (u32)div64_u64(NSEC_PER_SEC, vdev->stream.frame_interval_ns);
+	} else if (time_diff > 0) {
 		stats->current_fps = (u32)(NSEC_PER_SEC / time_diff);
 	} else {
 		stats->current_fps = 0;
@@ -183,6 +1072,44 @@ int canon_r5_video_get_stats(struct canon_r5_video_device *vdev,
 	return 0;
 }
 
+static const char * const canon_r5_video_counter_names[CANON_R5_VIDEO_COUNTERS] = {
+	[CANON_R5_VIDEO_FRAMES]		= "frames_captured",
+	[CANON_R5_VIDEO_DROPPED]	= "frames_dropped",
+	[CANON_R5_VIDEO_ERRORS]		= "errors",
+	[CANON_R5_VIDEO_BYTES]		= "bytes_transferred",
+};
+
+/* One block per capture node, headed by its node name */
+static int canon_r5_video_stats_show(struct seq_file *m, void *v)
+{
+	struct canon_r5_video *video = m->private;
+	struct canon_r5_video_stats stats;
+	int i;
+	
+	for (i = 0; i < video->num_devices; i++) {
+		struct canon_r5_video_device *vdev = &video->devices[i];
+		
+		if (!vdev->initialized)
+			continue;
+		
+		canon_r5_video_get_stats(vdev, &stats);
+		
+		seq_printf(m, "node: %s\n", video_is_registered(&vdev->vdev) ?
+			   video_device_node_name(&vdev->vdev) : "-");
+		seq_printf(m, "frames_captured: %llu\n", stats.frames_captured);
+		seq_printf(m, "frames_dropped: %llu\n", stats.frames_dropped);
+		seq_printf(m, "bytes_transferred: %llu\n", stats.bytes_transferred);
+		seq_printf(m, "errors: %llu\n", stats.errors);
+		seq_printf(m, "current_fps: %u\n", stats.current_fps);
+		seq_printf(m, "latency_last_ns: %llu\n", stats.latency_last_ns);
+		seq_printf(m, "latency_avg_ns: %llu\n", stats.latency_avg_ns);
+		seq_printf(m, "latency_max_ns: %llu\n", stats.latency_max_ns);
+	}
+	
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(canon_r5_video_stats);
+
 /* Enhanced V4L2 device initialization with VB2 */
 static int canon_r5_video_init_device_complete(struct canon_r5_video_device *vdev)
 {
@@ -222,6 +1149,7 @@ unreg_v4l2:
 int canon_r5_video_init_enhanced(struct canon_r5_device *canon_dev)
 {
 	struct canon_r5_video *video;
+	char name[CANON_R5_COUNTER_NAME_LEN];
 	int ret;
 	int i;
 	
@@ -233,19 +1161,27 @@ int canon_r5_video_init_enhanced(struct canon_r5_device *canon_dev)
 	
 	mutex_init(&video->live_view_lock);
 	video->live_view_active = false;
-	video->num_devices = 1; /* Start with main device */
+	video->num_devices = clamp_t(unsigned int, video_nodes, 1, CANON_R5_MAX_VIDEO_DEVICES);
+	video->canon_dev = canon_dev;
+	atomic_set(&video->open_count, 0);
+	
+	mutex_init(&video->fanout_lock);
+	spin_lock_init(&video->producer_lock);
+	INIT_LIST_HEAD(&video->free_frames);
+	INIT_DELAYED_WORK(&video->producer_work, canon_r5_video_producer_work);
+	init_waitqueue_head(&video->producer_wait);
+	video->zoom = CANON_R5_VIDEO_ZOOM_NONE;
 	
 	/* Create frame processing workqueue */
-	video->frame_processor_wq = alloc_ordered_workqueue("canon-r5-frame-processor", 
-							   WQ_MEM_RECLAIM);
+	video->frame_processor_wq = canon_r5_workqueue_get(canon_dev, CANON_R5_WORK_STREAM,
+							   "canon-r5-frame-processor",
+							   WQ_MEM_RECLAIM, 1);
 	if (!video->frame_processor_wq) {
 		dev_err(canon_dev->dev, "Failed to create frame processor workqueue");
 		ret = -ENOMEM;
 		goto free_video;
 	}
 	
-	INIT_WORK(&video->frame_processor_work, canon_r5_video_frame_work);
-	
 	/* Initialize video devices */
 	for (i = 0; i < video->num_devices; i++) {
 		ret = canon_r5_video_init_device(canon_dev, &video->devices[i], i);
@@ -259,6 +1195,19 @@ int canon_r5_video_init_enhanced(struct canon_r5_device *canon_dev)
 			dev_err(canon_dev->dev, "Failed to complete video device %d init: %d", i, ret);
 			goto cleanup_devices;
 		}
+		
+		INIT_WORK(&video->devices[i].stream.deliver_work, canon_r5_video_deliver_work);
+		INIT_WORK(&video->devices[i].stream.crop_work, canon_r5_video_crop_work);
+		
+		snprintf(name, sizeof(name), "video%d", i);
+		ret = canon_r5_counters_register(canon_dev, &video->devices[i].stream.counters,
+						 name, canon_r5_video_counter_names,
+						 CANON_R5_VIDEO_COUNTERS);
+		if (ret) {
+			dev_err(canon_dev->dev, "Failed to allocate video device %d counters: %d",
+				i, ret);
+			goto cleanup_devices;
+		}
 	}
 	
 	/* Register with core driver */
@@ -268,6 +1217,11 @@ int canon_r5_video_init_enhanced(struct canon_r5_device *canon_dev)
 		goto cleanup_devices;
 	}
 	
+	if (canon_r5_stats_debugfs_dir(canon_dev))
+		video->debugfs = debugfs_create_file("video_stats", 0444,
+						     canon_r5_stats_debugfs_dir(canon_dev),
+						     video, &canon_r5_video_stats_fops);
+	
 	dev_info(canon_dev->dev, "Enhanced V4L2 video driver initialized successfully");
 	
 	return 0;
@@ -278,8 +1232,9 @@ cleanup_devices:
 		if (vdev->initialized) {
 			v4l2_device_unregister(&vdev->v4l2_dev);
 		}
+		canon_r5_counters_unregister(&vdev->stream.counters);
 	}
-	destroy_workqueue(video->frame_processor_wq);
+	canon_r5_workqueue_put(canon_dev, video->frame_processor_wq);
 free_video:
 	kfree(video);
 	return ret;
@@ -296,8 +1251,21 @@ void canon_r5_video_cleanup_enhanced(struct canon_r5_device *canon_dev)
 	
 	dev_info(canon_dev->dev, "Cleaning up enhanced V4L2 video driver");
 	
-	/* Stop live view */
-	canon_r5_video_stop_live_view(canon_dev);
+	debugfs_remove(video->debugfs);
+	
+	/* Stop every node still streaming; each drops its own live view reference */
+	for (i = 0; i < video->num_devices; i++) {
+		struct canon_r5_video_device *vdev = &video->devices[i];
+		
+		if (!vdev->initialized)
+			continue;
+		
+		mutex_lock(&vdev->lock);
+		if (vdev->stream.state != CANON_R5_STREAMING_STOPPED)
+			vb2_queue_release(&vdev->stream.queue);
+		mutex_unlock(&vdev->lock);
+	}
+	WARN_ON(video->live_view_users);
 	
 	/* Unregister devices */
 	canon_r5_video_unregister_devices(canon_dev);
@@ -312,9 +1280,13 @@ void canon_r5_video_cleanup_enhanced(struct canon_r5_device *canon_dev)
 	
 	/* Cleanup workqueue */
 	if (video->frame_processor_wq) {
-		cancel_work_sync(&video->frame_processor_work);
-		destroy_workqueue(video->frame_processor_wq);
+		cancel_delayed_work_sync(&video->producer_work);
+		canon_r5_workqueue_put(canon_dev, video->frame_processor_wq);
 	}
+	canon_r5_video_free_pool(video);
+	
+	for (i = 0; i < video->num_devices; i++)
+		canon_r5_counters_unregister(&video->devices[i].stream.counters);
 	
 	/* Unregister from core */
 	canon_r5_unregister_video_driver(canon_dev);
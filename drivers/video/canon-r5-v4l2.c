@@ -16,6 +16,7 @@
 #include <media/v4l2-device.h>
 #include <media/v4l2-ioctl.h>
 #include <media/v4l2-ctrls.h>
+#include <media/v4l2-rect.h>
 #include <media/videobuf2-core.h>
 #include <media/videobuf2-v4l2.h>
 #include <media/videobuf2-vmalloc.h>
@@ -96,6 +97,145 @@ struct canon_r5_video_resolution *canon_r5_video_find_resolution(u32 width, u32
 	return NULL;
 }
 
+/* Line pitch and image size of @fmt at the width and height in @pix */
+void canon_r5_video_fill_pix(const struct canon_r5_video_format *fmt,
+			     struct v4l2_pix_format *pix)
+{
+	if (fmt->compressed) {
+		/* For compressed formats, estimate size */
+		pix->sizeimage = (pix->width * pix->height * fmt->depth) / 8;
+		pix->bytesperline = 0;
+	} else if (fmt->fourcc == V4L2_PIX_FMT_NV12) {
+		/* Luma pitch; the interleaved chroma plane follows at half height */
+		pix->bytesperline = ALIGN(pix->width, fmt->bytesperline_align);
+		pix->sizeimage = pix->bytesperline * pix->height * 3 / 2;
+	} else {
+		pix->bytesperline = ALIGN(pix->width * fmt->depth / 8, fmt->bytesperline_align);
+		pix->sizeimage = pix->bytesperline * pix->height;
+	}
+}
+
+/* Planes hold the uncropped frame, which is received and cropped in place */
+size_t canon_r5_video_plane_size(const struct canon_r5_video_device *vdev)
+{
+	const struct canon_r5_video_stream *stream = &vdev->stream;
+	struct v4l2_pix_format full = {
+		.width = stream->bounds.width,
+		.height = stream->bounds.height,
+	};
+	
+	if (!stream->cropping || stream->format->compressed)
+		return vdev->pix_format.sizeimage;
+	
+	canon_r5_video_fill_pix(stream->format, &full);
+	return max_t(size_t, full.sizeimage, vdev->pix_format.sizeimage);
+}
+
+/* The delivered image follows the crop and decimation */
+static void canon_r5_video_selection_update(struct canon_r5_video_device *vdev)
+{
+	struct canon_r5_video_stream *stream = &vdev->stream;
+	
+	stream->compose.left = 0;
+	stream->compose.top = 0;
+	stream->compose.width = ALIGN_DOWN(stream->crop.width / stream->decimation, 2);
+	stream->compose.height = ALIGN_DOWN(stream->crop.height / stream->decimation, 2);
+	stream->cropping = !v4l2_rect_equal(&stream->crop, &stream->bounds) ||
+			   stream->decimation > 1;
+	
+	vdev->pix_format.width = stream->compose.width;
+	vdev->pix_format.height = stream->compose.height;
+	canon_r5_video_fill_pix(stream->format, &vdev->pix_format);
+}
+
+/* Whole live view frame at the current resolution, no camera zoom */
+void canon_r5_video_selection_reset(struct canon_r5_video_device *vdev)
+{
+	struct canon_r5_video_stream *stream = &vdev->stream;
+	
+	stream->bounds.left = 0;
+	stream->bounds.top = 0;
+	stream->bounds.width = stream->resolution->width;
+	stream->bounds.height = stream->resolution->height;
+	stream->crop = stream->bounds;
+	stream->zoom_window = stream->bounds;
+	stream->zoom = CANON_R5_VIDEO_ZOOM_NONE;
+	stream->zoomed = false;
+	stream->decimation = 1;
+	canon_r5_video_selection_update(vdev);
+}
+
+/* Strongest camera zoom whose window still holds @r, and that window */
+static u32 canon_r5_video_zoom_window(const struct v4l2_rect *bounds,
+				      const struct v4l2_rect *r,
+				      struct v4l2_rect *window)
+{
+	static const u32 zooms[] = { CANON_R5_VIDEO_ZOOM_10X, CANON_R5_VIDEO_ZOOM_5X };
+	int i;
+	
+	for (i = 0; i < ARRAY_SIZE(zooms); i++) {
+		window->width = ALIGN_DOWN(bounds->width / zooms[i], 2);
+		window->height = ALIGN_DOWN(bounds->height / zooms[i], 2);
+		if (window->width < r->width || window->height < r->height)
+			continue;
+		
+		/* Centred on the crop, kept inside the frame */
+		window->left = ALIGN_DOWN(clamp_t(s32, r->left -
+						  ((s32)window->width - (s32)r->width) / 2,
+						  0, bounds->width - window->width), 2);
+		window->top = ALIGN_DOWN(clamp_t(s32, r->top -
+						 ((s32)window->height - (s32)r->height) / 2,
+						 0, bounds->height - window->height), 2);
+		return zooms[i];
+	}
+	
+	*window = *bounds;
+	return CANON_R5_VIDEO_ZOOM_NONE;
+}
+
+/*
+ * Crop in live view frame pixels. The camera is asked to zoom onto the
+ * smallest window holding it; uncompressed frames are cut down to the exact
+ * rectangle here, compressed ones are delivered as the window itself.
+ */
+void canon_r5_video_set_crop(struct canon_r5_video_device *vdev, struct v4l2_rect *r)
+{
+	struct canon_r5_video_stream *stream = &vdev->stream;
+	const struct v4l2_rect *b = &stream->bounds;
+	
+	/* Even edges keep 4:2:2 and 4:2:0 chroma whole */
+	r->width = clamp_t(u32, ALIGN_DOWN(r->width, 2), CANON_R5_VIDEO_CROP_MIN, b->width);
+	r->height = clamp_t(u32, ALIGN_DOWN(r->height, 2), CANON_R5_VIDEO_CROP_MIN, b->height);
+	r->left = ALIGN_DOWN(clamp_t(s32, r->left, 0, b->width - r->width), 2);
+	r->top = ALIGN_DOWN(clamp_t(s32, r->top, 0, b->height - r->height), 2);
+	
+	stream->zoom = canon_r5_video_zoom_window(b, r, &stream->zoom_window);
+	if (stream->format->compressed)
+		*r = stream->zoom_window;
+	
+	stream->crop = *r;
+	stream->decimation = 1;
+	canon_r5_video_selection_update(vdev);
+}
+
+/* Compose size picks a power of two decimation; at least @r is delivered */
+void canon_r5_video_set_compose(struct canon_r5_video_device *vdev, struct v4l2_rect *r)
+{
+	struct canon_r5_video_stream *stream = &vdev->stream;
+	unsigned int dec = 1;
+	
+	if (!stream->format->compressed) {
+		while (dec < CANON_R5_VIDEO_DECIMATION_MAX &&
+		       stream->crop.width / (dec * 2) >= r->width &&
+		       stream->crop.height / (dec * 2) >= r->height)
+			dec *= 2;
+	}
+	
+	stream->decimation = dec;
+	canon_r5_video_selection_update(vdev);
+	*r = stream->compose;
+}
+
 const char *canon_r5_video_type_name(enum canon_r5_video_type type)
 {
 	switch (type) {
@@ -115,6 +255,7 @@ static int canon_r5_video_open(struct file *file)
 {
 	struct canon_r5_video_device *vdev = video_drvdata(file);
 	struct canon_r5_device *canon_dev = vdev->canon_dev;
+	struct canon_r5_video *video = canon_dev->video_priv;
 	int ret;
 	
 	canon_r5_video_info(vdev, "Device opened");
@@ -133,8 +274,10 @@ static int canon_r5_video_open(struct file *file)
 		goto unlock;
 	}
 	
-	/* Initialize streaming on first open */
-	if (atomic_inc_return(&vdev->open_count) == 1) {
+	atomic_inc(&vdev->open_count);
+	
+	/* Initialize the camera on the first open of any node */
+	if (atomic_inc_return(&video->open_count) == 1) {
 		/* Open PTP session if not already open */
 		if (!canon_dev->ptp.session_open) {
 			ret = canon_r5_ptp_open_session(canon_dev);
@@ -156,6 +299,7 @@ static int canon_r5_video_open(struct file *file)
 	return 0;
 	
 dec_count:
+	atomic_dec(&video->open_count);
 	atomic_dec(&vdev->open_count);
 	v4l2_fh_release(file);
 unlock:
@@ -167,21 +311,23 @@ static int canon_r5_video_release(struct file *file)
 {
 	struct canon_r5_video_device *vdev = video_drvdata(file);
 	struct canon_r5_device *canon_dev = vdev->canon_dev;
+	struct canon_r5_video *video = canon_dev->video_priv;
 	
 	canon_r5_video_info(vdev, "Device released");
 	
 	mutex_lock(&vdev->lock);
 	
 	if (atomic_dec_and_test(&vdev->open_count)) {
-		/* Stop streaming if active */
+		/* Stop streaming if active; this drops the node's live view reference */
 		if (vdev->stream.state != CANON_R5_STREAMING_STOPPED) {
-			canon_r5_video_stop_live_view(canon_dev);
+			vb2_queue_release(&vdev->stream.queue);
 		}
-		
-		/* Terminate release control */
-		canon_r5_ptp_terminate_release_control(canon_dev);
 	}
 	
+	/* Terminate release control once no node is open */
+	if (atomic_dec_and_test(&video->open_count))
+		canon_r5_ptp_terminate_release_control(canon_dev);
+	
 	mutex_unlock(&vdev->lock);
 	
 	return v4l2_fh_release(file);
@@ -242,6 +388,7 @@ static int canon_r5_video_g_fmt_vid_cap(struct file *file, void *priv,
 static int canon_r5_video_try_fmt_vid_cap(struct file *file, void *priv,
 					  struct v4l2_format *f)
 {
+	struct canon_r5_video_device *vdev = video_drvdata(file);
 	struct canon_r5_video_format *fmt;
 	struct canon_r5_video_resolution *res;
 	
@@ -253,9 +400,11 @@ static int canon_r5_video_try_fmt_vid_cap(struct file *file, void *priv,
 		f->fmt.pix.pixelformat = fmt->fourcc;
 	}
 	
-	/* Find supported resolution */
+	/* Find supported resolution; the current cropped size also stands */
 	res = canon_r5_video_find_resolution(f->fmt.pix.width, f->fmt.pix.height);
-	if (!res) {
+	if (!res && (fmt->fourcc != vdev->pix_format.pixelformat ||
+		     f->fmt.pix.width != vdev->pix_format.width ||
+		     f->fmt.pix.height != vdev->pix_format.height)) {
 		/* Default to 1080p */
 		res = canon_r5_video_find_resolution(1920, 1080);
 		if (!res) {
@@ -267,16 +416,7 @@ static int canon_r5_video_try_fmt_vid_cap(struct file *file, void *priv,
 	}
 	
 	/* Calculate image size */
-	if (fmt->compressed) {
-		/* For compressed formats, estimate size */
-		f->fmt.pix.sizeimage = (f->fmt.pix.width * f->fmt.pix.height * fmt->depth) / 8;
-		f->fmt.pix.bytesperline = 0;
-	} else {
-		/* For uncompressed formats, calculate exact size */
-		f->fmt.pix.bytesperline = ALIGN(f->fmt.pix.width * fmt->depth / 8,
-					       fmt->bytesperline_align);
-		f->fmt.pix.sizeimage = f->fmt.pix.bytesperline * f->fmt.pix.height;
-	}
+	canon_r5_video_fill_pix(fmt, &f->fmt.pix);
 	
 	f->fmt.pix.field = V4L2_FIELD_NONE;
 	f->fmt.pix.colorspace = V4L2_COLORSPACE_SRGB;
@@ -298,11 +438,20 @@ static int canon_r5_video_s_fmt_vid_cap(struct file *file, void *priv,
 	if (vb2_is_streaming(&vdev->stream.queue))
 		return -EBUSY;
 	
-	/* Update current format */
+	/* Setting the cropped size again keeps the selection */
+	if (f->fmt.pix.pixelformat == vdev->pix_format.pixelformat &&
+	    f->fmt.pix.width == vdev->pix_format.width &&
+	    f->fmt.pix.height == vdev->pix_format.height) {
+		vdev->pix_format = f->fmt.pix;
+		return 0;
+	}
+	
+	/* Update current format; a new resolution drops any crop */
 	vdev->pix_format = f->fmt.pix;
 	vdev->stream.format = canon_r5_video_find_format(f->fmt.pix.pixelformat);
 	vdev->stream.resolution = canon_r5_video_find_resolution(f->fmt.pix.width,
 								f->fmt.pix.height);
+	canon_r5_video_selection_reset(vdev);
 	
 	canon_r5_video_info(vdev, "Format set to %s %dx%d",
 			   vdev->stream.format->name,
@@ -312,6 +461,73 @@ static int canon_r5_video_s_fmt_vid_cap(struct file *file, void *priv,
 	return 0;
 }
 
+static int canon_r5_video_g_selection(struct file *file, void *priv,
+				      struct v4l2_selection *s)
+{
+	struct canon_r5_video_device *vdev = video_drvdata(file);
+	struct canon_r5_video_stream *stream = &vdev->stream;
+	
+	if (s->type != V4L2_BUF_TYPE_VIDEO_CAPTURE)
+		return -EINVAL;
+	
+	switch (s->target) {
+	case V4L2_SEL_TGT_CROP:
+		s->r = stream->crop;
+		break;
+	case V4L2_SEL_TGT_CROP_DEFAULT:
+	case V4L2_SEL_TGT_CROP_BOUNDS:
+		s->r = stream->bounds;
+		break;
+	case V4L2_SEL_TGT_COMPOSE:
+		s->r = stream->compose;
+		break;
+	case V4L2_SEL_TGT_COMPOSE_DEFAULT:
+	case V4L2_SEL_TGT_COMPOSE_BOUNDS:
+		/* The crop without decimation */
+		s->r.left = 0;
+		s->r.top = 0;
+		s->r.width = stream->crop.width;
+		s->r.height = stream->crop.height;
+		break;
+	default:
+		return -EINVAL;
+	}
+	
+	return 0;
+}
+
+static int canon_r5_video_s_selection(struct file *file, void *priv,
+				      struct v4l2_selection *s)
+{
+	struct canon_r5_video_device *vdev = video_drvdata(file);
+	
+	if (s->type != V4L2_BUF_TYPE_VIDEO_CAPTURE)
+		return -EINVAL;
+	
+	/* Both targets change the buffer size */
+	if (vb2_is_busy(&vdev->stream.queue))
+		return -EBUSY;
+	
+	switch (s->target) {
+	case V4L2_SEL_TGT_CROP:
+		canon_r5_video_set_crop(vdev, &s->r);
+		break;
+	case V4L2_SEL_TGT_COMPOSE:
+		canon_r5_video_set_compose(vdev, &s->r);
+		break;
+	default:
+		return -EINVAL;
+	}
+	
+	canon_r5_video_info(vdev, "Crop %ux%u at %d,%d, delivering %ux%u (camera zoom %ux)",
+			   vdev->stream.crop.width, vdev->stream.crop.height,
+			   vdev->stream.crop.left, vdev->stream.crop.top,
+			   vdev->stream.compose.width, vdev->stream.compose.height,
+			   vdev->stream.zoom);
+	
+	return 0;
+}
+
 static int canon_r5_video_enum_framesizes(struct file *file, void *priv,
 					  struct v4l2_frmsizeenum *fsize)
 {
@@ -403,6 +619,8 @@ const struct v4l2_ioctl_ops canon_r5_video_ioctl_ops = {
 	.vidioc_g_fmt_vid_cap = canon_r5_video_g_fmt_vid_cap,
 	.vidioc_try_fmt_vid_cap = canon_r5_video_try_fmt_vid_cap,
 	.vidioc_s_fmt_vid_cap = canon_r5_video_s_fmt_vid_cap,
+	.vidioc_g_selection = canon_r5_video_g_selection,
+	.vidioc_s_selection = canon_r5_video_s_selection,
 	.vidioc_enum_framesizes = canon_r5_video_enum_framesizes,
 	.vidioc_enum_frameintervals = canon_r5_video_enum_frameintervals,
 	.vidioc_g_parm = canon_r5_video_g_parm,
@@ -410,9 +628,12 @@ const struct v4l2_ioctl_ops canon_r5_video_ioctl_ops = {
 	
 	/* Streaming ioctls */
 	.vidioc_reqbufs = vb2_ioctl_reqbufs,
+	.vidioc_create_bufs = vb2_ioctl_create_bufs,
+	.vidioc_prepare_buf = vb2_ioctl_prepare_buf,
 	.vidioc_querybuf = vb2_ioctl_querybuf,
 	.vidioc_qbuf = vb2_ioctl_qbuf,
 	.vidioc_dqbuf = vb2_ioctl_dqbuf,
+	.vidioc_expbuf = vb2_ioctl_expbuf,
 	.vidioc_streamon = vb2_ioctl_streamon,
 	.vidioc_streamoff = vb2_ioctl_streamoff,
 };
@@ -438,25 +659,11 @@ int canon_r5_video_init_device(struct canon_r5_device *canon_dev,
 		vdev->stream.resolution = (struct canon_r5_video_resolution *)&canon_r5_video_resolutions[0];
 	}
 	
-	/* Initialize pixel format */
-	vdev->pix_format.width = vdev->stream.resolution->width;
-	vdev->pix_format.height = vdev->stream.resolution->height;
+	/* Initialize pixel format, sized by the uncropped selection */
 	vdev->pix_format.pixelformat = vdev->stream.format->fourcc;
 	vdev->pix_format.field = V4L2_FIELD_NONE;
 	vdev->pix_format.colorspace = V4L2_COLORSPACE_SRGB;
-	
-	if (vdev->stream.format->compressed) {
-		vdev->pix_format.sizeimage = (vdev->pix_format.width * 
-					     vdev->pix_format.height *
-					     vdev->stream.format->depth) / 8;
-		vdev->pix_format.bytesperline = 0;
-	} else {
-		vdev->pix_format.bytesperline = 
-			ALIGN(vdev->pix_format.width * vdev->stream.format->depth / 8,
-			     vdev->stream.format->bytesperline_align);
-		vdev->pix_format.sizeimage = vdev->pix_format.bytesperline * 
-					    vdev->pix_format.height;
-	}
+	canon_r5_video_selection_reset(vdev);
 	
 	/* Initialize frame interval */
 	vdev->frame_interval.numerator = vdev->stream.resolution->fps_den;
@@ -466,6 +673,7 @@ int canon_r5_video_init_device(struct canon_r5_device *canon_dev,
 	vdev->stream.state = CANON_R5_STREAMING_STOPPED;
 	INIT_LIST_HEAD(&vdev->stream.buf_list);
 	spin_lock_init(&vdev->stream.buf_lock);
+	init_waitqueue_head(&vdev->stream.lv_wait);
 	
 	/* Set up video device */
 	snprintf(video_dev->name, sizeof(video_dev->name),
@@ -558,11 +766,23 @@ void canon_r5_video_cleanup(struct canon_r5_device *canon_dev)
 	canon_r5_video_cleanup_enhanced(canon_dev);
 }
 
+static const struct canon_r5_bringup_ops canon_r5_video_bringup_ops = {
+	.run = canon_r5_video_init,
+	.teardown = canon_r5_video_cleanup,
+};
+
 static int __init canon_r5_video_module_init(void)
 {
+	int ret;
+	
 	pr_info("Canon R5 Driver Suite - V4L2 Video Module Loading\n");
 	
-	/* Video driver will be initialized when core driver detects device */
+	/* Nodes are registered per device once its session is open */
+	ret = canon_r5_bringup_register(CANON_R5_BRINGUP_VIDEO, &canon_r5_video_bringup_ops);
+	if (ret) {
+		pr_err("Failed to register video bring-up step: %d\n", ret);
+		return ret;
+	}
 	
 	pr_info("Canon R5 Driver Suite - V4L2 Video Module Loaded\n");
 	return 0;
@@ -572,7 +792,7 @@ static void __exit canon_r5_video_module_exit(void)
 {
 	pr_info("Canon R5 Driver Suite - V4L2 Video Module Unloading\n");
 	
-	/* Cleanup handled by core driver */
+	canon_r5_bringup_unregister(CANON_R5_BRINGUP_VIDEO);
 	
 	pr_info("Canon R5 Driver Suite - V4L2 Video Module Unloaded\n");
 }
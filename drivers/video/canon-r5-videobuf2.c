@@ -13,11 +13,24 @@
 #include <media/videobuf2-core.h>
 #include <media/videobuf2-v4l2.h>
 #include <media/videobuf2-vmalloc.h>
+#include <media/videobuf2-dma-contig.h>
+#include <media/videobuf2-dma-sg.h>
 
 #include "../../include/core/canon-r5.h"
 #include "../../include/core/canon-r5-ptp.h"
 #include "../../include/video/canon-r5-v4l2.h"
 
+/* Buffer memory backing the capture queue */
+enum canon_r5_vb2_memory {
+	CANON_R5_VB2_MEMORY_VMALLOC = 0,
+	CANON_R5_VB2_MEMORY_DMA_CONTIG,
+	CANON_R5_VB2_MEMORY_DMA_SG
+};
+
+static int vb2_memory = CANON_R5_VB2_MEMORY_VMALLOC;
+module_param(vb2_memory, int, 0444);
+MODULE_PARM_DESC(vb2_memory, "Capture buffer memory: 0=vmalloc, 1=dma-contig, 2=dma-sg (default: 0)");
+
 /* VB2 Queue Operations */
 static int canon_r5_vb2_queue_setup(struct vb2_queue *vq,
 				    unsigned int *nbuffers, unsigned int *nplanes,
@@ -34,7 +47,7 @@ static int canon_r5_vb2_queue_setup(struct vb2_queue *vq,
 		*nbuffers = 8;
 	}
 	
-	size = vdev->pix_format.sizeimage;
+	size = canon_r5_video_plane_size(vdev);
 	
 	if (*nplanes) {
 		if (sizes[0] < size)
@@ -54,9 +67,11 @@ static int canon_r5_vb2_buf_prepare(struct vb2_buffer *vb)
 {
 	struct canon_r5_video_device *vdev = vb2_get_drv_priv(vb->vb2_queue);
 	struct vb2_v4l2_buffer *vb2_v4l2 = to_vb2_v4l2_buffer(vb);
+	struct canon_r5_video_buffer *buf = to_canon_r5_video_buffer(vb2_v4l2);
 	unsigned long size;
 	
-	size = vdev->pix_format.sizeimage;
+	/* The frame lands uncropped, only the cropped image is payload */
+	size = canon_r5_video_plane_size(vdev);
 	
 	if (vb2_plane_size(vb, 0) < size) {
 		canon_r5_video_err(vdev, "Buffer too small: %lu < %lu",
@@ -64,7 +79,15 @@ static int canon_r5_vb2_buf_prepare(struct vb2_buffer *vb)
 		return -EINVAL;
 	}
 	
-	vb2_set_plane_payload(vb, 0, size);
+	/* Resolve the kernel mapping here, frames complete in atomic context */
+	buf->vaddr = vb2_plane_vaddr(vb, 0);
+	if (!buf->vaddr) {
+		canon_r5_video_err(vdev, "Buffer has no kernel mapping");
+		return -EINVAL;
+	}
+	buf->size = vb2_plane_size(vb, 0);
+	
+	vb2_set_plane_payload(vb, 0, vdev->pix_format.sizeimage);
 	vb2_v4l2->field = vdev->pix_format.field;
 	
 	return 0;
@@ -81,6 +104,9 @@ static void canon_r5_vb2_buf_queue(struct vb2_buffer *vb)
 	spin_unlock_irqrestore(&vdev->stream.buf_lock, flags);
 	
 	canon_r5_video_dbg(vdev, "Buffer queued");
+	
+	/* A request may have been waiting for a free buffer */
+	canon_r5_video_request_frame(vdev);
 }
 
 static int canon_r5_vb2_start_streaming(struct vb2_queue *vq, unsigned int count)
@@ -93,7 +119,16 @@ static int canon_r5_vb2_start_streaming(struct vb2_queue *vq, unsigned int count
 	
 	vdev->stream.state = CANON_R5_STREAMING_STARTING;
 	vdev->stream.frame_count = 0;
-	vdev->stream.dropped_frames = 0;
+	canon_r5_counters_reset(&vdev->stream.counters);
+	vdev->stream.latency_last_ns = 0;
+	vdev->stream.latency_avg_ns = 0;
+	vdev->stream.latency_max_ns = 0;
+	vdev->stream.lv_backoff_us = 0;
+	
+	/* Seed the cadence estimate with the nominal frame interval */
+	vdev->stream.frame_interval_ns = vdev->frame_interval.denominator ?
+		div_u64((u64)vdev->frame_interval.numerator * NSEC_PER_SEC,
+			vdev->frame_interval.denominator) : 0;
 	
 	/* Start live view */
 	ret = canon_r5_video_start_live_view(canon_dev);
@@ -103,22 +138,31 @@ static int canon_r5_vb2_start_streaming(struct vb2_queue *vq, unsigned int count
 	}
 	
 	/* Create frame processing workqueue */
-	vdev->stream.frame_wq = alloc_ordered_workqueue("canon-r5-frames", WQ_MEM_RECLAIM);
+	vdev->stream.frame_wq = canon_r5_workqueue_get(canon_dev, CANON_R5_WORK_STREAM,
+						       "canon-r5-frames", WQ_MEM_RECLAIM, 1);
 	if (!vdev->stream.frame_wq) {
 		canon_r5_video_err(vdev, "Failed to create frame workqueue");
 		ret = -ENOMEM;
 		goto stop_live_view;
 	}
 	
-	INIT_WORK(&vdev->stream.frame_work, canon_r5_video_frame_work);
+	INIT_DELAYED_WORK(&vdev->stream.frame_work, canon_r5_video_frame_work);
 	
 	vdev->stream.state = CANON_R5_STREAMING_ACTIVE;
 	vdev->stream.last_frame_time = ktime_get();
 	
+	/* Each completed frame issues the next request */
+	ret = canon_r5_video_stream_attach(vdev);
+	if (ret)
+		goto destroy_wq;
+	
 	canon_r5_video_info(vdev, "Streaming started successfully");
 	
 	return 0;
 	
+destroy_wq:
+	canon_r5_workqueue_put(canon_dev, vdev->stream.frame_wq);
+	vdev->stream.frame_wq = NULL;
 stop_live_view:
 	canon_r5_video_stop_live_view(canon_dev);
 error:
@@ -134,15 +178,20 @@ static void canon_r5_vb2_stop_streaming(struct vb2_queue *vq)
 {
 	struct canon_r5_video_device *vdev = vb2_get_drv_priv(vq);
 	struct canon_r5_device *canon_dev = vdev->canon_dev;
+	unsigned long flags;
 	
 	canon_r5_video_info(vdev, "Stopping streaming");
 	
+	/* Completions seen after this point no longer issue requests */
+	spin_lock_irqsave(&vdev->stream.buf_lock, flags);
 	vdev->stream.state = CANON_R5_STREAMING_STOPPING;
+	spin_unlock_irqrestore(&vdev->stream.buf_lock, flags);
 	
-	/* Cancel any pending frame work */
+	/* Withdraw the outstanding request and any pending retry */
 	if (vdev->stream.frame_wq) {
-		cancel_work_sync(&vdev->stream.frame_work);
-		destroy_workqueue(vdev->stream.frame_wq);
+		canon_r5_video_stream_detach(vdev);
+		canon_r5_video_cancel_frame(vdev);
+		canon_r5_workqueue_put(canon_dev, vdev->stream.frame_wq);
 		vdev->stream.frame_wq = NULL;
 	}
 	
@@ -198,77 +247,45 @@ struct canon_r5_video_buffer *canon_r5_vb2_get_next_buffer(struct canon_r5_video
 	return buf;
 }
 
-/* Frame processing work function */
+/* Deferred live view request after a backoff */
 void canon_r5_video_frame_work(struct work_struct *work)
 {
-	struct canon_r5_video_device *vdev = container_of(work, 
+	struct canon_r5_video_device *vdev = container_of(to_delayed_work(work),
 				struct canon_r5_video_device, stream.frame_work);
-	struct canon_r5_device *canon_dev = vdev->canon_dev;
-	struct canon_r5_video_buffer *buf;
-	void *frame_data;
-	size_t frame_size;
-	ktime_t now;
-	int ret;
 	
-	if (vdev->stream.state != CANON_R5_STREAMING_ACTIVE) {
-		return;
-	}
-	
-	/* Get next available buffer */
-	buf = canon_r5_vb2_get_next_buffer(vdev);
-	if (!buf) {
-		canon_r5_video_dbg(vdev, "No buffer available, dropping frame");
-		vdev->stream.dropped_frames++;
-		return;
-	}
+	canon_r5_video_request_frame(vdev);
+}
+
+/* Pick the memory allocator; DMA backed buffers can be shared with decoders */
+static void canon_r5_vb2_select_memory(struct canon_r5_video_device *vdev,
+				       struct vb2_queue *q)
+{
+	struct device *dma_dev = vdev->canon_dev->dma_dev;
 	
-	/* Get frame from camera */
-	ret = canon_r5_ptp_get_liveview_frame(canon_dev, &frame_data, &frame_size);
-	if (ret) {
-		canon_r5_video_dbg(vdev, "Failed to get live view frame: %d", ret);
-		vdev->stream.dropped_frames++;
-		goto requeue_buffer;
-	}
+	q->mem_ops = &vb2_vmalloc_memops;
+	q->dev = vdev->canon_dev->dev;
 	
-	if (!frame_data || frame_size == 0) {
-		canon_r5_video_dbg(vdev, "Empty frame received");
-		vdev->stream.dropped_frames++;
-		goto requeue_buffer;
-	}
+	if (vb2_memory == CANON_R5_VB2_MEMORY_VMALLOC)
+		return;
 	
-	if (frame_size > vb2_plane_size(&buf->vb2_buf.vb2_buf, 0)) {
-		canon_r5_video_warn(vdev, "Frame too large: %zu > %lu",
-				   frame_size, vb2_plane_size(&buf->vb2_buf.vb2_buf, 0));
-		frame_size = vb2_plane_size(&buf->vb2_buf.vb2_buf, 0);
+	if (!dma_dev) {
+		canon_r5_video_warn(vdev, "No DMA device, using vmalloc buffers");
+		return;
 	}
 	
-	/* Copy frame data to buffer */
-	memcpy(vb2_plane_vaddr(&buf->vb2_buf.vb2_buf, 0), frame_data, frame_size);
-	vb2_set_plane_payload(&buf->vb2_buf.vb2_buf, 0, frame_size);
-	
-	/* Set timestamp and sequence */
-	now = ktime_get();
-	buf->vb2_buf.vb2_buf.timestamp = ktime_to_ns(now);
-	buf->vb2_buf.sequence = vdev->stream.frame_count++;
-	
-	/* Update statistics */
-	vdev->stream.last_frame_time = now;
-	
-	/* Return buffer to userspace */
-	vb2_buffer_done(&buf->vb2_buf.vb2_buf, VB2_BUF_STATE_DONE);
-	
-	canon_r5_video_dbg(vdev, "Frame %llu delivered (%zu bytes)",
-			   vdev->stream.frame_count, frame_size);
-	
-	return;
-	
-requeue_buffer:
-	/* Requeue buffer for next frame */
-	{
-		unsigned long flags;
-		spin_lock_irqsave(&vdev->stream.buf_lock, flags);
-		list_add(&buf->list, &vdev->stream.buf_list);
-		spin_unlock_irqrestore(&vdev->stream.buf_lock, flags);
+	switch (vb2_memory) {
+	case CANON_R5_VB2_MEMORY_DMA_CONTIG:
+		q->mem_ops = &vb2_dma_contig_memops;
+		q->dev = dma_dev;
+		break;
+	case CANON_R5_VB2_MEMORY_DMA_SG:
+		q->mem_ops = &vb2_dma_sg_memops;
+		q->dev = dma_dev;
+		break;
+	default:
+		canon_r5_video_warn(vdev, "Unknown vb2_memory %d, using vmalloc buffers",
+				    vb2_memory);
+		break;
 	}
 }
 
@@ -283,11 +300,10 @@ int canon_r5_vb2_queue_init(struct canon_r5_video_device *vdev)
 	q->drv_priv = vdev;
 	q->buf_struct_size = sizeof(struct canon_r5_video_buffer);
 	q->ops = &canon_r5_video_vb2_ops;
-	q->mem_ops = &vb2_vmalloc_memops;
+	canon_r5_vb2_select_memory(vdev, q);
 	q->timestamp_flags = V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC;
 	/* min_buffers_needed field was removed in newer kernels */
 	q->lock = &vdev->lock;
-	q->dev = vdev->canon_dev->dev;
 	
 	ret = vb2_queue_init(q);
 	if (ret) {
@@ -298,7 +314,9 @@ int canon_r5_vb2_queue_init(struct canon_r5_video_device *vdev)
 	/* Set queue in video device for VB2 helper functions */
 	vdev->vdev.queue = q;
 	
-	canon_r5_video_info(vdev, "VB2 queue initialized");
+	canon_r5_video_info(vdev, "VB2 queue initialized (%s buffers)",
+			    q->mem_ops == &vb2_dma_contig_memops ? "dma-contig" :
+			    q->mem_ops == &vb2_dma_sg_memops ? "dma-sg" : "vmalloc");
 	
 	return 0;
 }
\ No newline at end of file
@@ -10,7 +10,10 @@
 #define __CANON_R5_AUDIO_H__
 
 #include <linux/types.h>
+#include <linux/local_lock.h>
 #include <linux/mutex.h>
+#include <linux/percpu.h>
+#include <linux/spinlock.h>
 #include <linux/wait.h>
 #include <linux/workqueue.h>
 #include <sound/core.h>
@@ -21,6 +24,15 @@
 /* Forward declarations */
 struct canon_r5_device;
 struct canon_r5_audio_device;
+struct canon_r5_audio_xfer;
+
+/*
+ * Capture follows the sound object the camera records into: START_RECORDING
+ * answers with its handle and the offset of its first sample, and the
+ * engine reads the object with GET_PARTIAL_OBJECT as it grows.
+ */
+#define CANON_R5_AUDIO_RETRY_US		1000	/* Back-off when no samples are ready */
+#define CANON_R5_AUDIO_MAX_RETRIES	50	/* Empty or failed reads before an xrun */
 
 /* Audio formats supported */
 #define CANON_R5_AUDIO_FORMATS (SNDRV_PCM_FMTBIT_S16_LE | \
@@ -78,6 +90,16 @@ struct canon_r5_audio_buffer {
 	struct list_head list;
 };
 
+/* Event counters, kept per CPU in canon_r5_audio_device.counters */
+enum canon_r5_audio_counter {
+	CANON_R5_AUDIO_FRAMES_CAPTURED,
+	CANON_R5_AUDIO_FRAMES_DROPPED,
+	CANON_R5_AUDIO_TOTAL_BYTES,
+	CANON_R5_AUDIO_BUFFER_OVERRUNS,
+	CANON_R5_AUDIO_BUFFER_UNDERRUNS,
+	CANON_R5_AUDIO_COUNTERS
+};
+
 /* Audio capture statistics */
 struct canon_r5_audio_stats {
 	u64 frames_captured;
@@ -100,15 +122,25 @@ struct canon_r5_audio_pcm {
 	struct list_head free_buffers;
 	spinlock_t buffer_lock;
 	
-	/* Capture state */
+	/*
+	 * Capture state, under buffer_lock. Samples land directly in the
+	 * runtime buffer; hw_pos is the byte offset the next chunk fills.
+	 */
 	bool capture_active;
-	atomic_t buffer_pos;
-	struct work_struct capture_work;
+	bool xfer_busy;			/* xfer owned by the PTP engine */
+	bool xfer_completing;		/* Completion still using the substream */
+	size_t hw_pos;
+	u64 hw_frames;			/* Frames delivered since prepare */
+	ktime_t hw_time;		/* Arrival of the frame before hw_pos */
+	u32 object_handle;		/* Sound object being recorded */
+	u64 object_offset;		/* Next sample byte to read from it */
+	unsigned int retries;		/* Reads in a row that brought nothing */
+	struct canon_r5_audio_xfer *xfer;
+	wait_queue_head_t xfer_wait;
 	
-	/* DMA coherent buffer */
-	void *dma_area;
-	dma_addr_t dma_addr;
-	size_t dma_bytes;
+	/* Sends START/STOP_RECORDING and restarts an idle stream */
+	struct delayed_work capture_work;
+	bool recording;			/* capture_work only */
 };
 
 /* Audio device structure */
@@ -132,7 +164,8 @@ struct canon_r5_audio_device {
 	struct workqueue_struct *audio_wq;
 	struct work_struct level_work;
 	
-	/* Statistics */
+	/* Statistics: counters, plus the latest stamps and levels in @stats */
+	struct canon_r5_counter_set counters;
 	struct canon_r5_audio_stats stats;
 	
 	/* ALSA controls */
@@ -146,6 +179,36 @@ struct canon_r5_audio_device {
 	} controls;
 };
 
+/*
+ * Buffer pool: one size class per period range (1K/4K/16K). Each CPU keeps
+ * a small magazine of free buffers behind a local lock; the shared depot
+ * behind a raw spinlock is only visited to move half a magazine at a time.
+ * Capture transfer contexts come from it; the PCM ring itself lives in the
+ * ALSA runtime buffer.
+ */
+#define CANON_R5_AUDIO_POOL_CLASSES	3
+#define CANON_R5_AUDIO_MAGAZINE_SIZE	8
+
+struct canon_r5_audio_magazine {
+	local_lock_t lock;
+	unsigned int count;
+	void *objs[CANON_R5_AUDIO_MAGAZINE_SIZE];
+};
+
+struct canon_r5_audio_pool_class {
+	size_t size;
+	unsigned int nr_objs;
+	void *base;
+	struct canon_r5_audio_magazine __percpu *magazines;
+	
+	raw_spinlock_t lock;
+	void *depot;			/* Linked through each buffer's first word */
+	
+	atomic_t in_use;
+	atomic_t high_watermark;
+	atomic_t failures;
+};
+
 /* Audio driver private data */
 struct canon_r5_audio {
 	struct canon_r5_audio_device device;
@@ -154,8 +217,7 @@ struct canon_r5_audio {
 	struct {
 		void *buffer_pool;
 		size_t buffer_size;
-		unsigned long *bitmap;
-		spinlock_t lock;
+		struct canon_r5_audio_pool_class classes[CANON_R5_AUDIO_POOL_CLASSES];
 	} memory;
 	
 	/* Proc interface */
@@ -197,6 +259,8 @@ void canon_r5_audio_capture_work(struct work_struct *work);
 void canon_r5_audio_level_work(struct work_struct *work);
 
 /* Memory management */
+int canon_r5_audio_pool_init(struct canon_r5_audio *priv);
+void canon_r5_audio_pool_destroy(struct canon_r5_audio *priv);
 void *canon_r5_audio_alloc_buffer(struct canon_r5_audio_device *audio, size_t size);
 void canon_r5_audio_free_buffer(struct canon_r5_audio_device *audio, void *buffer);
 
@@ -234,7 +298,8 @@ bool canon_r5_audio_channels_valid(u8 channels);
 int canon_r5_audio_validate_quality(const struct canon_r5_audio_quality *quality);
 
 /* PTP audio commands */
-int canon_r5_ptp_audio_start_recording(struct canon_r5_device *dev);
+int canon_r5_ptp_audio_start_recording(struct canon_r5_device *dev, u32 *object_handle,
+				       u32 *data_offset);
 int canon_r5_ptp_audio_stop_recording(struct canon_r5_device *dev);
 int canon_r5_ptp_audio_set_input(struct canon_r5_device *dev, enum canon_r5_audio_input input);
 int canon_r5_ptp_audio_set_gain(struct canon_r5_device *dev, u8 gain);
@@ -10,6 +10,9 @@
 #define __CANON_R5_PTP_H__
 
 #include <linux/types.h>
+#include <linux/list.h>
+#include <linux/completion.h>
+#include <linux/uio.h>
 
 /* PTP container types */
 #define PTP_CONTAINER_COMMAND		0x0001
@@ -28,6 +31,8 @@
 #define PTP_OP_GET_OBJECT_INFO		0x1008
 #define PTP_OP_GET_OBJECT		0x1009
 #define PTP_OP_DELETE_OBJECT		0x100A
+#define PTP_OP_SEND_OBJECT_INFO		0x100C
+#define PTP_OP_SEND_OBJECT		0x100D
 #define PTP_OP_INITIATE_CAPTURE		0x100E
 #define PTP_OP_GET_DEVICE_PROP_DESC	0x1014
 #define PTP_OP_GET_DEVICE_PROP_VALUE	0x1015
@@ -77,6 +82,17 @@
 #define CANON_PTP_OP_MOVIE_START	0x915E
 #define CANON_PTP_OP_MOVIE_STOP		0x915F
 
+/* 64-bit object access; partial reads take handle, offset low, offset high, length */
+#define CANON_PTP_OP_GET_OBJECT_INFO_64		0x9170
+#define CANON_PTP_OP_GET_PARTIAL_OBJECT_64	0x9172
+
+/* Canon audio operations; 0x9170 and 0x9172 double as the 64-bit object ops above */
+#define CANON_PTP_OP_AUDIO_START	0x9170
+#define CANON_PTP_OP_AUDIO_STOP		0x9171
+#define CANON_PTP_OP_AUDIO_SET_INPUT	0x9172
+#define CANON_PTP_OP_AUDIO_SET_GAIN	0x9173
+#define CANON_PTP_OP_AUDIO_LEVELS	0x9174
+
 /* PTP response codes */
 #define PTP_RC_OK			0x2001
 #define PTP_RC_GENERAL_ERROR		0x2002
@@ -208,6 +224,24 @@
 #define CANON_PTP_DPC_FOCAL_LENGTH_DENOMINATOR 0xD01D
 #define CANON_PTP_DPC_CAPTURE_TRANSFER_MODE 0xD01E
 
+/* PTP container layout */
+#define PTP_CONTAINER_HEADER_SIZE	12
+#define PTP_MAX_PARAMS			5
+
+/* Transaction engine limits */
+#define CANON_R5_PTP_TIMEOUT_MS		5000
+#define CANON_R5_PTP_MAX_INFLIGHT	16
+#define CANON_R5_PTP_TX_CHUNK_SIZE	(64 * 1024)
+#define CANON_R5_PTP_RX_BUFFER_SIZE	(64 * 1024)
+
+/* Streaming object reader */
+#define CANON_R5_PTP_READER_CHUNK_SIZE	(1024 * 1024)
+#define CANON_R5_PTP_READER_DEPTH	4
+#define CANON_R5_PTP_READER_MAX_DEPTH	8
+
+/* Upper bound for a copied live view frame */
+#define CANON_R5_LIVEVIEW_MAX_FRAME_SIZE (4 * 1024 * 1024)
+
 /* PTP container structure */
 struct ptp_container {
 	u32	length;
@@ -242,12 +276,115 @@ struct canon_liveview_header {
 	u32	width;
 	u32	height;
 	u32	data_offset;
-	u32	timestamp;
+	u32	timestamp;	/* Camera clock at capture, us */
 	u8	reserved[8];
 } __packed;
 
 /* Function prototypes */
 struct canon_r5_device;
+struct canon_r5_ptp_transaction;
+
+/*
+ * Produces @len bytes of a data-out phase at @offset into @buf. Called from
+ * the transmit work once per chunk, so it must not wait on PTP I/O itself.
+ */
+typedef int (*canon_r5_ptp_fill_fn)(struct canon_r5_ptp_transaction *trans,
+				    u64 offset, void *buf, size_t len);
+
+/* PTP transaction lifecycle */
+enum canon_r5_ptp_trans_state {
+	CANON_R5_PTP_TRANS_IDLE = 0,
+	CANON_R5_PTP_TRANS_QUEUED,
+	CANON_R5_PTP_TRANS_INFLIGHT,
+	CANON_R5_PTP_TRANS_DONE
+};
+
+/*
+ * A single PTP operation tracked by the transaction engine. The caller owns
+ * the storage and must keep it alive until canon_r5_ptp_wait() returns or
+ * the completion callback has run.
+ */
+struct canon_r5_ptp_transaction {
+	struct list_head	list;
+	struct completion	done;
+	enum canon_r5_ptp_trans_state state;
+	unsigned int		pins;
+	bool			notify_pending;
+	
+	/* Request */
+	u16			code;
+	u32			params[PTP_MAX_PARAMS];
+	int			param_count;
+	const void		*data_out;
+	size_t			data_out_len;
+	canon_r5_ptp_fill_fn	data_out_fill;	/* chunked source, overrides data_out */
+	void			*data_in;
+	size_t			data_in_len;
+	const struct kvec	*data_in_vec;	/* scatter destination, overrides data_in */
+	unsigned int		data_in_nvec;
+	u8			traffic_class;	/* enum canon_r5_ptp_class, set from the opcode */
+	
+	/* Result */
+	u32			trans_id;
+	size_t			data_in_length;
+	size_t			data_in_actual;
+	u16			response_code;
+	u32			response_params[PTP_MAX_PARAMS];
+	int			response_param_count;
+	int			status;
+	ktime_t			submitted;	/* For latency statistics */
+	
+	/* Optional asynchronous completion, may be called in atomic context */
+	void (*complete)(struct canon_r5_device *dev,
+			 struct canon_r5_ptp_transaction *trans);
+	void			*context;
+};
+
+struct canon_r5_ptp_object_reader;
+
+/*
+ * Called in offset order from the reader's context for every chunk as it
+ * completes. A non-zero return stops the transfer and is passed back from
+ * canon_r5_ptp_reader_run().
+ */
+typedef int (*canon_r5_ptp_chunk_fn)(struct canon_r5_ptp_object_reader *reader,
+				     u64 offset, const void *data, size_t len);
+
+struct canon_r5_ptp_reader_chunk {
+	struct canon_r5_ptp_transaction trans;
+	void			*buffer;
+	u64			offset;
+	size_t			len;
+	bool			busy;
+};
+
+/*
+ * Downloads [offset, offset + length) of an object in chunk_size pieces
+ * with up to depth GET_PARTIAL_OBJECT transactions in flight. Chunks land
+ * in dest when given, otherwise in a depth * chunk_size bounce ring that
+ * the consumer must drain from its callback. A chunk shorter than asked
+ * for marks the end of the object.
+ */
+struct canon_r5_ptp_object_reader {
+	struct canon_r5_device	*dev;
+	u32			object_handle;
+	u64			start;
+	u64			offset;		/* Next byte to request */
+	u64			end;
+	void			*dest;
+	size_t			chunk_size;
+	unsigned int		depth;
+	
+	canon_r5_ptp_chunk_fn	consume;
+	void			*context;
+	
+	/* Result */
+	u64			consumed;	/* Bytes received in order */
+	bool			eof;
+	
+	void			*bounce;
+	struct canon_r5_ptp_reader_chunk chunk[CANON_R5_PTP_READER_MAX_DEPTH];
+};
 
 /* PTP core functions */
 int canon_r5_ptp_init(struct canon_r5_device *dev);
@@ -255,11 +392,31 @@ void canon_r5_ptp_cleanup(struct canon_r5_device *dev);
 int canon_r5_ptp_open_session(struct canon_r5_device *dev);
 int canon_r5_ptp_close_session(struct canon_r5_device *dev);
 
+/* Transaction engine */
+void canon_r5_ptp_transaction_init(struct canon_r5_ptp_transaction *trans, u16 code,
+				   const u32 *params, int param_count);
+int canon_r5_ptp_submit(struct canon_r5_device *dev, struct canon_r5_ptp_transaction *trans);
+int canon_r5_ptp_wait(struct canon_r5_device *dev, struct canon_r5_ptp_transaction *trans,
+		      unsigned int timeout_ms);
+int canon_r5_ptp_cancel(struct canon_r5_device *dev, struct canon_r5_ptp_transaction *trans,
+			int error);
+int canon_r5_ptp_transact(struct canon_r5_device *dev, struct canon_r5_ptp_transaction *trans);
+
+/* Streaming object download */
+void canon_r5_ptp_reader_init(struct canon_r5_ptp_object_reader *reader,
+			      struct canon_r5_device *dev, u32 object_handle,
+			      u64 offset, u64 length, void *dest);
+int canon_r5_ptp_reader_run(struct canon_r5_ptp_object_reader *reader);
+
 /* PTP command functions */
 int canon_r5_ptp_command(struct canon_r5_device *dev, u16 code, 
 			 u32 *params, int param_count,
 			 void *data, int data_len,
 			 u16 *response_code);
+int canon_r5_ptp_command_in(struct canon_r5_device *dev, u16 code,
+			    u32 *params, int param_count,
+			    void *buffer, size_t buffer_len, size_t *actual_len,
+			    u16 *response_code);
 
 int canon_r5_ptp_get_device_info(struct canon_r5_device *dev,
 				struct ptp_device_info *info);
@@ -273,6 +430,18 @@ int canon_r5_ptp_liveview_start(struct canon_r5_device *dev);
 int canon_r5_ptp_liveview_stop(struct canon_r5_device *dev);
 int canon_r5_ptp_get_liveview_frame(struct canon_r5_device *dev,
 				   void **frame_data, size_t *frame_size);
+int canon_r5_ptp_get_liveview_frame_into(struct canon_r5_device *dev,
+					 void *buffer, size_t buffer_len,
+					 struct canon_liveview_header *header,
+					 size_t *frame_size);
+void canon_r5_ptp_liveview_prepare(struct canon_r5_ptp_transaction *trans,
+				   struct kvec vec[2],
+				   struct canon_liveview_header *header,
+				   void *buffer, size_t buffer_len);
+int canon_r5_ptp_liveview_parse(struct canon_r5_device *dev,
+				const struct canon_r5_ptp_transaction *trans,
+				const struct canon_liveview_header *header,
+				void *buffer, size_t *frame_size);
 
 /* Capture functions */
 int canon_r5_ptp_capture_image(struct canon_r5_device *dev);
@@ -285,8 +454,30 @@ int canon_r5_ptp_get_property(struct canon_r5_device *dev, u16 property,
 int canon_r5_ptp_set_property(struct canon_r5_device *dev, u16 property,
 			     void *value, size_t value_size);
 
+/* Property cache (canon-r5-props.c) */
+struct attribute_group;
+extern const struct attribute_group *canon_r5_props_groups[];
+void canon_r5_props_init(struct canon_r5_device *dev);
+void canon_r5_props_start(struct canon_r5_device *dev);
+void canon_r5_props_stop(struct canon_r5_device *dev);
+void canon_r5_props_invalidate(struct canon_r5_device *dev);
+int canon_r5_props_prefetch(struct canon_r5_device *dev);
+void canon_r5_props_refresh_work(struct work_struct *work);
+int canon_r5_props_lookup(struct canon_r5_device *dev, u16 code,
+			  void *value, size_t value_size);
+int canon_r5_props_get(struct canon_r5_device *dev, u16 code, void *value, size_t value_size);
+void canon_r5_props_store(struct canon_r5_device *dev, u16 code,
+			  const void *value, size_t len);
+void canon_r5_props_changed(struct canon_r5_device *dev, u16 code);
+int canon_r5_props_write(struct canon_r5_device *dev, u16 code,
+			 const void *value, size_t len);
+void canon_r5_props_write_begin(struct canon_r5_device *dev);
+int canon_r5_props_write_commit(struct canon_r5_device *dev);
+int canon_r5_props_flush_writes(struct canon_r5_device *dev);
+
 /* Event handling */
 int canon_r5_ptp_check_event(struct canon_r5_device *dev);
+void canon_r5_ptp_event_received(struct canon_r5_device *dev, const void *data, size_t len);
 void canon_r5_ptp_event_handler(struct work_struct *work);
 
 /* Still image capture PTP functions */
@@ -302,5 +493,7 @@ int canon_r5_ptp_bulb_end(struct canon_r5_device *dev);
 int canon_r5_ptp_set_bracketing(struct canon_r5_device *dev, u8 shots, s8 step);
 int canon_r5_ptp_get_battery_info(struct canon_r5_device *dev, u32 *level, u32 *status);
 int canon_r5_ptp_get_captured_image(struct canon_r5_device *dev, u32 object_id, void **data, size_t *size);
+int canon_r5_ptp_get_object_into(struct canon_r5_device *dev, u32 object_handle,
+				 void *buffer, size_t buffer_len, size_t *object_size);
 
 #endif /* __CANON_R5_PTP_H__ */
\ No newline at end of file
@@ -0,0 +1,121 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Canon R5 Linux Driver Suite
+ * Tracepoints for the PTP transaction engine and USB transport
+ *
+ * Copyright (C) 2025 Canon R5 Driver Project
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM canon_r5
+
+#if !defined(__CANON_R5_TRACE_H__) || defined(TRACE_HEADER_MULTI_READ)
+#define __CANON_R5_TRACE_H__
+
+#include <linux/tracepoint.h>
+#include <linux/device.h>
+
+/* A transaction left the queue and its command container is on the wire */
+TRACE_EVENT(canon_r5_ptp_submit,
+	TP_PROTO(struct device *dev, u16 code, u32 trans_id, int nparams, size_t data_out),
+	TP_ARGS(dev, code, trans_id, nparams, data_out),
+	TP_STRUCT__entry(
+		__string(dev, dev_name(dev))
+		__field(u16, code)
+		__field(u32, trans_id)
+		__field(int, nparams)
+		__field(size_t, data_out)
+	),
+	TP_fast_assign(
+		__assign_str(dev);
+		__entry->code = code;
+		__entry->trans_id = trans_id;
+		__entry->nparams = nparams;
+		__entry->data_out = data_out;
+	),
+	TP_printk("%s code=0x%04x trans_id=%u nparams=%d data_out=%zu",
+		  __get_str(dev), __entry->code, __entry->trans_id,
+		  __entry->nparams, __entry->data_out)
+);
+
+/* Start of a data phase; out is host to camera */
+TRACE_EVENT(canon_r5_ptp_data,
+	TP_PROTO(struct device *dev, u16 code, u32 trans_id, bool out, size_t length),
+	TP_ARGS(dev, code, trans_id, out, length),
+	TP_STRUCT__entry(
+		__string(dev, dev_name(dev))
+		__field(u16, code)
+		__field(u32, trans_id)
+		__field(bool, out)
+		__field(size_t, length)
+	),
+	TP_fast_assign(
+		__assign_str(dev);
+		__entry->code = code;
+		__entry->trans_id = trans_id;
+		__entry->out = out;
+		__entry->length = length;
+	),
+	TP_printk("%s code=0x%04x trans_id=%u %s length=%zu",
+		  __get_str(dev), __entry->code, __entry->trans_id,
+		  __entry->out ? "out" : "in", __entry->length)
+);
+
+/* A transaction finished, by response or by error; latency counts from submit */
+TRACE_EVENT(canon_r5_ptp_response,
+	TP_PROTO(struct device *dev, u16 code, u32 trans_id, u16 response, int status,
+		 size_t data_in, u64 latency_us),
+	TP_ARGS(dev, code, trans_id, response, status, data_in, latency_us),
+	TP_STRUCT__entry(
+		__string(dev, dev_name(dev))
+		__field(u16, code)
+		__field(u32, trans_id)
+		__field(u16, response)
+		__field(int, status)
+		__field(size_t, data_in)
+		__field(u64, latency_us)
+	),
+	TP_fast_assign(
+		__assign_str(dev);
+		__entry->code = code;
+		__entry->trans_id = trans_id;
+		__entry->response = response;
+		__entry->status = status;
+		__entry->data_in = data_in;
+		__entry->latency_us = latency_us;
+	),
+	TP_printk("%s code=0x%04x trans_id=%u response=0x%04x status=%d data_in=%zu latency=%lluus",
+		  __get_str(dev), __entry->code, __entry->trans_id, __entry->response,
+		  __entry->status, __entry->data_in, __entry->latency_us)
+);
+
+TRACE_EVENT(canon_r5_urb_complete,
+	TP_PROTO(struct device *dev, u8 endpoint, int status, u32 actual, u32 length),
+	TP_ARGS(dev, endpoint, status, actual, length),
+	TP_STRUCT__entry(
+		__string(dev, dev_name(dev))
+		__field(u8, endpoint)
+		__field(int, status)
+		__field(u32, actual)
+		__field(u32, length)
+	),
+	TP_fast_assign(
+		__assign_str(dev);
+		__entry->endpoint = endpoint;
+		__entry->status = status;
+		__entry->actual = actual;
+		__entry->length = length;
+	),
+	TP_printk("%s ep=0x%02x status=%d actual=%u/%u",
+		  __get_str(dev), __entry->endpoint, __entry->status,
+		  __entry->actual, __entry->length)
+);
+
+#endif /* __CANON_R5_TRACE_H__ */
+
+/* Found through the driver's -I include path */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH core
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE canon-r5-trace
+#include <trace/define_trace.h>
@@ -14,7 +14,13 @@
 #include <linux/spinlock.h>
 #include <linux/workqueue.h>
 #include <linux/kref.h>
+#include <linux/ktime.h>
 #include <linux/idr.h>
+#include <linux/list.h>
+#include <linux/wait.h>
+#include <linux/percpu.h>
+#include <linux/cpumask.h>
+#include <linux/u64_stats_sync.h>
 
 #define CANON_R5_MODULE_NAME		"canon-r5"
 #define CANON_R5_DRIVER_VERSION		"0.1.0"
@@ -49,6 +55,7 @@ struct canon_r5_device;
 struct canon_r5_ptp_command;
 struct canon_r5_event;
 struct canon_r5_usb;
+struct canon_r5_ptp_transaction;
 
 /* Device state */
 enum canon_r5_state {
@@ -63,6 +70,246 @@ enum canon_r5_state {
 struct canon_r5_transport_ops {
 	int (*bulk_send)(struct canon_r5_device *dev, const void *data, size_t len);
 	int (*bulk_receive)(struct canon_r5_device *dev, void *data, size_t len, size_t *actual_len);
+	
+	/*
+	 * Optional asynchronous bulk IN stream. Once started, every completed
+	 * transfer is passed to complete() in order; complete() must not sleep.
+	 * bulk_receive() is unavailable while the stream is running.
+	 */
+	int (*rx_start)(struct canon_r5_device *dev,
+			void (*complete)(struct canon_r5_device *dev, const void *data,
+					 size_t len, int status));
+	void (*rx_stop)(struct canon_r5_device *dev);
+};
+
+/* Decoded PTP event container from the interrupt endpoint */
+struct canon_r5_event {
+	u16			code;
+	u8			nr_params;
+	u32			params[3];
+};
+
+#define CANON_R5_EVENT_RING_SIZE	64	/* Power of two */
+#define CANON_R5_EVENT_BATCH		16
+
+/*
+ * Device property cache. Slots cover PTP_DPC 0x5001-0x5016 followed by
+ * CANON_PTP_DPC 0xD001-0xD01E; values wider than CANON_R5_PROP_VALUE_MAX
+ * are never cached.
+ */
+#define CANON_R5_PROPS_PTP_COUNT	0x16
+#define CANON_R5_PROPS_CANON_COUNT	0x1E
+#define CANON_R5_PROPS_COUNT		(CANON_R5_PROPS_PTP_COUNT + CANON_R5_PROPS_CANON_COUNT)
+#define CANON_R5_PROP_VALUE_MAX		8
+
+enum canon_r5_prop_state {
+	CANON_R5_PROP_UNKNOWN = 0,
+	CANON_R5_PROP_VALID,
+	CANON_R5_PROP_STALE,		/* Change event seen, refresh pending */
+	CANON_R5_PROP_UNCACHED,		/* Unsupported or too wide */
+};
+
+struct canon_r5_prop {
+	u8			state;
+	u8			len;
+	u8			value[CANON_R5_PROP_VALUE_MAX];
+	u32			generation;	/* Bumped by each change event */
+	
+	/* Queued SET_PROPERTY, latest value wins */
+	bool			write_pending;
+	u8			write_len;
+	u8			write_value[CANON_R5_PROP_VALUE_MAX];
+};
+
+struct canon_r5_props {
+	spinlock_t		lock;
+	struct workqueue_struct	*wq;	/* Ordered: refresh and flushes */
+	struct canon_r5_prop	entries[CANON_R5_PROPS_COUNT];
+	struct work_struct	refresh_work;
+	bool			enabled;
+	
+	/* Write combining: slots in first-queued order, under lock */
+	u8			write_order[CANON_R5_PROPS_COUNT];
+	unsigned int		nr_writes;
+	unsigned int		write_holds;	/* Open begin/commit brackets */
+	int			write_error;	/* From the last windowed flush */
+	struct delayed_work	write_work;
+	struct mutex		write_lock;	/* Serializes flushes */
+};
+
+/*
+ * Camera clock recovery: maps capture times in camera microseconds onto
+ * CLOCK_MONOTONIC so video and audio share one timeline.
+ */
+#define CANON_R5_CLOCK_WINDOW		16	/* Observations per estimate */
+
+struct canon_r5_clock {
+	spinlock_t		lock;
+	bool			valid;
+	u64			dev_base_us;	/* Anchor on the camera clock */
+	s64			host_base_ns;	/* ... and on CLOCK_MONOTONIC */
+	s64			drift_ppb;	/* Camera rate error against the host */
+	u64			dev_last_us;	/* Newest camera time, widens 32-bit stamps */
+	
+	/* Least-delayed observation of the current window */
+	unsigned int		nr_obs;
+	u64			win_dev_us;
+	s64			win_host_ns;
+	s64			win_offset_ns;
+	
+	unsigned int		resets;		/* Camera clock discontinuities */
+};
+
+/*
+ * Deferred bring-up after probe. Each step runs on a workqueue once the
+ * steps it requires are done; feature modules register their own.
+ */
+enum canon_r5_bringup_step {
+	CANON_R5_BRINGUP_SESSION = 0,
+	CANON_R5_BRINGUP_DEVICE_INFO,
+	CANON_R5_BRINGUP_PROPERTIES,
+	CANON_R5_BRINGUP_STORAGE,
+	CANON_R5_BRINGUP_VIDEO,
+	CANON_R5_BRINGUP_STILL,
+	CANON_R5_BRINGUP_AUDIO,
+	CANON_R5_BRINGUP_COUNT
+};
+
+struct canon_r5_bringup_ops {
+	int (*run)(struct canon_r5_device *dev);
+	void (*teardown)(struct canon_r5_device *dev);	/* Optional */
+};
+
+struct canon_r5_bringup_step_work {
+	struct work_struct	work;
+	struct canon_r5_device	*dev;
+	enum canon_r5_bringup_step step;
+	u32			duration_us;
+};
+
+struct canon_r5_bringup {
+	spinlock_t		lock;
+	bool			active;
+	bool			settled;	/* Nothing left that can run */
+	unsigned long		queued;		/* Step bits, under lock */
+	unsigned long		done;
+	unsigned long		failed;
+	ktime_t			start;
+	struct canon_r5_bringup_step_work steps[CANON_R5_BRINGUP_COUNT];
+};
+
+/*
+ * Classes of deferred work. Each device normally gets dedicated queues; in
+ * multi-device mode every device shares one unbound queue per class, and
+ * a device pinned to a CPU set shares one per-CPU queue per class instead.
+ */
+enum canon_r5_work_class {
+	CANON_R5_WORK_IO,		/* PTP transfers and events */
+	CANON_R5_WORK_STREAM,		/* Live view and audio capture */
+	CANON_R5_WORK_BULK,		/* Still downloads, card and cache upkeep */
+	CANON_R5_WORK_CLASSES,
+};
+
+struct canon_r5_workers {
+	spinlock_t		lock;
+	cpumask_var_t		cpus;		/* Pinned set, empty when not pinned */
+	bool			pinned;
+	int			last_cpu;	/* Round-robin cursor over cpus */
+	int			node;		/* NUMA node of the USB host controller */
+};
+
+/*
+ * Per-opcode PTP statistics. Opcodes claim a slot on first use and the
+ * last slot collects any beyond that. Counters are per CPU and only summed
+ * when read through debugfs.
+ */
+#define CANON_R5_STATS_OPCODES		32
+#define CANON_R5_STATS_BUCKETS		24	/* log2 microseconds, the last is open */
+
+struct canon_r5_ptp_op_stats {
+	u64			count;
+	u64			errors;		/* Transport failure or non-OK response */
+	u64			bytes_in;
+	u64			bytes_out;
+	u64			latency[CANON_R5_STATS_BUCKETS];
+};
+
+struct canon_r5_stats {
+	u32			codes[CANON_R5_STATS_OPCODES];	/* Under transaction_lock */
+	struct canon_r5_ptp_op_stats __percpu *ops;	/* CANON_R5_STATS_OPCODES each */
+	struct dentry		*debugfs;
+	
+	/* Counter sets registered by the feature drivers */
+	struct mutex		sets_lock;
+	struct list_head	sets;
+	struct kobject		*kobj;		/* stats/ under the device's sysfs_kobj */
+};
+
+/*
+ * Counter sets shared by the feature drivers. Each counter is a per-CPU
+ * u64 updated without locks from any context; readers sum the CPUs under
+ * u64_stats_sync, so a 32-bit host never sees a torn value. A set
+ * registered with a device shows up as stats/<set>/<counter> in sysfs and
+ * in the debugfs "stats" file. Reset folds the current totals into @base
+ * rather than touching another CPU's counters.
+ */
+#define CANON_R5_COUNTER_NAME_LEN	16
+#define CANON_R5_COUNTERS_MAX		32	/* Counters in one set */
+
+struct canon_r5_counters_pcpu {
+	struct u64_stats_sync	syncp;
+	u64_stats_t		val[];
+};
+
+struct canon_r5_counter_attr;
+
+struct canon_r5_counter_set {
+	char			name[CANON_R5_COUNTER_NAME_LEN];
+	const char * const	*names;
+	unsigned int		count;
+	struct canon_r5_counters_pcpu __percpu *pcpu;
+	u64			*base;		/* Totals at the last reset, under base_lock */
+	spinlock_t		base_lock;
+	
+	/* Set while registered with a device */
+	struct canon_r5_device	*dev;
+	struct list_head	list;		/* dev->stats.sets, under sets_lock */
+	struct kobject		*kobj;
+	struct canon_r5_counter_attr *attrs;
+};
+
+/* Safe from any context, including hard interrupts */
+static inline void canon_r5_counter_add(struct canon_r5_counter_set *set,
+					unsigned int idx, u64 val)
+{
+	struct canon_r5_counters_pcpu *c;
+	unsigned long flags;
+	
+	if (unlikely(!set->pcpu))
+		return;
+	
+	c = get_cpu_ptr(set->pcpu);
+	flags = u64_stats_update_begin_irqsave(&c->syncp);
+	u64_stats_add(&c->val[idx], val);
+	u64_stats_update_end_irqrestore(&c->syncp, flags);
+	put_cpu_ptr(set->pcpu);
+}
+
+static inline void canon_r5_counter_inc(struct canon_r5_counter_set *set, unsigned int idx)
+{
+	canon_r5_counter_add(set, idx, 1);
+}
+
+/*
+ * PTP traffic classes, in dispatch priority order. Control always goes
+ * first; real-time and bulk share what is left, with the real-time class
+ * guaranteed its reserved share of the link whenever both are waiting.
+ */
+enum canon_r5_ptp_class {
+	CANON_R5_PTP_CLASS_CONTROL = 0,	/* Capture, focus, properties */
+	CANON_R5_PTP_CLASS_REALTIME,	/* Live view frames and audio */
+	CANON_R5_PTP_CLASS_BULK,	/* Object downloads and enumeration */
+	CANON_R5_PTP_CLASSES
 };
 
 /* PTP session information */
@@ -73,6 +320,35 @@ struct canon_r5_ptp {
 	bool			session_open;
 	struct work_struct	event_work;
 	struct workqueue_struct	*event_wq;
+	
+	/*
+	 * Lock-free SPSC event ring: the interrupt URB completion is the only
+	 * producer (event_head), event_work the only consumer (event_tail).
+	 */
+	struct canon_r5_event	events[CANON_R5_EVENT_RING_SIZE];
+	unsigned int		event_head;
+	unsigned int		event_tail;
+	atomic_t		events_dropped;
+	
+	/* Transaction engine, protected by transaction_lock */
+	struct list_head	tx_queue[CANON_R5_PTP_CLASSES];
+	unsigned int		inflight;
+	unsigned int		bulk_inflight;
+	u64			vtime;		/* Of the last real-time or bulk dispatch */
+	u64			class_vtime[CANON_R5_PTP_CLASSES];
+	ktime_t			drain_deadline;	/* Of the newest abandoned id */
+	struct canon_r5_ptp_transaction *rx_trans;
+	size_t			rx_offset;
+	size_t			rx_remaining;
+	wait_queue_head_t	rx_wait;
+	
+	/* Transfer contexts */
+	struct work_struct	tx_work;
+	struct work_struct	rx_work;
+	struct workqueue_struct	*xfer_wq;
+	void			*tx_buffer;
+	void			*rx_buffer;
+	bool			rx_async;
 };
 
 /* USB transport layer - defined in USB module */
@@ -80,7 +356,9 @@ struct canon_r5_ptp {
 /* Event handling */
 struct canon_r5_event_handler {
 	void (*video_frame_ready)(struct canon_r5_device *dev);
-	void (*still_capture_complete)(struct canon_r5_device *dev);
+	void (*still_capture_complete)(struct canon_r5_device *dev, u32 object_handle);
+	void (*object_changed)(struct canon_r5_device *dev, u16 event_code, u32 object_handle);
+	void (*property_changed)(struct canon_r5_device *dev, u32 property);
 	void (*card_inserted)(struct canon_r5_device *dev, int slot);
 	void (*card_removed)(struct canon_r5_device *dev, int slot);
 	void (*lens_attached)(struct canon_r5_device *dev);
@@ -99,9 +377,15 @@ struct canon_r5_device {
 	
 	/* Transport layer */
 	struct canon_r5_transport_ops *transport_ops;
+	struct device		*dma_dev;	/* DMA-capable ancestor, may be NULL */
 	
 	/* PTP layer */
 	struct canon_r5_ptp	ptp;
+	struct canon_r5_props	props;
+	struct canon_r5_clock	clock;
+	struct canon_r5_bringup	bringup;
+	struct canon_r5_stats	stats;
+	struct canon_r5_workers	workers;
 	
 	/* Device state */
 	enum canon_r5_state	state;
@@ -129,11 +413,12 @@ struct canon_r5_device {
 	char			serial_number[32];
 	char			firmware_version[16];
 	
-	/* Runtime data */
+	/* In-flight PTP transactions, keyed by trans_id */
 	struct idr		transaction_idr;
 	spinlock_t		transaction_lock;
 	
 	/* Sysfs */
+	int			id;		/* canon-r5-<id>, -1 until assigned */
 	struct kobject		*sysfs_kobj;
 };
 
@@ -147,6 +432,7 @@ void canon_r5_device_get(struct canon_r5_device *dev);
 void canon_r5_device_put(struct canon_r5_device *dev);
 int canon_r5_device_initialize(struct canon_r5_device *dev);
 void canon_r5_device_cleanup(struct canon_r5_device *dev);
+void canon_r5_for_each_device(void (*fn)(struct canon_r5_device *dev, void *data), void *data);
 
 /* Transport layer management */
 int canon_r5_register_transport(struct canon_r5_device *dev, struct canon_r5_transport_ops *ops);
@@ -194,6 +480,59 @@ void *canon_r5_get_lens_driver(struct canon_r5_device *dev);
 void *canon_r5_get_display_driver(struct canon_r5_device *dev);
 void *canon_r5_get_wireless_driver(struct canon_r5_device *dev);
 
+/* Deferred bring-up */
+int canon_r5_bringup_module_init(void);
+void canon_r5_bringup_module_exit(void);
+void canon_r5_bringup_init(struct canon_r5_device *dev);
+void canon_r5_bringup_start(struct canon_r5_device *dev);
+void canon_r5_bringup_stop(struct canon_r5_device *dev);
+int canon_r5_bringup_register(enum canon_r5_bringup_step step,
+			      const struct canon_r5_bringup_ops *ops);
+void canon_r5_bringup_unregister(enum canon_r5_bringup_step step);
+
+/* Worker pool */
+int canon_r5_workers_module_init(void);
+void canon_r5_workers_module_exit(void);
+int canon_r5_workers_init(struct canon_r5_device *dev);
+void canon_r5_workers_free(struct canon_r5_device *dev);
+struct workqueue_struct *canon_r5_workqueue_get(struct canon_r5_device *dev,
+						enum canon_r5_work_class cls, const char *name,
+						unsigned int flags, int max_active);
+void canon_r5_workqueue_put(struct canon_r5_device *dev, struct workqueue_struct *wq);
+bool canon_r5_queue_work(struct canon_r5_device *dev, struct workqueue_struct *wq,
+			 struct work_struct *work);
+bool canon_r5_queue_delayed_work(struct canon_r5_device *dev, struct workqueue_struct *wq,
+				 struct delayed_work *dwork, unsigned long delay);
+bool canon_r5_mod_delayed_work(struct canon_r5_device *dev, struct workqueue_struct *wq,
+			       struct delayed_work *dwork, unsigned long delay);
+
+/* Camera clock recovery */
+void canon_r5_clock_init(struct canon_r5_device *dev);
+void canon_r5_clock_reset(struct canon_r5_device *dev);
+ktime_t canon_r5_clock_stamp(struct canon_r5_device *dev, u64 dev_us, ktime_t arrival);
+int canon_r5_clock_to_host(struct canon_r5_device *dev, u64 dev_us, ktime_t *host);
+u64 canon_r5_clock_extend(struct canon_r5_device *dev, u32 stamp);
+
+/* PTP and driver statistics */
+void canon_r5_stats_module_init(void);
+void canon_r5_stats_module_exit(void);
+void canon_r5_stats_init(struct canon_r5_device *dev);
+void canon_r5_stats_free(struct canon_r5_device *dev);
+void canon_r5_stats_record(struct canon_r5_device *dev,
+			   const struct canon_r5_ptp_transaction *trans, u64 us, bool sent);
+u16 canon_r5_stats_read(struct canon_r5_device *dev, unsigned int slot,
+			struct canon_r5_ptp_op_stats *sum);
+u64 canon_r5_stats_percentile(const struct canon_r5_ptp_op_stats *sum, unsigned int pct);
+struct dentry *canon_r5_stats_debugfs_dir(struct canon_r5_device *dev);
+
+/* Feature driver counter sets */
+int canon_r5_counters_register(struct canon_r5_device *dev, struct canon_r5_counter_set *set,
+			       const char *name, const char * const *names, unsigned int count);
+void canon_r5_counters_unregister(struct canon_r5_counter_set *set);
+u64 canon_r5_counter_read(struct canon_r5_counter_set *set, unsigned int idx);
+void canon_r5_counters_read(struct canon_r5_counter_set *set, u64 *vals);
+void canon_r5_counters_reset(struct canon_r5_counter_set *set);
+
 /* Debugging */
 #define canon_r5_dbg(dev, fmt, ...) \
 	dev_dbg((dev)->dev, fmt, ##__VA_ARGS__)
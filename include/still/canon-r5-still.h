@@ -14,14 +14,46 @@
 #include <linux/wait.h>
 #include <linux/completion.h>
 #include <linux/workqueue.h>
+#include <linux/mempool.h>
+#include <linux/miscdevice.h>
+#include <linux/kref.h>
 #include <linux/kfifo.h>
+#include <linux/ioctl.h>
 
 /* Forward declarations */
 struct canon_r5_device;
 struct canon_r5_still_device;
+struct canon_r5_still_downloader;
 
-/* Maximum number of images in capture buffer */
-#define CANON_R5_STILL_MAX_IMAGES	64
+/* Preallocated image buffer pool */
+#define CANON_R5_STILL_POOL_MAX_BUFFERS	16
+#define CANON_R5_STILL_RAW_BUFFER_SIZE	(64 * 1024 * 1024)	/* 45 MP CR3 */
+#define CANON_R5_STILL_LARGE_BUFFER_SIZE (24 * 1024 * 1024)
+#define CANON_R5_STILL_MEDIUM_BUFFER_SIZE (12 * 1024 * 1024)
+#define CANON_R5_STILL_SMALL_BUFFER_SIZE (6 * 1024 * 1024)
+
+/* Object handles reported by transfer-request events, awaiting download */
+#define CANON_R5_STILL_EVENT_QUEUE	32	/* Power of two */
+#define CANON_R5_STILL_EVENT_TIMEOUT_MS	10000
+
+/* Capture pipeline bounds */
+#define CANON_R5_STILL_DOWNLOADERS	2	/* Images downloading at once */
+#define CANON_R5_STILL_SKIP_WINDOW	BITS_PER_LONG	/* Frames numbered ahead of hand-off */
+#define CANON_R5_STILL_MAX_IN_CAMERA	8	/* Default for triggered, not yet announced */
+
+/*
+ * Stages a frame passes through: triggered on the camera, announced by an
+ * OBJECT_ADDED/transfer-request event, downloading into a slot, and ready
+ * in the ring for hand-off. Each stage is bounded, so triggers keep firing
+ * while earlier frames drain at link speed.
+ */
+enum canon_r5_still_stage {
+	CANON_R5_STILL_STAGE_TRIGGERED = 0,
+	CANON_R5_STILL_STAGE_ANNOUNCED,
+	CANON_R5_STILL_STAGE_DOWNLOADING,
+	CANON_R5_STILL_STAGE_READY,
+	CANON_R5_STILL_STAGES
+};
 
 /* Still image formats */
 enum canon_r5_still_format {
@@ -131,10 +163,31 @@ struct canon_r5_image_metadata {
 	u8 color_space;
 };
 
-/* Captured image data */
+/* Image slot lifecycle in the capture ring */
+enum canon_r5_still_slot_state {
+	CANON_R5_STILL_SLOT_FREE = 0,	/* Available for the next capture */
+	CANON_R5_STILL_SLOT_FILLING,	/* GET_OBJECT data phase in progress */
+	CANON_R5_STILL_SLOT_DONE,	/* Downloaded, held until earlier frames are ready */
+	CANON_R5_STILL_SLOT_READY,	/* Complete, waiting to be dequeued */
+	CANON_R5_STILL_SLOT_USER,	/* Dequeued by userspace or a kernel consumer */
+};
+
+/* One preallocated image buffer, mmap'able at index * slot size */
+struct canon_r5_still_slot {
+	void *vaddr;
+	enum canon_r5_still_slot_state state;
+	size_t bytesused;
+	u32 sequence;
+	const void *owner;		/* File that dequeued it, NULL for the kernel */
+	struct canon_r5_image_metadata metadata;
+};
+
+/* Captured image handed to in-kernel consumers, backed by a ring slot */
 struct canon_r5_captured_image {
 	struct list_head list;
 	struct canon_r5_image_metadata metadata;
+	struct canon_r5_still_device *still;	/* Owner, for returning pool memory */
+	unsigned int slot;		/* Ring slot holding the data */
 	
 	void *data;			/* Image data buffer */
 	size_t data_size;		/* Size of image data */
@@ -144,6 +197,17 @@ struct canon_r5_captured_image {
 	atomic_t ref_count;		/* Reference counting */
 };
 
+/* Event counters, kept per CPU in canon_r5_still_device.counters */
+enum canon_r5_still_counter {
+	CANON_R5_STILL_IMAGES_CAPTURED,
+	CANON_R5_STILL_IMAGES_FAILED,
+	CANON_R5_STILL_TOTAL_BYTES,
+	CANON_R5_STILL_AF_OPERATIONS,
+	CANON_R5_STILL_AF_SUCCESS,
+	CANON_R5_STILL_TRIGGER_STALLS,
+	CANON_R5_STILL_COUNTERS
+};
+
 /* Still image capture statistics */
 struct canon_r5_still_stats {
 	u64 images_captured;
@@ -154,6 +218,11 @@ struct canon_r5_still_stats {
 	u32 average_focus_time_ms;
 	u32 average_capture_time_ms;
 	ktime_t last_capture;
+	
+	/* Frames in each pipeline stage when read, and the most seen */
+	u32 stage_depth[CANON_R5_STILL_STAGES];
+	u32 stage_max[CANON_R5_STILL_STAGES];
+	u64 trigger_stalls;		/* Continuous ticks held back by a full stage */
 };
 
 /* Still image device */
@@ -169,24 +238,20 @@ struct canon_r5_still_device {
 	struct canon_r5_image_quality quality;
 	struct canon_r5_capture_settings settings;
 	
-	/* Capture buffer management */
-	struct list_head captured_images;
-	spinlock_t image_list_lock;
-	DECLARE_KFIFO(image_queue, struct canon_r5_captured_image *, CANON_R5_STILL_MAX_IMAGES);
-	
+	/* Woken when a ring slot becomes READY */
 	wait_queue_head_t capture_wait;
 	atomic_t pending_captures;
 	
 	/* Capture processing */
-	struct work_struct capture_work;
 	struct workqueue_struct *capture_wq;
 	
-	/* Continuous shooting */
-	struct timer_list continuous_timer;
+	/* Continuous shooting, triggered from process context */
+	struct delayed_work trigger_work;
 	bool continuous_active;
 	u32 continuous_count;
 	
-	/* Statistics */
+	/* Statistics: counters, plus the gauges and timings in @stats */
+	struct canon_r5_counter_set counters;
 	struct canon_r5_still_stats stats;
 	
 	/* Focus system */
@@ -204,15 +269,76 @@ struct canon_r5_still_device {
 struct canon_r5_still {
 	struct canon_r5_still_device device;
 	
-	/* Memory management */
+	/* Memory management: page-backed image slots sized from the quality setting */
 	struct {
-		void *buffer_pool;
+		struct canon_r5_still_slot slots[CANON_R5_STILL_POOL_MAX_BUFFERS];
+		unsigned int nr_buffers;
 		size_t buffer_size;
-		unsigned long *bitmap;
+		unsigned int nr_free;
+		unsigned int nr_ready;
+		u32 sequence;
 		spinlock_t lock;
+		wait_queue_head_t wait;		/* Woken when a slot becomes FREE */
+		mempool_t *image_pool;		/* struct canon_r5_captured_image */
 	} memory;
+	
+	/* Download stage workers */
+	struct canon_r5_still_downloader *downloaders[CANON_R5_STILL_DOWNLOADERS];
+	
+	/* Filled from the PTP event work, drained by the downloaders */
+	struct {
+		DECLARE_KFIFO(handles, u32, CANON_R5_STILL_EVENT_QUEUE);
+		spinlock_t lock;
+		wait_queue_head_t wait;
+		u32 sequence;			/* Given to the next handle popped */
+	} events;
+	
+	/* Frames between stages; memory.lock covers the hand-off state */
+	struct {
+		atomic_t queued;		/* Triggered, not yet claimed by a downloader */
+		atomic_t in_camera;		/* Triggered, not yet announced */
+		atomic_t downloading;
+		unsigned long skip;		/* Failed frames after memory.sequence */
+	} pipeline;
+	
+	/* Capture ring character device */
+	struct miscdevice miscdev;
+	char name[32];
+	int minor_id;
+	unsigned int users;		/* Open file handles, under device.lock */
+	struct kref ref;		/* Held by the driver and each open file */
+	
+	struct dentry *debugfs;		/* still_stats */
 };
 
+/*
+ * Still capture character device (/dev/canon-r5-stillN)
+ *
+ * Every slot of the ring is mapped read-only with mmap() at offset
+ * index * slot_size. CAPTURE/BURST trigger the shutter, poll() reports
+ * POLLIN while a completed image is waiting, DQBUF returns the oldest one
+ * and QBUF hands its slot back for reuse.
+ */
+struct canon_r5_still_ring_info {
+	__u32 nr_slots;
+	__u32 reserved;
+	__u64 slot_size;
+};
+
+struct canon_r5_still_buffer {
+	__u32 index;
+	__u32 sequence;
+	__u64 bytesused;
+	__u64 timestamp;		/* CLOCK_REALTIME, ns */
+};
+
+#define CANON_R5_STILL_IOC_MAGIC	'R'
+#define CANON_R5_STILL_IOC_QUERYRING	_IOR(CANON_R5_STILL_IOC_MAGIC, 0x01, struct canon_r5_still_ring_info)
+#define CANON_R5_STILL_IOC_DQBUF	_IOR(CANON_R5_STILL_IOC_MAGIC, 0x02, struct canon_r5_still_buffer)
+#define CANON_R5_STILL_IOC_QBUF		_IOW(CANON_R5_STILL_IOC_MAGIC, 0x03, __u32)
+#define CANON_R5_STILL_IOC_CAPTURE	_IO(CANON_R5_STILL_IOC_MAGIC, 0x04)
+#define CANON_R5_STILL_IOC_BURST	_IOW(CANON_R5_STILL_IOC_MAGIC, 0x05, __u32)
+
 /* API functions */
 int canon_r5_still_init(struct canon_r5_device *dev);
 void canon_r5_still_cleanup(struct canon_r5_device *dev);
@@ -251,10 +377,11 @@ void canon_r5_still_reset_stats(struct canon_r5_still_device *still);
 
 /* Internal functions */
 void canon_r5_still_capture_work(struct work_struct *work);
-void canon_r5_still_continuous_timer(struct timer_list *timer);
+void canon_r5_still_trigger_work(struct work_struct *work);
 void canon_r5_still_af_work(struct work_struct *work);
 
 /* Memory management */
+size_t canon_r5_still_buffer_size(const struct canon_r5_image_quality *quality);
 void *canon_r5_still_alloc_image_buffer(struct canon_r5_still_device *still, size_t size);
 void canon_r5_still_free_image_buffer(struct canon_r5_still_device *still, void *buffer);
 
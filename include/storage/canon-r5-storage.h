@@ -86,10 +86,14 @@ struct canon_r5_storage_card {
 	bool needs_format;
 };
 
+/* Upper bound on objects indexed per card */
+#define CANON_R5_STORAGE_INDEX_MAX_OBJECTS	65536
+
 /* File object information */
 struct canon_r5_file_object {
 	struct list_head list;
-	struct rb_node rb_node;
+	struct rb_node rb_node;		/* fs_info->file_tree, by handle */
+	struct rb_node name_node;	/* fs_info->name_tree, by (parent, name) */
 	
 	/* PTP object handle and parent */
 	u32 object_handle;
@@ -117,11 +121,24 @@ struct canon_r5_file_object {
 		char lens_model[64];
 	} metadata;
 	
-	/* Reference counting and caching */
+	/* Reference counting */
 	struct kref ref_count;
-	bool cached;
-	void *cache_data;
-	size_t cache_size;
+};
+
+/* Object data is cached in fixed-size, extent-aligned pieces */
+#define CANON_R5_CACHE_EXTENT_SHIFT	18
+#define CANON_R5_CACHE_EXTENT_SIZE	(1UL << CANON_R5_CACHE_EXTENT_SHIFT)
+
+/* One cached extent; data stays valid while a reference is held */
+struct canon_r5_cache_extent {
+	struct rb_node node;		/* cache.extents, by (handle, index) */
+	struct list_head lru;		/* cache.lru_list, most recent first */
+	struct kref ref;
+	u32 object_handle;
+	u64 index;			/* offset >> CANON_R5_CACHE_EXTENT_SHIFT */
+	size_t len;			/* short only for an object's last extent */
+	unsigned long last_used;	/* jiffies */
+	void *data;
 };
 
 /* Directory entry for filesystem */
@@ -135,17 +152,73 @@ struct canon_r5_dir_entry {
 	bool is_directory;
 };
 
+/*
+ * One record of a GET_FOLDER_INFO data phase.  The phase is a __le32 record
+ * count followed by records, each starting with its own size so that newer
+ * firmware may append fields; the NUL-padded name fills the remainder.
+ */
+struct canon_r5_folder_record {
+	__le32 size;
+	__le32 object_handle;
+	__le32 storage_id;
+	__le16 format;
+	__le16 flags;
+	__le32 object_size;
+	__le32 object_size_high;
+	__le32 mtime;			/* seconds since the epoch */
+	char name[];
+} __packed;
+
+/* Object format of a folder (PTP "association") */
+#define CANON_R5_FOLDER_FORMAT		0x3001
+
+/* Object format of files the camera stores without interpreting */
+#define CANON_R5_UNDEFINED_FORMAT	0x3000
+
+/*
+ * Fixed leading part of the ObjectInfo dataset of SEND/GET_OBJECT_INFO.
+ * The filename follows as a PTP string, then capture date, modification
+ * date and keyword strings, which are left empty when sending.
+ */
+struct canon_r5_object_info {
+	__le32 storage_id;
+	__le16 format;
+	__le16 protection;
+	__le32 size;
+	__le16 thumb_format;
+	__le32 thumb_size;
+	__le32 thumb_width;
+	__le32 thumb_height;
+	__le32 image_width;
+	__le32 image_height;
+	__le32 image_depth;
+	__le32 parent_handle;
+	__le16 association_type;
+	__le32 association_desc;
+	__le32 sequence;
+} __packed;
+
+/* Initial data-phase buffer for one folder; regrown once to the announced size */
+#define CANON_R5_FOLDER_INFO_SIZE	(256 * 1024)
+#define CANON_R5_FOLDER_INFO_MAX_SIZE	(16 * 1024 * 1024)
+
+/* Initial GET_OBJECT_HANDLES listing; regrown once to the index limit when full */
+#define CANON_R5_STORAGE_LIST_HANDLES	256
+
 /* Filesystem superblock data */
 struct canon_r5_fs_info {
 	struct canon_r5_storage_device *storage;
 	struct mutex lock;
+	int slot;
 	
-	/* Root directory */
+	/* Metadata index, one reference held per indexed object */
 	struct rb_root file_tree;
+	struct rb_root name_tree;
 	struct list_head file_list;
 	spinlock_t file_lock;
+	u32 nr_objects;
 	
-	/* Directory cache */
+	/* Index state; valid is cleared when an event could not be applied */
 	struct {
 		struct list_head entries;
 		u32 parent_handle;
@@ -154,26 +227,41 @@ struct canon_r5_fs_info {
 		struct mutex lock;
 	} dir_cache;
 	
-	/* File cache management */
+	/* Extent cache, bounded by max_size bytes */
 	struct {
+		struct rb_root extents;
 		struct list_head lru_list;
+		spinlock_t lock;
 		size_t total_size;
 		size_t max_size;
-		struct work_struct cleanup_work;
-		struct workqueue_struct *cleanup_wq;
+		unsigned long nr_extents;
+		struct work_struct cleanup_work;	/* Runs on the storage background queue */
 	} cache;
 };
 
+/* Event counters, kept per CPU in canon_r5_storage_device.counters */
+enum canon_r5_storage_counter {
+	CANON_R5_STORAGE_FILES_READ,
+	CANON_R5_STORAGE_FILES_WRITTEN,
+	CANON_R5_STORAGE_BYTES_READ,
+	CANON_R5_STORAGE_BYTES_WRITTEN,
+	CANON_R5_STORAGE_CACHE_HITS,
+	CANON_R5_STORAGE_CACHE_MISSES,
+	CANON_R5_STORAGE_PTP_OPERATIONS,
+	CANON_R5_STORAGE_PTP_ERRORS,
+	CANON_R5_STORAGE_COUNTERS
+};
+
 /* Storage device statistics */
 struct canon_r5_storage_stats {
 	u64 files_read;
 	u64 files_written;
 	u64 bytes_read;
 	u64 bytes_written;
-	u32 cache_hits;
-	u32 cache_misses;
-	u32 ptp_operations;
-	u32 ptp_errors;
+	u64 cache_hits;
+	u64 cache_misses;
+	u64 ptp_operations;
+	u64 ptp_errors;
 	ktime_t last_operation;
 	
 	/* Performance metrics */
@@ -203,18 +291,17 @@ struct canon_r5_storage_device {
 	struct {
 		struct mutex lock;
 		struct work_struct refresh_work;
-		struct workqueue_struct *refresh_wq;
 		ktime_t last_refresh;
 	} ptp;
 	
-	/* Statistics */
+	/* Statistics: counters, plus the timings in @stats */
+	struct canon_r5_counter_set counters;
 	struct canon_r5_storage_stats stats;
 	
-	/* Event handling */
+	/* Event handling: slots with a store event not yet applied */
 	struct {
 		struct work_struct card_event_work;
-		int event_card_slot;
-		enum canon_r5_storage_status event_status;
+		unsigned long pending_slots;
 	} events;
 };
 
@@ -239,6 +326,8 @@ struct canon_r5_storage {
 		struct delayed_work sync_work;
 		struct work_struct scan_work;
 	} background;
+	
+	struct dentry *debugfs;		/* storage_stats */
 };
 
 /* API functions */
@@ -250,21 +339,56 @@ int canon_r5_storage_scan_cards(struct canon_r5_storage_device *storage);
 int canon_r5_storage_mount_card(struct canon_r5_storage_device *storage, int slot);
 int canon_r5_storage_unmount_card(struct canon_r5_storage_device *storage, int slot);
 int canon_r5_storage_format_card(struct canon_r5_storage_device *storage, int slot);
+u32 canon_r5_storage_slot_id(int slot);
 
 /* File operations */
 struct canon_r5_file_object *canon_r5_storage_get_file(struct canon_r5_storage_device *storage,
 						       u32 object_handle);
 void canon_r5_storage_put_file(struct canon_r5_file_object *file);
+/* Page-cache fills: the data is cached there, so skip the extent cache */
+#define CANON_R5_STORAGE_STREAM_NOCACHE	BIT(0)
+
 int canon_r5_storage_read_file(struct canon_r5_storage_device *storage,
 			       struct canon_r5_file_object *file,
 			       void *buffer, size_t size, loff_t offset,
-			       size_t *bytes_read);
+			       unsigned int flags, size_t *bytes_read);
+/* Receives file data in offset order as it arrives; non-zero stops the stream */
+typedef int (*canon_r5_storage_stream_fn)(void *context, loff_t offset,
+					  const void *data, size_t len);
+int canon_r5_storage_stream_file(struct canon_r5_storage_device *storage,
+				 struct canon_r5_file_object *file,
+				 loff_t offset, size_t size, unsigned int flags,
+				 canon_r5_storage_stream_fn fn, void *context,
+				 size_t *bytes_read);
+/* Supplies upload data in offset order from the PTP transmit work; must not wait on PTP I/O */
+typedef int (*canon_r5_storage_fill_fn)(void *context, loff_t offset,
+					void *data, size_t len);
+int canon_r5_storage_upload_file(struct canon_r5_storage_device *storage,
+				 u32 storage_id, u32 parent_handle,
+				 const char *filename, u64 size,
+				 canon_r5_storage_fill_fn fn, void *context,
+				 struct canon_r5_file_object **new_file);
 int canon_r5_storage_write_file(struct canon_r5_storage_device *storage,
 				const char *filename, const void *buffer,
 				size_t size, struct canon_r5_file_object **new_file);
 int canon_r5_storage_delete_file(struct canon_r5_storage_device *storage,
 				 struct canon_r5_file_object *file);
 
+/* Metadata index */
+void canon_r5_storage_index_insert(struct canon_r5_fs_info *fs_info,
+				   struct canon_r5_file_object *file);
+void canon_r5_storage_index_remove(struct canon_r5_fs_info *fs_info, u32 object_handle);
+struct canon_r5_file_object *canon_r5_storage_index_lookup(struct canon_r5_fs_info *fs_info,
+							   u32 parent_handle,
+							   const char *name);
+int canon_r5_storage_index_children(struct canon_r5_fs_info *fs_info, u32 parent_handle,
+				    const char *after, loff_t skip,
+				    struct canon_r5_dir_entry *entries, int max_entries);
+int canon_r5_storage_index_build(struct canon_r5_fs_info *fs_info);
+void canon_r5_storage_index_destroy(struct canon_r5_fs_info *fs_info);
+void canon_r5_storage_object_event(struct canon_r5_device *dev, u16 event_code,
+				   u32 object_handle);
+
 /* Directory operations */
 int canon_r5_storage_list_directory(struct canon_r5_storage_device *storage,
 				    u32 parent_handle,
@@ -282,10 +406,16 @@ extern const struct file_operations canon_r5_storage_file_ops;
 extern const struct address_space_operations canon_r5_storage_aops;
 
 /* Cache management */
-int canon_r5_storage_cache_file(struct canon_r5_storage_device *storage,
-			       struct canon_r5_file_object *file);
-void canon_r5_storage_cache_cleanup(struct canon_r5_storage_device *storage);
-void canon_r5_storage_cache_invalidate(struct canon_r5_storage_device *storage);
+void canon_r5_storage_cache_init(struct canon_r5_fs_info *fs_info, size_t max_size);
+struct canon_r5_cache_extent *canon_r5_storage_cache_lookup(struct canon_r5_fs_info *fs_info,
+							    u32 object_handle, u64 index);
+int canon_r5_storage_cache_insert(struct canon_r5_fs_info *fs_info, u32 object_handle,
+				  u64 index, const void *data, size_t len);
+void canon_r5_storage_cache_put(struct canon_r5_cache_extent *extent);
+unsigned long canon_r5_storage_cache_shrink(struct canon_r5_fs_info *fs_info,
+					    unsigned long nr_to_scan);
+void canon_r5_storage_cache_invalidate(struct canon_r5_fs_info *fs_info, u32 object_handle);
+void canon_r5_storage_cache_cleanup(struct canon_r5_fs_info *fs_info);
 
 /* Statistics */
 int canon_r5_storage_get_stats(struct canon_r5_storage_device *storage,
@@ -295,6 +425,8 @@ void canon_r5_storage_reset_stats(struct canon_r5_storage_device *storage);
 /* Internal functions */
 void canon_r5_storage_refresh_work(struct work_struct *work);
 void canon_r5_storage_card_event_work(struct work_struct *work);
+void canon_r5_storage_card_inserted(struct canon_r5_device *dev, int slot);
+void canon_r5_storage_card_removed(struct canon_r5_device *dev, int slot);
 void canon_r5_storage_cache_cleanup_work(struct work_struct *work);
 void canon_r5_storage_sync_work(struct work_struct *work);
 
@@ -306,12 +438,16 @@ int canon_r5_ptp_get_object_handles(struct canon_r5_device *dev, u32 storage_id,
 				    u32 parent_handle, u32 *handles, int max_handles);
 int canon_r5_ptp_get_object_info(struct canon_r5_device *dev, u32 object_handle,
 				 struct canon_r5_file_object *info);
+int canon_r5_ptp_get_folder_entries(struct canon_r5_device *dev, u32 storage_id,
+				    u32 parent_handle, struct list_head *entries);
 int canon_r5_ptp_get_object_data(struct canon_r5_device *dev, u32 object_handle,
 				 void *buffer, size_t size, size_t offset,
 				 size_t *bytes_read);
-int canon_r5_ptp_send_object_data(struct canon_r5_device *dev, const char *filename,
-				  const void *buffer, size_t size, u32 parent_handle,
+int canon_r5_ptp_send_object_info(struct canon_r5_device *dev, u32 storage_id,
+				  u32 parent_handle, const char *filename, u32 size,
 				  u32 *new_handle);
+int canon_r5_ptp_send_object(struct canon_r5_device *dev, u32 size,
+			     canon_r5_ptp_fill_fn fill, void *context);
 int canon_r5_ptp_delete_object(struct canon_r5_device *dev, u32 object_handle);
 int canon_r5_ptp_format_storage(struct canon_r5_device *dev, u32 storage_id);
 
@@ -13,6 +13,9 @@
 #include <linux/mutex.h>
 #include <linux/spinlock.h>
 #include <linux/workqueue.h>
+#include <linux/wait.h>
+#include <linux/uio.h>
+#include <linux/refcount.h>
 #include <media/v4l2-dev.h>
 #include <media/v4l2-device.h>
 #include <media/v4l2-ctrls.h>
@@ -68,6 +71,31 @@ struct canon_r5_video_buffer {
 	size_t			size;
 };
 
+/* Live view frame shared between streaming nodes */
+struct canon_r5_video_frame {
+	refcount_t		ref;
+	struct list_head	list;		/* on free_frames while unreferenced */
+	void			*data;
+	size_t			size;
+	size_t			len;
+	u32			width;		/* as reported by the camera, 0 if not */
+	u32			height;
+	ktime_t			request_time;
+	ktime_t			timestamp;
+};
+
+/* Camera live view magnifications, CANON_PTP_DPC_DZ_MAG */
+#define CANON_R5_VIDEO_ZOOM_NONE	1
+#define CANON_R5_VIDEO_ZOOM_5X		5
+#define CANON_R5_VIDEO_ZOOM_10X		10
+
+/* Smallest crop, and the largest decimation of an uncompressed crop */
+#define CANON_R5_VIDEO_CROP_MIN		32
+#define CANON_R5_VIDEO_DECIMATION_MAX	4
+
+/* One frame in flight, plus a pending and an in-copy frame per consumer */
+#define CANON_R5_VIDEO_POOL_FRAMES	(2 * CANON_R5_MAX_VIDEO_DEVICES + 1)
+
 /* Video streaming context */
 struct canon_r5_video_stream {
 	struct vb2_queue		queue;
@@ -79,14 +107,50 @@ struct canon_r5_video_stream {
 	struct canon_r5_video_resolution *resolution;
 	enum canon_r5_streaming_state	state;
 	
+	/* Selection in live view frame pixels; compose is the delivered image */
+	struct v4l2_rect		bounds;
+	struct v4l2_rect		crop;
+	struct v4l2_rect		compose;
+	unsigned int			decimation;	/* compose = crop / decimation */
+	bool				cropping;	/* compose differs from bounds */
+	u32				zoom;		/* camera zoom covering the crop */
+	struct v4l2_rect		zoom_window;	/* what the camera sends then */
+	bool				zoomed;		/* camera confirmed zoom, buf_lock */
+	
 	/* Frame handling */
-	struct work_struct		frame_work;
+	struct delayed_work		frame_work;	/* retry after backoff */
 	struct workqueue_struct		*frame_wq;
 	
+	/* Live view scheduler: one GET_LIVEVIEW outstanding, protected by buf_lock */
+	struct canon_r5_ptp_transaction	lv_trans;
+	struct kvec			lv_vec[2];
+	struct canon_liveview_header	lv_header;
+	struct canon_r5_video_buffer	*lv_buf;
+	ktime_t				lv_request_time;
+	unsigned int			lv_backoff_us;
+	wait_queue_head_t		lv_wait;
+	
+	/* A received frame waiting for crop_work; lv_buf stays claimed meanwhile */
+	struct work_struct		crop_work;
+	size_t				lv_size;
+	bool				lv_zoomed;
+	ktime_t				lv_arrival;
+	
+	/* Fan-out consumer state */
+	bool				attached;	/* fanout_lock */
+	bool				shared;		/* fed by the shared producer, buf_lock */
+	bool				fanout;		/* producer_lock */
+	struct canon_r5_video_frame	*pending;	/* producer_lock */
+	struct work_struct		deliver_work;
+	
 	/* Statistics */
-	u64				frame_count;
-	u64				dropped_frames;
+	u64				frame_count;	/* Sequence of the next buffer */
+	struct canon_r5_counter_set	counters;	/* enum canon_r5_video_counter */
 	ktime_t				last_frame_time;
+	u64				frame_interval_ns;	/* EWMA of camera cadence */
+	u64				latency_last_ns;	/* request to buffer done */
+	u64				latency_avg_ns;
+	u64				latency_max_ns;
 };
 
 /* Video device context */
@@ -123,14 +187,36 @@ struct canon_r5_video {
 	struct canon_r5_video_device	devices[CANON_R5_MAX_VIDEO_DEVICES];
 	int				num_devices;
 	
+	struct canon_r5_device		*canon_dev;
+	atomic_t			open_count;
+	
 	/* Live view state */
 	bool				live_view_active;
+	unsigned int			live_view_users;
 	struct mutex			live_view_lock;
 	
 	/* Frame processing */
-	struct work_struct		frame_processor_work;
 	struct workqueue_struct		*frame_processor_wq;
-	struct timer_list		frame_timer;
+	
+	/* Shared frame producer, active while more than one node streams */
+	struct mutex			fanout_lock;
+	unsigned int			streaming;
+	spinlock_t			producer_lock;
+	bool				producer_running;
+	struct canon_r5_video_frame	frames[CANON_R5_VIDEO_POOL_FRAMES];
+	struct list_head		free_frames;	/* producer_lock */
+	struct canon_r5_video_frame	*producer_frame;
+	struct canon_r5_ptp_transaction	producer_trans;
+	struct kvec			producer_vec[2];
+	struct canon_liveview_header	producer_header;
+	struct delayed_work		producer_work;
+	wait_queue_head_t		producer_wait;
+	unsigned int			producer_backoff_us;
+	u64				producer_interval_ns;
+	ktime_t				producer_last;
+	u32				zoom;		/* set on the camera, 0 if unknown; fanout_lock */
+	
+	struct dentry			*debugfs;	/* video_stats */
 };
 
 /* Format definitions */
@@ -160,6 +246,13 @@ int canon_r5_video_queue_frame(struct canon_r5_video_device *vdev,
 			       const void *frame_data, size_t frame_size);
 void canon_r5_video_frame_done(struct canon_r5_video_device *vdev);
 void canon_r5_video_frame_work(struct work_struct *work);
+void canon_r5_video_request_frame(struct canon_r5_video_device *vdev);
+void canon_r5_video_cancel_frame(struct canon_r5_video_device *vdev);
+int canon_r5_video_stream_attach(struct canon_r5_video_device *vdev);
+void canon_r5_video_stream_detach(struct canon_r5_video_device *vdev);
+ssize_t canon_r5_video_crop_frame(const struct canon_r5_video_stream *stream,
+				  const struct v4l2_rect *window,
+				  void *dst, const void *src, size_t len);
 
 /* Live view control */
 int canon_r5_video_start_live_view(struct canon_r5_device *dev);
@@ -180,6 +273,14 @@ extern const struct vb2_ops canon_r5_video_vb2_ops;
 struct canon_r5_video_format *canon_r5_video_find_format(u32 fourcc);
 struct canon_r5_video_resolution *canon_r5_video_find_resolution(u32 width, u32 height);
 const char *canon_r5_video_type_name(enum canon_r5_video_type type);
+void canon_r5_video_fill_pix(const struct canon_r5_video_format *fmt,
+			     struct v4l2_pix_format *pix);
+size_t canon_r5_video_plane_size(const struct canon_r5_video_device *vdev);
+
+/* Region of interest */
+void canon_r5_video_selection_reset(struct canon_r5_video_device *vdev);
+void canon_r5_video_set_crop(struct canon_r5_video_device *vdev, struct v4l2_rect *r);
+void canon_r5_video_set_compose(struct canon_r5_video_device *vdev, struct v4l2_rect *r);
 
 /* Buffer helpers */
 static inline struct canon_r5_video_buffer *
@@ -218,6 +319,14 @@ extern const struct canon_r5_video_ctrl canon_r5_video_controls[];
 extern const int canon_r5_video_num_controls;
 
 /* Statistics and debugging */
+enum canon_r5_video_counter {
+	CANON_R5_VIDEO_FRAMES,
+	CANON_R5_VIDEO_DROPPED,
+	CANON_R5_VIDEO_ERRORS,
+	CANON_R5_VIDEO_BYTES,
+	CANON_R5_VIDEO_COUNTERS
+};
+
 struct canon_r5_video_stats {
 	u64	frames_captured;
 	u64	frames_dropped;
@@ -225,6 +334,9 @@ struct canon_r5_video_stats {
 	u64	errors;
 	u32	current_fps;
 	ktime_t	last_frame;
+	u64	latency_last_ns;
+	u64	latency_avg_ns;
+	u64	latency_max_ns;
 };
 
 int canon_r5_video_get_stats(struct canon_r5_video_device *vdev,
@@ -7,14 +7,20 @@
  */
 
 #include <kunit/test.h>
+#include <linux/delay.h>
+#include <linux/fs.h>
 #include <linux/platform_device.h>
+#include <linux/preempt.h>
 #include <linux/slab.h>
 #include <sound/core.h>
 #include <sound/pcm.h>
+#include <sound/pcm_params.h>
 #include <sound/control.h>
 
 #include "audio/canon-r5-audio.h"
 #include "core/canon-r5.h"
+#include "core/canon-r5-ptp.h"
+#include "canon-r5-mock-transport.h"
 
 /**
  * Test context structure for audio tests
@@ -279,30 +285,40 @@ static void canon_r5_audio_buffer_test(struct kunit *test)
 /* Test audio statistics */
 static void canon_r5_audio_stats_test(struct kunit *test)
 {
+	static const char * const names[CANON_R5_AUDIO_COUNTERS] = {
+		"frames_captured", "frames_dropped", "total_bytes",
+		"buffer_overruns", "buffer_underruns",
+	};
 	struct canon_r5_audio_test_ctx *ctx = test->priv;
+	struct canon_r5_counter_set *counters = &ctx->audio_dev->counters;
 	struct canon_r5_audio_stats stats;
+	int ret;
+
+	ret = canon_r5_counters_register(NULL, counters, "audio", names,
+					 CANON_R5_AUDIO_COUNTERS);
+	KUNIT_ASSERT_EQ(test, ret, 0);
 
 	/* Initialize test statistics */
 	memset(&ctx->audio_dev->stats, 0, sizeof(ctx->audio_dev->stats));
-	ctx->audio_dev->stats.frames_captured = 10000;
-	ctx->audio_dev->stats.frames_dropped = 50;
-	ctx->audio_dev->stats.total_bytes = 1024 * 1024; /* 1MB */
-	ctx->audio_dev->stats.underruns = 2;
-	ctx->audio_dev->stats.overruns = 1;
-	ctx->audio_dev->stats.current_sample_rate = 96000;
+	canon_r5_counter_add(counters, CANON_R5_AUDIO_FRAMES_CAPTURED, 10000);
+	canon_r5_counter_add(counters, CANON_R5_AUDIO_FRAMES_DROPPED, 50);
+	canon_r5_counter_add(counters, CANON_R5_AUDIO_TOTAL_BYTES, 1024 * 1024); /* 1MB */
+	canon_r5_counter_add(counters, CANON_R5_AUDIO_BUFFER_UNDERRUNS, 2);
+	canon_r5_counter_inc(counters, CANON_R5_AUDIO_BUFFER_OVERRUNS);
+	ctx->audio_dev->stats.peak_level_left = 96000;
 
 	/* Get statistics */
 	memset(&stats, 0, sizeof(stats));
-	int ret = canon_r5_audio_get_stats(ctx->audio_dev, &stats);
+	ret = canon_r5_audio_get_stats(ctx->audio_dev, &stats);
 
 	/* Verify statistics retrieval */
 	KUNIT_EXPECT_EQ(test, ret, 0);
 	KUNIT_EXPECT_EQ(test, stats.frames_captured, 10000);
 	KUNIT_EXPECT_EQ(test, stats.frames_dropped, 50);
 	KUNIT_EXPECT_EQ(test, stats.total_bytes, 1024 * 1024);
-	KUNIT_EXPECT_EQ(test, stats.underruns, 2);
-	KUNIT_EXPECT_EQ(test, stats.overruns, 1);
-	KUNIT_EXPECT_EQ(test, stats.current_sample_rate, 96000);
+	KUNIT_EXPECT_EQ(test, stats.buffer_underruns, 2);
+	KUNIT_EXPECT_EQ(test, stats.buffer_overruns, 1);
+	KUNIT_EXPECT_EQ(test, stats.peak_level_left, 96000);
 
 	/* Test statistics reset */
 	canon_r5_audio_reset_stats(ctx->audio_dev);
@@ -311,8 +327,15 @@ static void canon_r5_audio_stats_test(struct kunit *test)
 	KUNIT_EXPECT_EQ(test, stats.frames_captured, 0);
 	KUNIT_EXPECT_EQ(test, stats.frames_dropped, 0);
 	KUNIT_EXPECT_EQ(test, stats.total_bytes, 0);
-	KUNIT_EXPECT_EQ(test, stats.underruns, 0);
-	KUNIT_EXPECT_EQ(test, stats.overruns, 0);
+	KUNIT_EXPECT_EQ(test, stats.buffer_underruns, 0);
+	KUNIT_EXPECT_EQ(test, stats.buffer_overruns, 0);
+	KUNIT_EXPECT_EQ(test, stats.peak_level_left, 0);
+
+	/* Counting resumes from the reset point */
+	canon_r5_counter_add(counters, CANON_R5_AUDIO_TOTAL_BYTES, 4096);
+	KUNIT_EXPECT_EQ(test, canon_r5_counter_read(counters, CANON_R5_AUDIO_TOTAL_BYTES), 4096);
+
+	canon_r5_counters_unregister(counters);
 }
 
 /* Test audio format name conversion */
@@ -400,6 +423,65 @@ static void canon_r5_audio_buffer_list_test(struct kunit *test)
 	KUNIT_EXPECT_TRUE(test, list_empty(buf_list));
 }
 
+/* Size-class pool: allocation, fallback to a larger class, watermark, free */
+static void canon_r5_audio_pool_test(struct kunit *test)
+{
+	struct canon_r5_audio_pool_class *small, *medium;
+	struct canon_r5_audio *priv;
+	void *bufs[64], *spill;
+	unsigned int i;
+
+	priv = kunit_kzalloc(test, sizeof(*priv), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, priv);
+	KUNIT_ASSERT_EQ(test, canon_r5_audio_pool_init(priv), 0);
+
+	small = &priv->memory.classes[0];
+	medium = &priv->memory.classes[1];
+	KUNIT_ASSERT_EQ(test, small->nr_objs, ARRAY_SIZE(bufs));
+
+	/* Magazines are per CPU: stay on one so the small class drains exactly */
+	migrate_disable();
+
+	for (i = 0; i < ARRAY_SIZE(bufs); i++) {
+		bufs[i] = canon_r5_audio_alloc_buffer(&priv->device, 512);
+		KUNIT_EXPECT_TRUE(test, bufs[i] >= small->base &&
+				  bufs[i] < small->base + small->size * small->nr_objs);
+	}
+	KUNIT_EXPECT_EQ(test, atomic_read(&small->in_use), 64);
+	KUNIT_EXPECT_EQ(test, atomic_read(&small->high_watermark), 64);
+	KUNIT_EXPECT_EQ(test, atomic_read(&small->failures), 0);
+
+	/* The small class is dry, so the next request spills into 4K */
+	spill = canon_r5_audio_alloc_buffer(&priv->device, 512);
+	KUNIT_EXPECT_TRUE(test, spill >= medium->base &&
+			  spill < medium->base + medium->size * medium->nr_objs);
+	KUNIT_EXPECT_EQ(test, atomic_read(&small->failures), 1);
+	KUNIT_EXPECT_EQ(test, atomic_read(&medium->in_use), 1);
+
+	/* Larger than every class */
+	KUNIT_EXPECT_NULL(test, canon_r5_audio_alloc_buffer(&priv->device, 32768));
+
+	canon_r5_audio_free_buffer(&priv->device, spill);
+	for (i = 0; i < ARRAY_SIZE(bufs); i++)
+		canon_r5_audio_free_buffer(&priv->device, bufs[i]);
+
+	/* Freed buffers come straight back from this CPU's magazine */
+	bufs[0] = canon_r5_audio_alloc_buffer(&priv->device, 1024);
+	KUNIT_EXPECT_TRUE(test, bufs[0] >= small->base &&
+			  bufs[0] < small->base + small->size * small->nr_objs);
+	canon_r5_audio_free_buffer(&priv->device, bufs[0]);
+
+	migrate_enable();
+
+	/* The watermark keeps the peak after everything is returned */
+	KUNIT_EXPECT_EQ(test, atomic_read(&small->in_use), 0);
+	KUNIT_EXPECT_EQ(test, atomic_read(&medium->in_use), 0);
+	KUNIT_EXPECT_EQ(test, atomic_read(&small->high_watermark), 64);
+	KUNIT_EXPECT_EQ(test, atomic_read(&medium->high_watermark), 1);
+
+	canon_r5_audio_pool_destroy(priv);
+}
+
 /* KUnit test suite definition */
 static struct kunit_case canon_r5_audio_test_cases[] = {
 	KUNIT_CASE(canon_r5_audio_format_validation_test),
@@ -416,6 +498,7 @@ static struct kunit_case canon_r5_audio_test_cases[] = {
 	KUNIT_CASE(canon_r5_audio_channels_names_test),
 	KUNIT_CASE(canon_r5_audio_volume_test),
 	KUNIT_CASE(canon_r5_audio_buffer_list_test),
+	KUNIT_CASE(canon_r5_audio_pool_test),
 	{}
 };
 
@@ -426,7 +509,223 @@ static struct kunit_suite canon_r5_audio_test_suite = {
 	.test_cases = canon_r5_audio_test_cases,
 };
 
-kunit_test_suite(canon_r5_audio_test_suite);
+/*
+ * Capture against the mock camera: START_RECORDING names the sound object,
+ * partial reads of it land in the ring and move the pointer, and once the
+ * object stops growing the bounded retries end the stream in an xrun.
+ */
+#define CANON_R5_AUDIO_TEST_HANDLE	0x00020001
+#define CANON_R5_AUDIO_TEST_OFFSET	44	/* WAV header before the samples */
+#define CANON_R5_AUDIO_TEST_FRAME	4	/* S16_LE stereo */
+#define CANON_R5_AUDIO_TEST_PERIOD	256	/* Frames */
+#define CANON_R5_AUDIO_TEST_PERIODS	4
+#define CANON_R5_AUDIO_TEST_RECORDED	(2 * CANON_R5_AUDIO_TEST_PERIOD)
+#define CANON_R5_AUDIO_TEST_WAIT_MS	2000
+
+struct canon_r5_audio_capture_ctx {
+	struct platform_device *pdev;
+	struct canon_r5_device *dev;
+	struct canon_r5_mock *mock;
+	bool initialized;
+	bool audio;
+};
+
+static int canon_r5_audio_capture_init(struct kunit *test)
+{
+	struct canon_r5_audio_capture_ctx *ctx;
+
+	ctx = kunit_kzalloc(test, sizeof(*ctx), GFP_KERNEL);
+	if (!ctx)
+		return -ENOMEM;
+
+	ctx->pdev = platform_device_alloc("canon-r5-audio-capture-test", 0);
+	if (!ctx->pdev)
+		return -ENOMEM;
+
+	if (platform_device_add(ctx->pdev)) {
+		platform_device_put(ctx->pdev);
+		return -ENODEV;
+	}
+
+	test->priv = ctx;
+	return 0;
+}
+
+static void canon_r5_audio_capture_exit(struct kunit *test)
+{
+	struct canon_r5_audio_capture_ctx *ctx = test->priv;
+
+	if (!ctx)
+		return;
+
+	if (ctx->audio)
+		canon_r5_audio_cleanup(ctx->dev);
+	if (ctx->initialized)
+		canon_r5_device_cleanup(ctx->dev);
+	if (!IS_ERR_OR_NULL(ctx->mock))
+		canon_r5_mock_destroy(ctx->mock);
+	if (ctx->dev)
+		canon_r5_device_put(ctx->dev);
+	platform_device_unregister(ctx->pdev);
+}
+
+static void canon_r5_audio_test_mask(struct snd_pcm_hw_params *params,
+				     snd_pcm_hw_param_t var, unsigned int val)
+{
+	struct snd_mask *mask = hw_param_mask(params, var);
+
+	snd_mask_none(mask);
+	snd_mask_set(mask, val);
+}
+
+static void canon_r5_audio_test_interval(struct snd_pcm_hw_params *params,
+					 snd_pcm_hw_param_t var, unsigned int val)
+{
+	struct snd_interval *interval = hw_param_interval(params, var);
+
+	interval->min = val;
+	interval->max = val;
+	interval->openmin = 0;
+	interval->openmax = 0;
+	interval->integer = 1;
+	interval->empty = 0;
+}
+
+/* Poll the stream until @done holds or the wait runs out */
+#define canon_r5_audio_test_wait(done)						\
+	({									\
+		unsigned int __ms = 0;						\
+										\
+		while (!(done) && __ms < CANON_R5_AUDIO_TEST_WAIT_MS) {		\
+			msleep(5);						\
+			__ms += 5;						\
+		}								\
+		(done);								\
+	})
+
+static void canon_r5_audio_capture_test(struct kunit *test)
+{
+	struct canon_r5_audio_capture_ctx *ctx = test->priv;
+	struct canon_r5_mock_config config = {
+		.latency_us = 100,
+		.async = true,
+	};
+	size_t recorded = CANON_R5_AUDIO_TEST_RECORDED * CANON_R5_AUDIO_TEST_FRAME;
+	struct canon_r5_mock_exchange session[] = {
+		{ .code = CANON_PTP_OP_AUDIO_START, .params = { CANON_R5_AUDIO_TEST_HANDLE,
+							       CANON_R5_AUDIO_TEST_OFFSET },
+		  .param_count = 2 },
+		{ .code = CANON_PTP_OP_GET_PARTIAL_OBJECT },
+		{ .code = CANON_PTP_OP_AUDIO_STOP },
+	};
+	struct canon_r5_audio_device *audio;
+	struct snd_pcm_substream *substream;
+	struct snd_pcm_hw_params *params;
+	struct snd_pcm_runtime *runtime;
+	struct canon_r5_audio_stats stats;
+	struct file *file;
+	u8 *object;
+	size_t i;
+	int ret;
+
+	object = kunit_kzalloc(test, CANON_R5_AUDIO_TEST_OFFSET + recorded, GFP_KERNEL);
+	params = kunit_kzalloc(test, sizeof(*params), GFP_KERNEL);
+	file = kunit_kzalloc(test, sizeof(*file), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, object);
+	KUNIT_ASSERT_NOT_NULL(test, params);
+	KUNIT_ASSERT_NOT_NULL(test, file);
+
+	for (i = 0; i < recorded; i++)
+		object[CANON_R5_AUDIO_TEST_OFFSET + i] = i * 7 + 1;
+	session[1].data = object;
+	session[1].data_len = CANON_R5_AUDIO_TEST_OFFSET + recorded;
+
+	ctx->dev = canon_r5_device_alloc(&ctx->pdev->dev);
+	KUNIT_ASSERT_NOT_NULL(test, ctx->dev);
+
+	ctx->mock = canon_r5_mock_create(ctx->dev, &config);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, ctx->mock);
+
+	KUNIT_ASSERT_EQ(test, canon_r5_device_initialize(ctx->dev), 0);
+	ctx->initialized = true;
+	KUNIT_ASSERT_EQ(test, canon_r5_ptp_open_session(ctx->dev), 0);
+	flush_work(&ctx->dev->props.refresh_work);
+
+	canon_r5_mock_load(ctx->mock, session, ARRAY_SIZE(session), false);
+
+	KUNIT_ASSERT_EQ(test, canon_r5_audio_init(ctx->dev), 0);
+	ctx->audio = true;
+	audio = canon_r5_get_audio_driver(ctx->dev);
+	KUNIT_ASSERT_NOT_NULL(test, audio);
+
+	mutex_lock(&audio->pcm->open_mutex);
+	ret = snd_pcm_open_substream(audio->pcm, SNDRV_PCM_STREAM_CAPTURE, file, &substream);
+	mutex_unlock(&audio->pcm->open_mutex);
+	KUNIT_ASSERT_EQ(test, ret, 0);
+	runtime = substream->runtime;
+
+	_snd_pcm_hw_params_any(params);
+	canon_r5_audio_test_mask(params, SNDRV_PCM_HW_PARAM_ACCESS,
+				 (__force unsigned int)SNDRV_PCM_ACCESS_RW_INTERLEAVED);
+	canon_r5_audio_test_mask(params, SNDRV_PCM_HW_PARAM_FORMAT,
+				 (__force unsigned int)SNDRV_PCM_FORMAT_S16_LE);
+	canon_r5_audio_test_interval(params, SNDRV_PCM_HW_PARAM_CHANNELS, 2);
+	canon_r5_audio_test_interval(params, SNDRV_PCM_HW_PARAM_RATE, 48000);
+	canon_r5_audio_test_interval(params, SNDRV_PCM_HW_PARAM_PERIOD_SIZE,
+				     CANON_R5_AUDIO_TEST_PERIOD);
+	canon_r5_audio_test_interval(params, SNDRV_PCM_HW_PARAM_PERIODS,
+				     CANON_R5_AUDIO_TEST_PERIODS);
+
+	ret = snd_pcm_kernel_ioctl(substream, SNDRV_PCM_IOCTL_HW_PARAMS, params);
+	KUNIT_EXPECT_EQ(test, ret, 0);
+	if (!ret)
+		ret = snd_pcm_kernel_ioctl(substream, SNDRV_PCM_IOCTL_PREPARE, NULL);
+	KUNIT_EXPECT_EQ(test, ret, 0);
+	if (!ret)
+		ret = snd_pcm_kernel_ioctl(substream, SNDRV_PCM_IOCTL_START, NULL);
+	KUNIT_EXPECT_EQ(test, ret, 0);
+	if (ret)
+		goto release;
+
+	/* Both recorded periods arrive and are reported as they complete */
+	KUNIT_EXPECT_TRUE(test, canon_r5_audio_test_wait(READ_ONCE(runtime->status->hw_ptr) >=
+							  CANON_R5_AUDIO_TEST_RECORDED));
+	KUNIT_EXPECT_EQ(test, substream->ops->pointer(substream),
+			(snd_pcm_uframes_t)CANON_R5_AUDIO_TEST_RECORDED);
+	KUNIT_EXPECT_EQ(test, memcmp(runtime->dma_area, object + CANON_R5_AUDIO_TEST_OFFSET,
+				     recorded), 0);
+
+	/* The object stops growing: the stream gives up instead of polling forever */
+	KUNIT_EXPECT_TRUE(test, canon_r5_audio_test_wait(READ_ONCE(runtime->status->state) ==
+							  SNDRV_PCM_STATE_XRUN));
+
+	canon_r5_audio_get_stats(audio, &stats);
+	KUNIT_EXPECT_EQ(test, stats.frames_captured, (u64)CANON_R5_AUDIO_TEST_RECORDED);
+	KUNIT_EXPECT_EQ(test, stats.buffer_underruns, 1U);
+	KUNIT_EXPECT_EQ(test, stats.buffer_overruns, 0U);
+
+release:
+	mutex_lock(&audio->pcm->open_mutex);
+	snd_pcm_release_substream(substream);
+	mutex_unlock(&audio->pcm->open_mutex);
+
+	/* The session lives on this stack */
+	canon_r5_mock_load(ctx->mock, NULL, 0, false);
+}
+
+static struct kunit_case canon_r5_audio_capture_test_cases[] = {
+	KUNIT_CASE(canon_r5_audio_capture_test),
+	{}
+};
+
+static struct kunit_suite canon_r5_audio_capture_test_suite = {
+	.name = "canon_r5_audio_capture",
+	.init = canon_r5_audio_capture_init,
+	.exit = canon_r5_audio_capture_exit,
+	.test_cases = canon_r5_audio_capture_test_cases,
+};
+
+kunit_test_suites(&canon_r5_audio_test_suite, &canon_r5_audio_capture_test_suite);
 
 MODULE_DESCRIPTION("Canon R5 Audio Driver Unit Tests");
 MODULE_AUTHOR("Canon R5 Driver Project");
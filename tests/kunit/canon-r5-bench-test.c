@@ -0,0 +1,667 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Canon R5 Data Path KUnit Benchmarks
+ *
+ * Drives the PTP engine against the mock transport and reports rates, so
+ * throughput regressions show up without a camera attached.
+ *
+ * Copyright (C) 2025 Canon R5 Driver Project
+ */
+
+#include <kunit/test.h>
+#include <linux/device.h>
+#include <linux/platform_device.h>
+#include <linux/slab.h>
+#include <linux/math64.h>
+#include <linux/ktime.h>
+#include <linux/workqueue.h>
+
+#include "core/canon-r5.h"
+#include "core/canon-r5-ptp.h"
+#include "canon-r5-mock-transport.h"
+
+static unsigned int bench_latency_us = 250;
+module_param(bench_latency_us, uint, 0644);
+MODULE_PARM_DESC(bench_latency_us, "Mock camera response latency in microseconds");
+
+static unsigned int bench_bandwidth_mbps = 320;
+module_param(bench_bandwidth_mbps, uint, 0644);
+MODULE_PARM_DESC(bench_bandwidth_mbps, "Mock link bandwidth in MB/s (0 = unlimited)");
+
+static unsigned int bench_iterations = 200;
+module_param(bench_iterations, uint, 0644);
+MODULE_PARM_DESC(bench_iterations, "Operations per benchmark");
+
+static unsigned int bench_bodies = 8;
+module_param(bench_bodies, uint, 0644);
+MODULE_PARM_DESC(bench_bodies, "Most camera bodies the scaling benchmark drives at once");
+
+#define CANON_R5_BENCH_LV_FRAME_SIZE	(256 * 1024)
+#define CANON_R5_BENCH_IMAGE_SIZE	(8 * 1024 * 1024)
+#define CANON_R5_BENCH_SLOT_SIZE	(12 * 1024 * 1024)
+#define CANON_R5_BENCH_FILE_SIZE	(64 * 1024 * 1024)
+#define CANON_R5_BENCH_OFFLOAD_SIZE	(16 * 1024 * 1024)
+#define CANON_R5_BENCH_MAX_BODIES	16
+#define CANON_R5_BENCH_OBJECT		0x00010001
+
+struct canon_r5_bench_body;
+
+/* Test fixture for benchmarks */
+struct canon_r5_bench_context {
+	struct platform_device *pdev;
+	struct canon_r5_device *dev;
+	struct canon_r5_mock *mock;
+	bool initialized;
+	
+	/* Extra bodies of the scaling benchmark */
+	struct canon_r5_bench_body *bodies;
+	unsigned int nr_bodies;
+};
+
+static u64 canon_r5_bench_link_bandwidth(void)
+{
+	return (u64)bench_bandwidth_mbps * 1000 * 1000;
+}
+
+/* Bring a device up on its own mock far enough to run transactions */
+static void canon_r5_bench_bring_up(struct kunit *test, struct canon_r5_device **dev,
+				    struct canon_r5_mock **mock, bool *initialized, bool async)
+{
+	struct canon_r5_bench_context *ctx = test->priv;
+	struct canon_r5_mock_config config = {
+		.latency_us = bench_latency_us,
+		.bandwidth = canon_r5_bench_link_bandwidth(),
+		.async = async,
+	};
+	int ret;
+	
+	*dev = canon_r5_device_alloc(&ctx->pdev->dev);
+	KUNIT_ASSERT_NOT_NULL(test, *dev);
+	
+	*mock = canon_r5_mock_create(*dev, &config);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, *mock);
+	
+	ret = canon_r5_device_initialize(*dev);
+	KUNIT_ASSERT_EQ(test, ret, 0);
+	*initialized = true;
+	KUNIT_ASSERT_EQ(test, (*dev)->ptp.rx_async, async);
+	
+	ret = canon_r5_ptp_open_session(*dev);
+	KUNIT_ASSERT_EQ(test, ret, 0);
+	
+	/* Keep the property prefetch out of the measurements */
+	flush_work(&(*dev)->props.refresh_work);
+}
+
+static void canon_r5_bench_tear_down(struct canon_r5_device *dev, struct canon_r5_mock *mock,
+				     bool initialized)
+{
+	if (initialized)
+		canon_r5_device_cleanup(dev);
+	canon_r5_mock_destroy(mock);
+	canon_r5_device_put(dev);
+}
+
+static void canon_r5_bench_start(struct kunit *test, bool async)
+{
+	struct canon_r5_bench_context *ctx = test->priv;
+	
+	canon_r5_bench_bring_up(test, &ctx->dev, &ctx->mock, &ctx->initialized, async);
+}
+
+static u64 canon_r5_bench_elapsed_us(ktime_t start)
+{
+	return max_t(s64, ktime_us_delta(ktime_get(), start), 1);
+}
+
+static void canon_r5_bench_report(struct kunit *test, const char *name, u64 ops, u64 bytes,
+				  u64 us)
+{
+	kunit_info(test, "%s: %llu ops in %llu us, %llu ops/s, %llu MB/s\n", name, ops, us,
+		   div64_u64(ops * USEC_PER_SEC, us), div64_u64(bytes, us));
+}
+
+/* A recorded session replayed strictly in order answers every command as recorded */
+static void canon_r5_bench_replay_test(struct kunit *test)
+{
+	struct canon_r5_bench_context *ctx = test->priv;
+	static const u8 device_info[] = { 0x64, 0x00, 0x0b, 0x00, 0x00, 0x00 };
+	static const struct canon_r5_mock_exchange session[] = {
+		{ .code = PTP_OP_GET_DEVICE_INFO, .data = device_info,
+		  .data_len = sizeof(device_info) },
+		{ .code = CANON_PTP_OP_SET_PROPERTY, .data_out = true },
+		{ .code = CANON_PTP_OP_CAPTURE, .response = PTP_RC_DEVICE_BUSY },
+		{ .code = CANON_PTP_OP_GET_PARTIAL_OBJECT, .data_len = 4096 },
+	};
+	struct canon_r5_mock_stats stats;
+	u32 params[3] = { CANON_R5_BENCH_OBJECT, 3072, 2048 };
+	u8 value[8] = { 0x08, 0, 0, 0, 0x01, 0xd1, 0, 0 };
+	size_t actual;
+	u16 response;
+	u8 *buffer;
+	int ret;
+	
+	buffer = kunit_kzalloc(test, 2048, GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, buffer);
+	
+	canon_r5_bench_start(test, true);
+	canon_r5_mock_load(ctx->mock, session, ARRAY_SIZE(session), true);
+	
+	ret = canon_r5_ptp_command_in(ctx->dev, PTP_OP_GET_DEVICE_INFO, NULL, 0,
+				      buffer, 2048, &actual, &response);
+	KUNIT_EXPECT_EQ(test, ret, 0);
+	KUNIT_EXPECT_EQ(test, actual, sizeof(device_info));
+	KUNIT_EXPECT_EQ(test, memcmp(buffer, device_info, sizeof(device_info)), 0);
+	
+	ret = canon_r5_ptp_command(ctx->dev, CANON_PTP_OP_SET_PROPERTY, NULL, 0,
+				   value, sizeof(value), &response);
+	KUNIT_EXPECT_EQ(test, ret, 0);
+	
+	ret = canon_r5_ptp_command(ctx->dev, CANON_PTP_OP_CAPTURE, NULL, 0, NULL, 0, &response);
+	KUNIT_EXPECT_EQ(test, ret, -EIO);
+	KUNIT_EXPECT_EQ(test, response, (u16)PTP_RC_DEVICE_BUSY);
+	
+	/* Partial reads get the requested slice, clipped to the object */
+	ret = canon_r5_ptp_command_in(ctx->dev, CANON_PTP_OP_GET_PARTIAL_OBJECT, params, 3,
+				      buffer, 2048, &actual, &response);
+	KUNIT_EXPECT_EQ(test, ret, 0);
+	KUNIT_EXPECT_EQ(test, actual, (size_t)1024);
+	KUNIT_EXPECT_EQ(test, buffer[0], 0x5a);
+	
+	/* Off the end of the recording */
+	ret = canon_r5_ptp_command(ctx->dev, CANON_PTP_OP_CAPTURE, NULL, 0, NULL, 0, &response);
+	KUNIT_EXPECT_EQ(test, response, (u16)PTP_RC_GENERAL_ERROR);
+	
+	canon_r5_mock_get_stats(ctx->mock, &stats);
+	KUNIT_EXPECT_EQ(test, stats.mismatches, 1ULL);
+	KUNIT_EXPECT_GE(test, stats.bytes_out, (u64)sizeof(value));
+	
+	/* Back to plain loopback so the session closes cleanly */
+	canon_r5_mock_load(ctx->mock, NULL, 0, false);
+}
+
+/* Round trips of a command without data, over both receive paths */
+static void canon_r5_bench_commands(struct kunit *test, bool async)
+{
+	struct canon_r5_bench_context *ctx = test->priv;
+	u64 us, rate;
+	u16 response;
+	ktime_t start;
+	unsigned int i;
+	int ret;
+	
+	canon_r5_bench_start(test, async);
+	
+	start = ktime_get();
+	for (i = 0; i < bench_iterations; i++) {
+		ret = canon_r5_ptp_command(ctx->dev, CANON_PTP_OP_GET_CHANGES, NULL, 0,
+					   NULL, 0, &response);
+		KUNIT_ASSERT_EQ(test, ret, 0);
+	}
+	us = canon_r5_bench_elapsed_us(start);
+	canon_r5_bench_report(test, async ? "commands (async rx)" : "commands (sync rx)",
+			      bench_iterations, 0, us);
+	
+	/* Engine overhead should stay well below the camera's own latency */
+	rate = div64_u64((u64)bench_iterations * USEC_PER_SEC, us);
+	if (bench_latency_us)
+		KUNIT_EXPECT_GE(test, rate, (u64)USEC_PER_SEC / (4 * bench_latency_us));
+}
+
+static void canon_r5_bench_commands_async_test(struct kunit *test)
+{
+	canon_r5_bench_commands(test, true);
+}
+
+static void canon_r5_bench_commands_sync_test(struct kunit *test)
+{
+	canon_r5_bench_commands(test, false);
+}
+
+/*
+ * Live view frames through the GET_LIVEVIEW transaction the video frame
+ * work issues. The vb2 side needs a registered video node and is left out.
+ */
+static void canon_r5_bench_liveview_test(struct kunit *test)
+{
+	struct canon_r5_bench_context *ctx = test->priv;
+	struct canon_r5_mock_exchange *session;
+	struct canon_liveview_header header, *recorded;
+	size_t frame_size;
+	void *frame, *buffer;
+	ktime_t start;
+	unsigned int i;
+	int ret;
+	
+	frame = kunit_kzalloc(test, sizeof(*recorded) + CANON_R5_BENCH_LV_FRAME_SIZE, GFP_KERNEL);
+	buffer = kunit_kzalloc(test, CANON_R5_BENCH_LV_FRAME_SIZE, GFP_KERNEL);
+	session = kunit_kzalloc(test, sizeof(*session), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, frame);
+	KUNIT_ASSERT_NOT_NULL(test, buffer);
+	KUNIT_ASSERT_NOT_NULL(test, session);
+	
+	recorded = frame;
+	recorded->length = cpu_to_le32(CANON_R5_BENCH_LV_FRAME_SIZE);
+	recorded->width = cpu_to_le32(1024);
+	recorded->height = cpu_to_le32(576);
+	recorded->data_offset = cpu_to_le32(sizeof(*recorded));
+	
+	session->code = CANON_PTP_OP_GET_LIVEVIEW;
+	session->data = frame;
+	session->data_len = sizeof(*recorded) + CANON_R5_BENCH_LV_FRAME_SIZE;
+	
+	canon_r5_bench_start(test, true);
+	canon_r5_mock_load(ctx->mock, session, 1, false);
+	
+	start = ktime_get();
+	for (i = 0; i < bench_iterations; i++) {
+		ret = canon_r5_ptp_get_liveview_frame_into(ctx->dev, buffer,
+							   CANON_R5_BENCH_LV_FRAME_SIZE,
+							   &header, &frame_size);
+		KUNIT_ASSERT_EQ(test, ret, 0);
+		KUNIT_ASSERT_EQ(test, frame_size, (size_t)CANON_R5_BENCH_LV_FRAME_SIZE);
+	}
+	canon_r5_bench_report(test, "liveview frames", bench_iterations,
+			      (u64)bench_iterations * CANON_R5_BENCH_LV_FRAME_SIZE,
+			      canon_r5_bench_elapsed_us(start));
+}
+
+/* Capture then download each image into a pool slot, as the still driver does */
+static void canon_r5_bench_still_test(struct kunit *test)
+{
+	struct canon_r5_bench_context *ctx = test->priv;
+	static const struct canon_r5_mock_exchange session[] = {
+		{ .code = CANON_PTP_OP_CAPTURE },
+		{ .code = CANON_PTP_OP_GET_PARTIAL_OBJECT, .data_len = CANON_R5_BENCH_IMAGE_SIZE },
+	};
+	struct canon_r5_ptp_object_reader *reader;
+	unsigned int i, shots = max(bench_iterations / 10, 1U);
+	ktime_t start;
+	void *slot;
+	int ret;
+	
+	reader = kunit_kzalloc(test, sizeof(*reader), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, reader);
+	slot = kvmalloc(CANON_R5_BENCH_SLOT_SIZE, GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, slot);
+	
+	canon_r5_bench_start(test, true);
+	canon_r5_mock_load(ctx->mock, session, ARRAY_SIZE(session), false);
+	
+	start = ktime_get();
+	for (i = 0; i < shots; i++) {
+		ret = canon_r5_ptp_capture_single(ctx->dev);
+		if (ret)
+			break;
+	
+		canon_r5_ptp_reader_init(reader, ctx->dev, CANON_R5_BENCH_OBJECT, 0,
+					 CANON_R5_BENCH_SLOT_SIZE, slot);
+		ret = canon_r5_ptp_reader_run(reader);
+		if (ret)
+			break;
+	
+		KUNIT_EXPECT_TRUE(test, reader->eof);
+		KUNIT_EXPECT_EQ(test, reader->consumed, (u64)CANON_R5_BENCH_IMAGE_SIZE);
+	}
+	canon_r5_bench_report(test, "still captures", i, (u64)i * CANON_R5_BENCH_IMAGE_SIZE,
+			      canon_r5_bench_elapsed_us(start));
+	
+	kvfree(slot);
+	KUNIT_EXPECT_EQ(test, ret, 0);
+}
+
+static int canon_r5_bench_consume(struct canon_r5_ptp_object_reader *reader, u64 offset,
+				  const void *data, size_t len)
+{
+	u64 *next = reader->context;
+	
+	if (offset != *next)
+		return -EILSEQ;
+	*next += len;
+	return 0;
+}
+
+/* Sequential file read through bounce chunks, as the storage read path streams it */
+static void canon_r5_bench_storage_read_test(struct kunit *test)
+{
+	struct canon_r5_bench_context *ctx = test->priv;
+	static const struct canon_r5_mock_exchange session[] = {
+		{ .code = CANON_PTP_OP_GET_PARTIAL_OBJECT, .data_len = CANON_R5_BENCH_FILE_SIZE },
+	};
+	struct canon_r5_ptp_object_reader *reader;
+	u64 next = 0, us, rate;
+	ktime_t start;
+	int ret;
+	
+	reader = kunit_kzalloc(test, sizeof(*reader), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, reader);
+	
+	canon_r5_bench_start(test, true);
+	canon_r5_mock_load(ctx->mock, session, ARRAY_SIZE(session), false);
+	
+	canon_r5_ptp_reader_init(reader, ctx->dev, CANON_R5_BENCH_OBJECT, 0,
+				 CANON_R5_BENCH_FILE_SIZE, NULL);
+	reader->consume = canon_r5_bench_consume;
+	reader->context = &next;
+	
+	start = ktime_get();
+	ret = canon_r5_ptp_reader_run(reader);
+	us = canon_r5_bench_elapsed_us(start);
+	canon_r5_bench_report(test, "storage read", 1, reader->consumed, us);
+	
+	KUNIT_ASSERT_EQ(test, ret, 0);
+	KUNIT_EXPECT_EQ(test, next, (u64)CANON_R5_BENCH_FILE_SIZE);
+	
+	/* Pipelined chunks should keep the link mostly busy */
+	rate = div64_u64(reader->consumed * USEC_PER_SEC, us);
+	if (bench_bandwidth_mbps)
+		KUNIT_EXPECT_GE(test, rate, canon_r5_bench_link_bandwidth() / 2);
+}
+
+static int canon_r5_bench_fill(struct canon_r5_ptp_transaction *trans, u64 offset,
+			       void *buf, size_t len)
+{
+	u64 *next = trans->context;
+	
+	if (offset != *next)
+		return -EILSEQ;
+	memset(buf, 0xa5, len);
+	*next += len;
+	return 0;
+}
+
+/* File upload whose data phase is filled chunk by chunk, as the storage write path sends it */
+static void canon_r5_bench_storage_write_test(struct kunit *test)
+{
+	struct canon_r5_bench_context *ctx = test->priv;
+	struct canon_r5_ptp_transaction trans;
+	struct canon_r5_mock_stats stats;
+	u64 next = 0, us;
+	ktime_t start;
+	int ret;
+	
+	canon_r5_bench_start(test, true);
+	
+	canon_r5_ptp_transaction_init(&trans, PTP_OP_SEND_OBJECT, NULL, 0);
+	trans.data_out_len = CANON_R5_BENCH_FILE_SIZE;
+	trans.data_out_fill = canon_r5_bench_fill;
+	trans.context = &next;
+	
+	start = ktime_get();
+	ret = canon_r5_ptp_transact(ctx->dev, &trans);
+	us = canon_r5_bench_elapsed_us(start);
+	canon_r5_bench_report(test, "storage write", 1, next, us);
+	
+	KUNIT_ASSERT_EQ(test, ret, 0);
+	KUNIT_EXPECT_EQ(test, next, (u64)CANON_R5_BENCH_FILE_SIZE);
+	
+	canon_r5_mock_get_stats(ctx->mock, &stats);
+	KUNIT_EXPECT_GE(test, stats.bytes_out, (u64)CANON_R5_BENCH_FILE_SIZE);
+}
+
+struct canon_r5_bench_offload {
+	struct work_struct work;
+	struct canon_r5_ptp_object_reader reader;
+	u64 next;
+	int ret;
+	bool done;
+};
+
+static void canon_r5_bench_offload_work(struct work_struct *work)
+{
+	struct canon_r5_bench_offload *offload =
+		container_of(work, struct canon_r5_bench_offload, work);
+	
+	offload->ret = canon_r5_ptp_reader_run(&offload->reader);
+	WRITE_ONCE(offload->done, true);
+}
+
+/* Shutter-class commands issued while a card offload keeps the link busy */
+static void canon_r5_bench_mixed_test(struct kunit *test)
+{
+	struct canon_r5_bench_context *ctx = test->priv;
+	static const struct canon_r5_mock_exchange session[] = {
+		{ .code = CANON_PTP_OP_GET_PARTIAL_OBJECT, .data_len = CANON_R5_BENCH_FILE_SIZE },
+	};
+	struct canon_r5_bench_offload *offload;
+	u64 us, total_us = 0, max_us = 0, chunk_us = 0;
+	unsigned int commands = 0;
+	u16 response;
+	ktime_t start;
+	int ret = 0;
+	
+	offload = kunit_kzalloc(test, sizeof(*offload), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, offload);
+	
+	canon_r5_bench_start(test, true);
+	canon_r5_mock_load(ctx->mock, session, ARRAY_SIZE(session), false);
+	
+	canon_r5_ptp_reader_init(&offload->reader, ctx->dev, CANON_R5_BENCH_OBJECT, 0,
+				 CANON_R5_BENCH_FILE_SIZE, NULL);
+	offload->reader.consume = canon_r5_bench_consume;
+	offload->reader.context = &offload->next;
+	INIT_WORK(&offload->work, canon_r5_bench_offload_work);
+	queue_work(system_unbound_wq, &offload->work);
+	
+	while (!READ_ONCE(offload->done)) {
+		start = ktime_get();
+		ret = canon_r5_ptp_command(ctx->dev, CANON_PTP_OP_GET_CHANGES, NULL, 0,
+					   NULL, 0, &response);
+		us = canon_r5_bench_elapsed_us(start);
+		if (ret)
+			break;
+		total_us += us;
+		max_us = max(max_us, us);
+		commands++;
+	}
+	
+	flush_work(&offload->work);
+	
+	KUNIT_ASSERT_EQ(test, ret, 0);
+	KUNIT_ASSERT_EQ(test, offload->ret, 0);
+	KUNIT_EXPECT_EQ(test, offload->next, (u64)CANON_R5_BENCH_FILE_SIZE);
+	KUNIT_ASSERT_GT(test, commands, 0U);
+	
+	kunit_info(test, "commands under offload: %u, avg %llu us, max %llu us\n",
+		   commands, div_u64(total_us, commands), max_us);
+	
+	/* Control jumps the queued chunks and waits for at most the one on the wire */
+	if (bench_bandwidth_mbps)
+		chunk_us = div64_u64((u64)CANON_R5_PTP_READER_CHUNK_SIZE * USEC_PER_SEC,
+				     canon_r5_bench_link_bandwidth());
+	KUNIT_EXPECT_LE(test, div_u64(total_us, commands), chunk_us + 4 * bench_latency_us + 1000);
+}
+
+struct canon_r5_bench_body {
+	struct canon_r5_device *dev;
+	struct canon_r5_mock *mock;
+	bool initialized;
+	
+	struct work_struct lv_work;
+	void *lv_buffer;
+	int lv_ret;
+	struct canon_r5_bench_offload offload;
+};
+
+static void canon_r5_bench_body_lv_work(struct work_struct *work)
+{
+	struct canon_r5_bench_body *body = container_of(work, struct canon_r5_bench_body, lv_work);
+	struct canon_liveview_header header;
+	size_t frame_size;
+	unsigned int i;
+	
+	for (i = 0; i < bench_iterations; i++) {
+		body->lv_ret = canon_r5_ptp_get_liveview_frame_into(body->dev, body->lv_buffer,
+								    CANON_R5_BENCH_LV_FRAME_SIZE,
+								    &header, &frame_size);
+		if (body->lv_ret)
+			break;
+	}
+}
+
+/*
+ * Every body streams live view while offloading a file, the way a capture
+ * rig ingests between takes. Each body has a link of its own, so aggregate
+ * rates should grow with the bodies until the host runs out of CPUs; load
+ * canon-r5-core with shared_workers=1 or worker_cpus= to compare pools.
+ */
+static void canon_r5_bench_scaling_test(struct kunit *test)
+{
+	struct canon_r5_bench_context *ctx = test->priv;
+	struct canon_r5_mock_exchange *session;
+	struct canon_liveview_header *recorded;
+	unsigned int max_bodies = clamp(bench_bodies, 1U, (unsigned int)CANON_R5_BENCH_MAX_BODIES);
+	unsigned int n, i, cpus = num_online_cpus();
+	struct canon_r5_bench_body *body;
+	u64 us, fps, single_fps = 0, bytes;
+	ktime_t start;
+	void *frame;
+	
+	frame = kunit_kzalloc(test, sizeof(*recorded) + CANON_R5_BENCH_LV_FRAME_SIZE, GFP_KERNEL);
+	session = kunit_kcalloc(test, 2, sizeof(*session), GFP_KERNEL);
+	ctx->bodies = kunit_kcalloc(test, max_bodies, sizeof(*ctx->bodies), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, frame);
+	KUNIT_ASSERT_NOT_NULL(test, session);
+	KUNIT_ASSERT_NOT_NULL(test, ctx->bodies);
+	
+	recorded = frame;
+	recorded->length = cpu_to_le32(CANON_R5_BENCH_LV_FRAME_SIZE);
+	recorded->width = cpu_to_le32(1024);
+	recorded->height = cpu_to_le32(576);
+	recorded->data_offset = cpu_to_le32(sizeof(*recorded));
+	
+	session[0].code = CANON_PTP_OP_GET_LIVEVIEW;
+	session[0].data = frame;
+	session[0].data_len = sizeof(*recorded) + CANON_R5_BENCH_LV_FRAME_SIZE;
+	session[1].code = CANON_PTP_OP_GET_PARTIAL_OBJECT;
+	session[1].data_len = CANON_R5_BENCH_OFFLOAD_SIZE;
+	
+	for (n = 1; ; n = min(n * 2, max_bodies)) {
+		/* Bodies join the rig and stay for the larger rounds */
+		while (ctx->nr_bodies < n) {
+			body = &ctx->bodies[ctx->nr_bodies++];
+			body->lv_buffer = kunit_kzalloc(test, CANON_R5_BENCH_LV_FRAME_SIZE, GFP_KERNEL);
+			KUNIT_ASSERT_NOT_NULL(test, body->lv_buffer);
+			canon_r5_bench_bring_up(test, &body->dev, &body->mock, &body->initialized, true);
+			canon_r5_mock_load(body->mock, session, 2, false);
+			INIT_WORK(&body->lv_work, canon_r5_bench_body_lv_work);
+			INIT_WORK(&body->offload.work, canon_r5_bench_offload_work);
+		}
+		
+		for (i = 0; i < n; i++) {
+			body = &ctx->bodies[i];
+			body->offload.next = 0;
+			body->offload.done = false;
+			canon_r5_ptp_reader_init(&body->offload.reader, body->dev,
+						 CANON_R5_BENCH_OBJECT, 0,
+						 CANON_R5_BENCH_OFFLOAD_SIZE, NULL);
+			body->offload.reader.consume = canon_r5_bench_consume;
+			body->offload.reader.context = &body->offload.next;
+		}
+		
+		start = ktime_get();
+		for (i = 0; i < n; i++) {
+			queue_work(system_unbound_wq, &ctx->bodies[i].lv_work);
+			queue_work(system_unbound_wq, &ctx->bodies[i].offload.work);
+		}
+		for (i = 0; i < n; i++) {
+			flush_work(&ctx->bodies[i].lv_work);
+			flush_work(&ctx->bodies[i].offload.work);
+		}
+		us = canon_r5_bench_elapsed_us(start);
+		
+		bytes = 0;
+		for (i = 0; i < n; i++) {
+			body = &ctx->bodies[i];
+			KUNIT_ASSERT_EQ(test, body->lv_ret, 0);
+			KUNIT_ASSERT_EQ(test, body->offload.ret, 0);
+			KUNIT_EXPECT_EQ(test, body->offload.next, (u64)CANON_R5_BENCH_OFFLOAD_SIZE);
+			bytes += body->offload.next;
+		}
+		
+		fps = div64_u64((u64)n * bench_iterations * USEC_PER_SEC, us);
+		kunit_info(test, "%u bodies: liveview %llu fps, offload %llu MB/s (%llu us)\n",
+			   n, fps, div64_u64(bytes, us), us);
+		
+		if (n == 1)
+			single_fps = fps;
+		if (n == max_bodies)
+			break;
+	}
+	
+	/* Paced links leave the host idle enough to scale with its CPUs */
+	if (bench_bandwidth_mbps && max_bodies > 1)
+		KUNIT_EXPECT_GE(test, fps * 2, single_fps * min(max_bodies, cpus));
+}
+
+/* Test setup function */
+static int canon_r5_bench_test_init(struct kunit *test)
+{
+	struct canon_r5_bench_context *ctx;
+	
+	ctx = kzalloc(sizeof(*ctx), GFP_KERNEL);
+	if (!ctx)
+		return -ENOMEM;
+	
+	ctx->pdev = platform_device_alloc("canon-r5-bench", 0);
+	if (!ctx->pdev) {
+		kfree(ctx);
+		return -ENOMEM;
+	}
+	
+	if (platform_device_add(ctx->pdev)) {
+		platform_device_put(ctx->pdev);
+		kfree(ctx);
+		return -ENOMEM;
+	}
+	
+	test->priv = ctx;
+	return 0;
+}
+
+/* Test cleanup function */
+static void canon_r5_bench_test_exit(struct kunit *test)
+{
+	struct canon_r5_bench_context *ctx = test->priv;
+	struct canon_r5_bench_body *body;
+	
+	if (!ctx)
+		return;
+	
+	while (ctx->nr_bodies) {
+		body = &ctx->bodies[--ctx->nr_bodies];
+		canon_r5_bench_tear_down(body->dev, body->mock, body->initialized);
+	}
+	canon_r5_bench_tear_down(ctx->dev, ctx->mock, ctx->initialized);
+	platform_device_unregister(ctx->pdev);
+	kfree(ctx);
+}
+
+/* Test case definitions */
+static struct kunit_case canon_r5_bench_test_cases[] = {
+	KUNIT_CASE(canon_r5_bench_replay_test),
+	KUNIT_CASE_SLOW(canon_r5_bench_commands_async_test),
+	KUNIT_CASE_SLOW(canon_r5_bench_commands_sync_test),
+	KUNIT_CASE_SLOW(canon_r5_bench_liveview_test),
+	KUNIT_CASE_SLOW(canon_r5_bench_still_test),
+	KUNIT_CASE_SLOW(canon_r5_bench_storage_read_test),
+	KUNIT_CASE_SLOW(canon_r5_bench_storage_write_test),
+	KUNIT_CASE_SLOW(canon_r5_bench_mixed_test),
+	KUNIT_CASE_SLOW(canon_r5_bench_scaling_test),
+	{}
+};
+
+/* Test suite definition */
+static struct kunit_suite canon_r5_bench_test_suite = {
+	.name = "canon-r5-bench",
+	.init = canon_r5_bench_test_init,
+	.exit = canon_r5_bench_test_exit,
+	.test_cases = canon_r5_bench_test_cases,
+};
+
+/* Register the test suite */
+kunit_test_suite(canon_r5_bench_test_suite);
+
+MODULE_LICENSE("GPL v2");
+MODULE_DESCRIPTION("Canon R5 Data Path KUnit Benchmarks");
+MODULE_AUTHOR("Canon R5 Driver Project");
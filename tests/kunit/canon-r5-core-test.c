@@ -8,8 +8,11 @@
 #include <kunit/test.h>
 #include <linux/device.h>
 #include <linux/platform_device.h>
+#include <linux/math64.h>
+#include <linux/delay.h>
 
 #include "core/canon-r5.h"
+#include "core/canon-r5-ptp.h"
 
 /* Test fixture for core driver tests */
 struct canon_r5_core_test_context {
@@ -178,6 +181,237 @@ static void canon_r5_core_capabilities_test(struct kunit *test)
 	canon_r5_device_put(dev);
 }
 
+/* Test camera clock recovery against a synthetic timeline */
+static void canon_r5_core_clock_test(struct kunit *test)
+{
+	struct canon_r5_core_test_context *ctx = test->priv;
+	struct canon_r5_device *dev;
+	const s64 base = 1000 * NSEC_PER_SEC;
+	ktime_t host, stamped;
+	u64 dev_us;
+	int i;
+	
+	dev = canon_r5_device_alloc(&ctx->pdev->dev);
+	KUNIT_ASSERT_NOT_NULL(test, dev);
+	
+	/* No estimate yet: arrival time passes through */
+	KUNIT_EXPECT_EQ(test, canon_r5_clock_to_host(dev, 0, &host), -EAGAIN);
+	stamped = canon_r5_clock_stamp(dev, 0, ns_to_ktime(base + 5 * NSEC_PER_MSEC));
+	KUNIT_EXPECT_EQ(test, ktime_to_ns(stamped), base + 5 * NSEC_PER_MSEC);
+	
+	/* Jittery arrivals, the least delayed 1 ms after capture */
+	for (i = 1; i < CANON_R5_CLOCK_WINDOW; i++) {
+		dev_us = i * 33333ULL;
+		canon_r5_clock_stamp(dev, dev_us,
+				     ns_to_ktime(base + dev_us * NSEC_PER_USEC +
+						 (i == 7 ? 1 : 2 + i % 3) * NSEC_PER_MSEC));
+	}
+	
+	KUNIT_ASSERT_EQ(test, canon_r5_clock_to_host(dev, 7 * 33333ULL, &host), 0);
+	KUNIT_EXPECT_EQ(test, ktime_to_ns(host), base + 7 * 33333000LL + NSEC_PER_MSEC);
+	
+	/* Capture times never land after the arrival */
+	dev_us = CANON_R5_CLOCK_WINDOW * 33333ULL;
+	stamped = canon_r5_clock_stamp(dev, dev_us, ns_to_ktime(base + dev_us * NSEC_PER_USEC));
+	KUNIT_EXPECT_LE(test, ktime_to_ns(stamped), base + (s64)dev_us * NSEC_PER_USEC);
+	
+	/* A camera running 100 ppm fast is picked up as negative drift */
+	for (i = CANON_R5_CLOCK_WINDOW + 1; i < 4 * CANON_R5_CLOCK_WINDOW; i++) {
+		dev_us = i * 33333ULL;
+		canon_r5_clock_stamp(dev, dev_us + div_u64(dev_us, 10000),
+				     ns_to_ktime(base + dev_us * NSEC_PER_USEC + 2 * NSEC_PER_MSEC));
+	}
+	KUNIT_EXPECT_LT(test, dev->clock.drift_ppb, 0LL);
+	KUNIT_EXPECT_GT(test, dev->clock.drift_ppb, -100000LL);
+	
+	/* A jump of the camera clock restarts the estimate */
+	canon_r5_clock_stamp(dev, 3600ULL * USEC_PER_SEC, ns_to_ktime(base + 3 * NSEC_PER_SEC));
+	KUNIT_EXPECT_FALSE(test, dev->clock.valid);
+	KUNIT_EXPECT_EQ(test, dev->clock.resets, 1U);
+	
+	/* 32-bit stamps widen around the newest camera time */
+	KUNIT_EXPECT_EQ(test, canon_r5_clock_extend(dev, 5), 0x100000005ULL);
+	
+	canon_r5_device_put(dev);
+}
+
+/* Test that bring-up stops at a failed step and skips its dependents */
+static void canon_r5_core_bringup_test(struct kunit *test)
+{
+	struct canon_r5_core_test_context *ctx = test->priv;
+	struct canon_r5_device *dev;
+	int i;
+	
+	dev = canon_r5_device_alloc(&ctx->pdev->dev);
+	KUNIT_ASSERT_NOT_NULL(test, dev);
+	
+	/* No transport: the session step fails and nothing after it is queued */
+	canon_r5_bringup_start(dev);
+	for (i = 0; i < 100 && !READ_ONCE(dev->bringup.settled); i++)
+		msleep(10);
+	
+	KUNIT_EXPECT_TRUE(test, dev->bringup.settled);
+	KUNIT_EXPECT_EQ(test, dev->bringup.failed, BIT(CANON_R5_BRINGUP_SESSION));
+	KUNIT_EXPECT_EQ(test, dev->bringup.queued, BIT(CANON_R5_BRINGUP_SESSION));
+	KUNIT_EXPECT_EQ(test, dev->bringup.done, 0UL);
+	KUNIT_EXPECT_NE(test, canon_r5_get_state(dev), CANON_R5_STATE_READY);
+	
+	canon_r5_bringup_stop(dev);
+	KUNIT_EXPECT_FALSE(test, dev->bringup.active);
+	
+	canon_r5_device_put(dev);
+}
+
+/* Test per-opcode accounting, histogram percentiles and the overflow slot */
+static void canon_r5_core_stats_test(struct kunit *test)
+{
+	struct canon_r5_core_test_context *ctx = test->priv;
+	struct canon_r5_ptp_transaction trans;
+	struct canon_r5_ptp_op_stats sum;
+	struct canon_r5_device *dev;
+	unsigned long flags;
+	int i;
+	
+	dev = canon_r5_device_alloc(&ctx->pdev->dev);
+	KUNIT_ASSERT_NOT_NULL(test, dev);
+	if (!dev->stats.ops)
+		kunit_skip(test, "per-CPU statistics not allocated");
+	
+	canon_r5_ptp_transaction_init(&trans, PTP_OP_GET_DEVICE_INFO, NULL, 0);
+	trans.response_code = PTP_RC_OK;
+	trans.data_in_actual = 512;
+	trans.data_out_len = 16;
+	
+	spin_lock_irqsave(&dev->transaction_lock, flags);
+	for (i = 0; i < 98; i++)
+		canon_r5_stats_record(dev, &trans, 100, true);
+	canon_r5_stats_record(dev, &trans, 40000, false);
+	trans.status = -ETIMEDOUT;
+	canon_r5_stats_record(dev, &trans, 5000000, false);
+	spin_unlock_irqrestore(&dev->transaction_lock, flags);
+	
+	KUNIT_EXPECT_EQ(test, canon_r5_stats_read(dev, 0, &sum), (u16)PTP_OP_GET_DEVICE_INFO);
+	KUNIT_EXPECT_EQ(test, sum.count, 100ULL);
+	KUNIT_EXPECT_EQ(test, sum.errors, 1ULL);
+	KUNIT_EXPECT_EQ(test, sum.bytes_in, 100ULL * 512);
+	KUNIT_EXPECT_EQ(test, sum.bytes_out, 98ULL * 16);
+	
+	/* Bucket upper bounds: 100 us is below 128, 40 ms below 65536 us */
+	KUNIT_EXPECT_EQ(test, canon_r5_stats_percentile(&sum, 50), 128ULL);
+	KUNIT_EXPECT_EQ(test, canon_r5_stats_percentile(&sum, 99), 65536ULL);
+	KUNIT_EXPECT_EQ(test, canon_r5_stats_percentile(&sum, 100), 1ULL << 23);
+	
+	/* Opcodes beyond the table share the last slot */
+	spin_lock_irqsave(&dev->transaction_lock, flags);
+	for (i = 0; i < CANON_R5_STATS_OPCODES; i++) {
+		trans.code = 0x9100 + i;
+		canon_r5_stats_record(dev, &trans, 1, false);
+	}
+	spin_unlock_irqrestore(&dev->transaction_lock, flags);
+	
+	KUNIT_EXPECT_EQ(test, canon_r5_stats_read(dev, CANON_R5_STATS_OPCODES - 1, &sum), 0xffff);
+	KUNIT_EXPECT_EQ(test, sum.count, 2ULL);
+	
+	canon_r5_device_put(dev);
+}
+
+/* Test counter sets: lock-free updates, reset points and registration */
+static void canon_r5_core_counters_test(struct kunit *test)
+{
+	static const char * const names[] = { "frames", "bytes" };
+	struct canon_r5_core_test_context *ctx = test->priv;
+	struct canon_r5_counter_set *set;
+	struct canon_r5_device *dev;
+	u64 vals[2];
+	int ret;
+	
+	set = kunit_kzalloc(test, sizeof(*set), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, set);
+	
+	dev = canon_r5_device_alloc(&ctx->pdev->dev);
+	KUNIT_ASSERT_NOT_NULL(test, dev);
+	
+	KUNIT_EXPECT_EQ(test, canon_r5_counters_register(dev, set, "test", names, 0), -EINVAL);
+	
+	ret = canon_r5_counters_register(dev, set, "test", names, ARRAY_SIZE(names));
+	KUNIT_ASSERT_EQ(test, ret, 0);
+	KUNIT_EXPECT_TRUE(test, list_is_singular(&dev->stats.sets));
+	
+	canon_r5_counter_inc(set, 0);
+	canon_r5_counter_add(set, 1, 1 << 20);
+	canon_r5_counters_read(set, vals);
+	KUNIT_EXPECT_EQ(test, vals[0], 1ULL);
+	KUNIT_EXPECT_EQ(test, vals[1], 1ULL << 20);
+	
+	/* Reset is a new origin, the per-CPU totals keep running */
+	canon_r5_counters_reset(set);
+	canon_r5_counter_add(set, 1, 512);
+	KUNIT_EXPECT_EQ(test, canon_r5_counter_read(set, 0), 0ULL);
+	KUNIT_EXPECT_EQ(test, canon_r5_counter_read(set, 1), 512ULL);
+	KUNIT_EXPECT_EQ(test, canon_r5_counter_read(set, 2), 0ULL);
+	
+	canon_r5_counters_unregister(set);
+	KUNIT_EXPECT_TRUE(test, list_empty(&dev->stats.sets));
+	
+	/* An unregistered set ignores updates */
+	canon_r5_counter_inc(set, 0);
+	
+	canon_r5_device_put(dev);
+}
+
+struct canon_r5_core_work {
+	struct work_struct work;
+	int cpu;
+};
+
+static void canon_r5_core_work_fn(struct work_struct *work)
+{
+	struct canon_r5_core_work *w = container_of(work, struct canon_r5_core_work, work);
+	
+	w->cpu = raw_smp_processor_id();
+}
+
+/* Device ids are reused and every body's queues run its work */
+static void canon_r5_core_workers_test(struct kunit *test)
+{
+	struct canon_r5_core_test_context *ctx = test->priv;
+	struct canon_r5_device *dev, *other;
+	struct workqueue_struct *wq;
+	struct canon_r5_core_work w = { .cpu = -1 };
+	int id;
+	
+	dev = canon_r5_device_alloc(&ctx->pdev->dev);
+	KUNIT_ASSERT_NOT_NULL(test, dev);
+	other = canon_r5_device_alloc(&ctx->pdev->dev);
+	KUNIT_ASSERT_NOT_NULL(test, other);
+	KUNIT_EXPECT_NE(test, dev->id, other->id);
+	
+	/* A released body hands its id to the next one */
+	id = dev->id;
+	canon_r5_device_put(dev);
+	dev = canon_r5_device_alloc(&ctx->pdev->dev);
+	KUNIT_ASSERT_NOT_NULL(test, dev);
+	KUNIT_EXPECT_EQ(test, dev->id, id);
+	
+	wq = canon_r5_workqueue_get(dev, CANON_R5_WORK_IO, "canon-r5-test", WQ_UNBOUND, 1);
+	KUNIT_ASSERT_NOT_NULL(test, wq);
+	KUNIT_EXPECT_NULL(test, canon_r5_workqueue_get(dev, CANON_R5_WORK_CLASSES,
+						       "canon-r5-test", WQ_UNBOUND, 1));
+	
+	INIT_WORK(&w.work, canon_r5_core_work_fn);
+	KUNIT_EXPECT_TRUE(test, canon_r5_queue_work(dev, wq, &w.work));
+	flush_work(&w.work);
+	KUNIT_EXPECT_GE(test, w.cpu, 0);
+	
+	/* Pinned work lands on the set */
+	if (dev->workers.pinned)
+		KUNIT_EXPECT_TRUE(test, cpumask_test_cpu(w.cpu, dev->workers.cpus));
+	
+	canon_r5_workqueue_put(dev, wq);
+	canon_r5_device_put(other);
+	canon_r5_device_put(dev);
+}
+
 /* Test setup function */
 static int canon_r5_core_test_init(struct kunit *test)
 {
@@ -225,6 +459,11 @@ static struct kunit_case canon_r5_core_test_cases[] = {
 	KUNIT_CASE(canon_r5_core_reference_counting_test),
 	KUNIT_CASE(canon_r5_core_init_cleanup_test),
 	KUNIT_CASE(canon_r5_core_capabilities_test),
+	KUNIT_CASE(canon_r5_core_clock_test),
+	KUNIT_CASE(canon_r5_core_bringup_test),
+	KUNIT_CASE(canon_r5_core_stats_test),
+	KUNIT_CASE(canon_r5_core_counters_test),
+	KUNIT_CASE(canon_r5_core_workers_test),
 	{}
 };
 
@@ -0,0 +1,572 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Canon R5 Linux Driver Suite
+ * Mock PTP transport for KUnit tests and benchmarks
+ *
+ * Copyright (C) 2025 Canon R5 Driver Project
+ */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/version.h>
+#include <linux/slab.h>
+#include <linux/delay.h>
+#include <linux/math64.h>
+#include <linux/jiffies.h>
+
+#include "core/canon-r5.h"
+#include "core/canon-r5-ptp.h"
+#include "canon-r5-mock-transport.h"
+
+MODULE_AUTHOR("Canon R5 Driver Project");
+MODULE_DESCRIPTION("Canon R5 Camera Driver Suite - Mock PTP Transport");
+MODULE_LICENSE("GPL v2");
+MODULE_VERSION(CANON_R5_DRIVER_VERSION);
+
+/* Payload byte sent for exchanges recorded without data */
+#define CANON_R5_MOCK_FILLER		0x5a
+
+/* The camera's answer to one transaction: optional data container, then the response */
+struct canon_r5_mock_reply {
+	struct list_head	list;
+	struct ptp_container	data_header;
+	const u8		*payload;	/* NULL sends filler */
+	size_t			payload_len;
+	size_t			data_len;	/* Whole data container, 0 for none */
+	struct ptp_container	response;
+	size_t			response_len;
+	size_t			pos;		/* Bytes already sent */
+	ktime_t			ready;		/* Earliest time of the first byte */
+};
+
+static struct canon_r5_mock *canon_r5_mock_from(struct canon_r5_device *dev)
+{
+	return container_of(dev->transport_ops, struct canon_r5_mock, ops);
+}
+
+static size_t canon_r5_mock_reply_len(const struct canon_r5_mock_reply *reply)
+{
+	return reply->data_len + reply->response_len;
+}
+
+/* Bytes left in the container at the reply's position; transfers never span two */
+static size_t canon_r5_mock_segment(const struct canon_r5_mock_reply *reply)
+{
+	if (reply->pos < reply->data_len)
+		return reply->data_len - reply->pos;
+	
+	return canon_r5_mock_reply_len(reply) - reply->pos;
+}
+
+static void canon_r5_mock_copy(const struct canon_r5_mock_reply *reply, u8 *dst, size_t len)
+{
+	size_t pos = reply->pos, n;
+	
+	if (pos < PTP_CONTAINER_HEADER_SIZE && pos < reply->data_len) {
+		n = min(len, PTP_CONTAINER_HEADER_SIZE - pos);
+		memcpy(dst, (const u8 *)&reply->data_header + pos, n);
+		dst += n;
+		pos += n;
+		len -= n;
+	}
+	
+	if (len && pos < reply->data_len) {
+		n = min(len, reply->data_len - pos);
+		if (reply->payload)
+			memcpy(dst, reply->payload + pos - PTP_CONTAINER_HEADER_SIZE, n);
+		else
+			memset(dst, CANON_R5_MOCK_FILLER, n);
+		dst += n;
+		pos += n;
+		len -= n;
+	}
+	
+	if (len)
+		memcpy(dst, (const u8 *)&reply->response + pos - reply->data_len, len);
+}
+
+/* Size and delivery time of the next bulk IN transfer. Needs mock->lock */
+static size_t canon_r5_mock_plan_locked(struct canon_r5_mock *mock,
+					const struct canon_r5_mock_reply *reply,
+					size_t max, ktime_t *due)
+{
+	size_t len = min3(max, canon_r5_mock_segment(reply), (size_t)CANON_R5_MOCK_PACKET_SIZE);
+	ktime_t start = ktime_after(reply->ready, mock->link_free) ? reply->ready : mock->link_free;
+	
+	*due = start;
+	if (mock->config.bandwidth)
+		*due = ktime_add_ns(start, div64_u64((u64)len * NSEC_PER_SEC,
+						     mock->config.bandwidth));
+	
+	return len;
+}
+
+/* Account a transfer that left the camera; returns the reply once fully sent */
+static struct canon_r5_mock_reply *canon_r5_mock_sent_locked(struct canon_r5_mock *mock,
+							     struct canon_r5_mock_reply *reply,
+							     size_t len, ktime_t due)
+{
+	reply->pos += len;
+	mock->link_free = due;
+	mock->stats.bytes_in += len;
+	
+	if (reply->pos < canon_r5_mock_reply_len(reply))
+		return NULL;
+	
+	list_del(&reply->list);
+	return reply;
+}
+
+static void canon_r5_mock_sleep_until(ktime_t due)
+{
+	s64 us = ktime_us_delta(due, ktime_get());
+	
+	if (us > 0)
+		fsleep(us);
+}
+
+/* Asynchronous stream: one expiry per bulk IN transfer, in interrupt context like a URB */
+static enum hrtimer_restart canon_r5_mock_timer(struct hrtimer *timer)
+{
+	struct canon_r5_mock *mock = container_of(timer, struct canon_r5_mock, timer);
+	void (*complete)(struct canon_r5_device *dev, const void *data,
+			 size_t len, int status);
+	struct canon_r5_mock_reply *reply, *done = NULL;
+	enum hrtimer_restart restart = HRTIMER_NORESTART;
+	unsigned long flags;
+	size_t len = 0;
+	ktime_t due;
+	
+	spin_lock_irqsave(&mock->lock, flags);
+	
+	complete = mock->complete;
+	reply = list_first_entry_or_null(&mock->replies, struct canon_r5_mock_reply, list);
+	if (reply && complete) {
+		len = mock->packet_len;
+		canon_r5_mock_copy(reply, mock->packet, len);
+		done = canon_r5_mock_sent_locked(mock, reply, len, hrtimer_get_expires(timer));
+	}
+	
+	reply = list_first_entry_or_null(&mock->replies, struct canon_r5_mock_reply, list);
+	if (reply && complete) {
+		mock->packet_len = canon_r5_mock_plan_locked(mock, reply, SIZE_MAX, &due);
+		hrtimer_set_expires(timer, due);
+		restart = HRTIMER_RESTART;
+	} else {
+		mock->timer_armed = false;
+	}
+	
+	spin_unlock_irqrestore(&mock->lock, flags);
+	
+	/* An hrtimer never runs concurrently with itself, so the packet buffer is ours */
+	if (len)
+		complete(mock->dev, mock->packet, len, 0);
+	
+	kfree(done);
+	
+	return restart;
+}
+
+/* Queue a reply and start sending it. Needs mock->lock */
+static void canon_r5_mock_queue_locked(struct canon_r5_mock *mock,
+				       struct canon_r5_mock_reply *reply)
+{
+	ktime_t due;
+	
+	list_add_tail(&reply->list, &mock->replies);
+	
+	if (!mock->complete || mock->timer_armed)
+		return;
+	
+	reply = list_first_entry(&mock->replies, struct canon_r5_mock_reply, list);
+	mock->packet_len = canon_r5_mock_plan_locked(mock, reply, SIZE_MAX, &due);
+	mock->timer_armed = true;
+	hrtimer_start(&mock->timer, due, HRTIMER_MODE_ABS);
+}
+
+/* Opcodes where the host sends a data phase, for commands not in the session */
+static bool canon_r5_mock_default_data_out(u16 code)
+{
+	switch (code) {
+	case PTP_OP_SET_DEVICE_PROP_VALUE:
+	case CANON_PTP_OP_SET_PROPERTY:
+	case PTP_OP_SEND_OBJECT_INFO:
+	case PTP_OP_SEND_OBJECT:
+		return true;
+	default:
+		return false;
+	}
+}
+
+/* Pick the recorded answer for a command. Needs mock->lock */
+static const struct canon_r5_mock_exchange *canon_r5_mock_lookup_locked(struct canon_r5_mock *mock,
+									   u16 code)
+{
+	size_t i, idx;
+	
+	if (!mock->session_len)
+		return NULL;
+	
+	if (mock->strict) {
+		if (mock->cursor < mock->session_len && mock->session[mock->cursor].code == code)
+			return &mock->session[mock->cursor++];
+		mock->stats.mismatches++;
+		return NULL;
+	}
+	
+	/* Repeatable replay: the next recorded exchange for this opcode, wrapping around */
+	for (i = 0; i < mock->session_len; i++) {
+		idx = (mock->cursor + i) % mock->session_len;
+		if (mock->session[idx].code == code) {
+			mock->cursor = idx + 1;
+			return &mock->session[idx];
+		}
+	}
+	
+	return NULL;
+}
+
+/* Slice a partial object read out of the recorded object */
+static void canon_r5_mock_partial(const struct canon_r5_mock *mock,
+				  const struct canon_r5_mock_exchange *ex,
+				  struct canon_r5_mock_reply *reply)
+{
+	u64 offset, len;
+	
+	if (mock->cmd_code == CANON_PTP_OP_GET_PARTIAL_OBJECT_64) {
+		offset = (u64)mock->cmd_params[2] << 32 | mock->cmd_params[1];
+		len = mock->cmd_params[3];
+	} else {
+		offset = mock->cmd_params[1];
+		len = mock->cmd_params[2];
+	}
+	
+	if (offset >= ex->data_len)
+		len = 0;
+	else
+		len = min_t(u64, len, ex->data_len - offset);
+	
+	reply->payload = ex->data ? (const u8 *)ex->data + offset : NULL;
+	reply->payload_len = len;
+}
+
+/* Answer the pending command once the host has sent all of it */
+static int canon_r5_mock_answer(struct canon_r5_mock *mock,
+				const struct canon_r5_mock_exchange *ex)
+{
+	struct canon_r5_mock_reply *reply;
+	unsigned long flags;
+	u16 response;
+	int i, count = 0;
+	
+	if (ex && ex->no_response) {
+		spin_lock_irqsave(&mock->lock, flags);
+		mock->stats.commands++;
+		spin_unlock_irqrestore(&mock->lock, flags);
+		return 0;
+	}
+	
+	reply = kzalloc(sizeof(*reply), GFP_KERNEL);
+	if (!reply)
+		return -ENOMEM;
+	
+	if (ex) {
+		response = ex->response ? : PTP_RC_OK;
+		count = clamp(ex->param_count, 0, PTP_MAX_PARAMS);
+	
+		if (mock->cmd_code == CANON_PTP_OP_GET_PARTIAL_OBJECT ||
+		    mock->cmd_code == CANON_PTP_OP_GET_PARTIAL_OBJECT_64) {
+			canon_r5_mock_partial(mock, ex, reply);
+			reply->data_len = PTP_CONTAINER_HEADER_SIZE + reply->payload_len;
+		} else if (ex->data_len) {
+			reply->payload = ex->data;
+			reply->payload_len = ex->data_len;
+			reply->data_len = PTP_CONTAINER_HEADER_SIZE + reply->payload_len;
+		}
+	} else {
+		response = mock->strict ? PTP_RC_GENERAL_ERROR : PTP_RC_OK;
+	}
+	
+	if (reply->data_len) {
+		reply->data_header.length = cpu_to_le32(reply->data_len);
+		reply->data_header.type = cpu_to_le16(PTP_CONTAINER_DATA);
+		reply->data_header.code = cpu_to_le16(mock->cmd_code);
+		reply->data_header.trans_id = cpu_to_le32(mock->cmd_trans_id);
+	}
+	
+	reply->response_len = PTP_CONTAINER_HEADER_SIZE + count * sizeof(u32);
+	reply->response.length = cpu_to_le32(reply->response_len);
+	reply->response.type = cpu_to_le16(PTP_CONTAINER_RESPONSE);
+	reply->response.code = cpu_to_le16(response);
+	reply->response.trans_id = cpu_to_le32(mock->cmd_trans_id);
+	for (i = 0; i < count; i++)
+		reply->response.params[i] = cpu_to_le32(ex->params[i]);
+	
+	reply->ready = ktime_add_us(ktime_get(), mock->config.latency_us);
+	
+	spin_lock_irqsave(&mock->lock, flags);
+	mock->stats.commands++;
+	canon_r5_mock_queue_locked(mock, reply);
+	spin_unlock_irqrestore(&mock->lock, flags);
+	
+	wake_up(&mock->wait);
+	
+	return 0;
+}
+
+static int canon_r5_mock_bulk_send(struct canon_r5_device *dev, const void *data, size_t len)
+{
+	struct canon_r5_mock *mock = canon_r5_mock_from(dev);
+	const struct ptp_container *container = data;
+	const struct canon_r5_mock_exchange *ex;
+	unsigned long flags;
+	u32 length;
+	size_t n;
+	int i;
+	
+	if (!data || !len)
+		return -EINVAL;
+	
+	spin_lock_irqsave(&mock->lock, flags);
+	mock->stats.bytes_out += len;
+	spin_unlock_irqrestore(&mock->lock, flags);
+	
+	if (mock->config.bandwidth)
+		fsleep(div64_u64((u64)len * USEC_PER_SEC, mock->config.bandwidth));
+	
+	/* Rest of a data phase split over several transfers */
+	if (mock->out_remaining) {
+		n = min(len, mock->out_remaining);
+		mock->out_remaining -= n;
+		if (mock->out_remaining)
+			return 0;
+		mock->cmd_pending = false;
+		return canon_r5_mock_answer(mock, mock->cmd_ex);
+	}
+	
+	if (len < PTP_CONTAINER_HEADER_SIZE)
+		return -EPROTO;
+	
+	length = le32_to_cpu(container->length);
+	if (length < PTP_CONTAINER_HEADER_SIZE)
+		return -EPROTO;
+	
+	switch (le16_to_cpu(container->type)) {
+	case PTP_CONTAINER_COMMAND:
+		if (mock->cmd_pending)
+			return -EPROTO;
+	
+		mock->cmd_code = le16_to_cpu(container->code);
+		mock->cmd_trans_id = le32_to_cpu(container->trans_id);
+		mock->cmd_param_count = min_t(int, (min_t(size_t, length, len) -
+						    PTP_CONTAINER_HEADER_SIZE) / sizeof(u32),
+					      PTP_MAX_PARAMS);
+		memset(mock->cmd_params, 0, sizeof(mock->cmd_params));
+		for (i = 0; i < mock->cmd_param_count; i++)
+			mock->cmd_params[i] = le32_to_cpu(container->params[i]);
+	
+		spin_lock_irqsave(&mock->lock, flags);
+		ex = canon_r5_mock_lookup_locked(mock, mock->cmd_code);
+		spin_unlock_irqrestore(&mock->lock, flags);
+	
+		if (ex ? ex->data_out : canon_r5_mock_default_data_out(mock->cmd_code)) {
+			mock->cmd_ex = ex;
+			mock->cmd_pending = true;
+			return 0;
+		}
+		return canon_r5_mock_answer(mock, ex);
+	case PTP_CONTAINER_DATA:
+		if (!mock->cmd_pending || le32_to_cpu(container->trans_id) != mock->cmd_trans_id)
+			return -EPROTO;
+	
+		n = min_t(size_t, len, length) - PTP_CONTAINER_HEADER_SIZE;
+		mock->out_remaining = length - PTP_CONTAINER_HEADER_SIZE - n;
+		if (mock->out_remaining)
+			return 0;
+		mock->cmd_pending = false;
+		return canon_r5_mock_answer(mock, mock->cmd_ex);
+	default:
+		return -EPROTO;
+	}
+}
+
+/* Synchronous bulk IN: block until the next transfer has crossed the link */
+static int canon_r5_mock_bulk_receive(struct canon_r5_device *dev, void *data, size_t len,
+				      size_t *actual_len)
+{
+	struct canon_r5_mock *mock = canon_r5_mock_from(dev);
+	struct canon_r5_mock_reply *reply, *done;
+	unsigned long flags;
+	ktime_t due;
+	size_t n;
+	long ret;
+	
+	*actual_len = 0;
+	
+	ret = wait_event_interruptible_timeout(mock->wait,
+					       READ_ONCE(mock->stopped) ||
+					       !list_empty_careful(&mock->replies),
+					       msecs_to_jiffies(CANON_R5_MOCK_TIMEOUT_MS));
+	if (ret < 0)
+		return ret;
+	
+	spin_lock_irqsave(&mock->lock, flags);
+	if (mock->stopped || list_empty(&mock->replies)) {
+		spin_unlock_irqrestore(&mock->lock, flags);
+		return mock->stopped ? -ESHUTDOWN : -ETIMEDOUT;
+	}
+	reply = list_first_entry(&mock->replies, struct canon_r5_mock_reply, list);
+	n = canon_r5_mock_plan_locked(mock, reply, len, &due);
+	spin_unlock_irqrestore(&mock->lock, flags);
+	
+	/* Only this receiver consumes replies, the head cannot go away meanwhile */
+	canon_r5_mock_sleep_until(due);
+	canon_r5_mock_copy(reply, data, n);
+	
+	spin_lock_irqsave(&mock->lock, flags);
+	done = canon_r5_mock_sent_locked(mock, reply, n, due);
+	spin_unlock_irqrestore(&mock->lock, flags);
+	
+	kfree(done);
+	*actual_len = n;
+	
+	return 0;
+}
+
+static int canon_r5_mock_rx_start(struct canon_r5_device *dev,
+				  void (*complete)(struct canon_r5_device *dev, const void *data,
+						   size_t len, int status))
+{
+	struct canon_r5_mock *mock = canon_r5_mock_from(dev);
+	unsigned long flags;
+	
+	spin_lock_irqsave(&mock->lock, flags);
+	mock->complete = complete;
+	spin_unlock_irqrestore(&mock->lock, flags);
+	
+	return 0;
+}
+
+static void canon_r5_mock_drop_replies(struct canon_r5_mock *mock)
+{
+	struct canon_r5_mock_reply *reply, *tmp;
+	unsigned long flags;
+	LIST_HEAD(dropped);
+	
+	spin_lock_irqsave(&mock->lock, flags);
+	list_splice_init(&mock->replies, &dropped);
+	mock->timer_armed = false;
+	spin_unlock_irqrestore(&mock->lock, flags);
+	
+	list_for_each_entry_safe(reply, tmp, &dropped, list)
+		kfree(reply);
+}
+
+/* Like killing the URBs: anything not yet delivered is lost */
+static void canon_r5_mock_rx_stop(struct canon_r5_device *dev)
+{
+	struct canon_r5_mock *mock = canon_r5_mock_from(dev);
+	unsigned long flags;
+	
+	spin_lock_irqsave(&mock->lock, flags);
+	mock->complete = NULL;
+	spin_unlock_irqrestore(&mock->lock, flags);
+	
+	hrtimer_cancel(&mock->timer);
+	canon_r5_mock_drop_replies(mock);
+}
+
+/* Create a mock camera and register it as the device's transport */
+struct canon_r5_mock *canon_r5_mock_create(struct canon_r5_device *dev,
+					   const struct canon_r5_mock_config *config)
+{
+	struct canon_r5_mock *mock;
+	int ret;
+	
+	if (!dev || !config)
+		return ERR_PTR(-EINVAL);
+	
+	mock = kzalloc(sizeof(*mock), GFP_KERNEL);
+	if (!mock)
+		return ERR_PTR(-ENOMEM);
+	
+	mock->packet = kmalloc(CANON_R5_MOCK_PACKET_SIZE, GFP_KERNEL);
+	if (!mock->packet) {
+		ret = -ENOMEM;
+		goto error_free;
+	}
+	
+	mock->dev = dev;
+	mock->config = *config;
+	mock->ops.bulk_send = canon_r5_mock_bulk_send;
+	mock->ops.bulk_receive = canon_r5_mock_bulk_receive;
+	if (config->async) {
+		mock->ops.rx_start = canon_r5_mock_rx_start;
+		mock->ops.rx_stop = canon_r5_mock_rx_stop;
+	}
+	
+	spin_lock_init(&mock->lock);
+	INIT_LIST_HEAD(&mock->replies);
+	init_waitqueue_head(&mock->wait);
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,13,0)
+	hrtimer_setup(&mock->timer, canon_r5_mock_timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+#else
+	hrtimer_init(&mock->timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+	mock->timer.function = canon_r5_mock_timer;
+#endif
+	
+	ret = canon_r5_register_transport(dev, &mock->ops);
+	if (ret)
+		goto error_free;
+	
+	return mock;
+	
+error_free:
+	kfree(mock->packet);
+	kfree(mock);
+	return ERR_PTR(ret);
+}
+EXPORT_SYMBOL_GPL(canon_r5_mock_create);
+
+/* The PTP layer must already be cleaned up */
+void canon_r5_mock_destroy(struct canon_r5_mock *mock)
+{
+	if (IS_ERR_OR_NULL(mock))
+		return;
+	
+	WRITE_ONCE(mock->stopped, true);
+	wake_up(&mock->wait);
+	
+	hrtimer_cancel(&mock->timer);
+	canon_r5_mock_drop_replies(mock);
+	canon_r5_unregister_transport(mock->dev);
+	
+	kfree(mock->packet);
+	kfree(mock);
+}
+EXPORT_SYMBOL_GPL(canon_r5_mock_destroy);
+
+/* Replay @session; the array must outlive the mock or the next load */
+void canon_r5_mock_load(struct canon_r5_mock *mock,
+			const struct canon_r5_mock_exchange *session, size_t len, bool strict)
+{
+	unsigned long flags;
+	
+	spin_lock_irqsave(&mock->lock, flags);
+	mock->session = session;
+	mock->session_len = session ? len : 0;
+	mock->cursor = 0;
+	mock->strict = strict;
+	spin_unlock_irqrestore(&mock->lock, flags);
+}
+EXPORT_SYMBOL_GPL(canon_r5_mock_load);
+
+void canon_r5_mock_get_stats(struct canon_r5_mock *mock, struct canon_r5_mock_stats *stats)
+{
+	unsigned long flags;
+	
+	spin_lock_irqsave(&mock->lock, flags);
+	*stats = mock->stats;
+	spin_unlock_irqrestore(&mock->lock, flags);
+}
+EXPORT_SYMBOL_GPL(canon_r5_mock_get_stats);
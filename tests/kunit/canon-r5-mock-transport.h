@@ -0,0 +1,106 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Canon R5 Linux Driver Suite
+ * Mock PTP transport for KUnit tests and benchmarks
+ *
+ * Copyright (C) 2025 Canon R5 Driver Project
+ */
+
+#ifndef __CANON_R5_MOCK_TRANSPORT_H__
+#define __CANON_R5_MOCK_TRANSPORT_H__
+
+#include <linux/types.h>
+#include <linux/list.h>
+#include <linux/spinlock.h>
+#include <linux/wait.h>
+#include <linux/hrtimer.h>
+#include <linux/ktime.h>
+
+/*
+ * Stands in for the USB transport: parses the command and data containers
+ * the PTP engine sends and answers them like a camera would, after a fixed
+ * latency and with data phases paced to a link bandwidth. Answers come from
+ * a recorded session when one is loaded, otherwise every command succeeds
+ * with no data.
+ */
+
+#define CANON_R5_MOCK_PACKET_SIZE	(64 * 1024)	/* Largest bulk IN transfer */
+#define CANON_R5_MOCK_TIMEOUT_MS	5000
+
+/* One recorded request/response pair */
+struct canon_r5_mock_exchange {
+	u16			code;		/* Operation answered */
+	u16			response;	/* 0 means PTP_RC_OK */
+	u32			params[PTP_MAX_PARAMS];
+	int			param_count;
+	bool			data_out;	/* A host data phase follows the command */
+	bool			no_response;	/* The camera swallows the command */
+	
+	/*
+	 * Data-in phase. A NULL @data sends @data_len filler bytes. Partial
+	 * object reads are answered with the requested slice of it.
+	 */
+	const void		*data;
+	size_t			data_len;
+};
+
+struct canon_r5_mock_config {
+	unsigned int		latency_us;	/* Command to first response byte */
+	u64			bandwidth;	/* Bytes per second, 0 for unlimited */
+	bool			async;		/* Offer rx_start(), as the USB transport does */
+};
+
+struct canon_r5_mock_stats {
+	u64			commands;
+	u64			bytes_in;	/* Camera to host, containers included */
+	u64			bytes_out;
+	u64			mismatches;	/* Commands a strict replay did not expect */
+};
+
+struct canon_r5_mock {
+	struct canon_r5_transport_ops ops;
+	struct canon_r5_device	*dev;
+	struct canon_r5_mock_config config;
+	
+	/* Recorded session */
+	const struct canon_r5_mock_exchange *session;
+	size_t			session_len;
+	size_t			cursor;
+	bool			strict;		/* Answer in recorded order only */
+	
+	spinlock_t		lock;
+	
+	/* Host to camera: command waiting for the end of its data phase */
+	bool			cmd_pending;
+	u16			cmd_code;
+	u32			cmd_trans_id;
+	u32			cmd_params[PTP_MAX_PARAMS];
+	int			cmd_param_count;
+	const struct canon_r5_mock_exchange *cmd_ex;
+	size_t			out_remaining;
+	
+	/* Camera to host, paced by a simulated link */
+	struct list_head	replies;
+	ktime_t			link_free;	/* When the link finishes its last packet */
+	wait_queue_head_t	wait;
+	bool			stopped;
+	
+	/* Asynchronous stream */
+	void (*complete)(struct canon_r5_device *dev, const void *data,
+			 size_t len, int status);
+	struct hrtimer		timer;
+	bool			timer_armed;
+	size_t			packet_len;	/* Planned for the next expiry */
+	u8			*packet;
+	
+	struct canon_r5_mock_stats stats;
+};
+
+struct canon_r5_mock *canon_r5_mock_create(struct canon_r5_device *dev,
+					   const struct canon_r5_mock_config *config);
+void canon_r5_mock_destroy(struct canon_r5_mock *mock);
+void canon_r5_mock_load(struct canon_r5_mock *mock,
+			const struct canon_r5_mock_exchange *session, size_t len, bool strict);
+void canon_r5_mock_get_stats(struct canon_r5_mock *mock, struct canon_r5_mock_stats *stats);
+
+#endif /* __CANON_R5_MOCK_TRANSPORT_H__ */
@@ -12,6 +12,7 @@
 
 #include "core/canon-r5.h"
 #include "core/canon-r5-ptp.h"
+#include "canon-r5-mock-transport.h"
 
 /* Test fixture for PTP tests */
 struct canon_r5_ptp_test_context {
@@ -90,6 +91,240 @@ static void canon_r5_ptp_command_validation_test(struct kunit *test)
 	KUNIT_EXPECT_EQ(test, ret, -EINVAL);
 }
 
+/* Test transaction engine submission checks */
+static void canon_r5_ptp_transaction_submit_test(struct kunit *test)
+{
+	struct canon_r5_ptp_test_context *ctx = test->priv;
+	struct canon_r5_device *dev = ctx->dev;
+	struct canon_r5_ptp_transaction trans;
+	u32 params[PTP_MAX_PARAMS + 2] = { 0 };
+	int ret;
+	
+	/* Parameter count is clamped to the container limit */
+	canon_r5_ptp_transaction_init(&trans, PTP_OP_GET_DEVICE_INFO, params, ARRAY_SIZE(params));
+	KUNIT_EXPECT_EQ(test, trans.param_count, PTP_MAX_PARAMS);
+	KUNIT_EXPECT_EQ(test, trans.state, CANON_R5_PTP_TRANS_IDLE);
+	
+	/* No transport registered: submission must fail without queueing */
+	ret = canon_r5_ptp_submit(dev, &trans);
+	KUNIT_EXPECT_EQ(test, ret, -ENODEV);
+	KUNIT_EXPECT_EQ(test, trans.state, CANON_R5_PTP_TRANS_IDLE);
+	KUNIT_EXPECT_TRUE(test, list_empty(&dev->ptp.tx_queue[trans.traffic_class]));
+	
+	/* Cancelling an idle transaction is a no-op */
+	KUNIT_EXPECT_EQ(test, canon_r5_ptp_cancel(dev, &trans, -ECANCELED), 0);
+	
+	ret = canon_r5_ptp_submit(NULL, &trans);
+	KUNIT_EXPECT_EQ(test, ret, -EINVAL);
+	
+	/* Traffic class follows the opcode and must be one the scheduler knows */
+	KUNIT_EXPECT_EQ(test, trans.traffic_class, (u8)CANON_R5_PTP_CLASS_CONTROL);
+	canon_r5_ptp_transaction_init(&trans, CANON_PTP_OP_GET_LIVEVIEW, NULL, 0);
+	KUNIT_EXPECT_EQ(test, trans.traffic_class, (u8)CANON_R5_PTP_CLASS_REALTIME);
+	canon_r5_ptp_transaction_init(&trans, CANON_PTP_OP_GET_PARTIAL_OBJECT, params, 3);
+	KUNIT_EXPECT_EQ(test, trans.traffic_class, (u8)CANON_R5_PTP_CLASS_BULK);
+	
+	/* Audio commands reuse the 64-bit object opcodes but must not queue as bulk */
+	canon_r5_ptp_transaction_init(&trans, CANON_PTP_OP_AUDIO_START, NULL, 0);
+	KUNIT_EXPECT_EQ(test, trans.traffic_class, (u8)CANON_R5_PTP_CLASS_CONTROL);
+	canon_r5_ptp_transaction_init(&trans, CANON_PTP_OP_AUDIO_SET_INPUT, params, 1);
+	KUNIT_EXPECT_EQ(test, trans.traffic_class, (u8)CANON_R5_PTP_CLASS_CONTROL);
+	
+	trans.traffic_class = CANON_R5_PTP_CLASSES;
+	ret = canon_r5_ptp_submit(dev, &trans);
+	KUNIT_EXPECT_EQ(test, ret, -EINVAL);
+}
+
+static int canon_r5_ptp_test_consume(struct canon_r5_ptp_object_reader *reader,
+				     u64 offset, const void *data, size_t len)
+{
+	(*(int *)reader->context)++;
+	return 0;
+}
+
+/* Test the streaming object reader setup and failure paths */
+static void canon_r5_ptp_object_reader_test(struct kunit *test)
+{
+	struct canon_r5_ptp_test_context *ctx = test->priv;
+	struct canon_r5_device *dev = ctx->dev;
+	struct canon_r5_ptp_object_reader *reader;
+	int calls = 0;
+	int ret;
+	
+	reader = kunit_kzalloc(test, sizeof(*reader), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, reader);
+	
+	canon_r5_ptp_reader_init(reader, dev, 0x00010001, 4096, 3 * 1024 * 1024, NULL);
+	KUNIT_EXPECT_EQ(test, reader->offset, 4096ULL);
+	KUNIT_EXPECT_EQ(test, reader->end, 4096ULL + 3 * 1024 * 1024);
+	KUNIT_EXPECT_EQ(test, reader->chunk_size, (size_t)CANON_R5_PTP_READER_CHUNK_SIZE);
+	KUNIT_EXPECT_EQ(test, reader->depth, CANON_R5_PTP_READER_DEPTH);
+	
+	/* No transport: the first chunk fails to submit and nothing is consumed */
+	reader->consume = canon_r5_ptp_test_consume;
+	reader->context = &calls;
+	reader->depth = 64;
+	ret = canon_r5_ptp_reader_run(reader);
+	KUNIT_EXPECT_EQ(test, ret, -ENODEV);
+	KUNIT_EXPECT_EQ(test, calls, 0);
+	KUNIT_EXPECT_EQ(test, reader->consumed, 0ULL);
+	KUNIT_EXPECT_EQ(test, reader->depth, CANON_R5_PTP_READER_MAX_DEPTH);
+	KUNIT_EXPECT_FALSE(test, reader->chunk[0].busy);
+	KUNIT_EXPECT_NULL(test, reader->bounce);
+	
+	/* An empty range completes without issuing anything */
+	canon_r5_ptp_reader_init(reader, dev, 0x00010001, 0, 0, NULL);
+	KUNIT_EXPECT_EQ(test, canon_r5_ptp_reader_run(reader), 0);
+	
+	reader->chunk_size = 0;
+	KUNIT_EXPECT_EQ(test, canon_r5_ptp_reader_run(reader), -EINVAL);
+	KUNIT_EXPECT_EQ(test, canon_r5_ptp_reader_run(NULL), -EINVAL);
+}
+
+static u32 canon_r5_ptp_test_props[8];
+static unsigned int canon_r5_ptp_test_nr_props;
+static u32 canon_r5_ptp_test_captured;
+
+static void canon_r5_ptp_test_property_changed(struct canon_r5_device *dev, u32 property)
+{
+	if (canon_r5_ptp_test_nr_props < ARRAY_SIZE(canon_r5_ptp_test_props))
+		canon_r5_ptp_test_props[canon_r5_ptp_test_nr_props] = property;
+	canon_r5_ptp_test_nr_props++;
+}
+
+static void canon_r5_ptp_test_capture_complete(struct canon_r5_device *dev, u32 object_handle)
+{
+	canon_r5_ptp_test_captured = object_handle;
+}
+
+static void canon_r5_ptp_test_push_event(struct canon_r5_device *dev, u16 code, u32 param)
+{
+	struct ptp_container container = { 0 };
+	
+	container.length = cpu_to_le32(PTP_CONTAINER_HEADER_SIZE + sizeof(u32));
+	container.type = cpu_to_le16(PTP_CONTAINER_EVENT);
+	container.code = cpu_to_le16(code);
+	container.params[0] = cpu_to_le32(param);
+	canon_r5_ptp_event_received(dev, &container, sizeof(container));
+}
+
+/* Test the interrupt event ring, batch coalescing and overflow accounting */
+static void canon_r5_ptp_event_ring_test(struct kunit *test)
+{
+	struct canon_r5_ptp_test_context *ctx = test->priv;
+	struct canon_r5_device *dev = ctx->dev;
+	struct ptp_container response = { 0 };
+	unsigned int i;
+	
+	canon_r5_ptp_test_nr_props = 0;
+	canon_r5_ptp_test_captured = 0;
+	dev->event_handler.property_changed = canon_r5_ptp_test_property_changed;
+	dev->event_handler.still_capture_complete = canon_r5_ptp_test_capture_complete;
+	
+	/* Only event containers of at least a header are queued */
+	response.length = cpu_to_le32(PTP_CONTAINER_HEADER_SIZE);
+	response.type = cpu_to_le16(PTP_CONTAINER_RESPONSE);
+	canon_r5_ptp_event_received(dev, &response, sizeof(response));
+	canon_r5_ptp_event_received(dev, &response, PTP_CONTAINER_HEADER_SIZE - 1);
+	KUNIT_EXPECT_EQ(test, canon_r5_ptp_check_event(dev), 0);
+	
+	/* A repeated property in one batch is delivered once, in its last position */
+	canon_r5_ptp_test_push_event(dev, PTP_EC_DEVICE_PROP_CHANGED, 0xD101);
+	canon_r5_ptp_test_push_event(dev, PTP_EC_DEVICE_PROP_CHANGED, 0xD102);
+	canon_r5_ptp_test_push_event(dev, PTP_EC_DEVICE_PROP_CHANGED, 0xD101);
+	canon_r5_ptp_test_push_event(dev, CANON_PTP_EC_REQUEST_OBJECT_TRANSFER, 0x90000001);
+	KUNIT_EXPECT_EQ(test, canon_r5_ptp_check_event(dev), 4);
+	
+	canon_r5_ptp_event_handler(&dev->ptp.event_work);
+	KUNIT_EXPECT_EQ(test, canon_r5_ptp_check_event(dev), 0);
+	KUNIT_EXPECT_EQ(test, canon_r5_ptp_test_nr_props, 2U);
+	KUNIT_EXPECT_EQ(test, canon_r5_ptp_test_props[0], 0xD102U);
+	KUNIT_EXPECT_EQ(test, canon_r5_ptp_test_props[1], 0xD101U);
+	KUNIT_EXPECT_EQ(test, canon_r5_ptp_test_captured, 0x90000001U);
+	
+	/* A full ring drops new events and counts them */
+	for (i = 0; i < CANON_R5_EVENT_RING_SIZE + 3; i++)
+		canon_r5_ptp_test_push_event(dev, PTP_EC_DEVICE_PROP_CHANGED, 0xD200 + i);
+	KUNIT_EXPECT_EQ(test, canon_r5_ptp_check_event(dev), CANON_R5_EVENT_RING_SIZE);
+	KUNIT_EXPECT_EQ(test, atomic_read(&dev->ptp.events_dropped), 3);
+	
+	canon_r5_ptp_test_nr_props = 0;
+	canon_r5_ptp_event_handler(&dev->ptp.event_work);
+	KUNIT_EXPECT_EQ(test, canon_r5_ptp_test_nr_props, (unsigned int)CANON_R5_EVENT_RING_SIZE);
+	KUNIT_EXPECT_EQ(test, atomic_read(&dev->ptp.events_dropped), 0);
+	
+	dev->event_handler.property_changed = NULL;
+	dev->event_handler.still_capture_complete = NULL;
+}
+
+/* Test property cache hits, change-event invalidation and uncached codes */
+static void canon_r5_ptp_property_cache_test(struct kunit *test)
+{
+	struct canon_r5_ptp_test_context *ctx = test->priv;
+	struct canon_r5_device *dev = ctx->dev;
+	u16 iso = 800;
+	u32 value = 0xFFFFFFFF;
+	
+	canon_r5_props_invalidate(dev);
+	KUNIT_EXPECT_EQ(test, canon_r5_props_lookup(dev, PTP_DPC_EXPOSURE_INDEX,
+						     &value, sizeof(value)), -ENOENT);
+	
+	/* Narrow values are zero-extended into the caller's buffer */
+	canon_r5_props_store(dev, PTP_DPC_EXPOSURE_INDEX, &iso, sizeof(iso));
+	KUNIT_EXPECT_EQ(test, canon_r5_props_lookup(dev, PTP_DPC_EXPOSURE_INDEX,
+						     &value, sizeof(value)), 0);
+	KUNIT_EXPECT_EQ(test, value, 800U);
+	KUNIT_EXPECT_EQ(test, canon_r5_props_get(dev, PTP_DPC_EXPOSURE_INDEX,
+						  &value, sizeof(value)), 0);
+	
+	/* A change event makes the next read go back to the camera */
+	canon_r5_props_changed(dev, PTP_DPC_EXPOSURE_INDEX);
+	KUNIT_EXPECT_EQ(test, canon_r5_props_lookup(dev, PTP_DPC_EXPOSURE_INDEX,
+						     &value, sizeof(value)), -ENOENT);
+	
+	/* Canon codes are tracked, unknown ones never are */
+	canon_r5_props_store(dev, CANON_PTP_DPC_DRIVE_MODE, &iso, sizeof(iso));
+	KUNIT_EXPECT_EQ(test, canon_r5_props_lookup(dev, CANON_PTP_DPC_DRIVE_MODE,
+						     &value, sizeof(value)), 0);
+	KUNIT_EXPECT_EQ(test, canon_r5_props_lookup(dev, 0x5FFF,
+						     &value, sizeof(value)), -EOPNOTSUPP);
+	
+	canon_r5_props_invalidate(dev);
+	KUNIT_EXPECT_EQ(test, canon_r5_props_lookup(dev, CANON_PTP_DPC_DRIVE_MODE,
+						     &value, sizeof(value)), -ENOENT);
+}
+
+/* Test that bracketed property writes are combined before being sent */
+static void canon_r5_ptp_property_write_test(struct kunit *test)
+{
+	struct canon_r5_ptp_test_context *ctx = test->priv;
+	struct canon_r5_device *dev = ctx->dev;
+	u16 iso = 400, f_number = 560;
+	
+	canon_r5_props_write_begin(dev);
+	KUNIT_EXPECT_EQ(test, canon_r5_props_write(dev, PTP_DPC_EXPOSURE_INDEX,
+						    &iso, sizeof(iso)), 0);
+	KUNIT_EXPECT_EQ(test, canon_r5_props_write(dev, PTP_DPC_F_NUMBER,
+						    &f_number, sizeof(f_number)), 0);
+	iso = 1600;
+	KUNIT_EXPECT_EQ(test, canon_r5_props_write(dev, PTP_DPC_EXPOSURE_INDEX,
+						    &iso, sizeof(iso)), 0);
+	
+	/* The superseded ISO keeps its place; only the latest value is queued */
+	KUNIT_EXPECT_EQ(test, dev->props.nr_writes, 2U);
+	KUNIT_EXPECT_EQ(test, dev->props.write_order[0],
+			(u8)(PTP_DPC_EXPOSURE_INDEX - PTP_DPC_BATTERY_LEVEL));
+	KUNIT_EXPECT_EQ(test, *(u16 *)dev->props.entries[dev->props.write_order[0]].write_value,
+			(u16)1600);
+	KUNIT_EXPECT_FALSE(test, delayed_work_pending(&dev->props.write_work));
+	
+	/* No transport: the commit drains the queue and reports the failure */
+	KUNIT_EXPECT_NE(test, canon_r5_props_write_commit(dev), 0);
+	KUNIT_EXPECT_EQ(test, dev->props.nr_writes, 0U);
+	KUNIT_EXPECT_EQ(test, canon_r5_props_lookup(dev, PTP_DPC_EXPOSURE_INDEX,
+						     &iso, sizeof(iso)), -ENOENT);
+}
+
 /* Test Canon-specific PTP operations */
 static void canon_r5_ptp_canon_operations_test(struct kunit *test)
 {
@@ -187,6 +422,51 @@ static void canon_r5_ptp_property_operations_test(struct kunit *test)
 	KUNIT_EXPECT_EQ(test, ret, -EINVAL);
 }
 
+/* Test in-place live view frame parsing */
+static void canon_r5_ptp_liveview_parse_test(struct kunit *test)
+{
+	struct canon_r5_ptp_test_context *ctx = test->priv;
+	struct canon_r5_device *dev = ctx->dev;
+	struct canon_r5_ptp_transaction trans;
+	struct canon_liveview_header header = { 0 };
+	struct kvec vec[2];
+	u8 buffer[64];
+	size_t frame_size;
+	int ret;
+	
+	memset(buffer, 0, sizeof(buffer));
+	canon_r5_ptp_liveview_prepare(&trans, vec, &header, buffer, sizeof(buffer));
+	KUNIT_EXPECT_EQ(test, trans.code, CANON_PTP_OP_GET_LIVEVIEW);
+	KUNIT_EXPECT_EQ(test, trans.data_in_nvec, 2U);
+	
+	/* Header only: no payload */
+	trans.data_in_actual = sizeof(header) - 1;
+	ret = canon_r5_ptp_liveview_parse(dev, &trans, &header, buffer, &frame_size);
+	KUNIT_EXPECT_EQ(test, ret, -ENODATA);
+	
+	/* Payload follows the header directly */
+	header.length = cpu_to_le32(40);
+	trans.data_in_length = sizeof(header) + 40;
+	trans.data_in_actual = sizeof(header) + 40;
+	ret = canon_r5_ptp_liveview_parse(dev, &trans, &header, buffer, &frame_size);
+	KUNIT_EXPECT_EQ(test, ret, 0);
+	KUNIT_EXPECT_EQ(test, frame_size, (size_t)40);
+	
+	/* Padded header: payload is shifted to the start of the buffer */
+	buffer[8] = 0xAB;
+	header.data_offset = cpu_to_le32(sizeof(header) + 8);
+	header.length = 0;
+	ret = canon_r5_ptp_liveview_parse(dev, &trans, &header, buffer, &frame_size);
+	KUNIT_EXPECT_EQ(test, ret, 0);
+	KUNIT_EXPECT_EQ(test, frame_size, (size_t)32);
+	KUNIT_EXPECT_EQ(test, buffer[0], 0xAB);
+	
+	/* Frame larger than the destination is rejected */
+	trans.data_in_length = sizeof(header) + sizeof(buffer) + 1;
+	ret = canon_r5_ptp_liveview_parse(dev, &trans, &header, buffer, &frame_size);
+	KUNIT_EXPECT_EQ(test, ret, -EMSGSIZE);
+}
+
 /* Test PTP data validation */
 static void canon_r5_ptp_data_validation_test(struct kunit *test)
 {
@@ -288,9 +568,15 @@ static struct kunit_case canon_r5_ptp_test_cases[] = {
 	KUNIT_CASE(canon_r5_ptp_session_test),
 	KUNIT_CASE(canon_r5_ptp_transaction_id_test),
 	KUNIT_CASE(canon_r5_ptp_command_validation_test),
+	KUNIT_CASE(canon_r5_ptp_transaction_submit_test),
+	KUNIT_CASE(canon_r5_ptp_object_reader_test),
+	KUNIT_CASE(canon_r5_ptp_event_ring_test),
+	KUNIT_CASE(canon_r5_ptp_property_cache_test),
+	KUNIT_CASE(canon_r5_ptp_property_write_test),
 	KUNIT_CASE(canon_r5_ptp_canon_operations_test),
 	KUNIT_CASE(canon_r5_ptp_capture_operations_test),
 	KUNIT_CASE(canon_r5_ptp_property_operations_test),
+	KUNIT_CASE(canon_r5_ptp_liveview_parse_test),
 	KUNIT_CASE(canon_r5_ptp_data_validation_test),
 	KUNIT_CASE(canon_r5_ptp_error_handling_test),
 	{}
@@ -304,8 +590,112 @@ static struct kunit_suite canon_r5_ptp_test_suite = {
 	.test_cases = canon_r5_ptp_test_cases,
 };
 
-/* Register the test suite */
-kunit_test_suite(canon_r5_ptp_test_suite);
+/* Transaction engine against the mock camera */
+struct canon_r5_ptp_mock_context {
+	struct platform_device *pdev;
+	struct canon_r5_device *dev;
+	struct canon_r5_mock *mock;
+	bool initialized;
+};
+
+static int canon_r5_ptp_mock_init(struct kunit *test)
+{
+	struct canon_r5_ptp_mock_context *ctx;
+	
+	ctx = kunit_kzalloc(test, sizeof(*ctx), GFP_KERNEL);
+	if (!ctx)
+		return -ENOMEM;
+	
+	ctx->pdev = platform_device_alloc("canon-r5-ptp-mock-test", 0);
+	if (!ctx->pdev)
+		return -ENOMEM;
+	
+	if (platform_device_add(ctx->pdev)) {
+		platform_device_put(ctx->pdev);
+		return -ENODEV;
+	}
+	
+	test->priv = ctx;
+	return 0;
+}
+
+static void canon_r5_ptp_mock_exit(struct kunit *test)
+{
+	struct canon_r5_ptp_mock_context *ctx = test->priv;
+	
+	if (!ctx)
+		return;
+	
+	if (ctx->initialized)
+		canon_r5_device_cleanup(ctx->dev);
+	if (!IS_ERR_OR_NULL(ctx->mock))
+		canon_r5_mock_destroy(ctx->mock);
+	if (ctx->dev)
+		canon_r5_device_put(ctx->dev);
+	platform_device_unregister(ctx->pdev);
+}
+
+/*
+ * A command the camera never answers times out and leaves its id draining
+ * in the one-slot window; once the drain deadline passes the slot is given
+ * back and the next command goes out and completes.
+ */
+static void canon_r5_ptp_dropped_response_test(struct kunit *test)
+{
+	struct canon_r5_ptp_mock_context *ctx = test->priv;
+	struct canon_r5_mock_config config = {
+		.latency_us = 100,
+	};
+	static const struct canon_r5_mock_exchange session[] = {
+		{ .code = CANON_PTP_OP_AUTOFOCUS, .no_response = true },
+		{ .code = CANON_PTP_OP_GET_BATTERY },
+	};
+	struct canon_r5_ptp_transaction trans;
+	u16 response_code = 0;
+	int ret;
+	
+	ctx->dev = canon_r5_device_alloc(&ctx->pdev->dev);
+	KUNIT_ASSERT_NOT_NULL(test, ctx->dev);
+	
+	ctx->mock = canon_r5_mock_create(ctx->dev, &config);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, ctx->mock);
+	
+	KUNIT_ASSERT_EQ(test, canon_r5_device_initialize(ctx->dev), 0);
+	ctx->initialized = true;
+	KUNIT_ASSERT_EQ(test, canon_r5_ptp_open_session(ctx->dev), 0);
+	flush_work(&ctx->dev->props.refresh_work);
+	
+	canon_r5_mock_load(ctx->mock, session, ARRAY_SIZE(session), false);
+	
+	ret = canon_r5_ptp_command(ctx->dev, CANON_PTP_OP_AUTOFOCUS, NULL, 0,
+				   NULL, 0, &response_code);
+	KUNIT_EXPECT_EQ(test, ret, -ETIMEDOUT);
+	
+	/* Queued behind the drain for up to one more timeout, then answered */
+	canon_r5_ptp_transaction_init(&trans, CANON_PTP_OP_GET_BATTERY, NULL, 0);
+	KUNIT_ASSERT_EQ(test, canon_r5_ptp_submit(ctx->dev, &trans), 0);
+	ret = canon_r5_ptp_wait(ctx->dev, &trans, 3 * CANON_R5_PTP_TIMEOUT_MS);
+	KUNIT_EXPECT_EQ(test, ret, 0);
+	KUNIT_EXPECT_EQ(test, trans.response_code, (u16)PTP_RC_OK);
+	KUNIT_EXPECT_EQ(test, READ_ONCE(ctx->dev->ptp.inflight), 0U);
+	
+	canon_r5_mock_load(ctx->mock, NULL, 0, false);
+}
+
+static struct kunit_case canon_r5_ptp_mock_test_cases[] = {
+	KUNIT_CASE_SLOW(canon_r5_ptp_dropped_response_test),
+	{}
+};
+
+static struct kunit_suite canon_r5_ptp_mock_test_suite = {
+	.name = "canon-r5-ptp-mock",
+	.init = canon_r5_ptp_mock_init,
+	.exit = canon_r5_ptp_mock_exit,
+	.test_cases = canon_r5_ptp_mock_test_cases,
+};
+
+/* Register the test suites */
+kunit_test_suites(&canon_r5_ptp_test_suite, &canon_r5_ptp_mock_test_suite);
 
 MODULE_LICENSE("GPL v2");
 MODULE_DESCRIPTION("Canon R5 PTP Protocol KUnit Tests");
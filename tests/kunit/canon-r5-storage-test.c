@@ -291,22 +291,146 @@ static void canon_r5_storage_directory_entry_test(struct kunit *test)
 	KUNIT_EXPECT_PTR_EQ(test, list_first_entry(&dir_list, struct canon_r5_dir_entry, list), entry);
 }
 
+/* Test the (handle) and (parent, name) metadata index */
+static void canon_r5_storage_index_test(struct kunit *test)
+{
+	static const char * const names[] = { "IMG_0003.CR3", "IMG_0001.CR3", "IMG_0002.CR3" };
+	struct canon_r5_storage_test_ctx *ctx = test->priv;
+	struct canon_r5_fs_info *fs_info;
+	struct canon_r5_file_object *file;
+	struct canon_r5_dir_entry entries[4];
+	int i;
+
+	fs_info = kunit_kzalloc(test, sizeof(*fs_info), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, fs_info);
+	fs_info->storage = ctx->storage_dev;
+	fs_info->file_tree = RB_ROOT;
+	fs_info->name_tree = RB_ROOT;
+	INIT_LIST_HEAD(&fs_info->file_list);
+	spin_lock_init(&fs_info->file_lock);
+	canon_r5_storage_cache_init(fs_info, 0);
+	ctx->storage_dev->fs_info = fs_info;
+
+	/* Two directories, inserted out of name order */
+	for (i = 0; i < 4; i++) {
+		file = kzalloc(sizeof(*file), GFP_KERNEL);
+		KUNIT_ASSERT_NOT_NULL(test, file);
+		kref_init(&file->ref_count);
+		INIT_LIST_HEAD(&file->list);
+		file->object_handle = 0x00010001 + i;
+		file->parent_handle = (i == 3) ? 0x100 : 0;
+		strcpy(file->filename, (i == 3) ? names[1] : names[i]);
+		canon_r5_storage_index_insert(fs_info, file);
+	}
+	KUNIT_EXPECT_EQ(test, fs_info->nr_objects, 4);
+
+	/* The same name resolves per parent */
+	file = canon_r5_storage_index_lookup(fs_info, 0, "IMG_0001.CR3");
+	KUNIT_ASSERT_NOT_NULL(test, file);
+	KUNIT_EXPECT_EQ(test, file->object_handle, 0x00010002);
+	canon_r5_storage_put_file(file);
+
+	file = canon_r5_storage_index_lookup(fs_info, 0x100, "IMG_0001.CR3");
+	KUNIT_ASSERT_NOT_NULL(test, file);
+	KUNIT_EXPECT_EQ(test, file->object_handle, 0x00010004);
+	canon_r5_storage_put_file(file);
+
+	KUNIT_EXPECT_NULL(test, canon_r5_storage_index_lookup(fs_info, 0, "IMG_9999.CR3"));
+
+	/* Children come back in name order, honouring skip and resume */
+	KUNIT_EXPECT_EQ(test, canon_r5_storage_index_children(fs_info, 0, NULL, 0, entries, 4), 3);
+	KUNIT_EXPECT_STREQ(test, entries[0].name, "IMG_0001.CR3");
+	KUNIT_EXPECT_STREQ(test, entries[2].name, "IMG_0003.CR3");
+	KUNIT_EXPECT_EQ(test, canon_r5_storage_index_children(fs_info, 0, NULL, 2, entries, 4), 1);
+	KUNIT_EXPECT_STREQ(test, entries[0].name, "IMG_0003.CR3");
+	KUNIT_EXPECT_EQ(test, canon_r5_storage_index_children(fs_info, 0, "IMG_0001.CR3", 0,
+							      entries, 4), 2);
+	KUNIT_EXPECT_STREQ(test, entries[0].name, "IMG_0002.CR3");
+
+	/* Removal by handle drops both keys */
+	canon_r5_storage_index_remove(fs_info, 0x00010002);
+	KUNIT_EXPECT_NULL(test, canon_r5_storage_get_file(ctx->storage_dev, 0x00010002));
+	KUNIT_EXPECT_NULL(test, canon_r5_storage_index_lookup(fs_info, 0, "IMG_0001.CR3"));
+	KUNIT_EXPECT_EQ(test, fs_info->nr_objects, 3);
+
+	canon_r5_storage_index_destroy(fs_info);
+	KUNIT_EXPECT_EQ(test, fs_info->nr_objects, 0);
+	KUNIT_EXPECT_TRUE(test, RB_EMPTY_ROOT(&fs_info->name_tree));
+	ctx->storage_dev->fs_info = NULL;
+}
+
+/* Test extent cache budget, LRU order, invalidation and shrinking */
+static void canon_r5_storage_extent_cache_test(struct kunit *test)
+{
+	struct canon_r5_fs_info *fs_info;
+	struct canon_r5_cache_extent *extent;
+	u8 *data;
+
+	fs_info = kunit_kzalloc(test, sizeof(*fs_info), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, fs_info);
+	data = kunit_kzalloc(test, CANON_R5_CACHE_EXTENT_SIZE, GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, data);
+
+	/* Room for three full extents */
+	canon_r5_storage_cache_init(fs_info, 3 * CANON_R5_CACHE_EXTENT_SIZE);
+
+	data[0] = 0xA0;
+	KUNIT_EXPECT_EQ(test, canon_r5_storage_cache_insert(fs_info, 1, 0, data,
+							      CANON_R5_CACHE_EXTENT_SIZE), 0);
+	data[0] = 0xA1;
+	KUNIT_EXPECT_EQ(test, canon_r5_storage_cache_insert(fs_info, 1, 1, data,
+							      CANON_R5_CACHE_EXTENT_SIZE), 0);
+	data[0] = 0xB0;
+	KUNIT_EXPECT_EQ(test, canon_r5_storage_cache_insert(fs_info, 2, 0, data, 100), 0);
+	KUNIT_EXPECT_EQ(test, fs_info->cache.total_size, 2 * CANON_R5_CACHE_EXTENT_SIZE + 100);
+
+	/* A hit makes (1, 0) most recent, so (1, 1) is evicted next */
+	extent = canon_r5_storage_cache_lookup(fs_info, 1, 0);
+	KUNIT_ASSERT_NOT_NULL(test, extent);
+	KUNIT_EXPECT_EQ(test, ((u8 *)extent->data)[0], 0xA0);
+	canon_r5_storage_cache_put(extent);
+
+	KUNIT_EXPECT_EQ(test, canon_r5_storage_cache_insert(fs_info, 3, 0, data,
+							      CANON_R5_CACHE_EXTENT_SIZE), 0);
+	KUNIT_EXPECT_NULL(test, canon_r5_storage_cache_lookup(fs_info, 1, 1));
+	KUNIT_EXPECT_LE(test, fs_info->cache.total_size, fs_info->cache.max_size);
+	KUNIT_EXPECT_EQ(test, fs_info->cache.nr_extents, 3);
+
+	/* Invalidation drops one object's extents and fixes the byte count */
+	canon_r5_storage_cache_invalidate(fs_info, 2);
+	KUNIT_EXPECT_NULL(test, canon_r5_storage_cache_lookup(fs_info, 2, 0));
+	KUNIT_EXPECT_EQ(test, fs_info->cache.total_size, 2 * CANON_R5_CACHE_EXTENT_SIZE);
+
+	KUNIT_EXPECT_EQ(test, canon_r5_storage_cache_shrink(fs_info, 1), 1);
+	KUNIT_EXPECT_EQ(test, canon_r5_storage_cache_shrink(fs_info, 8), 1);
+	KUNIT_EXPECT_EQ(test, fs_info->cache.total_size, 0);
+	KUNIT_EXPECT_EQ(test, fs_info->cache.nr_extents, 0);
+}
+
 /* Test storage statistics */
 static void canon_r5_storage_stats_test(struct kunit *test)
 {
+	static const char * const names[CANON_R5_STORAGE_COUNTERS] = {
+		"files_read", "files_written", "bytes_read", "bytes_written",
+		"cache_hits", "cache_misses", "ptp_operations", "ptp_errors",
+	};
 	struct canon_r5_storage_test_ctx *ctx = test->priv;
+	struct canon_r5_counter_set *counters = &ctx->storage_dev->counters;
 	struct canon_r5_storage_stats stats;
 
+	KUNIT_ASSERT_EQ(test, canon_r5_counters_register(NULL, counters, "storage", names,
+							 CANON_R5_STORAGE_COUNTERS), 0);
+
 	/* Initialize statistics */
 	memset(&ctx->storage_dev->stats, 0, sizeof(ctx->storage_dev->stats));
-	ctx->storage_dev->stats.files_read = 100;
-	ctx->storage_dev->stats.files_written = 25;
-	ctx->storage_dev->stats.bytes_read = 1024 * 1024 * 1024; /* 1GB */
-	ctx->storage_dev->stats.bytes_written = 256 * 1024 * 1024; /* 256MB */
-	ctx->storage_dev->stats.cache_hits = 150;
-	ctx->storage_dev->stats.cache_misses = 50;
-	ctx->storage_dev->stats.ptp_operations = 200;
-	ctx->storage_dev->stats.ptp_errors = 5;
+	canon_r5_counter_add(counters, CANON_R5_STORAGE_FILES_READ, 100);
+	canon_r5_counter_add(counters, CANON_R5_STORAGE_FILES_WRITTEN, 25);
+	canon_r5_counter_add(counters, CANON_R5_STORAGE_BYTES_READ, 1024 * 1024 * 1024); /* 1GB */
+	canon_r5_counter_add(counters, CANON_R5_STORAGE_BYTES_WRITTEN, 256 * 1024 * 1024); /* 256MB */
+	canon_r5_counter_add(counters, CANON_R5_STORAGE_CACHE_HITS, 150);
+	canon_r5_counter_add(counters, CANON_R5_STORAGE_CACHE_MISSES, 50);
+	canon_r5_counter_add(counters, CANON_R5_STORAGE_PTP_OPERATIONS, 200);
+	canon_r5_counter_add(counters, CANON_R5_STORAGE_PTP_ERRORS, 5);
 	ctx->storage_dev->stats.avg_read_speed = 1500; /* KB/s */
 	ctx->storage_dev->stats.avg_write_speed = 1200; /* KB/s */
 	ctx->storage_dev->stats.avg_response_time = 15; /* microseconds */
@@ -337,6 +461,14 @@ static void canon_r5_storage_stats_test(struct kunit *test)
 	KUNIT_EXPECT_EQ(test, stats.files_written, 0);
 	KUNIT_EXPECT_EQ(test, stats.bytes_read, 0);
 	KUNIT_EXPECT_EQ(test, stats.bytes_written, 0);
+
+	/* Hit counts are 64-bit and no longer wrap at 2^32 */
+	canon_r5_counter_add(counters, CANON_R5_STORAGE_CACHE_HITS, 1ULL << 32);
+	canon_r5_counter_inc(counters, CANON_R5_STORAGE_CACHE_HITS);
+	ret = canon_r5_storage_get_stats(ctx->storage_dev, &stats);
+	KUNIT_EXPECT_EQ(test, stats.cache_hits, (1ULL << 32) + 1);
+
+	canon_r5_counters_unregister(counters);
 }
 
 /* Test storage type name conversion */
@@ -386,6 +518,8 @@ static struct kunit_case canon_r5_storage_test_cases[] = {
 	KUNIT_CASE(canon_r5_storage_write_protection_test),
 	KUNIT_CASE(canon_r5_storage_file_object_test),
 	KUNIT_CASE(canon_r5_storage_directory_entry_test),
+	KUNIT_CASE(canon_r5_storage_index_test),
+	KUNIT_CASE(canon_r5_storage_extent_cache_test),
 	KUNIT_CASE(canon_r5_storage_stats_test),
 	KUNIT_CASE(canon_r5_storage_type_names_test),
 	KUNIT_CASE(canon_r5_storage_status_names_test),
@@ -11,9 +11,11 @@
 #include <linux/slab.h>
 #include <linux/videodev2.h>
 #include <media/v4l2-device.h>
+#include <media/v4l2-rect.h>
 
-#include "video/canon-r5-v4l2.h"
 #include "core/canon-r5.h"
+#include "core/canon-r5-ptp.h"
+#include "video/canon-r5-v4l2.h"
 
 /**
  * Test context structure for video tests
@@ -24,6 +26,10 @@ struct canon_r5_video_test_ctx {
 	struct canon_r5_video_device *video_dev;
 };
 
+static const char * const video_test_counter_names[CANON_R5_VIDEO_COUNTERS] = {
+	"frames_captured", "frames_dropped", "errors", "bytes_transferred",
+};
+
 /* Test fixture setup */
 static int canon_r5_video_test_init(struct kunit *test)
 {
@@ -70,6 +76,13 @@ static int canon_r5_video_test_init(struct kunit *test)
 	atomic_set(&ctx->video_dev->open_count, 0);
 	ctx->video_dev->initialized = true;
 
+	/* Counters without a sysfs tree, as for a device never published */
+	if (canon_r5_counters_register(NULL, &ctx->video_dev->stream.counters, "video0",
+				       video_test_counter_names, CANON_R5_VIDEO_COUNTERS)) {
+		platform_device_unregister(ctx->pdev);
+		return -ENOMEM;
+	}
+
 	test->priv = ctx;
 	return 0;
 }
@@ -79,6 +92,8 @@ static void canon_r5_video_test_exit(struct kunit *test)
 {
 	struct canon_r5_video_test_ctx *ctx = test->priv;
 
+	if (ctx && ctx->video_dev)
+		canon_r5_counters_unregister(&ctx->video_dev->stream.counters);
 	if (ctx && ctx->pdev)
 		platform_device_unregister(ctx->pdev);
 }
@@ -171,7 +186,8 @@ static void canon_r5_video_device_init_test(struct kunit *test)
 	/* Verify streaming state */
 	KUNIT_EXPECT_EQ(test, ctx->video_dev->stream.state, CANON_R5_STREAMING_STOPPED);
 	KUNIT_EXPECT_EQ(test, ctx->video_dev->stream.frame_count, 0);
-	KUNIT_EXPECT_EQ(test, ctx->video_dev->stream.dropped_frames, 0);
+	KUNIT_EXPECT_EQ(test, canon_r5_counter_read(&ctx->video_dev->stream.counters,
+						    CANON_R5_VIDEO_DROPPED), 0);
 }
 
 /* Test pixel format configuration */
@@ -287,8 +303,9 @@ static void canon_r5_video_stats_test(struct kunit *test)
 	struct canon_r5_video_stats stats;
 
 	/* Initialize test statistics */
-	stream->frame_count = 1000;
-	stream->dropped_frames = 25;
+	canon_r5_counter_add(&stream->counters, CANON_R5_VIDEO_FRAMES, 1000);
+	canon_r5_counter_add(&stream->counters, CANON_R5_VIDEO_DROPPED, 25);
+	canon_r5_counter_add(&stream->counters, CANON_R5_VIDEO_BYTES, 1000 * 4096);
 
 	/* Get statistics */
 	memset(&stats, 0, sizeof(stats));
@@ -298,6 +315,39 @@ static void canon_r5_video_stats_test(struct kunit *test)
 	KUNIT_EXPECT_EQ(test, ret, 0);
 	KUNIT_EXPECT_EQ(test, stats.frames_captured, 1000);
 	KUNIT_EXPECT_EQ(test, stats.frames_dropped, 25);
+	KUNIT_EXPECT_EQ(test, stats.bytes_transferred, 1000 * 4096);
+
+	/* A new stream starts counting from zero */
+	canon_r5_counters_reset(&stream->counters);
+	canon_r5_counter_inc(&stream->counters, CANON_R5_VIDEO_FRAMES);
+	ret = canon_r5_video_get_stats(ctx->video_dev, &stats);
+	KUNIT_EXPECT_EQ(test, stats.frames_captured, 1);
+	KUNIT_EXPECT_EQ(test, stats.frames_dropped, 0);
+}
+
+/* Test live view latency and cadence reporting */
+static void canon_r5_video_latency_stats_test(struct kunit *test)
+{
+	struct canon_r5_video_test_ctx *ctx = test->priv;
+	struct canon_r5_video_stream *stream = &ctx->video_dev->stream;
+	struct canon_r5_video_stats stats;
+	int ret;
+
+	stream->frame_interval_ns = NSEC_PER_SEC / 30;
+	stream->latency_last_ns = 12 * NSEC_PER_MSEC;
+	stream->latency_avg_ns = 10 * NSEC_PER_MSEC;
+	stream->latency_max_ns = 20 * NSEC_PER_MSEC;
+	canon_r5_counter_add(&stream->counters, CANON_R5_VIDEO_ERRORS, 3);
+
+	memset(&stats, 0, sizeof(stats));
+	ret = canon_r5_video_get_stats(ctx->video_dev, &stats);
+
+	KUNIT_EXPECT_EQ(test, ret, 0);
+	KUNIT_EXPECT_EQ(test, stats.current_fps, 30U);
+	KUNIT_EXPECT_EQ(test, stats.latency_last_ns, 12 * NSEC_PER_MSEC);
+	KUNIT_EXPECT_EQ(test, stats.latency_avg_ns, 10 * NSEC_PER_MSEC);
+	KUNIT_EXPECT_EQ(test, stats.latency_max_ns, 20 * NSEC_PER_MSEC);
+	KUNIT_EXPECT_EQ(test, stats.errors, 3ULL);
 }
 
 /* Test open count management */
@@ -362,6 +412,108 @@ static void canon_r5_video_buffer_list_test(struct kunit *test)
 	KUNIT_EXPECT_TRUE(test, list_empty(&stream->buf_list));
 }
 
+/* Pattern byte of a synthetic frame at @row, @col */
+static u8 canon_r5_video_test_pixel(u32 row, u32 col)
+{
+	return (row * 7 + col) & 0xff;
+}
+
+/* Test crop and compose selection and the in-place frame crop */
+static void canon_r5_video_selection_test(struct kunit *test)
+{
+	struct canon_r5_video_test_ctx *ctx = test->priv;
+	struct canon_r5_video_device *vdev = ctx->video_dev;
+	struct canon_r5_video_stream *stream = &vdev->stream;
+	struct v4l2_rect r;
+	size_t frame_size = 640 * 480 * 2;
+	u8 *frame, *out;
+	u32 row, col;
+	ssize_t len;
+
+	stream->format = canon_r5_video_find_format(V4L2_PIX_FMT_YUYV);
+	stream->resolution = canon_r5_video_find_resolution(1920, 1080);
+	KUNIT_ASSERT_NOT_NULL(test, stream->format);
+	KUNIT_ASSERT_NOT_NULL(test, stream->resolution);
+	canon_r5_video_selection_reset(vdev);
+	KUNIT_EXPECT_FALSE(test, stream->cropping);
+	KUNIT_EXPECT_EQ(test, vdev->pix_format.width, 1920);
+	KUNIT_EXPECT_EQ(test, canon_r5_video_plane_size(vdev), vdev->pix_format.sizeimage);
+
+	/* A small crop is served by the 10x window centred on it */
+	r = (struct v4l2_rect){ .left = 801, .top = 500, .width = 161, .height = 100 };
+	canon_r5_video_set_crop(vdev, &r);
+	KUNIT_EXPECT_EQ(test, r.left, 800);
+	KUNIT_EXPECT_EQ(test, r.width, 160);
+	KUNIT_EXPECT_EQ(test, stream->zoom, CANON_R5_VIDEO_ZOOM_10X);
+	KUNIT_EXPECT_EQ(test, stream->zoom_window.width, 192);
+	KUNIT_EXPECT_EQ(test, stream->zoom_window.height, 108);
+	KUNIT_EXPECT_EQ(test, stream->zoom_window.left, 784);
+	KUNIT_EXPECT_EQ(test, stream->zoom_window.top, 496);
+	KUNIT_EXPECT_EQ(test, vdev->pix_format.width, 160);
+	KUNIT_EXPECT_EQ(test, vdev->pix_format.height, 100);
+	KUNIT_EXPECT_EQ(test, vdev->pix_format.sizeimage, 160 * 2 * 100);
+	KUNIT_EXPECT_EQ(test, canon_r5_video_plane_size(vdev), 1920 * 2 * 1080);
+
+	/* Compose picks the decimation that still covers the request */
+	r = (struct v4l2_rect){ .width = 70, .height = 40 };
+	canon_r5_video_set_compose(vdev, &r);
+	KUNIT_EXPECT_EQ(test, stream->decimation, 2);
+	KUNIT_EXPECT_EQ(test, r.width, 80);
+	KUNIT_EXPECT_EQ(test, r.height, 50);
+
+	/* Compressed frames snap the crop to what the camera sends */
+	stream->format = canon_r5_video_find_format(V4L2_PIX_FMT_MJPEG);
+	r = (struct v4l2_rect){ .left = 800, .top = 500, .width = 160, .height = 100 };
+	canon_r5_video_set_crop(vdev, &r);
+	KUNIT_EXPECT_TRUE(test, v4l2_rect_equal(&r, &stream->zoom_window));
+	r = (struct v4l2_rect){ .width = 16, .height = 16 };
+	canon_r5_video_set_compose(vdev, &r);
+	KUNIT_EXPECT_EQ(test, stream->decimation, 1);
+
+	/* Crop a whole VGA YUYV frame in place */
+	stream->format = canon_r5_video_find_format(V4L2_PIX_FMT_YUYV);
+	stream->resolution = canon_r5_video_find_resolution(640, 480);
+	KUNIT_ASSERT_NOT_NULL(test, stream->resolution);
+	canon_r5_video_selection_reset(vdev);
+	r = (struct v4l2_rect){ .left = 64, .top = 32, .width = 64, .height = 32 };
+	canon_r5_video_set_crop(vdev, &r);
+
+	frame = kunit_kmalloc(test, frame_size, GFP_KERNEL);
+	out = kunit_kmalloc(test, frame_size, GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, frame);
+	KUNIT_ASSERT_NOT_NULL(test, out);
+	for (row = 0; row < 480; row++)
+		for (col = 0; col < 640 * 2; col++)
+			frame[row * 640 * 2 + col] = canon_r5_video_test_pixel(row, col);
+
+	len = canon_r5_video_crop_frame(stream, &stream->bounds, frame, frame, frame_size);
+	KUNIT_EXPECT_EQ(test, len, 64 * 2 * 32);
+	for (row = 0; row < 32; row++) {
+		KUNIT_EXPECT_EQ(test, frame[row * 128], canon_r5_video_test_pixel(32 + row, 128));
+		KUNIT_EXPECT_EQ(test, frame[row * 128 + 127],
+				canon_r5_video_test_pixel(32 + row, 255));
+	}
+
+	/* Decimated into a separate buffer, whole Y0 Cb Y1 Cr pairs */
+	for (row = 0; row < 480; row++)
+		for (col = 0; col < 640 * 2; col++)
+			frame[row * 640 * 2 + col] = canon_r5_video_test_pixel(row, col);
+	r = (struct v4l2_rect){ .width = 32, .height = 16 };
+	canon_r5_video_set_compose(vdev, &r);
+	KUNIT_EXPECT_EQ(test, stream->decimation, 2);
+	len = canon_r5_video_crop_frame(stream, &stream->bounds, out, frame, frame_size);
+	KUNIT_EXPECT_EQ(test, len, 32 * 2 * 16);
+	KUNIT_EXPECT_EQ(test, out[64 + 4], canon_r5_video_test_pixel(34, 128 + 8));
+	KUNIT_EXPECT_EQ(test, out[64 + 7], canon_r5_video_test_pixel(34, 128 + 11));
+
+	/* A window that misses the crop is refused before anything moves */
+	r = (struct v4l2_rect){ .left = 0, .top = 0, .width = 64, .height = 64 };
+	KUNIT_EXPECT_EQ(test, canon_r5_video_crop_frame(stream, &r, out, frame, frame_size),
+			-EPROTO);
+	KUNIT_EXPECT_EQ(test, canon_r5_video_crop_frame(stream, &stream->bounds, out, frame, 64),
+			-EPROTO);
+}
+
 /* KUnit test suite definition */
 static struct kunit_case canon_r5_video_test_cases[] = {
 	KUNIT_CASE(canon_r5_video_type_validation_test),
@@ -373,8 +525,10 @@ static struct kunit_case canon_r5_video_test_cases[] = {
 	KUNIT_CASE(canon_r5_video_streaming_state_test),
 	KUNIT_CASE(canon_r5_video_buffer_test),
 	KUNIT_CASE(canon_r5_video_stats_test),
+	KUNIT_CASE(canon_r5_video_latency_stats_test),
 	KUNIT_CASE(canon_r5_video_open_count_test),
 	KUNIT_CASE(canon_r5_video_buffer_list_test),
+	KUNIT_CASE(canon_r5_video_selection_test),
 	{}
 };
 
@@ -0,0 +1,589 @@
+#!/usr/bin/env python3
+"""
+Canon R5 Driver Device Benchmarks
+
+Hardware-in-the-loop measurements of the driver's real workloads with a
+camera attached: V4L2 streaming rate and latency, burst capture rate,
+card offload throughput and ALSA overruns. Driver counters are read from
+debugfs (canon-r5/<device>/) before and after each run, and the report
+is JSON with stable keys so runs can be diffed between driver builds.
+
+Copyright (C) 2025 Canon R5 Driver Project
+SPDX-License-Identifier: GPL-2.0
+"""
+
+import os
+import re
+import sys
+import glob
+import json
+import mmap
+import time
+import fcntl
+import errno
+import select
+import struct
+import argparse
+import subprocess
+import statistics
+from pathlib import Path
+from typing import Dict, List, Optional, Any
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+from benchmark import BenchmarkResult
+
+DEBUGFS_ROOT = "/sys/kernel/debug/canon-r5"
+
+# ioctl request encoding, asm-generic layout
+_IOC_WRITE = 1
+_IOC_READ = 2
+
+def _IOC(direction: int, kind: str, nr: int, size: int) -> int:
+    return (direction << 30) | (size << 16) | (ord(kind) << 8) | nr
+
+def _IOR(kind: str, nr: int, size: int) -> int:
+    return _IOC(_IOC_READ, kind, nr, size)
+
+def _IOW(kind: str, nr: int, size: int) -> int:
+    return _IOC(_IOC_WRITE, kind, nr, size)
+
+def _IOWR(kind: str, nr: int, size: int) -> int:
+    return _IOC(_IOC_READ | _IOC_WRITE, kind, nr, size)
+
+# struct v4l2_requestbuffers and struct v4l2_buffer (64-bit layout)
+V4L2_REQBUFS_FMT = "IIII4x"
+V4L2_BUFFER_FMT = "IIIII4xqq16sII8xIIi4x"
+V4L2_BUF_TYPE_VIDEO_CAPTURE = 1
+V4L2_MEMORY_MMAP = 1
+V4L2_BUF_FLAG_TIMESTAMP_MASK = 0xe000
+V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC = 0x2000
+
+VIDIOC_REQBUFS = _IOWR('V', 8, struct.calcsize(V4L2_REQBUFS_FMT))
+VIDIOC_QBUF = _IOWR('V', 15, struct.calcsize(V4L2_BUFFER_FMT))
+VIDIOC_DQBUF = _IOWR('V', 17, struct.calcsize(V4L2_BUFFER_FMT))
+VIDIOC_STREAMON = _IOW('V', 18, 4)
+VIDIOC_STREAMOFF = _IOW('V', 19, 4)
+
+# Still capture ring, include/still/canon-r5-still.h
+STILL_RING_INFO_FMT = "IIQ"
+STILL_BUFFER_FMT = "IIQQ"
+STILL_IOC_QUERYRING = _IOR('R', 0x01, struct.calcsize(STILL_RING_INFO_FMT))
+STILL_IOC_DQBUF = _IOR('R', 0x02, struct.calcsize(STILL_BUFFER_FMT))
+STILL_IOC_QBUF = _IOW('R', 0x03, 4)
+STILL_IOC_BURST = _IOW('R', 0x05, 4)
+
+
+def percentile(values: List[float], pct: float) -> float:
+    """Nearest-rank percentile of an unsorted list"""
+    if not values:
+        return 0.0
+    ordered = sorted(values)
+    rank = max(0, min(len(ordered) - 1, int(round(pct / 100.0 * len(ordered) + 0.5)) - 1))
+    return ordered[rank]
+
+
+def delta(before: Dict[str, Any], after: Dict[str, Any]) -> Dict[str, Any]:
+    """Difference of two counter snapshots; non-numeric values are taken from after"""
+    result = {}
+    for key, value in after.items():
+        old = before.get(key)
+        if isinstance(value, dict):
+            result[key] = delta(old if isinstance(old, dict) else {}, value)
+        elif isinstance(value, int) and isinstance(old, int):
+            result[key] = value - old
+        else:
+            result[key] = value
+    return result
+
+
+class DriverStats:
+    """Reader for the per-device debugfs files the drivers export"""
+
+    def __init__(self, device: Optional[str] = None):
+        self.dir = None
+        if device:
+            self.dir = Path(DEBUGFS_ROOT) / device
+        else:
+            found = sorted(glob.glob(f"{DEBUGFS_ROOT}/*/ptp_latency"))
+            if found:
+                self.dir = Path(found[0]).parent
+
+    @property
+    def available(self) -> bool:
+        return self.dir is not None and self.dir.is_dir()
+
+    def _read(self, name: str) -> Optional[str]:
+        if not self.available:
+            return None
+        try:
+            return (self.dir / name).read_text()
+        except OSError:
+            return None
+
+    @staticmethod
+    def _parse_blocks(text: str, header: Optional[str] = None) -> Any:
+        """Parse "key: value" lines, split into blocks at each header key"""
+        blocks: Dict[str, Dict[str, Any]] = {}
+        current: Dict[str, Any] = {}
+        for line in text.splitlines():
+            if ":" not in line:
+                continue
+            key, value = (part.strip() for part in line.split(":", 1))
+            if header and key == header:
+                current = blocks.setdefault(value, {})
+                continue
+            current[key] = int(value) if re.fullmatch(r"-?\d+", value) else value
+        return blocks if header else current
+
+    def video(self) -> Dict[str, Any]:
+        text = self._read("video_stats")
+        return self._parse_blocks(text, header="node") if text else {}
+
+    def still(self) -> Dict[str, Any]:
+        text = self._read("still_stats")
+        return self._parse_blocks(text) if text else {}
+
+    def storage(self) -> Dict[str, Any]:
+        text = self._read("storage_stats")
+        return self._parse_blocks(text) if text else {}
+
+    def ptp(self) -> Dict[str, Any]:
+        """Per-opcode counters; the histogram lines are left out"""
+        text = self._read("ptp_latency")
+        ops: Dict[str, Any] = {}
+        if not text:
+            return ops
+        for line in text.splitlines()[1:]:
+            fields = line.split()
+            if len(fields) != 8 or not (fields[0].startswith("0x") or fields[0] == "other"):
+                continue
+            ops[fields[0]] = dict(zip(
+                ["count", "errors", "bytes_in", "bytes_out", "p50_us", "p90_us", "p99_us"],
+                (int(f) for f in fields[1:])))
+        return ops
+
+    def reset_ptp(self):
+        if self.available:
+            try:
+                (self.dir / "ptp_reset").write_text("1\n")
+            except OSError:
+                pass
+
+
+class CanonR5DeviceBenchmark:
+    """Canon R5 driver workload benchmarks against an attached camera"""
+
+    def __init__(self, args: argparse.Namespace):
+        self.args = args
+        self.results: List[BenchmarkResult] = []
+        self.verbose = args.verbose
+        self.stats = DriverStats(args.device)
+
+    def log(self, message: str, level: str = "INFO"):
+        """Log a message with timestamp"""
+        timestamp = time.strftime("%Y-%m-%d %H:%M:%S")
+        if self.verbose or level == "ERROR":
+            print(f"[{timestamp}] [{level}] {message}")
+
+    def skipped(self, name: str, reason: str) -> BenchmarkResult:
+        self.log(f"Skipping {name}: {reason}", "WARN")
+        return BenchmarkResult(name=name, duration=0, metadata={"skipped": reason})
+
+    def find_video_node(self) -> Optional[str]:
+        if self.args.video:
+            return self.args.video
+        for name in sorted(glob.glob("/sys/class/video4linux/video*/name")):
+            if "canon" in Path(name).read_text().lower():
+                return "/dev/" + Path(name).parent.name
+        return None
+
+    def benchmark_video_streaming(self) -> BenchmarkResult:
+        """Stream MMAP buffers and time each dequeue against its capture timestamp"""
+        node = self.find_video_node()
+        if not node or not os.path.exists(node):
+            return self.skipped("video_streaming", "no_video_node")
+
+        frames = self.args.frames
+        buf_type = struct.pack("I", V4L2_BUF_TYPE_VIDEO_CAPTURE)
+        latencies = []
+        sequences = []
+        before = self.stats.video()
+        start_time = time.time()
+
+        try:
+            fd = os.open(node, os.O_RDWR | os.O_NONBLOCK)
+        except OSError as e:
+            return BenchmarkResult(name="video_streaming", duration=0, success=False,
+                                   error_message=f"{node}: {e.strerror}")
+
+        try:
+            req = bytearray(struct.pack(V4L2_REQBUFS_FMT, self.args.buffers,
+                                        V4L2_BUF_TYPE_VIDEO_CAPTURE, V4L2_MEMORY_MMAP, 0))
+            fcntl.ioctl(fd, VIDIOC_REQBUFS, req)
+            count = struct.unpack(V4L2_REQBUFS_FMT, req)[0]
+
+            for index in range(count):
+                buf = struct.pack(V4L2_BUFFER_FMT, index, V4L2_BUF_TYPE_VIDEO_CAPTURE,
+                                  0, 0, 0, 0, 0, b"", 0, V4L2_MEMORY_MMAP, 0, 0, 0)
+                fcntl.ioctl(fd, VIDIOC_QBUF, bytearray(buf))
+
+            fcntl.ioctl(fd, VIDIOC_STREAMON, buf_type)
+            poller = select.poll()
+            poller.register(fd, select.POLLIN)
+
+            stream_start = time.monotonic()
+            first_frame = None
+            while len(sequences) < frames:
+                if not poller.poll(self.args.timeout * 1000):
+                    raise TimeoutError(f"no frame within {self.args.timeout}s")
+
+                buf = bytearray(struct.calcsize(V4L2_BUFFER_FMT))
+                struct.pack_into("II", buf, 0, 0, V4L2_BUF_TYPE_VIDEO_CAPTURE)
+                struct.pack_into("I", buf, struct.calcsize("IIIII4xqq16sI"), V4L2_MEMORY_MMAP)
+                try:
+                    fcntl.ioctl(fd, VIDIOC_DQBUF, buf)
+                except OSError as e:
+                    if e.errno == errno.EAGAIN:
+                        continue
+                    raise
+                now = time.monotonic()
+
+                fields = struct.unpack(V4L2_BUFFER_FMT, buf)
+                flags, sec, usec, sequence = fields[3], fields[5], fields[6], fields[8]
+                if first_frame is None:
+                    first_frame = now
+                sequences.append(sequence)
+                if flags & V4L2_BUF_FLAG_TIMESTAMP_MASK == V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC:
+                    latencies.append((now - (sec + usec / 1e6)) * 1e3)
+
+                fcntl.ioctl(fd, VIDIOC_QBUF, buf)
+
+            stream_time = time.monotonic() - first_frame
+            fcntl.ioctl(fd, VIDIOC_STREAMOFF, buf_type)
+        except (OSError, TimeoutError) as e:
+            return BenchmarkResult(name="video_streaming", duration=time.time() - start_time,
+                                   success=False, error_message=str(e))
+        finally:
+            os.close(fd)
+
+        fps = (len(sequences) - 1) / stream_time if stream_time > 0 else 0
+        missed = (sequences[-1] - sequences[0] + 1) - len(sequences)
+
+        return BenchmarkResult(
+            name="video_streaming",
+            duration=time.time() - start_time,
+            throughput=fps,
+            latency=statistics.median(latencies) / 1e3 if latencies else None,
+            metadata={
+                "node": node,
+                "frames": len(sequences),
+                "fps": fps,
+                "sequence_gaps": missed,
+                "startup_s": first_frame - stream_start,
+                "latency_ms": {
+                    "p50": percentile(latencies, 50),
+                    "p90": percentile(latencies, 90),
+                    "p99": percentile(latencies, 99),
+                    "max": max(latencies) if latencies else 0,
+                },
+                "driver": delta(before, self.stats.video()),
+            }
+        )
+
+    def benchmark_burst_capture(self) -> BenchmarkResult:
+        """Fire bursts on the still capture ring and drain it as images arrive"""
+        nodes = sorted(glob.glob("/dev/canon-r5-still*"))
+        node = self.args.still or (nodes[0] if nodes else None)
+        if not node or not os.path.exists(node):
+            return self.skipped("burst_capture", "no_still_node")
+
+        shots = self.args.shots
+        before = self.stats.still()
+        sizes = []
+        start_time = time.time()
+
+        try:
+            fd = os.open(node, os.O_RDWR)
+        except OSError as e:
+            return BenchmarkResult(name="burst_capture", duration=0, success=False,
+                                   error_message=f"{node}: {e.strerror}")
+
+        try:
+            info = bytearray(struct.calcsize(STILL_RING_INFO_FMT))
+            fcntl.ioctl(fd, STILL_IOC_QUERYRING, info)
+            nr_slots, _, slot_size = struct.unpack(STILL_RING_INFO_FMT, info)
+            ring = mmap.mmap(fd, nr_slots * slot_size, mmap.MAP_SHARED, mmap.PROT_READ)
+
+            poller = select.poll()
+            poller.register(fd, select.POLLIN)
+
+            burst_start = time.monotonic()
+            fcntl.ioctl(fd, STILL_IOC_BURST, struct.pack("I", shots))
+            while len(sizes) < shots:
+                if not poller.poll(self.args.timeout * 1000):
+                    raise TimeoutError(f"{len(sizes)}/{shots} images within timeout")
+
+                buf = bytearray(struct.calcsize(STILL_BUFFER_FMT))
+                fcntl.ioctl(fd, STILL_IOC_DQBUF, buf)
+                index, _, bytesused, _ = struct.unpack(STILL_BUFFER_FMT, buf)
+
+                # Touch the image the way a consumer would before handing the slot back
+                _ = ring[index * slot_size:index * slot_size + min(bytesused, 4096)]
+                sizes.append(bytesused)
+                fcntl.ioctl(fd, STILL_IOC_QBUF, struct.pack("I", index))
+            burst_time = time.monotonic() - burst_start
+            ring.close()
+        except (OSError, TimeoutError) as e:
+            return BenchmarkResult(name="burst_capture", duration=time.time() - start_time,
+                                   success=False, error_message=str(e))
+        finally:
+            os.close(fd)
+
+        return BenchmarkResult(
+            name="burst_capture",
+            duration=time.time() - start_time,
+            throughput=shots / burst_time if burst_time > 0 else 0,
+            metadata={
+                "node": node,
+                "shots": shots,
+                "shots_per_second": shots / burst_time if burst_time > 0 else 0,
+                "mb_per_second": sum(sizes) / burst_time / 1e6 if burst_time > 0 else 0,
+                "ring_slots": nr_slots,
+                "average_image_bytes": sum(sizes) // len(sizes),
+                "driver": delta(before, self.stats.still()),
+            }
+        )
+
+    def benchmark_card_offload(self) -> BenchmarkResult:
+        """Copy files off the mounted card the way an ingest tool would"""
+        mount = self.args.mount
+        if not mount or not os.path.ismount(mount):
+            return self.skipped("card_offload", "no_mount")
+
+        files = sorted((p for p in Path(mount).rglob("*") if p.is_file()),
+                       key=lambda p: p.stat().st_size, reverse=True)
+        if not files:
+            return self.skipped("card_offload", "no_files")
+
+        limit = self.args.offload_mb * 1024 * 1024
+        before = self.stats.storage()
+        total = 0
+        count = 0
+        start_time = time.time()
+
+        offload_start = time.monotonic()
+        try:
+            for path in files:
+                if total >= limit:
+                    break
+                fd = os.open(path, os.O_RDONLY)
+                try:
+                    # Start cold so the numbers reflect the camera rather than the page cache
+                    os.posix_fadvise(fd, 0, 0, os.POSIX_FADV_DONTNEED)
+                    while True:
+                        chunk = os.read(fd, 4 * 1024 * 1024)
+                        if not chunk:
+                            break
+                        total += len(chunk)
+                finally:
+                    os.close(fd)
+                count += 1
+        except OSError as e:
+            return BenchmarkResult(name="card_offload", duration=time.time() - start_time,
+                                   success=False, error_message=f"{e.filename}: {e.strerror}")
+        offload_time = time.monotonic() - offload_start
+
+        return BenchmarkResult(
+            name="card_offload",
+            duration=time.time() - start_time,
+            throughput=total / offload_time / 1e6 if offload_time > 0 else 0,
+            metadata={
+                "mount": mount,
+                "files": count,
+                "bytes": total,
+                "mb_per_second": total / offload_time / 1e6 if offload_time > 0 else 0,
+                "driver": delta(before, self.stats.storage()),
+            }
+        )
+
+    def find_audio_card(self) -> Optional[int]:
+        found = sorted(glob.glob("/proc/asound/card*/canon_r5_audio"))
+        if not found:
+            return None
+        return int(re.search(r"card(\d+)", found[0]).group(1))
+
+    def audio_overruns(self, card: int) -> Optional[int]:
+        try:
+            text = Path(f"/proc/asound/card{card}/canon_r5_audio").read_text()
+        except OSError:
+            return None
+        match = re.search(r"Buffer overruns:\s*(\d+)", text)
+        return int(match.group(1)) if match else None
+
+    def benchmark_audio_xruns(self) -> BenchmarkResult:
+        """Record for a fixed time and count overruns seen by arecord and the driver"""
+        card = self.find_audio_card()
+        if card is None:
+            return self.skipped("audio_xruns", "no_audio_card")
+
+        seconds = self.args.audio_seconds
+        before = self.audio_overruns(card)
+        start_time = time.time()
+
+        cmd = ["arecord", "-D", f"hw:{card},0", "-f", "S16_LE", "-r", "48000", "-c", "2",
+               "-d", str(seconds), "-t", "raw", "/dev/null"]
+        try:
+            result = subprocess.run(cmd, capture_output=True, text=True, timeout=seconds + 30)
+        except FileNotFoundError:
+            return self.skipped("audio_xruns", "arecord_not_installed")
+        except subprocess.TimeoutExpired:
+            return BenchmarkResult(name="audio_xruns", duration=time.time() - start_time,
+                                   success=False, error_message="arecord timed out")
+
+        if result.returncode != 0:
+            return BenchmarkResult(name="audio_xruns", duration=time.time() - start_time,
+                                   success=False, error_message=result.stderr.strip())
+
+        user_xruns = result.stderr.count("overrun!!!")
+        after = self.audio_overruns(card)
+        driver_xruns = after - before if before is not None and after is not None else None
+
+        return BenchmarkResult(
+            name="audio_xruns",
+            duration=time.time() - start_time,
+            metadata={
+                "card": card,
+                "seconds": seconds,
+                "arecord_xruns": user_xruns,
+                "driver_overruns": driver_xruns,
+                "xruns_per_minute": user_xruns * 60.0 / seconds,
+            }
+        )
+
+    def run_all_benchmarks(self) -> List[BenchmarkResult]:
+        """Run the selected benchmarks"""
+        self.log("Starting Canon R5 device benchmarks...")
+
+        if not self.stats.available:
+            self.log("Driver debugfs not found; driver counters will be empty", "WARN")
+
+        benchmarks = {
+            "video": self.benchmark_video_streaming,
+            "still": self.benchmark_burst_capture,
+            "storage": self.benchmark_card_offload,
+            "audio": self.benchmark_audio_xruns,
+        }
+
+        for name in self.args.only or benchmarks:
+            try:
+                result = benchmarks[name]()
+            except Exception as e:
+                result = BenchmarkResult(name=name, duration=0, success=False,
+                                         error_message=str(e))
+            self.results.append(result)
+
+            if result.success:
+                self.log(f"✓ {result.name} completed in {result.duration:.2f}s")
+            else:
+                self.log(f"✗ {result.name} failed: {result.error_message}", "ERROR")
+
+        return self.results
+
+    def generate_report(self, output_file: Optional[str] = None) -> Dict[str, Any]:
+        """Generate the JSON report; keys are sorted so reports diff cleanly"""
+        report = {
+            "timestamp": time.strftime("%Y-%m-%d %H:%M:%S"),
+            "system_info": {
+                "kernel": os.uname().release,
+                "cpu_count": os.cpu_count(),
+                "debugfs": str(self.stats.dir) if self.stats.available else None,
+            },
+            "summary": {
+                "total_benchmarks": len(self.results),
+                "successful": sum(1 for r in self.results if r.success),
+                "failed": sum(1 for r in self.results if not r.success),
+            },
+            "results": {r.name: asdict_result(r) for r in self.results},
+            "ptp": self.stats.ptp(),
+        }
+
+        if output_file:
+            with open(output_file, 'w') as f:
+                json.dump(report, f, indent=2, sort_keys=True)
+            self.log(f"Report saved to {output_file}")
+
+        return report
+
+    def print_summary(self, baseline: Optional[Dict[str, Any]] = None):
+        """Print headline numbers, with the change against a baseline report"""
+        print("\n" + "="*60)
+        print("CANON R5 DEVICE BENCHMARK RESULTS")
+        print("="*60)
+
+        for result in self.results:
+            status = "✓" if result.success else "✗"
+            print(f"{status} {result.name:<20} {result.duration:>8.2f}s")
+
+            if result.error_message:
+                print(f"  Error: {result.error_message}")
+            if result.metadata and "skipped" in result.metadata:
+                print(f"  Skipped: {result.metadata['skipped']}")
+            if result.throughput is None:
+                continue
+
+            line = f"  Throughput: {result.throughput:,.2f}"
+            old = (baseline or {}).get("results", {}).get(result.name, {}).get("throughput")
+            if old:
+                line += f" ({(result.throughput - old) / old * 100:+.1f}% vs baseline)"
+            print(line)
+
+        print("\n" + "="*60)
+
+
+def asdict_result(result: BenchmarkResult) -> Dict[str, Any]:
+    return {key: value for key, value in vars(result).items() if key != "name"}
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Canon R5 Driver Device Benchmarks")
+    parser.add_argument("--verbose", "-v", action="store_true", help="Verbose output")
+    parser.add_argument("--output", "-o", help="Output file for JSON report")
+    parser.add_argument("--baseline", help="Earlier JSON report to compare against")
+    parser.add_argument("--only", nargs="+", choices=["video", "still", "storage", "audio"],
+                        help="Run only these benchmarks")
+    parser.add_argument("--device", help="Core device name under debugfs (default: first found)")
+    parser.add_argument("--video", help="V4L2 capture node (default: first Canon node)")
+    parser.add_argument("--still", help="Still capture node (default: /dev/canon-r5-still0)")
+    parser.add_argument("--mount", help="Mounted card filesystem for the offload benchmark")
+    parser.add_argument("--frames", type=int, default=300, help="Frames to stream")
+    parser.add_argument("--buffers", type=int, default=4, help="V4L2 buffers to request")
+    parser.add_argument("--shots", type=int, default=20, help="Images per burst")
+    parser.add_argument("--offload-mb", type=int, default=2048, help="Data to copy off the card")
+    parser.add_argument("--audio-seconds", type=int, default=60, help="Recording length")
+    parser.add_argument("--timeout", type=int, default=10, help="Per-frame/image timeout (s)")
+    parser.add_argument("--reset-ptp", action="store_true",
+                        help="Clear the PTP latency counters before starting")
+
+    args = parser.parse_args()
+
+    baseline = None
+    if args.baseline:
+        with open(args.baseline) as f:
+            baseline = json.load(f)
+
+    benchmark = CanonR5DeviceBenchmark(args)
+    if args.reset_ptp:
+        benchmark.stats.reset_ptp()
+
+    benchmark.run_all_benchmarks()
+    report = benchmark.generate_report(args.output)
+    benchmark.print_summary(baseline)
+
+    failed_count = report["summary"]["failed"]
+    if failed_count > 0:
+        print(f"\n{failed_count} benchmark(s) failed.")
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()